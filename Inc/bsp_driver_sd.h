@@ -92,6 +92,7 @@ uint8_t BSP_SD_ReadBlocks(uint32_t *pData, uint64_t ReadAddr, uint32_t BlockSize
 uint8_t BSP_SD_WriteBlocks(uint32_t *pData, uint64_t WriteAddr, uint32_t BlockSize, uint32_t NumOfBlocks);
 uint8_t BSP_SD_ReadBlocks_DMA(uint32_t *pData, uint64_t ReadAddr, uint32_t BlockSize, uint32_t NumOfBlocks);
 uint8_t BSP_SD_WriteBlocks_DMA(uint32_t *pData, uint64_t WriteAddr, uint32_t BlockSize, uint32_t NumOfBlocks);
+uint8_t BSP_SD_SetWriteBlockEraseCount(uint32_t NumOfBlocks);
 uint8_t BSP_SD_Erase(uint64_t StartAddr, uint64_t EndAddr);
 void BSP_SD_IRQHandler(void);
 void BSP_SD_DMA_Tx_IRQHandler(void);
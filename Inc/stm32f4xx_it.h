@@ -48,6 +48,9 @@
 void SysTick_Handler(void);
 void EXTI4_IRQHandler(void);
 void ETH_IRQHandler(void);
+void SDIO_IRQHandler(void);
+void DMA2_Stream3_IRQHandler(void);
+void DMA2_Stream6_IRQHandler(void);
 
 #ifdef __cplusplus
 }
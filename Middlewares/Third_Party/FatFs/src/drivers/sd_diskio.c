@@ -34,10 +34,26 @@
 /* Block Size in Bytes */
 #define BLOCK_SIZE                512
 
+/* Number of blocks, which are transferred at once for unaligned buffers */
+#ifdef SD_CONF_BOUNCE_BLOCKS
+#define SD_BOUNCE_BLOCKS          SD_CONF_BOUNCE_BLOCKS
+#else
+#define SD_BOUNCE_BLOCKS          4
+#endif
+
+/* The DMA transfers words and cannot access the CCM RAM */
+#define SD_CCMRAM_START           0x10000000UL
+#define SD_CCMRAM_END             0x10010000UL
+#define SD_DMA_CAPABLE(p)         ((((uintptr_t)(p) & 3) == 0) && \
+                                   ((uintptr_t)(p) < SD_CCMRAM_START || (uintptr_t)(p) >= SD_CCMRAM_END))
+
 /* Private variables ---------------------------------------------------------*/
 /* Disk status */
 static volatile DSTATUS Stat = STA_NOINIT;
 
+/* Buffer for the blocks of unaligned requests */
+static uint32_t bounce_buffer[SD_BOUNCE_BLOCKS * BLOCK_SIZE / 4];
+
 /* Private function prototypes -----------------------------------------------*/
 DSTATUS SD_initialize (BYTE);
 DSTATUS SD_status (BYTE);
@@ -102,6 +118,8 @@ DSTATUS SD_status(BYTE lun)
 
 /**
   * @brief  Reads Sector(s)
+  * @note   Buffers, which cannot be used by the DMA, are read in chunks
+  *         of SD_BOUNCE_BLOCKS blocks through the bounce buffer.
   * @param  lun : not used
   * @param  *buff: Data buffer to store read data
   * @param  sector: Sector address (LBA)
@@ -110,21 +128,41 @@ DSTATUS SD_status(BYTE lun)
   */
 DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 {
-  DRESULT res = RES_OK;
-  
-  if(BSP_SD_ReadBlocks((uint32_t*)buff, 
-                       (uint64_t) (sector * BLOCK_SIZE), 
-                       BLOCK_SIZE, 
-                       count) != MSD_OK)
+  if (SD_DMA_CAPABLE(buff))
   {
-    res = RES_ERROR;
+    /* One multi-block command for the whole request */
+    if (BSP_SD_ReadBlocks_DMA((uint32_t*)buff, (uint64_t)sector * BLOCK_SIZE, BLOCK_SIZE, count) != MSD_OK)
+    {
+      return RES_ERROR;
+    }
+
+    return RES_OK;
   }
-  
-  return res;
+
+  while (count > 0)
+  {
+    const UINT blocks = (count < SD_BOUNCE_BLOCKS) ? count : SD_BOUNCE_BLOCKS;
+
+    if (BSP_SD_ReadBlocks_DMA(bounce_buffer, (uint64_t)sector * BLOCK_SIZE, BLOCK_SIZE, blocks) != MSD_OK)
+    {
+      return RES_ERROR;
+    }
+
+    memcpy(buff, bounce_buffer, blocks * BLOCK_SIZE);
+
+    buff += blocks * BLOCK_SIZE;
+    sector += blocks;
+    count -= blocks;
+  }
+
+  return RES_OK;
 }
 
 /**
   * @brief  Writes Sector(s)
+  * @note   Multi-block writes announce their length to the card first,
+  *         so that it can pre-erase the blocks. Buffers, which cannot be
+  *         used by the DMA, are written in chunks through the bounce buffer.
   * @param  lun : not used
   * @param  *buff: Data to be written
   * @param  sector: Sector address (LBA)
@@ -132,18 +170,46 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
   * @retval DRESULT: Operation result
   */
 #if _USE_WRITE == 1
+static DRESULT SD_write_blocks(const uint32_t *buff, DWORD sector, UINT count)
+{
+  /* The hint is only an optimisation, the write works without it */
+  if (count > 1)
+  {
+    BSP_SD_SetWriteBlockEraseCount(count);
+  }
+
+  if (BSP_SD_WriteBlocks_DMA((uint32_t*)buff, (uint64_t)sector * BLOCK_SIZE, BLOCK_SIZE, count) != MSD_OK)
+  {
+    return RES_ERROR;
+  }
+
+  return RES_OK;
+}
+
 DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
 {
-  DRESULT res = RES_OK;
-  
-  if(BSP_SD_WriteBlocks((uint32_t*)buff, 
-                        (uint64_t)(sector * BLOCK_SIZE), 
-                        BLOCK_SIZE, count) != MSD_OK)
+  if (SD_DMA_CAPABLE(buff))
   {
-    res = RES_ERROR;
+    return SD_write_blocks((const uint32_t*)buff, sector, count);
   }
-  
-  return res;
+
+  while (count > 0)
+  {
+    const UINT blocks = (count < SD_BOUNCE_BLOCKS) ? count : SD_BOUNCE_BLOCKS;
+
+    memcpy(bounce_buffer, buff, blocks * BLOCK_SIZE);
+
+    if (SD_write_blocks(bounce_buffer, sector, blocks) != RES_OK)
+    {
+      return RES_ERROR;
+    }
+
+    buff += blocks * BLOCK_SIZE;
+    sector += blocks;
+    count -= blocks;
+  }
+
+  return RES_OK;
 }
 #endif /* _USE_WRITE == 1 */
 
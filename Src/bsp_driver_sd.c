@@ -34,11 +34,35 @@
 /* USER CODE BEGIN 0 */
 /* Includes ------------------------------------------------------------------*/
 #include "bsp_driver_sd.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
 #include "lib/logging.h"
 #include "agent.h"
 
 const uint8_t SDIO_ACCESS_RETRIES = 5;
 
+/* ACMD23 SET_WR_BLK_ERASE_COUNT, which is not defined by the HAL */
+#define SD_CMD_SD_APP_SET_WR_BLK_ERASE_COUNT  ((uint8_t)23)
+
+/* Error bits of the R1 response */
+#define SD_R1_ERRORBITS                       ((uint32_t)0xFDFFE008)
+
+/* Flags, which are cleared after a command */
+#define SD_STATIC_FLAGS                       ((uint32_t)(SDIO_FLAG_CCRCFAIL | SDIO_FLAG_DCRCFAIL | SDIO_FLAG_CTIMEOUT |\
+                                                          SDIO_FLAG_DTIMEOUT | SDIO_FLAG_TXUNDERR | SDIO_FLAG_RXOVERR  |\
+                                                          SDIO_FLAG_CMDREND  | SDIO_FLAG_CMDSENT  | SDIO_FLAG_DATAEND  |\
+                                                          SDIO_FLAG_DBCKEND))
+
+/* Loops to wait for the response of a command */
+#define SD_CMD_TIMEOUT                        ((uint32_t)0x00010000)
+
+/* Ticks to wait for the end of a DMA transfer or for the card programming the blocks */
+#define SD_TRANSFER_TIMEOUT                   pdMS_TO_TICKS(1000)
+
+/* Given by the interrupts at the end of a DMA transfer */
+static SemaphoreHandle_t sd_transfer_sem = NULL;
+
 
 /* Extern variables ---------------------------------------------------------*/ 
   
@@ -58,6 +82,11 @@ uint8_t BSP_SD_Init(void)
   {
     return MSD_ERROR;
   }
+  if (sd_transfer_sem == NULL)
+  {
+    sd_transfer_sem = xSemaphoreCreateBinary();
+  }
+
   SD_state = HAL_SD_Init(&hsd, &SDCardInfo);
 #ifdef BUS_4BITS
   if (SD_state == MSD_OK)
@@ -177,42 +206,127 @@ uint8_t BSP_SD_WriteBlocks(uint32_t *pData, uint64_t WriteAddr, uint32_t BlockSi
 }
 
 /**
-  * @brief  Reads block(s) from a specified address in an SD card, in DMA mode. 
-  * @param  pData: Pointer to the buffer that will contain the data to transmit
-  * @param  ReadAddr: Address from where data is to be read  
-  * @param  BlockSize: SD card data block size, that should be 512
-  * @param  NumOfBlocks: Number of SD blocks to read 
-  * @retval SD status
+  * @brief  Checks, whether the calling task can wait for the interrupt at the end of a DMA transfer
+  * @retval 1 if it can wait, 0 if polling has to be used
   */
-uint8_t BSP_SD_ReadBlocks_DMA(uint32_t *pData, uint64_t ReadAddr, uint32_t BlockSize, uint32_t NumOfBlocks)
+static uint8_t BSP_SD_CanWait(void)
 {
-  uint8_t SD_state = MSD_OK;
-  
-  /* Read block(s) in DMA transfer mode */
-  if(HAL_SD_ReadBlocks_DMA(&hsd, pData, ReadAddr, BlockSize, NumOfBlocks) != SD_OK)  
+  /* Nobody can wait, before the scheduler was started */
+  return sd_transfer_sem != NULL && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING;
+}
+
+/**
+  * @brief  Ends a DMA write and waits, until the card has programmed the blocks
+  * @note   Unlike HAL_SD_CheckWriteOperation(), other tasks can run while the card is busy.
+  * @param  None
+  * @retval SD Card error state
+  */
+static HAL_SD_ErrorTypedef BSP_SD_FinishWrite(void)
+{
+  const TickType_t start = xTaskGetTickCount();
+  HAL_SD_ErrorTypedef error = SD_OK;
+
+  /* Send stop command in multiblock write */
+  if (hsd.SdOperation == SD_WRITE_MULTIPLE_BLOCK)
   {
-    SD_state = MSD_ERROR;
+    error = HAL_SD_StopTransfer(&hsd);
   }
-  
-  /* Wait until transfer is complete */
-  if(SD_state == MSD_OK)
+
+  __HAL_SD_SDIO_CLEAR_FLAG(&hsd, SD_STATIC_FLAGS);
+
+  if (hsd.SdTransferErr != SD_OK)
+  {
+    return (HAL_SD_ErrorTypedef)hsd.SdTransferErr;
+  }
+
+  if (error != SD_OK)
   {
-    if(HAL_SD_CheckReadOperation(&hsd, (uint32_t)SD_DATATIMEOUT) != SD_OK)  
+    return error;
+  }
+
+  for (;;)
+  {
+    switch (HAL_SD_GetStatus(&hsd))
     {
-      SD_state = MSD_ERROR;
+      case SD_TRANSFER_OK:
+        return SD_OK;
+      case SD_TRANSFER_ERROR:
+        return SD_ERROR;
+      default:
+        break;
     }
-    else
+
+    if (xTaskGetTickCount() - start > SD_TRANSFER_TIMEOUT)
     {
-      SD_state = MSD_OK;
+      return SD_DATA_TIMEOUT;
     }
+
+    vTaskDelay(1);
   }
-  
-  return SD_state; 
 }
 
 /**
-  * @brief  Writes block(s) to a specified address in an SD card, in DMA mode.  
-  * @param  pData: Pointer to the buffer that will contain the data to transmit
+  * @brief  Reads block(s) from a specified address in an SD card, in DMA mode.
+  * @note   The calling task is blocked until the transfer has finished,
+  *         so other tasks can run meanwhile. Before the scheduler was
+  *         started, polling mode is used.
+  * @param  pData: Pointer to the buffer that will contain the data to transmit, 4 byte aligned
+  * @param  ReadAddr: Address from where data is to be read  
+  * @param  BlockSize: SD card data block size, that should be 512
+  * @param  NumOfBlocks: Number of SD blocks to read 
+  * @retval SD status
+  */
+uint8_t BSP_SD_ReadBlocks_DMA(uint32_t *pData, uint64_t ReadAddr, uint32_t BlockSize, uint32_t NumOfBlocks)
+{
+	uint8_t retries = SDIO_ACCESS_RETRIES;
+
+	if (!BSP_SD_CanWait()) {
+		return BSP_SD_ReadBlocks(pData, ReadAddr, BlockSize, NumOfBlocks);
+	}
+
+	HAL_SD_ErrorTypedef error = SD_OK;
+	do {
+		/* Forget the completion of an aborted transfer */
+		xSemaphoreTake(sd_transfer_sem, 0);
+
+		error = HAL_SD_ReadBlocks_DMA(&hsd, pData, ReadAddr, BlockSize, NumOfBlocks);
+
+		if (error == SD_OK) {
+			if (xSemaphoreTake(sd_transfer_sem, SD_TRANSFER_TIMEOUT) == pdTRUE) {
+				/* Checks the result and sends the stop command of a multiblock read */
+				error = HAL_SD_CheckReadOperation(&hsd, (uint32_t)SD_DATATIMEOUT);
+			} else {
+				error = SD_DATA_TIMEOUT;
+			}
+		}
+
+		if (error != SD_OK) {
+			HAL_DMA_Abort(hsd.hdmarx);
+			__HAL_SD_SDIO_CLEAR_FLAG(&hsd, SD_STATIC_FLAGS);
+
+			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "HAL_SD_ReadBlocks_DMA(addr %u, size %u, count %u) failed with error %u",
+				(uint32_t)ReadAddr, BlockSize, NumOfBlocks, error);
+
+			retries--;
+			if (retries <= 0) {
+				LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Too many failes. Giving up reading from SD card!");
+				return MSD_ERROR;
+			}
+
+			/* wait for accessing the SD card again */
+			vTaskDelay(pdMS_TO_TICKS(1));
+		}
+	} while (error != SD_OK);
+
+	return MSD_OK;
+}
+
+/**
+  * @brief  Writes block(s) to a specified address in an SD card, in DMA mode.
+  * @note   The calling task is blocked until the card has programmed the blocks,
+  *         so other tasks can run meanwhile. Before the scheduler was
+  *         started, polling mode is used.
+  * @param  pData: Pointer to the buffer that will contain the data to transmit, 4 byte aligned
   * @param  WriteAddr: Address from where data is to be written  
   * @param  BlockSize: SD card data block size, that should be 512
   * @param  NumOfBlocks: Number of SD blocks to write 
@@ -220,28 +334,97 @@ uint8_t BSP_SD_ReadBlocks_DMA(uint32_t *pData, uint64_t ReadAddr, uint32_t Block
   */
 uint8_t BSP_SD_WriteBlocks_DMA(uint32_t *pData, uint64_t WriteAddr, uint32_t BlockSize, uint32_t NumOfBlocks)
 {
-  uint8_t SD_state = SD_OK;
-  
-  /* Write block(s) in DMA transfer mode */
-  if(HAL_SD_WriteBlocks_DMA(&hsd, pData, WriteAddr, BlockSize, NumOfBlocks) != SD_OK)  
-  {
-    SD_state = MSD_ERROR;
-  }
-  
-  /* Wait until transfer is complete */
-  if(SD_state == MSD_OK)
+	uint8_t retries = SDIO_ACCESS_RETRIES;
+
+	if (!BSP_SD_CanWait()) {
+		return BSP_SD_WriteBlocks(pData, WriteAddr, BlockSize, NumOfBlocks);
+	}
+
+	HAL_SD_ErrorTypedef error = SD_OK;
+	do {
+		/* Forget the completion of an aborted transfer */
+		xSemaphoreTake(sd_transfer_sem, 0);
+
+		error = HAL_SD_WriteBlocks_DMA(&hsd, pData, WriteAddr, BlockSize, NumOfBlocks);
+
+		if (error == SD_OK) {
+			if (xSemaphoreTake(sd_transfer_sem, SD_TRANSFER_TIMEOUT) == pdTRUE) {
+				error = BSP_SD_FinishWrite();
+			} else {
+				error = SD_DATA_TIMEOUT;
+			}
+		}
+
+		if (error != SD_OK) {
+			HAL_DMA_Abort(hsd.hdmatx);
+			__HAL_SD_SDIO_CLEAR_FLAG(&hsd, SD_STATIC_FLAGS);
+
+			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "HAL_SD_WriteBlocks_DMA(addr %u, size %u, count %u) failed with error %u",
+				(uint32_t)WriteAddr, BlockSize, NumOfBlocks, error);
+
+			retries--;
+			if (retries <= 0) {
+				LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Too many failes. Giving up writting to SD card!");
+				return MSD_ERROR;
+			}
+
+			/* wait for accessing the SD card again */
+			vTaskDelay(pdMS_TO_TICKS(1));
+		}
+	} while (error != SD_OK);
+
+	return MSD_OK;
+}
+
+/**
+  * @brief  Sends a command with a short response to the card
+  * @param  Index: command index
+  * @param  Argument: command argument
+  * @retval SD status
+  */
+static uint8_t BSP_SD_SendCommand(uint8_t Index, uint32_t Argument)
+{
+  SDIO_CmdInitTypeDef sdio_cmdinitstructure;
+  uint32_t timeout = SD_CMD_TIMEOUT;
+
+  sdio_cmdinitstructure.Argument         = Argument;
+  sdio_cmdinitstructure.CmdIndex         = Index;
+  sdio_cmdinitstructure.Response         = SDIO_RESPONSE_SHORT;
+  sdio_cmdinitstructure.WaitForInterrupt = SDIO_WAIT_NO;
+  sdio_cmdinitstructure.CPSM             = SDIO_CPSM_ENABLE;
+  SDIO_SendCommand(hsd.Instance, &sdio_cmdinitstructure);
+
+  while (!__HAL_SD_SDIO_GET_FLAG(&hsd, SDIO_FLAG_CCRCFAIL | SDIO_FLAG_CMDREND | SDIO_FLAG_CTIMEOUT))
   {
-    if(HAL_SD_CheckWriteOperation(&hsd, (uint32_t)SD_DATATIMEOUT) != SD_OK)  
+    if (--timeout == 0)
     {
-      SD_state = MSD_ERROR;
-    }
-    else
-    {
-      SD_state = MSD_OK;
+      return MSD_ERROR;
     }
   }
-  
-  return SD_state; 
+
+  const uint8_t failed = __HAL_SD_SDIO_GET_FLAG(&hsd, SDIO_FLAG_CCRCFAIL | SDIO_FLAG_CTIMEOUT) ||
+                         SDIO_GetCommandResponse(hsd.Instance) != Index ||
+                         (SDIO_GetResponse(SDIO_RESP1) & SD_R1_ERRORBITS) != 0;
+
+  __HAL_SD_SDIO_CLEAR_FLAG(&hsd, SD_STATIC_FLAGS);
+
+  return failed ? MSD_ERROR : MSD_OK;
+}
+
+/**
+  * @brief  Tells the card the number of blocks of the next multiblock write (ACMD23),
+  *         so that it can erase them in advance.
+  * @param  NumOfBlocks: Number of SD blocks, which will be written
+  * @retval SD status
+  */
+uint8_t BSP_SD_SetWriteBlockEraseCount(uint32_t NumOfBlocks)
+{
+  if (BSP_SD_SendCommand(SD_CMD_APP_CMD, (uint32_t)hsd.RCA << 16) != MSD_OK)
+  {
+    return MSD_ERROR;
+  }
+
+  return BSP_SD_SendCommand(SD_CMD_SD_APP_SET_WR_BLK_ERASE_COUNT, NumOfBlocks & 0x7FFFFF);
 }
 
 /**
@@ -292,6 +475,49 @@ void BSP_SD_DMA_Rx_IRQHandler(void)
   HAL_DMA_IRQHandler(hsd.hdmarx);
 }
 
+/**
+  * @brief  Wakes up the task, which waits for the end of a DMA transfer.
+  * @note   Called by the SDIO and DMA interrupts.
+  * @param  None
+  * @retval None
+  */
+static void BSP_SD_TransferDone(void)
+{
+  BaseType_t woken = pdFALSE;
+
+  if (sd_transfer_sem != NULL)
+  {
+    xSemaphoreGiveFromISR(sd_transfer_sem, &woken);
+  }
+
+  portYIELD_FROM_ISR(woken);
+}
+
+void HAL_SD_XferErrorCallback(SD_HandleTypeDef *hsd)
+{
+  BSP_SD_TransferDone();
+}
+
+void HAL_SD_DMA_RxCpltCallback(DMA_HandleTypeDef *hdma)
+{
+  BSP_SD_TransferDone();
+}
+
+void HAL_SD_DMA_RxErrorCallback(DMA_HandleTypeDef *hdma)
+{
+  BSP_SD_TransferDone();
+}
+
+void HAL_SD_DMA_TxCpltCallback(DMA_HandleTypeDef *hdma)
+{
+  BSP_SD_TransferDone();
+}
+
+void HAL_SD_DMA_TxErrorCallback(DMA_HandleTypeDef *hdma)
+{
+  BSP_SD_TransferDone();
+}
+
 /**
   * @brief  Gets the current SD card data status.
   * @param  None
@@ -575,7 +575,7 @@ void TIM8_TRG_COM_TIM14_IRQHandler() { Unexpected_Interrupt(__func__); }
 void TIM8_CC_IRQHandler() { Unexpected_Interrupt(__func__); }
 void DMA1_Stream7_IRQHandler() { Unexpected_Interrupt(__func__); }
 void FSMC_IRQHandler() { Unexpected_Interrupt(__func__); }
-void SDIO_IRQHandler() { Unexpected_Interrupt(__func__); }
+/*void SDIO_IRQHandler() { Unexpected_Interrupt(__func__); }*/
 void TIM5_IRQHandler() { Unexpected_Interrupt(__func__); }
 void SPI3_IRQHandler() { Unexpected_Interrupt(__func__); }
 void UART4_IRQHandler() { Unexpected_Interrupt(__func__); }
@@ -585,7 +585,7 @@ void TIM7_IRQHandler() { Unexpected_Interrupt(__func__); }
 void DMA2_Stream0_IRQHandler() { Unexpected_Interrupt(__func__); }
 void DMA2_Stream1_IRQHandler() { Unexpected_Interrupt(__func__); }
 void DMA2_Stream2_IRQHandler() { Unexpected_Interrupt(__func__); }
-void DMA2_Stream3_IRQHandler() { Unexpected_Interrupt(__func__); }
+/*void DMA2_Stream3_IRQHandler() { Unexpected_Interrupt(__func__); }*/
 void DMA2_Stream4_IRQHandler() { Unexpected_Interrupt(__func__); }
 /*void ETH_IRQHandler() { Unexpected_Interrupt(__func__); }*/
 void ETH_WKUP_IRQHandler() { Unexpected_Interrupt(__func__); }
@@ -595,7 +595,7 @@ void CAN2_RX1_IRQHandler() { Unexpected_Interrupt(__func__); }
 void CAN2_SCE_IRQHandler() { Unexpected_Interrupt(__func__); }
 void OTG_FS_IRQHandler() { Unexpected_Interrupt(__func__); }
 void DMA2_Stream5_IRQHandler() { Unexpected_Interrupt(__func__); }
-void DMA2_Stream6_IRQHandler() { Unexpected_Interrupt(__func__); }
+/*void DMA2_Stream6_IRQHandler() { Unexpected_Interrupt(__func__); }*/
 void DMA2_Stream7_IRQHandler() { Unexpected_Interrupt(__func__); }
 void USART6_IRQHandler() { Unexpected_Interrupt(__func__); }
 void I2C3_EV_IRQHandler() { Unexpected_Interrupt(__func__); }
@@ -70,10 +70,106 @@
 #define MMEM_ALIGNMENT 4
 #endif
 
-static SemaphoreHandle_t mutex = NULL;
+/**
+ * Use the slab backend instead of the compacting heap.
+ * The slab backend hands out power-of-two sized blocks from per-class
+ * free lists, so blocks never move and alloc/free do not depend on the
+ * number of bytes in use. The price is the internal fragmentation of
+ * rounding every request up to its size class.
+ */
+#ifdef MMEM_CONF_SLAB
+#define MMEM_SLAB MMEM_CONF_SLAB
+#else
+#define MMEM_SLAB 0
+#endif
+
+#if MMEM_SLAB
+/**
+ * Size of the smallest size class.
+ * Has to be a power of two and big enough to hold the free list links.
+ */
+#ifdef MMEM_CONF_SLAB_MIN_SIZE
+#define MMEM_SLAB_MIN_SIZE MMEM_CONF_SLAB_MIN_SIZE
+#else
+#define MMEM_SLAB_MIN_SIZE 32
+#endif
+
+/**
+ * Number of size classes, the biggest class is
+ * MMEM_SLAB_MIN_SIZE << (MMEM_SLAB_CLASSES - 1).
+ * By default the biggest class is the biggest power of two, that fits
+ * into MMEM_SIZE. Allocations bigger than that class always fail,
+ * with the default MMEM_SIZE this is 16 KB.
+ */
+#ifdef MMEM_CONF_SLAB_CLASSES
+#define MMEM_SLAB_CLASSES MMEM_CONF_SLAB_CLASSES
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 15)
+#define MMEM_SLAB_CLASSES 16
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 14)
+#define MMEM_SLAB_CLASSES 15
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 13)
+#define MMEM_SLAB_CLASSES 14
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 12)
+#define MMEM_SLAB_CLASSES 13
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 11)
+#define MMEM_SLAB_CLASSES 12
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 10)
+#define MMEM_SLAB_CLASSES 11
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 9)
+#define MMEM_SLAB_CLASSES 10
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 8)
+#define MMEM_SLAB_CLASSES 9
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 7)
+#define MMEM_SLAB_CLASSES 8
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 6)
+#define MMEM_SLAB_CLASSES 7
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 5)
+#define MMEM_SLAB_CLASSES 6
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 4)
+#define MMEM_SLAB_CLASSES 5
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 3)
+#define MMEM_SLAB_CLASSES 4
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 2)
+#define MMEM_SLAB_CLASSES 3
+#elif MMEM_SIZE >= (MMEM_SLAB_MIN_SIZE << 1)
+#define MMEM_SLAB_CLASSES 2
+#else
+#define MMEM_SLAB_CLASSES 1
+#endif
+
+#define MMEM_SLAB_BLOCKS (MMEM_SIZE / MMEM_SLAB_MIN_SIZE)
+#define MMEM_SLAB_FREE 0x80
+#define MMEM_SLAB_CLASS_MASK 0x7F
+#define MMEM_SLAB_CLASS_SIZE(c) ((size_t)MMEM_SLAB_MIN_SIZE << (c))
+
+#if MMEM_SLAB_MIN_SIZE < 2 * __SIZEOF_POINTER__ || (MMEM_SLAB_MIN_SIZE & (MMEM_SLAB_MIN_SIZE - 1)) != 0
+#error "MMEM_SLAB_MIN_SIZE has to be a power of two and hold two pointers"
+#endif
+
+/**
+ * Free list links, stored in the first bytes of a free block
+ */
+struct mmem_slab_free {
+	struct mmem_slab_free *next;
+	struct mmem_slab_free *prev;
+};
+
+static struct mmem_slab_free *free_lists[MMEM_SLAB_CLASSES];
+
+/**
+ * One entry per MMEM_SLAB_MIN_SIZE chunk.
+ * Only the entry of the first chunk of a block is valid, it contains the
+ * size class of the block and MMEM_SLAB_FREE if the block is free.
+ * All other entries are zero.
+ */
+static uint8_t block_info[MMEM_SLAB_BLOCKS];
+#else
 LIST(mmemlist);
+#endif /* MMEM_SLAB */
+
+static SemaphoreHandle_t mutex = NULL;
 static size_t avail_memory;
-static char memory[MMEM_SIZE];
+static char memory[MMEM_SIZE] __attribute__ ((aligned(8)));
 
 
 size_t mmem_avail_memory(void)
@@ -85,6 +181,408 @@ size_t mmem_avail_memory(void)
 }
 
 
+#if MMEM_SLAB
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief      Get the smallest size class which can hold size bytes
+ * \param size Number of bytes
+ * \return     Size class or -1 if size is bigger than the biggest class
+ */
+static int
+mmem_slab_class(size_t size)
+{
+	for (int c = 0; c < MMEM_SLAB_CLASSES; c++) {
+		if (MMEM_SLAB_CLASS_SIZE(c) >= size) {
+			return c;
+		}
+	}
+
+	return -1;
+}
+
+static inline size_t
+mmem_slab_index(const void *block)
+{
+	return ((const char *)block - memory) / MMEM_SLAB_MIN_SIZE;
+}
+
+static void
+mmem_slab_push(int c, void *block)
+{
+	struct mmem_slab_free *f = block;
+
+	f->prev = NULL;
+	f->next = free_lists[c];
+	if (f->next != NULL) {
+		f->next->prev = f;
+	}
+	free_lists[c] = f;
+
+	block_info[mmem_slab_index(block)] = c | MMEM_SLAB_FREE;
+}
+
+static void
+mmem_slab_unlink(int c, void *block)
+{
+	struct mmem_slab_free *f = block;
+
+	if (f->prev != NULL) {
+		f->prev->next = f->next;
+	} else {
+		free_lists[c] = f->next;
+	}
+	if (f->next != NULL) {
+		f->next->prev = f->prev;
+	}
+
+	block_info[mmem_slab_index(block)] = c;
+}
+
+/**
+ * \brief   Take a block of class c from the free lists
+ *
+ *          If the class is empty, the smallest bigger free block is
+ *          split in halves until it has the requested size.
+ *          Has to be called with the mutex held.
+ */
+static void *
+mmem_slab_take(int c)
+{
+	int found = c;
+
+	while (found < MMEM_SLAB_CLASSES && free_lists[found] == NULL) {
+		found++;
+	}
+	if (found >= MMEM_SLAB_CLASSES) {
+		return NULL;
+	}
+
+	char *block = (char *)free_lists[found];
+	mmem_slab_unlink(found, block);
+
+	/* return the upper halves to the smaller classes */
+	while (found > c) {
+		found--;
+		mmem_slab_push(found, block + MMEM_SLAB_CLASS_SIZE(found));
+	}
+	block_info[mmem_slab_index(block)] = c;
+
+	avail_memory -= MMEM_SLAB_CLASS_SIZE(c);
+
+	return block;
+}
+
+/**
+ * \brief   Give a block of class c back to the free lists
+ *
+ *          The block is merged with its buddy as long as the buddy is
+ *          free and of the same class.
+ *          Has to be called with the mutex held.
+ */
+static void
+mmem_slab_release(int c, char *block)
+{
+	avail_memory += MMEM_SLAB_CLASS_SIZE(c);
+
+	while (c + 1 < MMEM_SLAB_CLASSES) {
+		const size_t offset = block - memory;
+		const size_t buddy_offset = offset ^ MMEM_SLAB_CLASS_SIZE(c);
+
+		if (buddy_offset + MMEM_SLAB_CLASS_SIZE(c) > MMEM_SLAB_BLOCKS * MMEM_SLAB_MIN_SIZE) {
+			break;
+		}
+
+		char *const buddy = &memory[buddy_offset];
+		if (block_info[mmem_slab_index(buddy)] != (c | MMEM_SLAB_FREE)) {
+			break;
+		}
+
+		mmem_slab_unlink(c, buddy);
+
+		/* only the first chunk of a block carries the block info */
+		if (buddy < block) {
+			block_info[mmem_slab_index(block)] = 0;
+			block = buddy;
+		} else {
+			block_info[mmem_slab_index(buddy)] = 0;
+		}
+		c++;
+	}
+
+	mmem_slab_push(c, block);
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief      Allocate a managed memory block
+ * \param m    A pointer to a struct mmem.
+ * \param size The size of the requested memory block
+ * \return     Non-zero if the memory could be allocated, zero if memory
+ *             was not available.
+ *
+ *             Slab version of mmem_alloc(). The block is taken from the
+ *             free list of the smallest fitting size class and will not
+ *             move until it is freed.
+ */
+int
+mmem_alloc(struct mmem *m, unsigned int size)
+{
+	/* enter the critical section */
+	if ( !xSemaphoreTake(mutex, portMAX_DELAY) ) {
+		return -1;
+	}
+
+	LOG(LOGD_CORE, LOG_MMEM, LOGL_DBG, "%p %lu %lu", m, size, avail_memory);
+
+	const int c = mmem_slab_class(size);
+	if (c < 0) {
+		xSemaphoreGive(mutex);
+		return 0;
+	}
+
+	void *const block = mmem_slab_take(c);
+	if (block == NULL) {
+		xSemaphoreGive(mutex);
+		return 0;
+	}
+
+	m->next = NULL;
+	m->ptr = block;
+	m->size = size;
+	m->real_size = MMEM_SLAB_CLASS_SIZE(c);
+
+	LOG(LOGD_CORE, LOG_MMEM, LOGL_DBG, "%p %p %lu %lu", m, m->ptr, m->real_size, avail_memory);
+
+	xSemaphoreGive(mutex);
+
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief      Deallocate a managed memory block
+ * \param m    A pointer to the managed memory block
+ *
+ *             Slab version of mmem_free(). No other block is moved.
+ */
+int
+mmem_free(struct mmem *m)
+{
+	/* enter the critical section */
+	if ( !xSemaphoreTake(mutex, portMAX_DELAY) ) {
+		return -1;
+	}
+
+	LOG(LOGD_CORE, LOG_MMEM, LOGL_DBG, "%p %p %lu %lu", m, m->ptr, m->real_size, avail_memory);
+
+	/* fail if the memory does not belong to an allocated block */
+	configASSERT((char *)m->ptr >= memory && (char *)m->ptr < &memory[MMEM_SIZE]);
+	const uint8_t info = block_info[mmem_slab_index(m->ptr)];
+	configASSERT(!(info & MMEM_SLAB_FREE));
+	configASSERT(MMEM_SLAB_CLASS_SIZE(info & MMEM_SLAB_CLASS_MASK) == m->real_size);
+
+	mmem_slab_release(info & MMEM_SLAB_CLASS_MASK, m->ptr);
+
+	LOG(LOGD_CORE, LOG_MMEM, LOGL_DBG, "%lu", avail_memory);
+
+	xSemaphoreGive(mutex);
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief      Change the size of allocated memory
+ * \param mem  mmem chunk whose size should be changed
+ * \param size Size to change the chunk to
+ * \return     1 on success, 0 on failure
+ *
+ *             Slab version of mmem_realloc(). Sizes within the same class
+ *             are changed in place, shrinking returns the unused halves
+ *             to the free lists and growing copies the data into a block
+ *             of the bigger class. If the size could not be changed the
+ *             original chunk is preserved.
+ */
+int
+mmem_realloc(struct mmem *mem, unsigned int size)
+{
+	/* enter the critical section */
+	if ( !xSemaphoreTake(mutex, portMAX_DELAY) ) {
+		return 0;
+	}
+
+	LOG(LOGD_CORE, LOG_MMEM, LOGL_DBG, "%p %p %lu %lu %lu", mem, mem->ptr, mem->real_size, size, avail_memory);
+
+	const int c = mmem_slab_class(size);
+	if (c < 0) {
+		xSemaphoreGive(mutex);
+		return 0;
+	}
+
+	char *block = mem->ptr;
+	int old_c = block_info[mmem_slab_index(block)];
+	configASSERT(!(old_c & MMEM_SLAB_FREE));
+
+	if (c < old_c) {
+		/* give the upper halves back */
+		while (old_c > c) {
+			old_c--;
+			mmem_slab_release(old_c, block + MMEM_SLAB_CLASS_SIZE(old_c));
+		}
+		block_info[mmem_slab_index(block)] = c;
+	} else if (c > old_c) {
+		char *const new_block = mmem_slab_take(c);
+		if (new_block == NULL) {
+			xSemaphoreGive(mutex);
+			return 0;
+		}
+
+		memcpy(new_block, block, mem->size);
+		mmem_slab_release(old_c, block);
+		block = new_block;
+	}
+
+	mem->ptr = block;
+	mem->size = size;
+	mem->real_size = MMEM_SLAB_CLASS_SIZE(c);
+
+	LOG(LOGD_CORE, LOG_MMEM, LOGL_DBG, "%p %p %lu %lu", mem, mem->ptr, mem->real_size, avail_memory);
+
+	xSemaphoreGive(mutex);
+	return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief      Hand an allocated chunk over to another struct mmem
+ * \param to   struct mmem, which is not allocated yet
+ * \param from mmem chunk which is handed over
+ * \return     1 on success, 0 on failure
+ *
+ *             Slab version of mmem_move(). The descriptors of the slab
+ *             allocator are not linked, so only the fields are copied.
+ */
+int
+mmem_move(struct mmem *to, struct mmem *from)
+{
+	/* enter the critical section */
+	if ( !xSemaphoreTake(mutex, portMAX_DELAY) ) {
+		return 0;
+	}
+
+	LOG(LOGD_CORE, LOG_MMEM, LOGL_DBG, "%p %p %p %lu", to, from, from->ptr, from->real_size);
+
+	*to = *from;
+	from->ptr = NULL;
+
+	xSemaphoreGive(mutex);
+	return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief      Initialize the managed memory module
+ *
+ *             Slab version of mmem_init(). The memory is cut into the
+ *             biggest aligned blocks which fit, these are the initial
+ *             content of the free lists.
+ */
+int
+mmem_init(void)
+{
+	/* Only execute the initalisation before the scheduler was started.
+	 * So there exists only one thread and
+	 * no locking is needed for the initialisation
+	 */
+	configASSERT(xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED);
+
+	/* cancle, if initialisation was already done */
+	if(mutex != NULL) {
+		return -1;
+	}
+	/* Do not use an recursive mutex,
+	 * because mmem_check() will not work vital then.
+	 */
+	mutex = xSemaphoreCreateMutex();
+	if(mutex == NULL) {
+		return -2;
+	}
+
+	memset(free_lists, 0, sizeof(free_lists));
+	memset(block_info, 0, sizeof(block_info));
+
+	const size_t total = MMEM_SLAB_BLOCKS * MMEM_SLAB_MIN_SIZE;
+	size_t offset = 0;
+	while (offset < total) {
+		int c = MMEM_SLAB_CLASSES - 1;
+		while (c > 0 && (offset % MMEM_SLAB_CLASS_SIZE(c) != 0 || offset + MMEM_SLAB_CLASS_SIZE(c) > total)) {
+			c--;
+		}
+
+		mmem_slab_push(c, &memory[offset]);
+		offset += MMEM_SLAB_CLASS_SIZE(c);
+	}
+	avail_memory = total;
+
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * @brief mmem_check checks the free lists for consistency
+ */
+void
+mmem_check(void)
+{
+	if (mutex == NULL) {
+		/* initalization not done,
+		 * so data could be wrong
+		 */
+		return;
+	}
+
+	/* In ISR the mutex state could not be checked,
+	 * therefore cancle when called from ISR.
+	 */
+	const uint16_t irq_nr = (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk);
+	if (irq_nr > 0) {
+		return;
+	}
+
+	/* mutex check is only needed, if the scheduler is running */
+	if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
+		/* do not check, if any function is in the critical region */
+		if (xSemaphoreGetMutexHolder(mutex) != NULL) {
+			return;
+		}
+
+		/* enter the critical section */
+		if ( !xSemaphoreTake(mutex, portMAX_DELAY) ) {
+			return;
+		}
+	} else {
+		return;
+	}
+
+	size_t free_memory = 0;
+	for (int c = 0; c < MMEM_SLAB_CLASSES; c++) {
+		for (const struct mmem_slab_free *f = free_lists[c]; f != NULL; f = f->next) {
+			if (block_info[mmem_slab_index(f)] != (c | MMEM_SLAB_FREE)) {
+				print_stack_trace_part(2);
+			}
+			free_memory += MMEM_SLAB_CLASS_SIZE(c);
+		}
+	}
+
+	if (free_memory != avail_memory) {
+		/* only last two entries needed.
+		 * On first check was successfully and on
+		 * second entry check fails
+		 */
+		print_stack_trace_part(2);
+	}
+
+	xSemaphoreGive(mutex);
+}
+
+#else /* MMEM_SLAB */
 /*---------------------------------------------------------------------------*/
 /**
  * \brief      Allocate a managed memory block
@@ -284,6 +782,41 @@ mmem_realloc(struct mmem *mem, unsigned int size)
 	return 1;
 }
 
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief      Hand an allocated chunk over to another struct mmem
+ * \param to   struct mmem, which is not allocated yet
+ * \param from mmem chunk which is handed over
+ * \return     1 on success, 0 on failure
+ *
+ *             The memory is not copied. Afterwards the chunk has to be
+ *             accessed and freed by to, from is not allocated anymore.
+ */
+int
+mmem_move(struct mmem *to, struct mmem *from)
+{
+	/* enter the critical section */
+	if ( !xSemaphoreTake(mutex, portMAX_DELAY) ) {
+		return 0;
+	}
+
+	LOG(LOGD_CORE, LOG_MMEM, LOGL_DBG, "%p %p %p %lu", to, from, from->ptr, from->real_size);
+
+	/* Put the new descriptor at the position of the old one,
+	 * because the list has to stay in the order of the memory
+	 */
+	list_insert(mmemlist, from, to);
+	list_remove(mmemlist, from);
+
+	to->ptr = from->ptr;
+	to->size = from->size;
+	to->real_size = from->real_size;
+	from->ptr = NULL;
+
+	xSemaphoreGive(mutex);
+	return 1;
+}
+
 /*---------------------------------------------------------------------------*/
 /**
  * \brief      Initialize the managed memory module
@@ -412,5 +945,6 @@ mmem_check(void)
 
 	xSemaphoreGive(mutex);
 }
+#endif /* MMEM_SLAB */
 
 /** @} */
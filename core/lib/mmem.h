@@ -92,6 +92,7 @@ int  mmem_alloc(struct mmem *m, unsigned int size);
 int mmem_free(struct mmem *);
 int mmem_init(void);
 int mmem_realloc(struct mmem *mem, unsigned int size);
+int mmem_move(struct mmem *to, struct mmem *from);
 size_t mmem_avail_memory(void);
 
 /* Can be called by the function instrumentation.
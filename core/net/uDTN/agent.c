@@ -333,6 +333,11 @@ void agent_process(void* p)
 			continue;
 		}
 
+		if(ev.event == dtn_bundle_durable_event) {
+			LOG(LOGD_DTN, LOG_AGENT, LOGL_DBG, "bundle %lu written to storage", ev.bundle_number);
+			continue;
+		}
+
 		if(ev.event == dtn_processing_finished) {
 			// data should contain the bundlemem ptr
 			struct bundle_t * bundle = NULL;
@@ -72,6 +72,9 @@ typedef enum {
 	/* Event thrown to the bundle agent by storage */
 	dtn_bundle_in_storage_event,
 
+	/* Event thrown to the bundle agent by storage, after a bundle was written to the medium */
+	dtn_bundle_durable_event,
+
 	/* Event to transmit an administrative record */
 	dtn_send_admin_record_event,
 
@@ -112,7 +115,7 @@ typedef struct {
 		struct mmem* bundlemem;
 		/* used by dtn_application_registration_event, dtn_application_status_event, dtn_application_remove_event */
 		struct registration_api* registration;
-		/* used by dtn_bundle_in_storage_event */
+		/* used by dtn_bundle_in_storage_event, dtn_bundle_durable_event */
 		uint32_t bundle_number;
 		/* used by dtn_beacon_event */
 		linkaddr_t* linkaddr;
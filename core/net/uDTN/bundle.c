@@ -31,8 +31,36 @@
 /**
  * "Internal" functions
  */
-static size_t bundle_decode_block(struct mmem* const bundlemem, const uint8_t* const buffer, const size_t max_len);
+static size_t bundle_decode_block(struct mmem* const bundlemem, const uint8_t* const buffer, const size_t max_len, struct mmem* const adopt);
 static int bundle_encode_block(struct bundle_block_t *block, uint8_t *buffer, int max_len);
+static void bundle_invalidate_primary_image(struct mmem *bundlemem);
+
+/**
+ * Type, flags and size of a block: 1 byte plus two 32 bit SDNVs
+ */
+#define BUNDLE_BLOCK_HEADER_MAX_LENGTH (1 + 5 + 5)
+
+/**
+ * Order of the primary block fields following the block length
+ */
+enum {
+	PRIMARY_FIELD_DST_NODE,
+	PRIMARY_FIELD_DST_SRV,
+	PRIMARY_FIELD_SRC_NODE,
+	PRIMARY_FIELD_SRC_SRV,
+	PRIMARY_FIELD_REP_NODE,
+	PRIMARY_FIELD_REP_SRV,
+	PRIMARY_FIELD_CUST_NODE,
+	PRIMARY_FIELD_CUST_SRV,
+	PRIMARY_FIELD_TSTAMP,
+	PRIMARY_FIELD_TSTAMP_SEQ,
+	PRIMARY_FIELD_LIFETIME,
+	PRIMARY_FIELD_DICT_LEN,
+	/* only present in fragments */
+	PRIMARY_FIELD_FRAG_OFFS,
+	PRIMARY_FIELD_APP_LEN,
+	PRIMARY_FIELD_COUNT
+};
 
 
 int bundle_init()
@@ -74,73 +102,182 @@ struct mmem * bundle_create_bundle()
 	return &bs->bundle;
 }
 
-int bundle_add_block(struct mmem *bundlemem, uint8_t type, uint8_t flags, uint8_t *data, int d_len)
+/**
+ * \brief Allocates the next block descriptor of a bundle and its data
+ * \param bundlemem MMEM allocation of the bundle
+ * \param size size of the block data
+ * \return the new block or NULL on error
+ */
+static struct bundle_block_t *bundle_new_block(struct mmem *bundlemem, uint8_t type, uint32_t flags, int size)
 {
-	struct bundle_t *bundle;
+	struct bundle_slot_t *bs = container_of(bundlemem, struct bundle_slot_t, bundle);
+	struct bundle_t *bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
 	struct bundle_block_t *block;
-	uint8_t i;
-	int n;
 
-	n = mmem_realloc(bundlemem, bundlemem->size + d_len + sizeof(struct bundle_block_t));
-	if( !n ) {
-		return -1;
+	if (bundle->num_blocks >= BUNDLE_MAX_BLOCKS) {
+		LOG(LOGD_DTN, LOG_BUNDLE, LOGL_ERR, "Bundle has too many blocks, please increase BUNDLE_MAX_BLOCKS");
+		return NULL;
+	}
+
+	block = &bs->blocks[bundle->num_blocks];
+	if (mmem_alloc(&block->data, size) < 1) {
+		return NULL;
 	}
 
+	/* Update the pointer, it may have changed due to the allocation */
 	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	bundle->num_blocks++;
 
-	/* FIXME: Make sure we don't traverse outside of our allocated memory */
+	block->type = type;
+	block->flags = flags;
+	block->block_size = size;
+	block->payload = (uint8_t *) MMEM_PTR(&block->data);
+	block->borrowed = 0;
 
-	/* Go through the blocks until we're behind the last one */
-	block = (struct bundle_block_t *) bundle->block_data;
-	for (i=0;i<bundle->num_blocks;i++) {
-		/* None of these is the last block anymore */
-		block->flags &= ~BUNDLE_BLOCK_FLAG_LAST;
-		block = (struct bundle_block_t *) &block->payload[block->block_size];
+	return block;
+}
+
+/**
+ * \brief Takes over a MMEM chunk as data of the next block of a bundle
+ * \param bundlemem MMEM allocation of the bundle
+ * \param data MMEM chunk containing the block data, it is moved into the block
+ * \param offset position of the block data in the chunk
+ * \param size size of the block data
+ * \return the new block or NULL on error
+ */
+static struct bundle_block_t *bundle_adopt_block(struct mmem *bundlemem, uint8_t type, uint32_t flags,
+												 struct mmem *data, size_t offset, int size)
+{
+	struct bundle_slot_t *bs = container_of(bundlemem, struct bundle_slot_t, bundle);
+	struct bundle_t *bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	struct bundle_block_t *block;
+
+	if (bundle->num_blocks >= BUNDLE_MAX_BLOCKS) {
+		LOG(LOGD_DTN, LOG_BUNDLE, LOGL_ERR, "Bundle has too many blocks, please increase BUNDLE_MAX_BLOCKS");
+		return NULL;
+	}
+
+	block = &bs->blocks[bundle->num_blocks];
+
+	/* Move the block data to the beginning of the chunk */
+	memmove(MMEM_PTR(data), (uint8_t *) MMEM_PTR(data) + offset, size);
+
+	if (!mmem_move(&block->data, data)) {
+		return NULL;
+	}
+
+	/* Cut off everything behind the block data.
+	 * Shrinking does not fail, the chunk is only kept bigger otherwise.
+	 */
+	mmem_realloc(&block->data, size);
+
+	/* Update the pointer, it may have changed due to the reallocation */
+	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	bundle->num_blocks++;
+
+	block->type = type;
+	block->flags = flags;
+	block->block_size = size;
+	block->payload = (uint8_t *) MMEM_PTR(&block->data);
+	block->borrowed = 0;
+
+	return block;
+}
+
+int bundle_add_block_borrowed(struct mmem *bundlemem, uint8_t type, uint32_t flags, uint8_t *data, int d_len)
+{
+	struct bundle_slot_t *bs = container_of(bundlemem, struct bundle_slot_t, bundle);
+	struct bundle_t *bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	struct bundle_block_t *block;
+
+	if (bundle->num_blocks >= BUNDLE_MAX_BLOCKS) {
+		LOG(LOGD_DTN, LOG_BUNDLE, LOGL_ERR, "Bundle has too many blocks, please increase BUNDLE_MAX_BLOCKS");
+		return -1;
 	}
 
+	block = &bs->blocks[bundle->num_blocks];
+	bundle->num_blocks++;
+
+	/* The chunk is not known to MMEM, so it is never moved */
+	block->data.next = NULL;
+	block->data.size = d_len;
+	block->data.real_size = d_len;
+	block->data.ptr = data;
+
 	block->type = type;
-	block->flags = BUNDLE_BLOCK_FLAG_LAST | flags;
+	block->flags = flags;
 	block->block_size = d_len;
+	block->payload = data;
+	block->borrowed = 1;
 
-	bundle->num_blocks++;
+	return d_len;
+}
 
-	memcpy(block->payload, data, d_len);
+int bundle_add_block(struct mmem *bundlemem, uint8_t type, uint8_t flags, uint8_t *data, int d_len)
+{
+	struct bundle_slot_t *bs = container_of(bundlemem, struct bundle_slot_t, bundle);
+	struct bundle_block_t *block;
+	uint8_t i;
+
+	block = bundle_new_block(bundlemem, type, BUNDLE_BLOCK_FLAG_LAST | flags, d_len);
+	if( block == NULL ) {
+		return -1;
+	}
+
+	/* None of the other blocks is the last block anymore */
+	for (i=0; &bs->blocks[i] != block; i++) {
+		bs->blocks[i].flags &= ~BUNDLE_BLOCK_FLAG_LAST;
+	}
+
+	if( data != NULL ) {
+		memcpy(block->payload, data, d_len);
+	}
 
 	return d_len;
 }
 
 struct bundle_block_t *bundle_get_block(struct mmem *bundlemem, uint8_t i)
 {
+	struct bundle_slot_t *bs = container_of(bundlemem, struct bundle_slot_t, bundle);
 	struct bundle_t *bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
-	struct bundle_block_t *block = (struct bundle_block_t *) bundle->block_data;
 
 	if (i >= bundle->num_blocks)
 		return NULL;
 
-	for (;i!=0;i--) {
-		block = (struct bundle_block_t *) &block->payload[block->block_size];
-	}
+	bs->blocks[i].payload = (uint8_t *) MMEM_PTR(&bs->blocks[i].data);
 
-	return block;
+	return &bs->blocks[i];
 }
 
 struct bundle_block_t *bundle_get_block_by_type(struct mmem *bundlemem, uint8_t type)
 {
+	struct bundle_slot_t *bs = container_of(bundlemem, struct bundle_slot_t, bundle);
 	struct bundle_t *bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
-	struct bundle_block_t *block = (struct bundle_block_t *) bundle->block_data;
 	int i = 0;
 
 	for(i=0; i<bundle->num_blocks; i++) {
-		if( block->type == type ) {
-			return block;
+		if( bs->blocks[i].type == type ) {
+			return bundle_get_block(bundlemem, i);
 		}
-
-		block = (struct bundle_block_t *) &block->payload[block->block_size];
 	}
 
 	return NULL;
 }
 
+size_t bundle_get_size(struct mmem *bundlemem)
+{
+	struct bundle_slot_t *bs = container_of(bundlemem, struct bundle_slot_t, bundle);
+	struct bundle_t *bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	size_t size = bundlemem->size;
+	int i = 0;
+
+	for(i=0; i<bundle->num_blocks; i++) {
+		size += sizeof(struct bundle_block_t) + bs->blocks[i].block_size;
+	}
+
+	return size;
+}
+
 struct bundle_block_t * bundle_get_payload_block(struct mmem * bundlemem) {
 	return bundle_get_block_by_type(bundlemem, BUNDLE_BLOCK_TYPE_PAYLOAD);
 }
@@ -149,6 +286,8 @@ uint8_t bundle_set_attr(struct mmem *bundlemem, uint8_t attr, const uint32_t* co
 {
 	struct bundle_t *bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
 	LOG(LOGD_DTN, LOG_BUNDLE, LOGL_DBG, "set attr %lx",*val);
+	bundle_invalidate_primary_image(bundlemem);
+
 	switch (attr) {
 		case FLAGS:
 			bundle->flags = *val;
@@ -207,6 +346,8 @@ uint8_t bundle_set_attr_long(struct mmem *bundlemem, uint8_t attr, const uint64_
 {
 	struct bundle_t *bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
 	LOG(LOGD_DTN, LOG_BUNDLE, LOGL_DBG, "set attr %lx",*val);
+	bundle_invalidate_primary_image(bundlemem);
+
 	switch (attr) {
 		case DEST_NODE:
 			bundle->dst_node = *val;
@@ -360,9 +501,17 @@ uint8_t bundle_get_attr_long(struct mmem *bundlemem, uint8_t attr, uint64_t *val
 	return 1;
 }
 
-struct mmem *bundle_recover_bundle(const uint8_t* const buffer, const size_t size)
+/**
+ * \brief generates the bundle struct from raw data
+ * \param buffer pointer to the buffer with raw data
+ * \param size size of raw data
+ * \param adopt MMEM chunk containing buffer, which may be taken over
+ *              by the payload block. NULL to copy all blocks
+ * \return Pointer to the MMEM struct containing the bundle
+ */
+static struct mmem *bundle_recover(const uint8_t* const buffer, const size_t size, struct mmem* const adopt)
 {
-	uint32_t primary_size, value;
+	uint32_t primary_size;
 	size_t offs = 0;
 	struct mmem *bundlemem;
 	struct bundle_t *bundle;
@@ -391,47 +540,48 @@ struct mmem *bundle_recover_bundle(const uint8_t* const buffer, const size_t siz
 	offs += sdnv_decode(&buffer[offs], size-offs, &primary_size);
 	primary_size += offs;
 
+	/* All remaining fields of the primary block are decoded in one pass */
+	uint64_t fields[PRIMARY_FIELD_COUNT];
+	const size_t field_count = (bundle->flags & BUNDLE_FLAG_FRAGMENT) ? PRIMARY_FIELD_COUNT : PRIMARY_FIELD_FRAG_OFFS;
+	if (primary_size > size) {
+		LOG(LOGD_DTN, LOG_BUNDLE, LOGL_ERR, "Primary bundle block is truncated.");
+		goto err;
+	}
+	ret = sdnv_decode_array(&buffer[offs], primary_size-offs, fields, field_count);
+	if (ret < 0) {
+		LOG(LOGD_DTN, LOG_BUNDLE, LOGL_ERR, "Problem decoding the primary bundle block.");
+		goto err;
+	}
+	offs += ret;
+
+	/* Everything except for the service numbers and the timestamp has 32 bits */
+	for (uint8_t i = 0; i < field_count; i++) {
+		if (i != PRIMARY_FIELD_DST_SRV && i != PRIMARY_FIELD_SRC_SRV && i != PRIMARY_FIELD_TSTAMP && fields[i] > UINT32_MAX) {
+			LOG(LOGD_DTN, LOG_BUNDLE, LOGL_ERR, "Primary bundle block field %u is too big.", i);
+			goto err;
+		}
+	}
+
 	/*
-	 * Use temp variable, otherwise raises hard fault exception.
+	 * The 64 bit fields are assigned from the array,
+	 * because decoding into them raises a hard fault exception.
 	 * Variable is not aligned for correct offset,
 	 * because of packed attribute.
-	 * For example address has to be a multiply of 8.
-	 * But packed attribute is needed,
-	 * because of memory allocation for the payload block
 	 */
-	uint64_t sdnv_temp = 0;
-
-	/* Destination node + SSP */
-	offs += sdnv_decode(&buffer[offs], size-offs, &bundle->dst_node);
-	offs += sdnv_decode_long(&buffer[offs], size-offs, &sdnv_temp);
-	bundle->dst_srv = sdnv_temp;
-
-	/* Source node + SSP */
-	offs += sdnv_decode(&buffer[offs], size-offs, &bundle->src_node);
-	offs += sdnv_decode_long(&buffer[offs], size-offs, &sdnv_temp);
-	bundle->src_srv = sdnv_temp;
-
-	/* Report-to node + SSP */
-	offs += sdnv_decode(&buffer[offs], size-offs, &bundle->rep_node);
-	offs += sdnv_decode(&buffer[offs], size-offs, &bundle->rep_srv);
-
-	/* Custodian node + SSP */
-	offs += sdnv_decode(&buffer[offs], size-offs, &bundle->cust_node);
-	offs += sdnv_decode(&buffer[offs], size-offs, &bundle->cust_srv);
-
-	/* Creation Timestamp */
-	offs += sdnv_decode_long(&buffer[offs], size-offs, &sdnv_temp);
-	bundle->tstamp = sdnv_temp;
-
-	/* Creation Timestamp Sequence Number */
-	offs += sdnv_decode(&buffer[offs], size-offs, &bundle->tstamp_seq);
-
-	/* Lifetime */
-	offs += sdnv_decode(&buffer[offs], size-offs, &bundle->lifetime);
+	bundle->dst_node = fields[PRIMARY_FIELD_DST_NODE];
+	bundle->dst_srv = fields[PRIMARY_FIELD_DST_SRV];
+	bundle->src_node = fields[PRIMARY_FIELD_SRC_NODE];
+	bundle->src_srv = fields[PRIMARY_FIELD_SRC_SRV];
+	bundle->rep_node = fields[PRIMARY_FIELD_REP_NODE];
+	bundle->rep_srv = fields[PRIMARY_FIELD_REP_SRV];
+	bundle->cust_node = fields[PRIMARY_FIELD_CUST_NODE];
+	bundle->cust_srv = fields[PRIMARY_FIELD_CUST_SRV];
+	bundle->tstamp = fields[PRIMARY_FIELD_TSTAMP];
+	bundle->tstamp_seq = fields[PRIMARY_FIELD_TSTAMP_SEQ];
+	bundle->lifetime = fields[PRIMARY_FIELD_LIFETIME];
 
 	/* Directory Length */
-	offs += sdnv_decode(&buffer[offs], size-offs, &value);
-	if (value != 0) {
+	if (fields[PRIMARY_FIELD_DICT_LEN] != 0) {
 		LOG(LOGD_DTN, LOG_BUNDLE, LOGL_ERR, "Bundle does not use CBHE.");
 		goto err;
 	}
@@ -439,11 +589,8 @@ struct mmem *bundle_recover_bundle(const uint8_t* const buffer, const size_t siz
 	if (bundle->flags & BUNDLE_FLAG_FRAGMENT) {
 		LOG(LOGD_DTN, LOG_BUNDLE, LOGL_INF, "Bundle is a fragment");
 
-		/* Fragment Offset */
-		offs += sdnv_decode(&buffer[offs], size-offs, &bundle->frag_offs);
-
-		/* Total App Data Unit Length */
-		offs += sdnv_decode(&buffer[offs], size-offs, &bundle->app_len);
+		bundle->frag_offs = fields[PRIMARY_FIELD_FRAG_OFFS];
+		bundle->app_len = fields[PRIMARY_FIELD_APP_LEN];
 	}
 
 	if (offs != primary_size) {
@@ -453,7 +600,7 @@ struct mmem *bundle_recover_bundle(const uint8_t* const buffer, const size_t siz
 
 	/* FIXME: Loop around and decode all blocks - does this work? */
 	while (size-offs > 1) {
-		ret = bundle_decode_block(bundlemem, &buffer[offs], size-offs);
+		ret = bundle_decode_block(bundlemem, &buffer[offs], size-offs, adopt);
 
 		/* If block decode failed, we are out of memory and have to abort */
 		if( ret < 1 ) {
@@ -471,15 +618,32 @@ err:
 
 }
 
-static size_t bundle_decode_block(struct mmem* const bundlemem, const uint8_t* const buffer, const size_t max_len)
+struct mmem *bundle_recover_bundle(const uint8_t* const buffer, const size_t size)
+{
+	return bundle_recover(buffer, size, NULL);
+}
+
+struct mmem *bundle_recover_bundle_mmem(struct mmem* const buffer)
+{
+	struct mmem *bundlemem;
+
+	bundlemem = bundle_recover((uint8_t *) MMEM_PTR(buffer), buffer->size, buffer);
+
+	/* Free the buffer, if the payload block did not take it over */
+	if (buffer->ptr != NULL) {
+		mmem_free(buffer);
+		buffer->ptr = NULL;
+	}
+
+	return bundlemem;
+}
+
+static size_t bundle_decode_block(struct mmem* const bundlemem, const uint8_t* const buffer, const size_t max_len, struct mmem* const adopt)
 {
 	uint8_t type;
-	int block_offs = 0;
 	size_t offs = 0;
 	uint32_t flags, size;
-	struct bundle_t *bundle;
 	struct bundle_block_t *block;
-	int n;
 
 	type = buffer[offs];
 	offs++;
@@ -494,27 +658,32 @@ static size_t bundle_decode_block(struct mmem* const bundlemem, const uint8_t* c
 		return 0;
 	}
 
-	block_offs = bundlemem->size;
-
 	if( type == BUNDLE_BLOCK_TYPE_AEB ) {
 		// TODO remove const cast
 		return offs + bundle_ageing_parse_age_extension_block(bundlemem, type, flags, (uint8_t*)&buffer[offs], size);
 	}
 
-	n = mmem_realloc(bundlemem, bundlemem->size + sizeof(struct bundle_block_t) + size);
-	if( !n ) {
-		LOG(LOGD_DTN, LOG_BUNDLE, LOGL_ERR, "Bundle payload length too big for MMEM.");
-		return 0;
-	}
+	/* The payload block takes over the receive buffer, if it is the last part of it.
+	 * Nothing must be read from the buffer afterwards.
+	 */
+	if( adopt != NULL && type == BUNDLE_BLOCK_TYPE_PAYLOAD && size == max_len-offs ) {
+		const size_t adopt_offset = &buffer[offs] - (uint8_t *) MMEM_PTR(adopt);
 
-	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
-	bundle->num_blocks++;
+		block = bundle_adopt_block(bundlemem, type, flags, adopt, adopt_offset, size);
+		if( block == NULL ) {
+			LOG(LOGD_DTN, LOG_BUNDLE, LOGL_ERR, "Could not take over the receive buffer.");
+			return 0;
+		}
+
+		return offs + size;
+	}
 
 	/* Add the block to the end of the bundle */
-	block = (struct bundle_block_t *)((uint8_t *)bundle + block_offs);
-	block->type = type;
-	block->flags = flags;
-	block->block_size = size;
+	block = bundle_new_block(bundlemem, type, flags, size);
+	if( block == NULL ) {
+		LOG(LOGD_DTN, LOG_BUNDLE, LOGL_ERR, "Bundle payload length too big for MMEM.");
+		return 0;
+	}
 
 	/* Copy the actual payload over */
 	memcpy(block->payload, &buffer[offs], block->block_size);
@@ -522,13 +691,99 @@ static size_t bundle_decode_block(struct mmem* const bundlemem, const uint8_t* c
 	return offs + block->block_size;
 }
 
-int bundle_encode_bundle(struct mmem *bundlemem, uint8_t *buffer, int max_len)
+/**
+ * \brief Calculates the length of the encoded primary block fields following the block length field
+ * \param bundle the bundle
+ * \return length in bytes
+ */
+static size_t bundle_primary_block_length(const struct bundle_t * const bundle)
 {
+	size_t length = 0;
+
+	length += sdnv_encoding_len(bundle->dst_node);
+	length += sdnv_encoding_len_long(bundle->dst_srv);
+	length += sdnv_encoding_len(bundle->src_node);
+	length += sdnv_encoding_len_long(bundle->src_srv);
+	length += sdnv_encoding_len(bundle->rep_node);
+	length += sdnv_encoding_len(bundle->rep_srv);
+	length += sdnv_encoding_len(bundle->cust_node);
+	length += sdnv_encoding_len(bundle->cust_srv);
+	length += sdnv_encoding_len_long(bundle->tstamp);
+	length += sdnv_encoding_len(bundle->tstamp_seq);
+	length += sdnv_encoding_len(bundle->lifetime);
+
+	/* Directory Length */
+	length += sdnv_encoding_len(0);
+
+	if (bundle->flags & BUNDLE_FLAG_FRAGMENT) {
+		length += sdnv_encoding_len(bundle->frag_offs);
+		length += sdnv_encoding_len(bundle->app_len);
+	}
+
+	return length;
+}
+
+/**
+ * \brief Calculates the length of an encoded block
+ * \param block the block
+ * \return length in bytes
+ */
+static size_t bundle_block_encoded_length(const struct bundle_block_t * const block)
+{
+	return 1 + sdnv_encoding_len(block->flags) + sdnv_encoding_len(block->block_size) + block->block_size;
+}
+
+/**
+ * \brief Calculates the length of the encoded primary block
+ * \param bundlemem MMEM allocation of the bundle
+ * \return length in bytes
+ */
+static size_t bundle_primary_encoded_length(struct mmem *bundlemem)
+{
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	const size_t primary_length = bundle_primary_block_length(bundle);
+	size_t length = 0;
+
+	/* Version, Flags, Block Length and the primary block fields */
+	length += 1;
+	length += sdnv_encoding_len(bundle->flags);
+	length += sdnv_encoding_len(primary_length);
+	length += primary_length;
+
+	return length;
+}
+
+size_t bundle_encoded_length(struct mmem *bundlemem)
+{
+	struct bundle_slot_t *bs = container_of(bundlemem, struct bundle_slot_t, bundle);
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	size_t length = bundle_primary_encoded_length(bundlemem);
 	uint8_t i;
-	uint32_t value, offs = 0, blklen_offs;
-	int ret, blklen_size;
+
+	length += bundle_ageing_encoded_length(bundlemem);
+
+	for (i=0;i<bundle->num_blocks;i++) {
+		length += bundle_block_encoded_length(&bs->blocks[i]);
+	}
+
+	return length;
+}
+
+/**
+ * \brief Encodes the primary block
+ * \param bundlemem MMEM allocation of the bundle
+ * \param buffer pointer to a buffer
+ * \param max_len size of the buffer
+ * \return number of bytes written or -1 if the buffer is too small
+ */
+static int bundle_encode_primary_block(struct mmem *bundlemem, uint8_t *buffer, int max_len)
+{
+	uint32_t offs = 0;
+	int ret;
 	struct bundle_t *bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
-	struct bundle_block_t *block;
+
+	if (max_len < 1)
+		return -1;
 
 	/* Hardcode the version to 0x06 */
 	buffer[0] = 0x06;
@@ -540,10 +795,11 @@ int bundle_encode_bundle(struct mmem *bundlemem, uint8_t *buffer, int max_len)
 		return -1;
 	offs += ret;
 
-	/* Block length will be calculated later
-	 * reserve one byte for now */
-	blklen_offs = offs;
-	offs++;
+	/* Block length is known in advance, so everything is written in one pass */
+	ret = sdnv_encode(bundle_primary_block_length(bundle), &buffer[offs], max_len - offs);
+	if (ret < 0)
+		return -1;
+	offs += ret;
 
 	/* Destination node + SSP */
 	ret = sdnv_encode(bundle->dst_node, &buffer[offs], max_len - offs);
@@ -629,37 +885,112 @@ int bundle_encode_bundle(struct mmem *bundlemem, uint8_t *buffer, int max_len)
 		offs += ret;
 	}
 
-	/* Calculate block length value */
-	value = offs - blklen_offs - 1;
-	blklen_size = sdnv_encoding_len(value);
-	/* Move the data around */
-	if (blklen_size > 1) {
-		memmove(&buffer[blklen_offs+blklen_size], &buffer[blklen_offs+1], value);
+	return offs;
+}
+
+/**
+ * \brief Returns the cached encoding of the primary block
+ * \param bundlemem MMEM allocation of the bundle
+ * \return MMEM chunk with the encoded primary block or NULL on error
+ *
+ * The primary block is encoded on first use and kept in the bundle slot,
+ * until the bundle is changed by bundle_set_attr() or freed.
+ */
+static struct mmem *bundle_get_primary_image(struct mmem *bundlemem)
+{
+	struct bundle_slot_t *bs = container_of(bundlemem, struct bundle_slot_t, bundle);
+
+	/* Open cursors still read the encoding from before the change */
+	if (bs->primary_image_stale) {
+		return NULL;
+	}
+
+	if (bs->primary_image.ptr != NULL) {
+		return &bs->primary_image;
+	}
+
+	if (mmem_alloc(&bs->primary_image, bundle_primary_encoded_length(bundlemem)) < 1) {
+		bs->primary_image.ptr = NULL;
+		return NULL;
+	}
+
+	if (bundle_encode_primary_block(bundlemem, (uint8_t *) MMEM_PTR(&bs->primary_image), bs->primary_image.size) < 0) {
+		mmem_free(&bs->primary_image);
+		bs->primary_image.ptr = NULL;
+		return NULL;
 	}
-	ret = sdnv_encode(value, &buffer[blklen_offs], blklen_size);
 
-	offs += ret-1;
+	return &bs->primary_image;
+}
+
+/**
+ * \brief Drops the cached encoding of the primary block after a change
+ * \param bundlemem MMEM allocation of the bundle
+ *
+ * While cursors are open, the encoding is only marked as stale and freed
+ * with the last cursor, so a transmission in progress stays consistent.
+ */
+static void bundle_invalidate_primary_image(struct mmem *bundlemem)
+{
+	struct bundle_slot_t *bs = container_of(bundlemem, struct bundle_slot_t, bundle);
+
+	if (bs->cursors > 0) {
+		bs->primary_image_stale = 1;
+		return;
+	}
+
+	if (bs->primary_image.ptr != NULL) {
+		mmem_free(&bs->primary_image);
+		bs->primary_image.ptr = NULL;
+	}
+}
+
+
+int bundle_encode_bundle(struct mmem *bundlemem, uint8_t *buffer, int max_len)
+{
+	uint8_t i;
+	int offs;
+	int ret;
+	struct bundle_t *bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	struct bundle_block_t *block;
+
+	offs = bundle_encode_primary_block(bundlemem, buffer, max_len);
+	if (offs < 0)
+		return -1;
 
 	/* Encode Bundle Age Block - always as first block */
-	offs += bundle_ageing_encode_age_extension_block(bundlemem, &buffer[offs], max_len - offs);
+	ret = bundle_ageing_encode_age_extension_block(bundlemem, &buffer[offs], max_len - offs);
+	if (ret < 1)
+		return -1;
+	offs += ret;
 
-	block = (struct bundle_block_t *) bundle->block_data;
 	for (i=0;i<bundle->num_blocks;i++) {
-		offs += bundle_encode_block(block, &buffer[offs], max_len - offs);
-
-		/* Reference the next block */
-		block = (struct bundle_block_t *) &block->payload[block->block_size];
+		block = bundle_get_block(bundlemem, i);
+		ret = bundle_encode_block(block, &buffer[offs], max_len - offs);
+		if (ret < 0)
+			return -1;
+		offs += ret;
 	}
 
 	return offs;
 }
 
-static int bundle_encode_block(struct bundle_block_t *block, uint8_t *buffer, int max_len)
+/**
+ * \brief Encodes type, flags and size of a block
+ * \param block the block
+ * \param buffer pointer to a buffer
+ * \param max_len size of the buffer
+ * \return number of bytes written or -1 if the buffer is too small
+ */
+static int bundle_encode_block_header(const struct bundle_block_t *block, uint8_t *buffer, int max_len)
 {
 	uint32_t offs = 0;
 	int ret;
 	uint32_t value;
 
+	if (max_len < 1)
+		return -1;
+
 	/* Encode the next block */
 	buffer[offs] = block->type;
 	offs++;
@@ -677,13 +1008,163 @@ static int bundle_encode_block(struct bundle_block_t *block, uint8_t *buffer, in
 		return -1;
 	offs += ret;
 
+	return offs;
+}
+
+static int bundle_encode_block(struct bundle_block_t *block, uint8_t *buffer, int max_len)
+{
+	int offs;
+
+	offs = bundle_encode_block_header(block, buffer, max_len);
+	if (offs < 0)
+		return -1;
+
 	/* Payload */
+	if (block->block_size > max_len - offs)
+		return -1;
 	memcpy(&buffer[offs], block->payload, block->block_size);
 	offs += block->block_size;
 
 	return offs;
 }
 
+int bundle_cursor_init(struct bundle_cursor_t *cursor, struct mmem *bundlemem)
+{
+	struct bundle_slot_t *bs = container_of(bundlemem, struct bundle_slot_t, bundle);
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	struct mmem *primary_image;
+	int ret;
+	uint8_t i;
+
+	memset(cursor, 0, sizeof(struct bundle_cursor_t));
+
+	/* The primary block does not change, so its encoding is reused */
+	primary_image = bundle_get_primary_image(bundlemem);
+	if (primary_image == NULL) {
+		return -1;
+	}
+
+	/* Only the age extension block is encoded for every transmission.
+	 * It is encoded now and not when it is read,
+	 * otherwise parts of a resumed transmission would not fit together.
+	 */
+	ret = bundle_ageing_encode_age_extension_block(bundlemem, cursor->aeb, sizeof(cursor->aeb));
+	if (ret < 1) {
+		return -1;
+	}
+	cursor->aeb_length = ret;
+
+	cursor->bundlemem = bundlemem;
+	bs->cursors++;
+	cursor->length = primary_image->size + cursor->aeb_length;
+	for (i=0;i<bundle->num_blocks;i++) {
+		cursor->length += bundle_block_encoded_length(&bs->blocks[i]);
+	}
+
+	return 1;
+}
+
+int bundle_cursor_free(struct bundle_cursor_t *cursor)
+{
+	/* The primary block encoding belongs to the bundle,
+	 * it is only freed, if the bundle was changed while the cursor was open
+	 */
+	if (cursor->bundlemem != NULL) {
+		struct bundle_slot_t *bs = container_of(cursor->bundlemem, struct bundle_slot_t, bundle);
+
+		bs->cursors--;
+		if (bs->cursors == 0 && bs->primary_image_stale) {
+			mmem_free(&bs->primary_image);
+			bs->primary_image.ptr = NULL;
+			bs->primary_image_stale = 0;
+		}
+	}
+
+	memset(cursor, 0, sizeof(struct bundle_cursor_t));
+
+	return 1;
+}
+
+/**
+ * \brief Moves the cursor forward and copies the passed bytes
+ * \param cursor the cursor
+ * \param buffer destination of the bytes, NULL to skip them
+ * \param length number of bytes to move forward
+ * \return number of bytes the cursor was moved
+ *
+ * The encoded bundle consists of the primary block part, the age
+ * extension block part and the header part and data part of every block.
+ */
+static size_t bundle_cursor_advance(struct bundle_cursor_t *cursor, uint8_t *buffer, size_t length)
+{
+	struct bundle_slot_t *bs = container_of(cursor->bundlemem, struct bundle_slot_t, bundle);
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(cursor->bundlemem);
+	uint8_t block_header[BUNDLE_BLOCK_HEADER_MAX_LENGTH];
+	size_t done = 0;
+
+	while (done < length && cursor->part < 2 + 2 * bundle->num_blocks) {
+		const uint8_t *part_data;
+		size_t part_length;
+
+		if (cursor->part == 0) {
+			part_data = (uint8_t *) MMEM_PTR(&bs->primary_image);
+			part_length = bs->primary_image.size;
+		} else if (cursor->part == 1) {
+			part_data = cursor->aeb;
+			part_length = cursor->aeb_length;
+		} else if (cursor->part % 2 == 0) {
+			/* Block headers are a few bytes only, encode them on the fly */
+			part_data = block_header;
+			part_length = bundle_encode_block_header(&bs->blocks[(cursor->part - 2) / 2], block_header, sizeof(block_header));
+		} else {
+			const struct bundle_block_t * const block = &bs->blocks[(cursor->part - 2) / 2];
+			part_data = (uint8_t *) MMEM_PTR(&block->data);
+			part_length = block->block_size;
+		}
+		size_t n = part_length - cursor->part_offset;
+		if (n > length - done) {
+			n = length - done;
+		}
+
+		if (buffer != NULL) {
+			memcpy(&buffer[done], &part_data[cursor->part_offset], n);
+		}
+		done += n;
+		cursor->part_offset += n;
+		cursor->offset += n;
+
+		if (cursor->part_offset >= part_length) {
+			cursor->part++;
+			cursor->part_offset = 0;
+		}
+	}
+
+	return done;
+}
+
+int bundle_cursor_seek(struct bundle_cursor_t *cursor, size_t offset)
+{
+	if (offset > cursor->length) {
+		return -1;
+	}
+
+	/* Parts are only walked forward, so rewind first */
+	if (offset < cursor->offset) {
+		cursor->offset = 0;
+		cursor->part = 0;
+		cursor->part_offset = 0;
+	}
+
+	bundle_cursor_advance(cursor, NULL, offset - cursor->offset);
+
+	return 1;
+}
+
+size_t bundle_cursor_read(struct bundle_cursor_t *cursor, uint8_t *buffer, size_t length)
+{
+	return bundle_cursor_advance(cursor, buffer, length);
+}
+
 int bundle_increment(struct mmem *bundlemem)
 {
 	struct bundle_slot_t *bs;
@@ -693,6 +1174,14 @@ int bundle_increment(struct mmem *bundlemem)
 	return bundleslot_increment(bs);
 }
 
+int bundle_get_references(struct mmem *bundlemem)
+{
+	struct bundle_slot_t *bs;
+
+	bs = container_of(bundlemem, struct bundle_slot_t, bundle);
+	return __atomic_load_n(&bs->ref, __ATOMIC_ACQUIRE);
+}
+
 int bundle_decrement(struct mmem *bundlemem)
 {
 	struct bundle_slot_t *bs;
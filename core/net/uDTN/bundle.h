@@ -24,6 +24,7 @@
 #include "queue.h"
 
 #include "lib/mmem.h"
+#include "bundle_ageing.h"
 #include "cl_address.h"
 #include "net/packetbuf.h"
 
@@ -107,16 +108,44 @@
 //payload block defines
 #define DATA 							17
 
+/**
+ * Maximum number of blocks (besides the primary block) a bundle can have.
+ * Bundles with more blocks are rejected. Peers like IBR-DTN add an age block,
+ * a previous hop block and further extension blocks to the payload block.
+ * Every bundle slot holds a descriptor for each block.
+ */
+#ifdef CONF_BUNDLE_MAX_BLOCKS
+#define BUNDLE_MAX_BLOCKS CONF_BUNDLE_MAX_BLOCKS
+#else
+#define BUNDLE_MAX_BLOCKS 6
+#endif
+
+/**
+ * \brief Descriptor of a bundle block
+ *
+ * The descriptors of a bundle live in its bundle slot, the block data is
+ * held in a separate MMEM chunk per block. So adding a block does not
+ * relocate the bundle or the other blocks.
+ */
 struct bundle_block_t {
 	uint8_t type;
 	uint32_t flags;
 
 	/* FIXME: EID References are unsupported */
 
-	/* Variable array at the end to hold the payload */
 	int block_size;
-	uint8_t payload[];
-} __attribute__((packed));
+
+	/* Points to the block data. Updated by bundle_get_block() and only
+	 * valid until the next MMEM operation */
+	uint8_t *payload;
+
+	/* MMEM chunk holding the block data */
+	struct mmem data;
+
+	/* Set, if data.ptr points to memory of a storage module instead of
+	 * a MMEM chunk. The data is then not freed with the bundle. */
+	uint8_t borrowed;
+};
 
 /**
 * \brief this struct defines the bundle for internal processing
@@ -154,7 +183,6 @@ struct bundle_t{
 	uint32_t aeb_value_ms;
 
 	uint8_t num_blocks;
-	uint8_t block_data[];
 } __attribute__ ((packed));
 
 int bundle_init();
@@ -167,15 +195,97 @@ int bundle_init();
  */
 struct mmem * bundle_recover_bundle(const uint8_t* const buffer, const size_t size);
 
+/**
+ * \brief generates the bundle struct from raw data in a MMEM chunk
+ * \param buffer MMEM chunk with the raw data
+ * \return Pointer to the MMEM struct containing the bundle
+ *
+ * The payload block takes over the chunk instead of copying it, if the
+ * payload block is the last block. The chunk is freed in any case.
+ */
+struct mmem * bundle_recover_bundle_mmem(struct mmem* const buffer);
+
 /**
  * \brief Encodes the bundle to raw data
  * \param bundlemem pointer to the MMEM struct containing the bundle
  * \param buffer pointer to a buffer
  * \param max_len Size of the buffer
- * \return The number of bytes that were written to buf
+ * \return The number of bytes that were written to buf or -1 if the buffer is too small
  */
 int bundle_encode_bundle(struct mmem * bundlemem, uint8_t * buffer, int max_len);
 
+/**
+ * \brief Calculates the number of bytes bundle_encode_bundle will write
+ * \param bundlemem pointer to the MMEM struct containing the bundle
+ * \return length of the encoded bundle
+ *
+ * The age extension block has a fixed length,
+ * so the length does not change while the bundle is getting older.
+ */
+size_t bundle_encoded_length(struct mmem * bundlemem);
+
+/**
+ * \brief Resumable serializer of a bundle
+ *
+ * The encoded primary block is kept in the bundle slot and shared by all
+ * cursors of the bundle, only the age extension block is encoded by
+ * bundle_cursor_init(). All other blocks are copied from the bundle while
+ * reading, so the encoded bundle never exists in memory as a whole.
+ * The cursor does not hold a reference on the bundle, the caller has to
+ * keep the bundle referenced, until the cursor is freed. Changes of the
+ * primary block by bundle_set_attr() are only encoded by cursors, that are
+ * initialized after all open cursors of the bundle were freed.
+ */
+struct bundle_cursor_t {
+	struct mmem * bundlemem;
+
+	/* Encoded age extension block */
+	uint8_t aeb[BUNDLE_AGEING_AEB_LENGTH];
+	uint8_t aeb_length;
+
+	/* Length of the encoded bundle */
+	size_t length;
+
+	/* Current position in the encoded bundle */
+	size_t offset;
+
+	/* Current part (primary block, age extension block, then header and data of each block) and position in it */
+	uint8_t part;
+	size_t part_offset;
+};
+
+/**
+ * \brief Prepares a cursor at the beginning of the encoded bundle
+ * \param cursor the cursor
+ * \param bundlemem pointer to the MMEM struct containing the bundle
+ * \return 1 on success or -1 on error
+ */
+int bundle_cursor_init(struct bundle_cursor_t * cursor, struct mmem * bundlemem);
+
+/**
+ * \brief Frees the memory of a cursor
+ * \param cursor the cursor
+ * \return 1 on success
+ */
+int bundle_cursor_free(struct bundle_cursor_t * cursor);
+
+/**
+ * \brief Moves the cursor to a position of the encoded bundle
+ * \param cursor the cursor
+ * \param offset position in bytes from the beginning of the encoded bundle
+ * \return 1 on success or -1 if offset is behind the end of the bundle
+ */
+int bundle_cursor_seek(struct bundle_cursor_t * cursor, size_t offset);
+
+/**
+ * \brief Copies the next bytes of the encoded bundle and advances the cursor
+ * \param cursor the cursor
+ * \param buffer pointer to a buffer
+ * \param length number of bytes to copy
+ * \return number of bytes copied, less than length at the end of the bundle
+ */
+size_t bundle_cursor_read(struct bundle_cursor_t * cursor, uint8_t * buffer, size_t length);
+
 /**
  * \brief sets an attribute of a bundle
  * \param bundlemem pointer to the MMEM struct containing bundle
@@ -216,12 +326,25 @@ uint16_t bundle_delete_bundle(struct mmem * bundlemem);
  * \param bundlemem pointer to the MMEM allocation of the bundle
  * \param type type of the block
  * \param flags processing flags of the block
- * \param data pointer to the block payload
+ * \param data pointer to the block payload, if NULL the block is allocated but not filled
  * \param d_len length of the block payload
- * \return 1 on success or 0 on error
+ * \return d_len on success or -1 on error
  */
 int bundle_add_block(struct mmem * bundlemem, uint8_t type, uint8_t flags, uint8_t * data, int d_len);
 
+/**
+ * \brief Add a block to a bundle, whose data is not copied
+ * \param bundlemem pointer to the MMEM allocation of the bundle
+ * \param type type of the block
+ * \param flags processing flags of the block, used as they are
+ * \param data pointer to the block payload
+ * \param d_len length of the block payload
+ * \return d_len on success or -1 on error
+ *
+ * The data has to stay valid until the bundle is freed.
+ */
+int bundle_add_block_borrowed(struct mmem * bundlemem, uint8_t type, uint32_t flags, uint8_t * data, int d_len);
+
 /**
  * \brief Returns a pointer a bundle block
  * \param bundlemem MMEM allocation of the bundle
@@ -238,6 +361,13 @@ struct bundle_block_t * bundle_get_block(struct mmem * bundlemem, uint8_t i);
  */
 struct bundle_block_t * bundle_get_block_by_type(struct mmem * bundlemem, uint8_t type);
 
+/**
+ * \brief Returns the number of bytes the bundle occupies in memory
+ * \param bundlemem MMEM allocation of the bundle
+ * \return size of the bundle struct and all block data
+ */
+size_t bundle_get_size(struct mmem * bundlemem);
+
 /**
  * \brief Returns pointer to bundle payload block
  * \param bundlemem MMEM allocation of the bundle
@@ -268,6 +398,11 @@ int bundle_decrement(struct mmem *bundlemem);
  */
 int bundle_increment(struct mmem *bundlemem);
 
+/**
+ * \brief Returns the number of references on a bundle
+ */
+int bundle_get_references(struct mmem *bundlemem);
+
 #endif
 /** @} */
 /** @} */
@@ -141,6 +141,47 @@ uint8_t bundle_ageing_parse_age_extension_block(struct mmem *bundlemem, uint8_t
 	return offset;
 }
 
+/**
+ * \brief Encodes the current age of a bundle in microseconds
+ * \param bundlemem Bundle MMEM Pointer
+ * \param buffer Buffer for the SDNV, has to hold BUNDLE_AGEING_AGE_LENGTH bytes
+ * \return Length of the SDNV
+ */
+static int bundle_ageing_encode_age(struct mmem *bundlemem, uint8_t *buffer) {
+#if UDTN_SUPPORT_LONG_AEB
+	/* Update the age value
+	 * 4294967 = 0xFFFFFFFF / 1000
+	 */
+	if( bundle_ageing_get_age(bundlemem) > 4294967 ) {
+		// Keep use of 64 bit data types as low as possible for performance reasons
+		uint64_t age = 0;
+		age = ((uint64_t) bundle_ageing_get_age(bundlemem)) * ((uint64_t) 1000);
+		return sdnv_encode_fixed(age, buffer, BUNDLE_AGEING_AGE_LENGTH);
+	} else {
+		uint32_t age = 0;
+		age = bundle_ageing_get_age(bundlemem) * 1000;
+		return sdnv_encode_fixed(age, buffer, BUNDLE_AGEING_AGE_LENGTH);
+	}
+#else
+	uint32_t age = 0;
+	age = bundle_ageing_get_age(bundlemem) * 1000;
+	return sdnv_encode_fixed(age, buffer, BUNDLE_AGEING_AGE_LENGTH);
+#endif
+}
+
+/**
+ * \brief Calculates the length of the encoded age extension block
+ * \param bundlemem Bundle MMEM Pointer
+ * \return Length of the block, which does not depend on the age
+ */
+uint8_t bundle_ageing_encoded_length(struct mmem *bundlemem) {
+	if( bundlemem == NULL || MMEM_PTR(bundlemem) == NULL ) {
+		return 0;
+	}
+
+	return BUNDLE_AGEING_AEB_LENGTH;
+}
+
 /**
  * \brief Encodes the age extension block
  * \param bundlemem Bundle MMEM Pointer
@@ -152,7 +193,7 @@ uint8_t bundle_ageing_encode_age_extension_block(struct mmem *bundlemem, uint8_t
 	struct bundle_t *bundle;
 	uint32_t length = 0;
 	uint8_t offset = 0;
-	uint8_t tmpbuffer[10];
+	uint8_t tmpbuffer[BUNDLE_AGEING_AGE_LENGTH];
 	uint32_t flags = 0;
 	int ret;
 
@@ -165,25 +206,15 @@ uint8_t bundle_ageing_encode_age_extension_block(struct mmem *bundlemem, uint8_t
 		return 0;
 	}
 
-#if UDTN_SUPPORT_LONG_AEB
-	/* Update the age value
-	 * 4294967 = 0xFFFFFFFF / 1000
-	 */
-	if( bundle_ageing_get_age(bundlemem) > 4294967 ) {
-		// Keep use of 64 bit data types as low as possible for performance reasons
-		uint64_t age = 0;
-		age = ((uint64_t) bundle_ageing_get_age(bundlemem)) * ((uint64_t) 1000);
-		length = sdnv_encode_long(age, tmpbuffer, 10);
-	} else {
-		uint32_t age = 0;
-		age = bundle_ageing_get_age(bundlemem) * 1000;
-		length = sdnv_encode(age, tmpbuffer, 10);
+	ret = bundle_ageing_encode_age(bundlemem, tmpbuffer);
+	if( ret < 0 ) {
+		return 0;
+	}
+	length = ret;
+
+	if( max_len < 1 ) {
+		return 0;
 	}
-#else
-	uint32_t age = 0;
-	age = bundle_ageing_get_age(bundlemem) * 1000;
-	length = sdnv_encode(age, tmpbuffer, 10);
-#endif
 
 	/* Encode the next block */
 	buffer[offset] = BUNDLE_BLOCK_TYPE_AEB;
@@ -205,6 +236,9 @@ uint8_t bundle_ageing_encode_age_extension_block(struct mmem *bundlemem, uint8_t
 	offset += ret;
 
 	/* Payload */
+	if( length > max_len - offset ) {
+		return 0;
+	}
 	memcpy(&buffer[offset], tmpbuffer, length);
 	offset += length;
 
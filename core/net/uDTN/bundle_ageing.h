@@ -32,8 +32,24 @@
 #define UDTN_SUPPORT_LONG_AEB 0
 #endif
 
+/**
+ * The age is always encoded with this length, so the length of the
+ * age extension block does not change while the bundle gets older
+ */
+#if UDTN_SUPPORT_LONG_AEB
+#define BUNDLE_AGEING_AGE_LENGTH 10
+#else
+#define BUNDLE_AGEING_AGE_LENGTH 5
+#endif
+
+/**
+ * Length of the encoded age extension block: type, flags, length and age
+ */
+#define BUNDLE_AGEING_AEB_LENGTH (3 + BUNDLE_AGEING_AGE_LENGTH)
+
 uint8_t bundle_ageing_parse_age_extension_block(struct mmem *bundlemem, uint8_t type, uint32_t flags, uint8_t * buffer, int length);
 uint8_t bundle_ageing_encode_age_extension_block(struct mmem *bundlemem, uint8_t *buffer, int max_len);
+uint8_t bundle_ageing_encoded_length(struct mmem *bundlemem);
 uint32_t bundle_ageing_get_age(struct mmem * bundlemem);
 uint8_t bundle_ageing_is_expired(struct mmem * bundlemem);
 
@@ -31,8 +31,10 @@
 #define BUNDLE_NUM (BUNDLE_STORAGE_SIZE + 10)
 #endif
 
+/* Only protects the free list, the reference counts are changed atomically */
 static SemaphoreHandle_t mutex = NULL;
 static struct bundle_slot_t bundleslots[BUNDLE_NUM];
+static struct bundle_slot_t *free_slots = NULL;
 static uint8_t slots_in_use = 0;
 
 
@@ -55,6 +57,13 @@ int bundleslot_init()
 
 	memset(bundleslots, 0, sizeof(bundleslots));
 
+	/* chain all slots into the free list */
+	free_slots = NULL;
+	for (int i=BUNDLE_NUM-1; i>=0; i--) {
+		bundleslots[i].next = free_slots;
+		free_slots = &bundleslots[i];
+	}
+
 	return 1;
 }
 
@@ -66,21 +75,22 @@ struct bundle_slot_t *bundleslot_get_free()
 		return NULL;
 	}
 
-	for (uint16_t i=0; i<BUNDLE_NUM; i++) {
-		if (bundleslots[i].ref == 0) {
-			memset(&bundleslots[i], 0, sizeof(struct bundle_slot_t));
-
-			bundleslots[i].ref++;
-			bundleslots[i].type = 0;
-			slots_in_use ++;
-
-			xSemaphoreGiveRecursive(mutex);
-			return &bundleslots[i];
-		}
+	struct bundle_slot_t * const bs = free_slots;
+	if (bs == NULL) {
+		xSemaphoreGiveRecursive(mutex);
+		return NULL;
 	}
+	free_slots = bs->next;
+	slots_in_use ++;
 
 	xSemaphoreGiveRecursive(mutex);
-	return NULL;
+
+	/* the slot is not reachable by anybody else now */
+	memset(bs, 0, sizeof(struct bundle_slot_t));
+	bs->type = 0;
+	__atomic_store_n(&bs->ref, 1, __ATOMIC_RELEASE);
+
+	return bs;
 }
 
 /* Frees the bundle */
@@ -91,25 +101,51 @@ int bundleslot_free(struct bundle_slot_t *bs)
 		return -1;
 	}
 
-	if( bs->bundle.ptr == NULL ) {
+	/* A slot without memory and without references is already in the free list.
+	 * A slot without memory but with a reference failed to allocate its memory
+	 * and is given back without freeing anything.
+	 */
+	if( bs->bundle.ptr == NULL && __atomic_load_n(&bs->ref, __ATOMIC_ACQUIRE) == 0 ) {
 		LOG(LOGD_DTN, LOG_SLOTS, LOGL_ERR, "DUPLICATE FREE");
 
 		xSemaphoreGiveRecursive(mutex);
 		return -2;
 	}
 
-	bs->ref = 0;
+	__atomic_store_n(&bs->ref, 0, __ATOMIC_RELEASE);
 	slots_in_use --;
 
 	LOG(LOGD_DTN, LOG_SLOTS, LOGL_DBG, "bundleslot_free(%p) %u", bs, slots_in_use);
 
-	// Zeroify all freed memory
-	memset(bs->bundle.ptr, 0, sizeof(struct bundle_t));
+	if( bs->bundle.ptr != NULL ) {
+		// Zeroify all freed memory
+		memset(bs->bundle.ptr, 0, sizeof(struct bundle_t));
 
-	mmem_free(&bs->bundle);
+		mmem_free(&bs->bundle);
 
-	// And kill the pointer!
-	bs->bundle.ptr = NULL;
+		// And kill the pointer!
+		bs->bundle.ptr = NULL;
+	}
+
+	// The block data is allocated separately
+	for (int i=0; i<BUNDLE_MAX_BLOCKS; i++) {
+		if( bs->blocks[i].data.ptr != NULL && !bs->blocks[i].borrowed ) {
+			mmem_free(&bs->blocks[i].data);
+		}
+		bs->blocks[i].data.ptr = NULL;
+		bs->blocks[i].borrowed = 0;
+		bs->blocks[i].payload = NULL;
+	}
+
+	if( bs->primary_image.ptr != NULL ) {
+		mmem_free(&bs->primary_image);
+		bs->primary_image.ptr = NULL;
+	}
+	bs->cursors = 0;
+	bs->primary_image_stale = 0;
+
+	bs->next = free_slots;
+	free_slots = bs;
 
 	xSemaphoreGiveRecursive(mutex);
 	return 0;
@@ -118,45 +154,42 @@ int bundleslot_free(struct bundle_slot_t *bs)
 /* Increment usage count */
 int bundleslot_increment(struct bundle_slot_t *bs)
 {
-	/* enter the critical section */
-	if ( !xSemaphoreTakeRecursive(mutex, portMAX_DELAY) ) {
-		return -2;
-	}
-
-	LOG(LOGD_DTN, LOG_SLOTS, LOGL_DBG, "bundleslot_inc(%p) to %u", bs, bs->ref+1);
+	uint8_t ref = __atomic_load_n(&bs->ref, __ATOMIC_RELAXED);
 
-	if (!bs->ref) {
-		xSemaphoreGiveRecursive(mutex);
-		return -1;
-	}
+	do {
+		/* a slot without references is (about to be) freed and cannot be revived */
+		if (!ref) {
+			return -1;
+		}
+	} while (!__atomic_compare_exchange_n(&bs->ref, &ref, ref + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
 
-	bs->ref++;
+	LOG(LOGD_DTN, LOG_SLOTS, LOGL_DBG, "bundleslot_inc(%p) to %u", bs, ref+1);
 
-	xSemaphoreGiveRecursive(mutex);
-	// TODO save in temp variable
-	return bs->ref;
+	return ref + 1;
 }
 
 /* Decrement usage count, free if necessary */
 int bundleslot_decrement(struct bundle_slot_t *bs)
 {
-	/* enter the critical section */
-	if ( !xSemaphoreTakeRecursive(mutex, portMAX_DELAY) ) {
-		return -2;
-	}
+	uint8_t ref = __atomic_load_n(&bs->ref, __ATOMIC_RELAXED);
 
-	LOG(LOGD_DTN, LOG_SLOTS, LOGL_DBG, "bundleslot_dec(%p) to %u", bs, bs->ref-1);
+	do {
+		if (!ref) {
+			return -1;
+		}
+	} while (!__atomic_compare_exchange_n(&bs->ref, &ref, ref - 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
 
-	if (!bs->ref) {
-		xSemaphoreGiveRecursive(mutex);
-		return -1;
-	}
+	LOG(LOGD_DTN, LOG_SLOTS, LOGL_DBG, "bundleslot_dec(%p) to %u", bs, ref-1);
 
-	bs->ref--;
-	if (!bs->ref)
-		bundleslot_free(bs);
+	/* Only the last reference has to lock to give the slot back.
+	 * Nobody else can reach the slot anymore, because increment fails on 0
+	 * and the slot is not yet in the free list.
+	 */
+	if (ref == 1) {
+		if (bundleslot_free(bs) < 0) {
+			return -2;
+		}
+	}
 
-	xSemaphoreGiveRecursive(mutex);
-	// TODO save in temp variable
-	return bs->ref;
+	return ref - 1;
 }
@@ -18,6 +18,8 @@
 
 #include "lib/mmem.h"
 
+#include "bundle.h"
+
 /* Kernel container_of function
  * WARNING: The ({}) macro extenstion is GCC-specific,
  * but it's worth using it here */
@@ -26,10 +28,20 @@
 		(type *)( (char *)__mptr - offsetof(type,member) );})
 
 struct bundle_slot_t {
+	/** link in the free list, while the slot is unused */
 	struct bundle_slot_t *next;
+	/** reference count, only changed with atomic operations */
 	uint8_t ref;
 	int type;
 	struct mmem bundle;
+	/** descriptors of the blocks of the bundle */
+	struct bundle_block_t blocks[BUNDLE_MAX_BLOCKS];
+	/** encoded primary block, built on the first serialization of the bundle */
+	struct mmem primary_image;
+	/** number of open cursors, which read primary_image */
+	uint8_t cursors;
+	/** set, if the bundle was changed while cursors were open, primary_image is freed with the last cursor */
+	uint8_t primary_image_stale;
 };
 
 int bundleslot_init();
@@ -49,25 +49,86 @@ struct blocked_neighbour_t {
 
 	/* Since when is he blocked? */
 	clock_time_t timestamp;
+
+	/* Ticket, whose segments are in flight to him */
+	struct transmit_ticket_t * ticket;
+};
+
+/**
+ * Structure to remember the receive window, that a neighbour has advertised,
+ * and the round trip time to him
+ */
+struct dgram_neighbour_t {
+	struct dgram_neighbour_t * next;
+
+	/* Address of the neighbour */
+	cl_addr_t neighbour;
+
+	/* How many segments may be in flight to him? */
+	uint8_t window;
+
+	/* Smoothed round trip time [in ticks, scaled by 8] and its variation [in ticks, scaled by 4] */
+	bool rtt_valid;
+	int32_t srtt;
+	int32_t rttvar;
+
+	/* How often was his timeout doubled, since he has answered the last time? */
+	uint8_t backoff;
+};
+
+/**
+ * Queue of the tickets for one neighbour
+ */
+struct dgram_queue_t {
+	struct dgram_queue_t * next;
+
+	/* Next queue in the same bucket of the neighbour index */
+	struct dgram_queue_t * next_hash;
+
+	/* Address of the neighbour */
+	cl_addr_t neighbour;
+
+	/* Tickets with high priority are at the head, the others follow in the order of their enqueueing */
+	LIST_STRUCT(tickets);
+
+	/* Ticket of the multipart bundle, that we receive from the neighbour */
+	struct transmit_ticket_t * recv;
 };
 
 /**
- * List to keep track of outgoing bundles
+ * Memory for the tickets
  */
-LIST(transmission_ticket_list);
 MEMB(transmission_ticket_mem, struct transmit_ticket_t, CONVERGENCE_LAYER_QUEUE);
 
+/**
+ * List of the neighbours, for which we have tickets
+ */
+LIST(queue_list);
+MEMB(queue_mem, struct dgram_queue_t, CONVERGENCE_LAYER_QUEUE);
+
+/**
+ * Indexes of the queues by neighbour and of the enqueued tickets by bundle number
+ */
+static struct dgram_queue_t * queue_index[CONVERGENCE_LAYER_HASH_SIZE];
+static struct transmit_ticket_t * bundle_index[CONVERGENCE_LAYER_HASH_SIZE];
+
 /**
  * List to keep track of blocked neighbours
  */
 LIST(blocked_neighbour_list);
 MEMB(blocked_neighbour_mem, struct blocked_neighbour_t, CONVERGENCE_LAYER_QUEUE);
 
+/**
+ * List to keep track of the windows of our neighbours
+ */
+LIST(neighbour_list);
+MEMB(neighbour_mem, struct dgram_neighbour_t, CONVERGENCE_LAYER_NEIGHBOURS);
+
 /**
  * Internal functions
  */
-static int convergence_layer_dgram_is_blocked(const cl_addr_t * const neighbour);
-static int convergence_layer_dgram_set_blocked(const cl_addr_t* const neighbour);
+static struct blocked_neighbour_t * convergence_layer_dgram_find_blocked(const cl_addr_t * const neighbour);
+static int convergence_layer_dgram_set_blocked(const cl_addr_t* const neighbour, struct transmit_ticket_t * const ticket);
 static int convergence_layer_dgram_set_unblocked(const cl_addr_t * const neighbour);
 
 /**
@@ -91,6 +152,16 @@ static int convergence_layer_queue = 0;
  */
 static uint8_t outgoing_sequence_number = 0;
 
+/**
+ * How many segments may be in flight to a neighbour?
+ */
+static uint8_t convergence_layer_window = CONVERGENCE_LAYER_WINDOW;
+
+/**
+ * Is a SACK delayed, that has to be sent by the process?
+ */
+static volatile bool convergence_layer_sack_pending = false;
+
 /**
  * Backoff timer
  */
@@ -98,6 +169,11 @@ static volatile bool convergence_layer_backoff_pending = false;
 
 static SemaphoreHandle_t transmit_reqest_sem = NULL;
 
+/**
+ * Task, that checks the timeouts, it is notified when a neighbour is blocked
+ */
+static TaskHandle_t timeout_task = NULL;
+
 
 int convergence_layer_dgram_init(void)
 {
@@ -122,7 +198,7 @@ int convergence_layer_dgram_init(void)
 		return -2;
 	}
 
-	if ( !xTaskCreate(convergence_layer_dgram_check_timeouts, "CL TIMEOUTS", configFATFS_STACK_SIZE, NULL, tskIDLE_PRIORITY+1, NULL) ) {
+	if ( !xTaskCreate(convergence_layer_dgram_check_timeouts, "CL TIMEOUTS", configFATFS_STACK_SIZE, NULL, tskIDLE_PRIORITY+1, &timeout_task) ) {
 		return -3;
 	}
 
@@ -130,6 +206,201 @@ int convergence_layer_dgram_init(void)
 }
 
 
+/**
+ * \brief Gets the bucket of a key
+ *
+ * Bundle numbers and addresses may be sequential, so the bits are mixed
+ * before the low bits are used as the bucket.
+ */
+static inline uint16_t convergence_layer_dgram_hash(uint32_t key)
+{
+	key ^= key >> 16;
+	key *= 0x45d9f3b;
+	key ^= key >> 16;
+
+	return key & (CONVERGENCE_LAYER_HASH_SIZE - 1);
+}
+
+
+static uint16_t convergence_layer_dgram_neighbour_hash(const cl_addr_t* const neighbour)
+{
+	uint32_t key = 0;
+
+	if( neighbour->isIP ) {
+		key = ip4_addr_get_u32(&neighbour->ip) ^ neighbour->port;
+	} else {
+		for( int i = 0; i < LINKADDR_SIZE; i++ ) {
+			key = (key << 8) ^ (key >> 24) ^ neighbour->lowpan.u8[i];
+		}
+	}
+
+	return convergence_layer_dgram_hash(key);
+}
+
+
+/**
+ * \brief Returns the queue of a neighbour
+ * \return queue or NULL, if there are no tickets for him
+ */
+static struct dgram_queue_t * convergence_layer_dgram_find_queue(const cl_addr_t* const neighbour)
+{
+	struct dgram_queue_t * q = NULL;
+
+	for( q = queue_index[convergence_layer_dgram_neighbour_hash(neighbour)];
+		 q != NULL;
+		 q = q->next_hash ) {
+		if( cl_addr_cmp(neighbour, &q->neighbour) ) {
+			return q;
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * \brief Puts a ticket into the queue of its neighbour
+ */
+static int convergence_layer_dgram_queue_ticket(struct transmit_ticket_t * const ticket, const uint8_t priority)
+{
+	struct dgram_queue_t * q = convergence_layer_dgram_find_queue(&ticket->neighbour);
+
+	if( q == NULL ) {
+		q = memb_alloc(&queue_mem);
+		if( q == NULL ) {
+			LOG(LOGD_DTN, LOG_CL, LOGL_ERR, "Cannot allocate queue memory");
+			return -1;
+		}
+
+		cl_addr_copy(&q->neighbour, &ticket->neighbour);
+		LIST_STRUCT_INIT(q, tickets);
+		q->recv = NULL;
+
+		const uint16_t bucket = convergence_layer_dgram_neighbour_hash(&q->neighbour);
+		q->next_hash = queue_index[bucket];
+		queue_index[bucket] = q;
+
+		list_add(queue_list, q);
+	}
+
+	if( priority == CONVERGENCE_LAYER_PRIORITY_NORMAL ) {
+		/* Append to queue */
+		list_add(q->tickets, ticket);
+	} else {
+		/* Prepend to queue */
+		list_push(q->tickets, ticket);
+	}
+
+	if( ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART_RECV ) {
+		q->recv = ticket;
+	}
+
+	return 1;
+}
+
+
+/**
+ * \brief Takes a ticket out of the queue of its neighbour
+ *
+ * The queue is freed, when its last ticket is gone.
+ */
+static void convergence_layer_dgram_dequeue_ticket(struct transmit_ticket_t * const ticket)
+{
+	struct dgram_queue_t * const q = convergence_layer_dgram_find_queue(&ticket->neighbour);
+	if( q == NULL ) {
+		/* The ticket was never enqueued */
+		return;
+	}
+
+	list_remove(q->tickets, ticket);
+	if( q->recv == ticket ) {
+		q->recv = NULL;
+	}
+
+	if( list_head(q->tickets) != NULL ) {
+		return;
+	}
+
+	struct dgram_queue_t ** p = &queue_index[convergence_layer_dgram_neighbour_hash(&q->neighbour)];
+	while( *p != q ) {
+		p = &(*p)->next_hash;
+	}
+	*p = q->next_hash;
+
+	list_remove(queue_list, q);
+	memb_free(&queue_mem, q);
+}
+
+
+/**
+ * \brief Returns the first ticket of a neighbour, that has one of the flags
+ *
+ * Tickets for ACKs and incoming multipart bundles are at the head of the queue
+ * and the ticket, that is waiting for an app-layer ACK, is usually the next one.
+ */
+static struct transmit_ticket_t * convergence_layer_dgram_find_ticket(const cl_addr_t* const neighbour, const uint16_t flags)
+{
+	struct dgram_queue_t * const q = convergence_layer_dgram_find_queue(neighbour);
+	struct transmit_ticket_t * ticket = NULL;
+
+	if( q == NULL ) {
+		return NULL;
+	}
+
+	for( ticket = list_head(q->tickets);
+		 ticket != NULL;
+		 ticket = list_item_next(ticket) ) {
+		if( ticket->flags & flags ) {
+			return ticket;
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * \brief Returns the ticket of the multipart bundle, that we receive from a neighbour
+ */
+static struct transmit_ticket_t * convergence_layer_dgram_find_recv_ticket(const cl_addr_t* const neighbour)
+{
+	const struct dgram_queue_t * const q = convergence_layer_dgram_find_queue(neighbour);
+
+	return (q != NULL) ? q->recv : NULL;
+}
+
+
+static void convergence_layer_dgram_index_bundle(struct transmit_ticket_t * const ticket)
+{
+	const uint16_t bucket = convergence_layer_dgram_hash(ticket->bundle_number);
+
+	ticket->next_bundle = bundle_index[bucket];
+	bundle_index[bucket] = ticket;
+}
+
+
+static void convergence_layer_dgram_unindex_bundle(struct transmit_ticket_t * const ticket)
+{
+	struct transmit_ticket_t ** p = NULL;
+
+	for( p = &bundle_index[convergence_layer_dgram_hash(ticket->bundle_number)];
+		 *p != NULL;
+		 p = &(*p)->next_bundle ) {
+		if( *p == ticket ) {
+			*p = ticket->next_bundle;
+			ticket->next_bundle = NULL;
+			return;
+		}
+	}
+}
+
+
+/**
+ * \brief Allocates a ticket
+ *
+ * The ticket is put into the queue of its neighbour, when it is enqueued.
+ * Tickets of the CL itself are queued by convergence_layer_dgram_queue_ticket().
+ */
 static struct transmit_ticket_t * convergence_layer_dgram_get_transmit_ticket_priority(uint8_t priority)
 {
 	struct transmit_ticket_t * ticket = NULL;
@@ -153,15 +424,6 @@ static struct transmit_ticket_t * convergence_layer_dgram_get_transmit_ticket_pr
 	/* Initialize the ticket */
 	memset(ticket, 0, sizeof(struct transmit_ticket_t));
 
-	/* Add it to our list */
-	if( priority == CONVERGENCE_LAYER_PRIORITY_NORMAL ) {
-		/* Append to list */
-		list_add(transmission_ticket_list, ticket);
-	} else {
-		/* Prepend to list */
-		list_push(transmission_ticket_list, ticket);
-	}
-
 	/* Count the used slots */
 	convergence_layer_slots++;
 
@@ -178,13 +440,16 @@ struct transmit_ticket_t * convergence_layer_dgram_get_transmit_ticket()
 
 int convergence_layer_dgram_free_transmit_ticket(struct transmit_ticket_t * ticket)
 {
+	/* Free the serializer of an outgoing bundle, while the bundle is still referenced */
+	bundle_cursor_free(&ticket->cursor);
+
 	/* Remove our reference to the bundle */
 	if( ticket->bundle != NULL ) {
 		bundle_decrement(ticket->bundle);
 		ticket->bundle = NULL;
 	}
 
-	/* Also free MMEM if it was allocate to serialize the bundle */
+	/* And the MMEM of an incoming multipart bundle */
 	if( ticket->buffer.ptr != NULL ) {
 		mmem_free(&ticket->buffer);
 		ticket->buffer.ptr = NULL;
@@ -200,8 +465,15 @@ int convergence_layer_dgram_free_transmit_ticket(struct transmit_ticket_t * tick
 	/* Count the used slots */
 	convergence_layer_slots--;
 
-	/* Remove ticket from list and free memory */
-	list_remove(transmission_ticket_list, ticket);
+	/* The lock of the neighbour must not refer to the ticket anymore */
+	struct blocked_neighbour_t * const blocked = convergence_layer_dgram_find_blocked(&ticket->neighbour);
+	if( blocked != NULL && blocked->ticket == ticket ) {
+		blocked->ticket = NULL;
+	}
+
+	/* Remove ticket from the queue and the index and free memory */
+	convergence_layer_dgram_dequeue_ticket(ticket);
+	convergence_layer_dgram_unindex_bundle(ticket);
 	memset(ticket, 0, sizeof(struct transmit_ticket_t));
 	memb_free(&transmission_ticket_mem, ticket);
 
@@ -220,6 +492,15 @@ int convergence_layer_dgram_enqueue_bundle(struct transmit_ticket_t * ticket)
 	cl_addr_string(&ticket->neighbour, addr_str, sizeof(addr_str));
 	LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Enqueuing bundle %lu to %s, queue is at %u entries", ticket->bundle_number, addr_str, convergence_layer_queue);
 
+	/* Put the ticket into the queue of its neighbour */
+	if( convergence_layer_dgram_queue_ticket(ticket, CONVERGENCE_LAYER_PRIORITY_NORMAL) < 0 ) {
+		return -1;
+	}
+
+	/* Index the ticket by its bundle number, only once, if it is enqueued again */
+	convergence_layer_dgram_unindex_bundle(ticket);
+	convergence_layer_dgram_index_bundle(ticket);
+
 	/* The ticket is now active a ready for transmission */
 	ticket->flags |= CONVERGENCE_LAYER_QUEUE_ACTIVE;
 
@@ -232,56 +513,331 @@ int convergence_layer_dgram_enqueue_bundle(struct transmit_ticket_t * ticket)
 }
 
 
-static int convergence_layer_dgram_encode_bundle(struct transmit_ticket_t* const ticket)
+void convergence_layer_dgram_set_window(const uint8_t window)
 {
-	LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Encoding bundle %lu", ticket->bundle_number);
+	if( window < 1 ) {
+		convergence_layer_window = 1;
+	} else if( window > CONVERGENCE_LAYER_WINDOW ) {
+		convergence_layer_window = CONVERGENCE_LAYER_WINDOW;
+	} else {
+		convergence_layer_window = window;
+	}
+}
 
-	/* Now allocate a buffer to serialize the bundle
-	 * The size is a rough estimation here and will be reallocated later on */
-	if(mmem_alloc(&ticket->buffer, ticket->bundle->size) < 1) {
-		LOG(LOGD_DTN, LOG_CL, LOGL_ERR, "Bundle %lu could not be encoded, not enough memory for %u bytes", ticket->bundle_number, ticket->bundle->size);
-		return -1;
+
+/**
+ * \brief Returns our receive window for a CL
+ *
+ * Selective repeat can only tell new segments from repeated ones,
+ * if the window covers at most half of the sequence number space.
+ * The window stays below half of it, so a stale ACK for the segment
+ * before the window cannot alias the ACK for a full window.
+ */
+static uint8_t convergence_layer_dgram_local_window(const struct convergence_layer* const clayer)
+{
+	uint8_t sequence_numbers = 1;
+	for( uint8_t seqno = clayer->next_seqno(0);
+		 seqno != 0 && sequence_numbers < UINT8_MAX;
+		 seqno = clayer->next_seqno(seqno) ) {
+		sequence_numbers++;
 	}
 
-	/* Encode the bundle into our temporary buffer */
-	const size_t length = bundle_encode_bundle(ticket->bundle, (uint8_t *) MMEM_PTR(&ticket->buffer), ticket->buffer.size);
+	const uint8_t window = ((sequence_numbers - 1) / 2 > 0) ? (sequence_numbers - 1) / 2 : 1;
+	return (window < convergence_layer_window) ? window : convergence_layer_window;
+}
 
-	if( length < 0 ) {
-		LOG(LOGD_DTN, LOG_CL, LOGL_ERR, "Bundle %lu could not be encoded, error occured", ticket->bundle_number);
-		mmem_free(&ticket->buffer);
-		ticket->buffer.ptr = NULL;
-		return -1;
+
+static struct dgram_neighbour_t * convergence_layer_dgram_find_neighbour(const cl_addr_t* const neighbour)
+{
+	struct dgram_neighbour_t * n = NULL;
+
+	for( n = list_head(neighbour_list);
+		 n != NULL;
+		 n = list_item_next(n) ) {
+		if( cl_addr_cmp(neighbour, &n->neighbour) ) {
+			return n;
+		}
 	}
 
-	/* Decrease memory size to what is actually needed */
-	if(mmem_realloc(&ticket->buffer, length) < 1) {
-		LOG(LOGD_DTN, LOG_CL, LOGL_ERR, "Bundle %lu could not be encoded, realloc failed", ticket->bundle_number);
-		mmem_free(&ticket->buffer);
-		ticket->buffer.ptr = NULL;
+	return NULL;
+}
+
+
+/**
+ * \brief Returns the entry of a neighbour and creates it, if he is unknown
+ */
+static struct dgram_neighbour_t * convergence_layer_dgram_get_neighbour(const cl_addr_t* const neighbour)
+{
+	struct dgram_neighbour_t * n = convergence_layer_dgram_find_neighbour(neighbour);
+	if( n != NULL ) {
+		return n;
+	}
+
+	n = memb_alloc(&neighbour_mem);
+	if( n == NULL ) {
+		/* Reuse the neighbour, we have learned about first */
+		n = list_pop(neighbour_list);
+	}
+
+	memset(n, 0, sizeof(struct dgram_neighbour_t));
+	cl_addr_copy(&n->neighbour, neighbour);
+	list_add(neighbour_list, n);
+
+	return n;
+}
+
+
+/**
+ * \brief Returns the number of segments, that may be in flight to a neighbour
+ */
+static uint8_t convergence_layer_dgram_get_window(const cl_addr_t* const neighbour)
+{
+	const struct dgram_neighbour_t* const n = convergence_layer_dgram_find_neighbour(neighbour);
+
+	/* Until the neighbour has advertised his window, we do stop-and-wait */
+	if( n == NULL || n->window < 1 ) {
+		return 1;
+	}
+
+	const uint8_t window = convergence_layer_dgram_local_window(neighbour->clayer);
+	return (n->window < window) ? n->window : window;
+}
+
+
+/**
+ * \brief Notes down the window from the options of an ACK
+ *
+ * ACKs without window option come from stop-and-wait peers like IBR-DTN.
+ * sack is set to the segments, that the peer has received after the acked one.
+ */
+static void convergence_layer_dgram_parse_options(const cl_addr_t* const source, const uint8_t* const payload, const size_t length,
+												  uint8_t* const sack)
+{
+	uint8_t window = 1;
+	*sack = 0;
+
+	for( size_t i = 0; i + 2 <= length; i += 2 + payload[i + 1] ) {
+		const uint8_t type = payload[i];
+		const uint8_t option_length = payload[i + 1];
+
+		if( i + 2 + option_length > length ) {
+			break;
+		}
+
+		if( type == CONVERGENCE_LAYER_OPTION_WINDOW && option_length >= 1 ) {
+			window = payload[i + 2];
+		} else if( type == CONVERGENCE_LAYER_OPTION_SACK && option_length >= 1 ) {
+			*sack = payload[i + 2];
+		}
+	}
+
+	struct dgram_neighbour_t * const n = convergence_layer_dgram_get_neighbour(source);
+	n->window = window;
+}
+
+
+/**
+ * \brief Returns how long we wait for an app-layer ACK from a neighbour
+ *
+ * The retransmission timeout is estimated from the round trip time like in TCP (RFC 6298)
+ * and doubled for every timeout, until the neighbour answers again.
+ */
+static TickType_t convergence_layer_dgram_get_timeout(const cl_addr_t* const neighbour)
+{
+	const struct dgram_neighbour_t* const n = convergence_layer_dgram_find_neighbour(neighbour);
+
+	TickType_t timeout = pdMS_TO_TICKS(CONVERGENCE_LAYER_TIMEOUT);
+	if( n != NULL && n->rtt_valid ) {
+		timeout = (n->srtt >> 3) + n->rttvar;
+	}
+
+	if( timeout < pdMS_TO_TICKS(CONVERGENCE_LAYER_MIN_TIMEOUT) ) {
+		timeout = pdMS_TO_TICKS(CONVERGENCE_LAYER_MIN_TIMEOUT);
+	}
+
+	for( uint8_t i = 0; n != NULL && i < n->backoff && timeout < pdMS_TO_TICKS(CONVERGENCE_LAYER_MAX_TIMEOUT); i++ ) {
+		timeout <<= 1;
+	}
+
+	if( timeout > pdMS_TO_TICKS(CONVERGENCE_LAYER_MAX_TIMEOUT) ) {
+		timeout = pdMS_TO_TICKS(CONVERGENCE_LAYER_MAX_TIMEOUT);
+	}
+
+	return timeout;
+}
+
+
+/**
+ * \brief Notes down, that a neighbour has acked a ticket
+ *
+ * If the timed segment is acked, its round trip time is taken into the estimation.
+ * Segments, that were sent again, are not timed (Karn's algorithm),
+ * because the ACK could be for any of the transmissions.
+ */
+static void convergence_layer_dgram_update_rtt(struct transmit_ticket_t* const ticket)
+{
+	struct dgram_neighbour_t* const n = convergence_layer_dgram_get_neighbour(&ticket->neighbour);
+
+	/* He answers again, so his timeout does not need to be backed off anymore */
+	n->backoff = 0;
+
+	if( !(ticket->flags & CONVERGENCE_LAYER_QUEUE_RTT) ) {
+		return;
+	}
+
+	if( (ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART) && ticket->offset_acked <= ticket->offset_rtt ) {
+		/* The timed segment is still in flight */
+		return;
+	}
+
+	ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_RTT;
+	const int32_t rtt = xTaskGetTickCount() - ticket->timestamp_rtt;
+
+	if( !n->rtt_valid ) {
+		/* First measurement */
+		n->srtt = rtt << 3;
+		n->rttvar = rtt << 1;
+		n->rtt_valid = true;
+	} else {
+		/* srtt += (rtt - srtt) / 8 and rttvar += (|rtt - srtt| - rttvar) / 4 */
+		int32_t delta = rtt - (n->srtt >> 3);
+		n->srtt += delta;
+		if( delta < 0 ) {
+			delta = -delta;
+		}
+		delta -= (n->rttvar >> 2);
+		n->rttvar += delta;
+	}
+
+	LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "RTT of bundle %lu is %ld ticks, SRTT %ld, RTTVAR %ld",
+		ticket->bundle_number, rtt, n->srtt >> 3, n->rttvar >> 2);
+}
+
+
+/**
+ * \brief Returns the number of segments of a multipart bundle, that have not been acked yet
+ */
+static int convergence_layer_dgram_segments_in_flight(const struct transmit_ticket_t* const ticket, const size_t max_payload_length)
+{
+	return (ticket->offset_sent - ticket->offset_acked + (max_payload_length - 1)) / max_payload_length;
+}
+
+
+/**
+ * \brief Returns the offset of the next segment, that the peer is missing, but a later one was received
+ *
+ * Holes before ticket->offset_retransmit were sent again already.
+ * \return offset of the hole or -1, if there is none
+ */
+static int convergence_layer_dgram_next_hole(const struct transmit_ticket_t* const ticket, const size_t max_payload_length)
+{
+	int offset = ticket->offset_acked;
+	uint8_t later = ticket->received;
+	bool received = false;
+
+	/* A segment is a hole, as long as a later one was received */
+	while( later != 0 ) {
+		if( !received && offset >= ticket->offset_retransmit ) {
+			return offset;
+		}
+
+		received = later & 0x01;
+		later >>= 1;
+		offset += max_payload_length;
+	}
+
+	return -1;
+}
+
+
+/**
+ * \brief Releases the bundle of an outgoing ticket together with its serializer
+ */
+static void convergence_layer_dgram_release_bundle(struct transmit_ticket_t* const ticket)
+{
+	bundle_cursor_free(&ticket->cursor);
+
+	if( ticket->bundle != NULL ) {
+		bundle_decrement(ticket->bundle);
+		ticket->bundle = NULL;
+	}
+}
+
+
+static int convergence_layer_dgram_encode_bundle(struct transmit_ticket_t* const ticket)
+{
+	LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Encoding bundle %lu", ticket->bundle_number);
+
+	/* Only the age extension block is encoded here, the encoded primary
+	 * block is cached by the bundle. The segments are read from the bundle
+	 * when they are sent.
+	 */
+	if( bundle_cursor_init(&ticket->cursor, ticket->bundle) < 0 ) {
+		LOG(LOGD_DTN, LOG_CL, LOGL_ERR, "Bundle %lu could not be encoded, not enough memory", ticket->bundle_number);
 		return -1;
 	}
 
 	/* Initialize the state for this bundle */
 	ticket->offset_sent = 0;
 	ticket->offset_acked = 0;
+	ticket->offset_retransmit = 0;
+	ticket->received = 0;
 
 	return 0;
 }
 
 
-static int convergence_layer_dgram_send_bundle(struct transmit_ticket_t* const ticket, const uint8_t flags,
-											   const uint8_t* const payload, const size_t length)
+/**
+ * \brief Takes back the segment, that the CL has not sent
+ */
+static void convergence_layer_dgram_segment_not_sent(struct transmit_ticket_t* const ticket)
+{
+	if( ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART ) {
+		if( ticket->offset_transit == ticket->offset_acked ) {
+			/* The oldest segment in flight has to be sent again */
+			ticket->flags |= CONVERGENCE_LAYER_QUEUE_RETRANSMIT;
+		} else if( ticket->offset_transit < ticket->offset_retransmit ) {
+			/* A hole was not sent again, try it once more */
+			ticket->offset_retransmit = ticket->offset_transit;
+		} else {
+			/* The newest segment has not left, send it again as a new one */
+			ticket->offset_sent = ticket->offset_transit;
+		}
+	}
+
+	/* The segment has to be timed again */
+	ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_RTT;
+
+	/* Unblock the neighbour, if there is nothing else in flight */
+	if( !(ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART) || ticket->offset_sent == ticket->offset_acked ) {
+		convergence_layer_dgram_set_unblocked(&ticket->neighbour);
+	}
+}
+
+
+static int convergence_layer_dgram_send_bundle(struct transmit_ticket_t* const ticket, const uint8_t sequence_number, const uint8_t flags,
+											   const size_t offset, const size_t length)
 {
 	/* Flag the bundle as being in transit now */
 	ticket->flags |= CONVERGENCE_LAYER_QUEUE_IN_TRANSIT;
+	ticket->offset_transit = offset;
 
 	/* This neighbour is blocked, until we have received the App Layer ACK or NACK */
-	convergence_layer_dgram_set_blocked(&ticket->neighbour);
+	convergence_layer_dgram_set_blocked(&ticket->neighbour, ticket);
 
-	const int ret = ticket->neighbour.clayer->send_bundle(&ticket->neighbour, ticket->sequence_number, flags, payload, length, ticket);
-	if (ret < 0) {
-		bundle_decrement(ticket->bundle);
-		ticket->bundle = NULL;
+	/* The CL reads the segment from the cursor straight into its frame */
+	bundle_cursor_seek(&ticket->cursor, offset);
+
+	const int ret = ticket->neighbour.clayer->send_bundle(&ticket->neighbour, sequence_number, flags, &ticket->cursor, length, ticket);
+	if (ret <= 0) {
+		/* The CL has not taken the segment, so there will be no status for it.
+		 * The ticket is sent again, when the process is polled the next time.
+		 */
+		ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_IN_TRANSIT;
+		convergence_layer_dgram_segment_not_sent(ticket);
+	}
+	if (ret < 0 && !(ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART)) {
+		convergence_layer_dgram_release_bundle(ticket);
 	}
 
 	return ret;
@@ -295,21 +851,26 @@ static int convergence_layer_dgram_prepare_segmentation(struct transmit_ticket_t
 	LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Sending bundle %lu to %s with ticket %p (flags 0x%x)",
 		ticket->bundle_number, addr_str, ticket, ticket->flags);
 
+	/* The segments of a multipart bundle are read from the bundle,
+	 * so it has to be sent again from the beginning, if it was released.
+	 */
+	if( (ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART) && ticket->bundle == NULL ) {
+		LOG(LOGD_DTN, LOG_CL, LOGL_WRN, "Bundle %lu was released during multipart transmission, starting over", ticket->bundle_number);
+		ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_MULTIPART;
+	}
+
 	/*
 	 * only execute for the first part of a bundle
 	 * not calling again for following parts,
 	 * because of segmentation
 	 */
 	if( !(ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART) ) {
-		/* free the buffer,
-		 * if sent failed and the encoded bundle is available.
+		/* free the cursor,
+		 * if sent failed and the bundle was already encoded.
 		 * Have to be encoded again,
 		 * because the aging block has possibly changed.
 		 */
-		if(MMEM_PTR(&ticket->buffer) != NULL) {
-			mmem_free(&ticket->buffer);
-			ticket->buffer.ptr = NULL;
-		}
+		bundle_cursor_free(&ticket->cursor);
 
 		/* Read the bundle from storage, if it is not in memory */
 		if( ticket->bundle == NULL ) {
@@ -341,7 +902,7 @@ static int convergence_layer_dgram_prepare_segmentation(struct transmit_ticket_t
 			LOG(LOGD_DTN, LOG_CL, LOGL_INF, "Bundle %lu has expired, not sending it", ticket->bundle_number);
 
 			/* Bundle is expired */
-			bundle_decrement(ticket->bundle);
+			convergence_layer_dgram_release_bundle(ticket);
 
 			/* Tell storage to delete - it will take care of the rest */
 			BUNDLE_STORAGE.del_bundle(ticket->bundle_number, REASON_LIFETIME_EXPIRED);
@@ -361,24 +922,21 @@ static int convergence_layer_dgram_prepare_segmentation(struct transmit_ticket_t
 
 
 	const size_t max_payload_length = ticket->neighbour.clayer->max_payload_length();
-	if( ticket->buffer.size > max_payload_length && !(ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART) ) {
-		LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Try to send bundle %lu as mutlipart bundle (buf %p, size %lu, flags 0x%x)",
-			ticket->bundle_number, ticket->buffer, ticket->buffer.size, ticket->flags);
+	if( ticket->cursor.length > max_payload_length && !(ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART) ) {
+		LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Try to send bundle %lu as mutlipart bundle (size %lu, flags 0x%x)",
+			ticket->bundle_number, ticket->cursor.length, ticket->flags);
 
 		/*
-		 * We do not need the original bundle anymore
-		 * It is already encoded to ticket->buffer.
-		 * The encoding was done by convergence_layer_dgram_encode_bundle().
-		 * The ticket can only be deleted,
-		 * if the first part of the bundle was send.
-		 * If trying to send the first part again,
-		 * the ageing check has to be repeated.
-		 */
-		bundle_decrement(ticket->bundle);
-		ticket->bundle = NULL;
+		 * The bundle is kept until the last segment is acked,
+		 * because the segments are read from it by ticket->cursor.
+		 * The age extension block has been encoded by
+		 * convergence_layer_dgram_encode_bundle(),
+		 * so the age stays the same for all segments.
+		 */
 
 		/* This is a bundle for multiple segments and we have our first look at it */
 		ticket->flags |= CONVERGENCE_LAYER_QUEUE_MULTIPART;
+		ticket->flags &= ~(CONVERGENCE_LAYER_QUEUE_RETRANSMIT | CONVERGENCE_LAYER_QUEUE_RECOVERY);
 
 		/* Initialize the state for this bundle */
 		ticket->sequence_number = outgoing_sequence_number;
@@ -386,7 +944,7 @@ static int convergence_layer_dgram_prepare_segmentation(struct transmit_ticket_t
 		/* Calculate the number of segments we will need.
 		 * In worst case the last byte will be send in an own segment.
 		 */
-		const size_t segments = ( ticket->buffer.size + (max_payload_length - 1) ) / max_payload_length;
+		const size_t segments = ( ticket->cursor.length + (max_payload_length - 1) ) / max_payload_length;
 
 		/* And reserve the sequence number space for this bundle to allow for consequtive numbers.
 		 * Subtract one because next_seqno() will add one again
@@ -396,64 +954,96 @@ static int convergence_layer_dgram_prepare_segmentation(struct transmit_ticket_t
 
 	/* Check if this is a multipart bundle */
 	if( ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART ) {
+		int offset = ticket->offset_sent;
+		int hole;
+
+		if( ticket->flags & CONVERGENCE_LAYER_QUEUE_RETRANSMIT ) {
+			/* Only the oldest segment, that was not acked, is sent again.
+			 * The peer keeps the segments after it and acks them together with it.
+			 * No new segments are sent, until all segments in flight are acked.
+			 */
+			offset = ticket->offset_acked;
+			ticket->offset_retransmit = offset + max_payload_length;
+			ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_RETRANSMIT;
+			ticket->flags |= CONVERGENCE_LAYER_QUEUE_RECOVERY;
+		} else if( (hole = convergence_layer_dgram_next_hole(ticket, max_payload_length)) >= 0 ) {
+			/* The peer has received later segments, so this one was lost */
+			offset = hole;
+			ticket->offset_retransmit = offset + max_payload_length;
+		} else if( (ticket->flags & CONVERGENCE_LAYER_QUEUE_RECOVERY) || offset >= ticket->cursor.length ||
+				   convergence_layer_dgram_segments_in_flight(ticket, max_payload_length) >= convergence_layer_dgram_get_window(&ticket->neighbour) ) {
+			/* The window is full, wait for the next ACK */
+			return 0;
+		}
+
 		/* Calculate the remaining length */
-		const size_t length = ticket->buffer.size - ticket->offset_acked;
+		const size_t length = ticket->cursor.length - offset;
 
 		/* Is it possible, that we send a single-part bundle here because the heuristic
 		 * from above failed. So be it.
 		 */
-		uint8_t flags = CONVERGENCE_LAYER_FLAGS_FIRST | CONVERGENCE_LAYER_FLAGS_LAST;
-		if( length <= max_payload_length && ticket->offset_acked == 0 ) {
-			/* One bundle per segment, standard flags */
-			flags = CONVERGENCE_LAYER_FLAGS_FIRST | CONVERGENCE_LAYER_FLAGS_LAST;
-		} else if( ticket->offset_acked == 0 ) {
+		uint8_t flags = 0;
+		if( offset == 0 ) {
 			/* First segment of a bundle */
-			flags = CONVERGENCE_LAYER_FLAGS_FIRST;
-		} else if( length <= max_payload_length ) {
+			flags |= CONVERGENCE_LAYER_FLAGS_FIRST;
+		}
+		if( length <= max_payload_length ) {
 			/* Last segment of a bundle */
-			flags = CONVERGENCE_LAYER_FLAGS_LAST;
-		} else {
-			/* A segment in the middle of a bundle */
-			flags = 0;
+			flags |= CONVERGENCE_LAYER_FLAGS_LAST;
+		}
+		if( convergence_layer_dgram_get_window(&ticket->neighbour) > 1 ) {
+			/* The peer may ack several segments with one SACK */
+			flags |= CONVERGENCE_LAYER_FLAGS_WINDOW;
 		}
 
 		/* one byte for the CL header */
 		const size_t length_to_sent = (length > max_payload_length) ? max_payload_length : length;
 
-		/* only increment the sequence number, if all packages before were successfully acknowledged */
-		if( ticket->offset_sent == ticket->offset_acked ) {
-			/* Increment the sequence number for the new segment, except for the first segment */
-			if( ticket->offset_sent > 0 ) {
-				ticket->sequence_number = ticket->neighbour.clayer->next_seqno(ticket->sequence_number);
-			}
+		/* ticket->sequence_number belongs to the oldest segment, that was not acked */
+		uint8_t sequence_number = ticket->sequence_number;
+		for( int o = ticket->offset_acked; o < offset; o += max_payload_length ) {
+			sequence_number = ticket->neighbour.clayer->next_seqno(sequence_number);
 		}
 
-		const uint8_t* const buffer = ((uint8_t*) MMEM_PTR(&ticket->buffer)) + ticket->offset_acked;
-		const int ret = convergence_layer_dgram_send_bundle(ticket, flags, buffer, length_to_sent);
-
-		/* Every segment so far has been acked */
-		if( ticket->offset_sent == ticket->offset_acked ) {
-			/* It is the first time that we are sending this segment */
+		/* It is the first time that we are sending this segment */
+		if( offset == ticket->offset_sent ) {
 			ticket->offset_sent += length_to_sent;
+
+			/* Time one segment at once */
+			if( !(ticket->flags & CONVERGENCE_LAYER_QUEUE_RTT) ) {
+				ticket->flags |= CONVERGENCE_LAYER_QUEUE_RTT;
+				ticket->offset_rtt = offset;
+				ticket->timestamp_rtt = xTaskGetTickCount();
+			}
+		} else {
+			/* The following ACKs could be for the retransmission */
+			ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_RTT;
 		}
 
-		return ret;
+		return convergence_layer_dgram_send_bundle(ticket, sequence_number, flags, offset, length_to_sent);
 	} else {
 
 		/* Initialize the sequence number */
 		ticket->sequence_number = outgoing_sequence_number;
 		outgoing_sequence_number = ticket->neighbour.clayer->next_seqno(outgoing_sequence_number);
 
+		/* Only the first transmission is timed */
+		if( ticket->tries == 0 ) {
+			ticket->flags |= CONVERGENCE_LAYER_QUEUE_RTT;
+			ticket->timestamp_rtt = xTaskGetTickCount();
+		} else {
+			ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_RTT;
+		}
+
 		/* One bundle per segment, standard flags */
 		const uint8_t flags = CONVERGENCE_LAYER_FLAGS_FIRST | CONVERGENCE_LAYER_FLAGS_LAST;
-		const uint8_t* const buffer = ((uint8_t*) MMEM_PTR(&ticket->buffer));
-		return convergence_layer_dgram_send_bundle(ticket, flags, buffer, ticket->buffer.size);
+		return convergence_layer_dgram_send_bundle(ticket, ticket->sequence_number, flags, 0, ticket->cursor.length);
 	}
 }
 
 
 static int convergence_layer_dgram_send_ack(const cl_addr_t* const destination, const uint8_t sequence_number, const uint8_t type,
-							   struct transmit_ticket_t* const ticket)
+							   const uint8_t received, struct transmit_ticket_t* const ticket)
 {
 	char addr_str[CL_ADDR_STRING_LENGTH];
 	cl_addr_string(destination, addr_str, sizeof(addr_str));
@@ -462,7 +1052,23 @@ static int convergence_layer_dgram_send_ack(const cl_addr_t* const destination,
 	/* Note down our latest attempt */
 	ticket->timestamp = xTaskGetTickCount();
 
-	const int ret = destination->clayer->send_ack(destination, sequence_number, type, ticket);
+	/* Advertise our receive window in every ACK */
+	uint8_t options[6];
+	size_t options_length = 0;
+	if( type == CONVERGENCE_LAYER_TYPE_ACK ) {
+		options[options_length++] = CONVERGENCE_LAYER_OPTION_WINDOW;
+		options[options_length++] = 1;
+		options[options_length++] = convergence_layer_dgram_local_window(destination->clayer);
+	}
+
+	/* Segments received out of order turn the ACK into a SACK */
+	if( type == CONVERGENCE_LAYER_TYPE_ACK && received != 0 ) {
+		options[options_length++] = CONVERGENCE_LAYER_OPTION_SACK;
+		options[options_length++] = 1;
+		options[options_length++] = received;
+	}
+
+	const int ret = destination->clayer->send_ack(destination, sequence_number, type, options, options_length, ticket);
 	if (ret == 0) {
 		/* ack was not send, becasue of an busy radio */
 		/* This ticket has to be processed ASAP, so set timestamp to 0 */
@@ -474,17 +1080,59 @@ static int convergence_layer_dgram_send_ack(const cl_addr_t* const destination,
 }
 
 
-static int convergence_layer_dgram_create_send_ack(const cl_addr_t* const destination, const uint8_t sequence_number, const uint8_t type)
+/**
+ * \brief Drops the pending ACKs and NACKs to a neighbour
+ *
+ * Only the newest ACK may be retransmitted. An older one would ack
+ * segments, that the neighbour has sent again in the meantime.
+ */
+static void convergence_layer_dgram_drop_acks(const cl_addr_t* const destination)
+{
+	struct dgram_queue_t * const q = convergence_layer_dgram_find_queue(destination);
+	struct transmit_ticket_t * ticket = NULL;
+	struct transmit_ticket_t * next = NULL;
+
+	if( q == NULL ) {
+		return;
+	}
+
+	for( ticket = list_head(q->tickets);
+		 ticket != NULL;
+		 ticket = next ) {
+		next = list_item_next(ticket);
+
+		if( !(ticket->flags & CONVERGENCE_LAYER_QUEUE_ACK) && !(ticket->flags & CONVERGENCE_LAYER_QUEUE_NACK) && !(ticket->flags & CONVERGENCE_LAYER_QUEUE_TEMP_NACK) ) {
+			continue;
+		}
+
+		if( ticket->flags & CONVERGENCE_LAYER_QUEUE_IN_TRANSIT ) {
+			/* The MAC callback still refers to the ticket, so it is freed there instead of being retried */
+			ticket->tries = CONVERGENCE_LAYER_RETRANSMIT_TRIES;
+			continue;
+		}
+
+		convergence_layer_dgram_free_transmit_ticket(ticket);
+	}
+}
+
+
+static int convergence_layer_dgram_create_send_ack(const cl_addr_t* const destination, const uint8_t sequence_number, const uint8_t type,
+												   const uint8_t received)
 {
 	struct transmit_ticket_t * ticket = NULL;
 
+	/* The new ACK replaces the older ones */
+	convergence_layer_dgram_drop_acks(destination);
+
 	/* We have to keep track of the outgoing packet, because we have to be able to retransmit */
 	ticket = convergence_layer_dgram_get_transmit_ticket_priority(CONVERGENCE_LAYER_PRIORITY_HIGH);
 	if( ticket == NULL ) {
 		LOG(LOGD_DTN, LOG_CL, LOGL_WRN, "Unable to allocate ticket to potentially retransmit ACK/NACK");
 	} else {
 		cl_addr_copy(&ticket->neighbour, destination);
+		convergence_layer_dgram_queue_ticket(ticket, CONVERGENCE_LAYER_PRIORITY_HIGH);
 		ticket->sequence_number = sequence_number;
+		ticket->received = received;
 		ticket->flags |= CONVERGENCE_LAYER_QUEUE_IN_TRANSIT;
 
 		if( type == CONVERGENCE_LAYER_TYPE_ACK ) {
@@ -496,7 +1144,7 @@ static int convergence_layer_dgram_create_send_ack(const cl_addr_t* const destin
 		}
 	}
 
-	return convergence_layer_dgram_send_ack(destination, sequence_number, type, ticket);
+	return convergence_layer_dgram_send_ack(destination, sequence_number, type, received, ticket);
 }
 
 
@@ -508,7 +1156,11 @@ static int convergence_layer_dgram_resend_ack(struct transmit_ticket_t * ticket)
 	}
 
 	/* Check for the retransmission timer */
-	if( (xTaskGetTickCount() - ticket->timestamp) < pdMS_TO_TICKS(CONVERGENCE_LAYER_RETRANSMIT_TIMEOUT) ) {
+	const struct dgram_neighbour_t* const n = convergence_layer_dgram_find_neighbour(&ticket->neighbour);
+	const TickType_t timeout = (n != NULL && n->rtt_valid) ?
+			convergence_layer_dgram_get_timeout(&ticket->neighbour) / CONVERGENCE_LAYER_RETRANSMIT_TRIES :
+			pdMS_TO_TICKS(CONVERGENCE_LAYER_RETRANSMIT_TIMEOUT);
+	if( (xTaskGetTickCount() - ticket->timestamp) < timeout ) {
 		return 0;
 	}
 
@@ -525,19 +1177,27 @@ static int convergence_layer_dgram_resend_ack(struct transmit_ticket_t * ticket)
 		return 0;
 	}
 
-	convergence_layer_dgram_send_ack(&ticket->neighbour, ticket->sequence_number, type, ticket);
+	convergence_layer_dgram_send_ack(&ticket->neighbour, ticket->sequence_number, type, ticket->received, ticket);
 
 	return 1;
 }
 
 /**
  * Return values:
+ *  2 = SUCCESS, the SACK is sent later by the process
  *  1 = SUCCESS
+ *  0 = Repeated segment
  * -1 = Temporary error
  * -2 = Permanent error
+ * -3 = Segment discarded, no reply
+ *
+ * ack_sequence_number is set to the sequence number of the next segment, that we expect
+ * and ack_received to the segments after it, that we have received already.
+ * If delay_ack is set, the sender has a window and the ACK may be sent for several segments.
  */
 static int convergence_layer_dgram_parse_dataframe(const cl_addr_t* const source, const uint8_t* payload, const size_t payload_length,
-											 const uint8_t flags, const uint8_t sequence_number, const packetbuf_attr_t rssi)
+											 const uint8_t flags, const uint8_t sequence_number, const packetbuf_attr_t rssi,
+											 const bool delay_ack, uint8_t* const ack_sequence_number, uint8_t* const ack_received)
 {
 	struct mmem * bundlemem = NULL;
 	struct bundle_t * bundle = NULL;
@@ -548,6 +1208,10 @@ static int convergence_layer_dgram_parse_dataframe(const cl_addr_t* const source
 	/* Note down the payload length */
 	size_t length = payload_length;
 
+	/* Acknowledge the segment itself, if nothing else is known */
+	*ack_sequence_number = source->clayer->next_seqno(sequence_number);
+	*ack_received = 0;
+
 	if( flags != (CONVERGENCE_LAYER_FLAGS_FIRST | CONVERGENCE_LAYER_FLAGS_LAST ) ) {
 		/* We have a multipart bundle here */
 
@@ -558,12 +1222,18 @@ static int convergence_layer_dgram_parse_dataframe(const cl_addr_t* const source
 
 		if( flags == CONVERGENCE_LAYER_FLAGS_FIRST ) {
 			/* Beginning of a new bundle from a peer, remove old tickets */
-			for( ticket = list_head(transmission_ticket_list);
-				 ticket != NULL;
-				 ticket = list_item_next(ticket) ) {
-				if( cl_addr_cmp(&ticket->neighbour, source) && (ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART_RECV) ) {
-					break;
-				}
+			ticket = convergence_layer_dgram_find_recv_ticket(source);
+
+			/* The sender repeats the first segment, if our ACK for it was lost.
+			 * Keep the segments, that we have already, and send the current ACK again.
+			 */
+			if( ticket != NULL && ticket->first_sequence_number == sequence_number && ticket->segment_length == length &&
+				memcmp(MMEM_PTR(&ticket->buffer), payload, length) == 0 ) {
+				*ack_sequence_number = source->clayer->next_seqno(ticket->sequence_number);
+				*ack_received = ticket->received;
+				ticket->unacked = 0;
+				ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_SACK_DELAYED;
+				return 0;
 			}
 
 			/* We found a ticket, remove it */
@@ -586,8 +1256,15 @@ static int convergence_layer_dgram_parse_dataframe(const cl_addr_t* const source
 			/* Fill the fields of the ticket */
 			cl_addr_copy(&ticket->neighbour, source);
 			ticket->flags = CONVERGENCE_LAYER_QUEUE_MULTIPART_RECV;
+			if( convergence_layer_dgram_queue_ticket(ticket, CONVERGENCE_LAYER_PRIORITY_HIGH) < 0 ) {
+				convergence_layer_dgram_free_transmit_ticket(ticket);
+				return -1;
+			}
 			ticket->timestamp = xTaskGetTickCount();
 			ticket->sequence_number = sequence_number;
+			ticket->first_sequence_number = sequence_number;
+			ticket->segment_length = length;
+			ticket->offset_acked = length;
 			last_multipart_seqno = sequence_number;
 
 			/* Now allocate some memory */
@@ -607,21 +1284,19 @@ static int convergence_layer_dgram_parse_dataframe(const cl_addr_t* const source
 			return 1;
 		} else {
 			/* Either the middle of the end of a bundle, go look for the ticket */
-			for( ticket = list_head(transmission_ticket_list);
-				 ticket != NULL;
-				 ticket = list_item_next(ticket) ) {
-				if( cl_addr_cmp(&ticket->neighbour, source) && (ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART_RECV) ) {
-					break;
-				}
-			}
+			ticket = convergence_layer_dgram_find_recv_ticket(source);
 
 			/* Cannot find a ticket, discard segment */
 			if( ticket == NULL ) {
 				if (last_multipart_seqno != sequence_number) {
+					/* Possibly the first segment was lost and the sender has
+					 * sent the following segments of its window, so do not NACK.
+					 * The sender will send the first segment again.
+					 */
 					char addr_str[CL_ADDR_STRING_LENGTH];
 					cl_addr_string(source, addr_str, sizeof(addr_str));
 					LOG(LOGD_DTN, LOG_CL, LOGL_WRN, "Segment from peer %s does not match any bundles in progress, discarding", addr_str);
-					return -1;
+					return -3;
 				} else {
 					/* This segment was resend,
 					 * beacuse possibly the ACK was not received vital by the other node.
@@ -634,8 +1309,21 @@ static int convergence_layer_dgram_parse_dataframe(const cl_addr_t* const source
 				}
 			}
 
+			/* All segments before the next one are acked, even if this one is discarded */
 			const uint8_t reqested_seqno = source->clayer->next_seqno(ticket->sequence_number);
-			if( sequence_number != reqested_seqno ) {
+			*ack_sequence_number = reqested_seqno;
+			*ack_received = ticket->received;
+
+			/* Find the position of the segment in our window */
+			const uint8_t window = convergence_layer_dgram_local_window(source->clayer);
+			uint8_t distance = 0;
+			for( uint8_t seqno = reqested_seqno;
+				 seqno != sequence_number && distance < window;
+				 seqno = source->clayer->next_seqno(seqno) ) {
+				distance++;
+			}
+
+			if( distance >= window ) {
 				char addr_str[CL_ADDR_STRING_LENGTH];
 				cl_addr_string(source, addr_str, sizeof(addr_str));
 				LOG(LOGD_DTN, LOG_CL, LOGL_WRN, "Segment from peer %s is out of sequence. Recv %u, Exp %u",
@@ -643,30 +1331,98 @@ static int convergence_layer_dgram_parse_dataframe(const cl_addr_t* const source
 				return 1;
 			}
 
-			/* Store the last received and valid sequence number */
-			ticket->sequence_number = sequence_number;
-			last_multipart_seqno = sequence_number;
+			const uint8_t received_bit = (distance > 0) ? (1 << (distance - 1)) : 0;
+			if( ticket->received & received_bit ) {
+				/* We already have this segment */
+				return 1;
+			}
+
+			/* The segments after a gap are placed by the size of the first segment,
+			 * only the last segment of a bundle may be shorter
+			 */
+			if( distance > 0 && length != ticket->segment_length && !(flags & CONVERGENCE_LAYER_FLAGS_LAST) ) {
+				char addr_str[CL_ADDR_STRING_LENGTH];
+				cl_addr_string(source, addr_str, sizeof(addr_str));
+				LOG(LOGD_DTN, LOG_CL, LOGL_WRN, "Segment from peer %s has an unexpected length of %u bytes, discarding", addr_str, length);
+				return 1;
+			}
 
-			/* Note down the old length to know where to start */
-			n = ticket->buffer.size;
+			const size_t offset = ticket->offset_acked + distance * ticket->segment_length;
+
+			/* Nothing may follow the last segment */
+			if( ((ticket->flags & CONVERGENCE_LAYER_QUEUE_LAST_RECV) && offset + length > ticket->buffer.size) ||
+				((flags & CONVERGENCE_LAYER_FLAGS_LAST) && offset + length < ticket->buffer.size) ) {
+				char addr_str[CL_ADDR_STRING_LENGTH];
+				cl_addr_string(source, addr_str, sizeof(addr_str));
+				LOG(LOGD_DTN, LOG_CL, LOGL_WRN, "Segment from peer %s is behind the end of the bundle, discarding", addr_str);
+				return 1;
+			}
 
 			/* Allocate more memory */
-			ret = mmem_realloc(&ticket->buffer, ticket->buffer.size + length);
+			if( offset + length > ticket->buffer.size ) {
+				ret = mmem_realloc(&ticket->buffer, offset + length);
 
-			if( ret < 1 ) {
-				LOG(LOGD_DTN, LOG_CL, LOGL_ERR, "Unable to re-allocate multipart receive buffer of %u bytes", ticket->buffer.size + length);
-				convergence_layer_dgram_free_transmit_ticket(ticket);
-				return -1;
+				if( ret < 1 ) {
+					LOG(LOGD_DTN, LOG_CL, LOGL_ERR, "Unable to re-allocate multipart receive buffer of %u bytes", offset + length);
+					convergence_layer_dgram_free_transmit_ticket(ticket);
+					return -1;
+				}
 			}
 
 			/* Update timestamp to avoid the ticket from timing out */
 			ticket->timestamp = xTaskGetTickCount();
 
-			/* And append the payload */
-			memcpy(((uint8_t *) MMEM_PTR(&ticket->buffer)) + n, payload, length);
+			/* And put the payload in its place */
+			memcpy(((uint8_t *) MMEM_PTR(&ticket->buffer)) + offset, payload, length);
+
+			if( flags & CONVERGENCE_LAYER_FLAGS_LAST ) {
+				ticket->flags |= CONVERGENCE_LAYER_QUEUE_LAST_RECV;
+			}
+
+			if( distance > 0 ) {
+				/* Keep the segment, until the gap before it is closed */
+				ticket->received |= received_bit;
+				*ack_received = ticket->received;
+				return 1;
+			}
+
+			/* Segments after a gap are acked at once, so the sender learns about the gap */
+			const bool gap = (ticket->received != 0);
+
+			/* Store the last received and valid sequence number */
+			ticket->sequence_number = sequence_number;
+			ticket->offset_acked += length;
+
+			/* Take over the segments, that were received out of order and follow now */
+			while( ticket->received & 0x01 ) {
+				ticket->received >>= 1;
+				ticket->sequence_number = source->clayer->next_seqno(ticket->sequence_number);
+
+				const size_t remaining = ticket->buffer.size - ticket->offset_acked;
+				ticket->offset_acked += (remaining < ticket->segment_length) ? remaining : ticket->segment_length;
+			}
+			ticket->received >>= 1;
+
+			last_multipart_seqno = ticket->sequence_number;
+			*ack_sequence_number = source->clayer->next_seqno(ticket->sequence_number);
+			*ack_received = ticket->received;
+
+			/* Ack only every CONVERGENCE_LAYER_SACK_SEGMENTS segment,
+			 * the process sends the SACK, if no further segment arrives in time
+			 */
+			if( delay_ack && !gap && !(flags & CONVERGENCE_LAYER_FLAGS_LAST) &&
+				++ticket->unacked < CONVERGENCE_LAYER_SACK_SEGMENTS ) {
+				ticket->flags |= CONVERGENCE_LAYER_QUEUE_SACK_DELAYED;
+				convergence_layer_sack_pending = true;
+				xSemaphoreGive(transmit_reqest_sem);
+				return 2;
+			}
+
+			ticket->unacked = 0;
+			ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_SACK_DELAYED;
 		}
 
-		if( flags & CONVERGENCE_LAYER_FLAGS_LAST ) {
+		if( (ticket->flags & CONVERGENCE_LAYER_QUEUE_LAST_RECV) && ticket->offset_acked >= ticket->buffer.size ) {
 			/* We have the last segment, change pointer so that the rest of the function works as planned */
 			payload = (uint8_t *) MMEM_PTR(&ticket->buffer);
 			length = ticket->buffer.size;
@@ -681,12 +1437,17 @@ static int convergence_layer_dgram_parse_dataframe(const cl_addr_t* const source
 	}
 
 	/* Allocate memory, parse the bundle and set reference counter to 1 */
-	bundlemem = bundle_recover_bundle((uint8_t*)payload, length);
-
-	/* We do not need the ticket anymore if there was one, deallocate it */
 	if( ticket != NULL ) {
+		/* The payload block takes over the reassembly buffer,
+		 * so the bundle does not need a second allocation of the same size
+		 */
+		bundlemem = bundle_recover_bundle_mmem(&ticket->buffer);
+
+		/* We do not need the ticket anymore, deallocate it */
 		convergence_layer_dgram_free_transmit_ticket(ticket);
 		ticket = NULL;
+	} else {
+		bundlemem = bundle_recover_bundle((uint8_t*)payload, length);
 	}
 
 	if( !bundlemem ) {
@@ -750,9 +1511,12 @@ int convergence_layer_dgram_parse_ackframe(const cl_addr_t* const source, const
 {
 	struct transmit_ticket_t * ticket = NULL;
 	struct bundle_t * bundle = NULL;
+	uint8_t sack = 0;
 
-	/* This neighbour is now unblocked */
-	convergence_layer_dgram_set_unblocked(source);
+	/* Note down the window, that the neighbour advertises */
+	if( type == CONVERGENCE_LAYER_TYPE_ACK ) {
+		convergence_layer_dgram_parse_options(source, payload, length, &sack);
+	}
 
 	/* Poll the process to initiate transmission of the next bundle */
 	LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Resume sending task because of ack (seq %u flags 0x%x)", sequence_number, flags);
@@ -762,16 +1526,12 @@ int convergence_layer_dgram_parse_ackframe(const cl_addr_t* const source, const
 	cl_addr_string(source, addr_str, sizeof(addr_str));
 	LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Incoming ACK from %s with SeqNo %u", addr_str, sequence_number);
 
-	for(ticket = list_head(transmission_ticket_list);
-		ticket != NULL;
-		ticket = list_item_next(ticket) ) {
-		if( cl_addr_cmp(source, &ticket->neighbour) && (ticket->flags & CONVERGENCE_LAYER_QUEUE_ACK_PEND) ) {
-			break;
-		}
-	}
+	ticket = convergence_layer_dgram_find_ticket(source, CONVERGENCE_LAYER_QUEUE_ACK_PEND);
 
 	/* Unable to find that bundle */
 	if( ticket == NULL ) {
+		/* This neighbour is now unblocked */
+		convergence_layer_dgram_set_unblocked(source);
 		return -1;
 	}
 
@@ -788,39 +1548,94 @@ int convergence_layer_dgram_parse_ackframe(const cl_addr_t* const source, const
 	/* TODO: Handle temporary NACKs separately here */
 	if( type == CONVERGENCE_LAYER_TYPE_ACK ) {
 		if( ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART ) {
-			const uint8_t reqested_seq_no = source->clayer->next_seqno(ticket->sequence_number);
-			if(sequence_number == reqested_seq_no) {
+			const size_t max_payload_length = source->clayer->max_payload_length();
+
+			/* The ACK carries the sequence number of the next segment, that the peer expects.
+			 * So all segments in flight before that one are acked.
+			 */
+			int offset = ticket->offset_acked;
+			uint8_t reqested_seq_no = ticket->sequence_number;
+			bool acked = false;
+			while( offset < ticket->offset_sent && !acked ) {
+				offset += max_payload_length;
+				reqested_seq_no = source->clayer->next_seqno(reqested_seq_no);
+				acked = (sequence_number == reqested_seq_no);
+			}
+
+			if( acked ) {
 				// ACK received
-				ticket->offset_acked = ticket->offset_sent;
+				ticket->offset_acked = (offset < ticket->cursor.length) ? offset : ticket->cursor.length;
+				ticket->sequence_number = sequence_number;
+				convergence_layer_dgram_update_rtt(ticket);
 
-				if( ticket->offset_acked >= ticket->buffer.size ) {
+				if( ticket->offset_acked >= ticket->cursor.length ) {
 					/* Last segment, we are done */
 					LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Last Segment of bundle %lu acked, done", ticket->bundle_number);
 				} else {
 					/* There are more segments, keep on sending */
 					LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "One Segment of bundle %lu acked, more to come (sent %lu, acked %lu, size %lu)",
-						ticket->bundle_number, ticket->offset_sent, ticket->offset_acked, ticket->buffer.size);
+						ticket->bundle_number, ticket->offset_sent, ticket->offset_acked, ticket->cursor.length);
 
 					/* reset failed counters, becasue the next part of the bundle was received vital */
 					ticket->tries = 0;
 					ticket->failed_tries = 0;
+					ticket->timeouts = 0;
+
+					/* Restart the timer of the neighbour */
+					convergence_layer_dgram_set_unblocked(source);
+
+					/* The SACK is relative to the new oldest segment in flight,
+					 * only keep the bits of segments, that were sent
+					 */
+					const int in_flight = convergence_layer_dgram_segments_in_flight(ticket, max_payload_length);
+					ticket->received = (in_flight > 1) ? (sack & ((1 << (in_flight - 1)) - 1)) : 0;
+
+					if( ticket->offset_acked < ticket->offset_sent ) {
+						/* Segments are still in flight, so the neighbour stays ours */
+						convergence_layer_dgram_set_blocked(source, ticket);
+
+						/* While recovering, an ACK for some of the segments in flight
+						 * shows the next segment, that the peer is missing
+						 */
+						if( ticket->flags & CONVERGENCE_LAYER_QUEUE_RECOVERY ) {
+							ticket->flags |= CONVERGENCE_LAYER_QUEUE_RETRANSMIT;
+						}
+					} else {
+						ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_RECOVERY;
+					}
 
 					return 1;
 				}
 			} else {
-				/* Duplicate or out of sequence ACK, ignore it */
+				/* Duplicate or out of sequence ACK */
 				LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Duplicate ACK for bundle %lu received (seqno %u req seqno %u)",
-					ticket->bundle_number, sequence_number, reqested_seq_no);
+					ticket->bundle_number, sequence_number, source->clayer->next_seqno(ticket->sequence_number));
+
+				/* A SACK for the oldest segment in flight tells us the holes */
+				if( sequence_number == ticket->sequence_number ) {
+					const int in_flight = convergence_layer_dgram_segments_in_flight(ticket, max_payload_length);
+					ticket->received |= (in_flight > 1) ? (sack & ((1 << (in_flight - 1)) - 1)) : 0;
+				}
 				return 1;
 			}
 		}
 
+		/* This neighbour is now unblocked */
+		convergence_layer_dgram_set_unblocked(source);
+
+		if( !(ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART) ) {
+			convergence_layer_dgram_update_rtt(ticket);
+		}
+
 		/* Bundle has been ACKed and is now done */
 		ticket->flags = CONVERGENCE_LAYER_QUEUE_DONE;
 
 		/* Notify routing module */
 		ROUTING.sent(ticket, ROUTING_STATUS_OK);
 	} else if( type == CONVERGENCE_LAYER_TYPE_NACK ) {
+		/* This neighbour is now unblocked */
+		convergence_layer_dgram_set_unblocked(source);
+
 		/* Bundle has been NACKed and is now done */
 		ticket->flags = CONVERGENCE_LAYER_QUEUE_FAIL;
 
@@ -835,10 +1650,7 @@ int convergence_layer_dgram_parse_ackframe(const cl_addr_t* const source, const
 	}
 
 	/* We can free the bundle memory */
-	if( ticket->bundle != NULL ) {
-		bundle_decrement(ticket->bundle);
-		ticket->bundle = NULL;
-	}
+	convergence_layer_dgram_release_bundle(ticket);
 
 	return 1;
 }
@@ -852,17 +1664,23 @@ int convergence_layer_dgram_incoming_data(const cl_addr_t* const source, const u
 	LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Incoming data frame from %s with SeqNo %u and Flags %02X", addr_str, sequence_number, flags);
 
 	/* Parse the incoming data frame */
-	const int ret = convergence_layer_dgram_parse_dataframe(source, data_pointer, data_length, flags, sequence_number, rssi);
-
-	if( ret >= 0 ) {
+	uint8_t ack_sequence_number = 0;
+	uint8_t ack_received = 0;
+	const bool delay_ack = (flags & CONVERGENCE_LAYER_FLAGS_WINDOW) != 0;
+	const int ret = convergence_layer_dgram_parse_dataframe(source, data_pointer, data_length, flags & ~CONVERGENCE_LAYER_FLAGS_WINDOW,
+															sequence_number, rssi, delay_ack, &ack_sequence_number, &ack_received);
+
+	if( ret == 2 ) {
+		/* The SACK is delayed */
+	} else if( ret >= 0 ) {
 		/* Send ACK */
-		convergence_layer_dgram_create_send_ack(source, sequence_number + 1, CONVERGENCE_LAYER_TYPE_ACK);
+		convergence_layer_dgram_create_send_ack(source, ack_sequence_number, CONVERGENCE_LAYER_TYPE_ACK, ack_received);
 	} else if( ret == -1 ) {
 		/* Send temporary NACK */
-		convergence_layer_dgram_create_send_ack(source, sequence_number + 1, CONVERGENCE_LAYER_TYPE_TEMP_NACK);
+		convergence_layer_dgram_create_send_ack(source, ack_sequence_number, CONVERGENCE_LAYER_TYPE_TEMP_NACK, 0);
 	} else if( ret == -2 ) {
 		/* Send permanent NACK */
-		convergence_layer_dgram_create_send_ack(source, sequence_number + 1, CONVERGENCE_LAYER_TYPE_NACK);
+		convergence_layer_dgram_create_send_ack(source, ack_sequence_number, CONVERGENCE_LAYER_TYPE_NACK, 0);
 	} else {
 		/* FAIL */
 	}
@@ -942,10 +1760,11 @@ int convergence_layer_dgram_status(const void* const pointer, const uint8_t outc
 
 		LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "LL Ack received, waiting for App-layer ACK with SeqNo %u", ticket->sequence_number);
 
-		/* It is unlikely that we have to retransmit this bundle, so free up memory */
-		if( ticket->bundle != NULL ) {
-			bundle_decrement(ticket->bundle);
-			ticket->bundle = NULL;
+		/* It is unlikely that we have to retransmit this bundle, so free up memory.
+		 * Multipart bundles are needed for the following segments.
+		 */
+		if( !(ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART) ) {
+			convergence_layer_dgram_release_bundle(ticket);
 		}
 
 		return 1;
@@ -962,8 +1781,8 @@ int convergence_layer_dgram_status(const void* const pointer, const uint8_t outc
 		return 1;
 	}
 
-	/* Something went wrong, unblock the neighbour */
-	convergence_layer_dgram_set_unblocked(&ticket->neighbour);
+	/* Something went wrong, take the segment back */
+	convergence_layer_dgram_segment_not_sent(ticket);
 
 	/* Bundle did not get an ACK, increase try counter */
 	if( outcome == CONVERGENCE_LAYER_STATUS_NOACK ) {
@@ -980,10 +1799,7 @@ int convergence_layer_dgram_status(const void* const pointer, const uint8_t outc
 		ROUTING.sent(ticket, ROUTING_STATUS_FAIL);
 
 		/* We can already free the bundle memory */
-		if( ticket->bundle != NULL ) {
-			bundle_decrement(ticket->bundle);
-			ticket->bundle = NULL;
-		}
+		convergence_layer_dgram_release_bundle(ticket);
 
 		return 1;
 	}
@@ -997,38 +1813,33 @@ int convergence_layer_dgram_status(const void* const pointer, const uint8_t outc
 int convergence_layer_dgram_delete_bundle(uint32_t bundle_number)
 {
 	struct transmit_ticket_t * ticket = NULL;
-	int changed = 1;
+	struct transmit_ticket_t * next = NULL;
+	int ret = -1;
 
 	LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Deleting tickets for bundle %lu", bundle_number);
 
-	while(changed) {
-		changed = 0;
-
-		for(ticket = list_head(transmission_ticket_list);
-			ticket != NULL;
-			ticket = list_item_next(ticket) ) {
-			if( ticket->bundle_number == bundle_number ) {
-				break;
-			}
-		}
+	/* Only the tickets in the bucket of the bundle number have to be looked at */
+	for( ticket = bundle_index[convergence_layer_dgram_hash(bundle_number)];
+		 ticket != NULL;
+		 ticket = next ) {
+		next = ticket->next_bundle;
 
-		/* Unable to find that bundle */
-		if( ticket == NULL ) {
-			return -1;
+		if( ticket->bundle_number == bundle_number ) {
+			/* free the ticket's memory */
+			convergence_layer_dgram_free_transmit_ticket(ticket);
+			ret = 1;
 		}
-
-		/* free the ticket's memory */
-		convergence_layer_dgram_free_transmit_ticket(ticket);
-
-		changed = 1;
 	}
 
-
-	return 1;
+	return ret;
 }
 
 
-static int convergence_layer_dgram_is_blocked(const cl_addr_t* const neighbour)
+/**
+ * \brief Returns the lock of a neighbour
+ * \return lock or NULL, if the neighbour is not blocked
+ */
+static struct blocked_neighbour_t * convergence_layer_dgram_find_blocked(const cl_addr_t* const neighbour)
 {
 	struct blocked_neighbour_t * n = NULL;
 
@@ -1036,18 +1847,27 @@ static int convergence_layer_dgram_is_blocked(const cl_addr_t* const neighbour)
 		 n != NULL;
 		 n = list_item_next(n) ) {
 		if( cl_addr_cmp(neighbour, &n->neighbour) ) {
-			return 1;
+			return n;
 		}
 	}
 
-	return 0;
+	return NULL;
 }
 
 
-static int convergence_layer_dgram_set_blocked(const cl_addr_t* const neighbour)
+static int convergence_layer_dgram_set_blocked(const cl_addr_t* const neighbour, struct transmit_ticket_t * const ticket)
 {
 	struct blocked_neighbour_t * n = NULL;
 
+	/* The timer keeps running for the segments, that are already in flight */
+	for( n = list_head(blocked_neighbour_list);
+		 n != NULL;
+		 n = list_item_next(n) ) {
+		if( cl_addr_cmp(neighbour, &n->neighbour) ) {
+			return 0;
+		}
+	}
+
 	n = memb_alloc(&blocked_neighbour_mem);
 	if( n == NULL ) {
 		LOG(LOGD_DTN, LOG_CL, LOGL_ERR, "Cannot allocate neighbour memory");
@@ -1057,10 +1877,14 @@ static int convergence_layer_dgram_set_blocked(const cl_addr_t* const neighbour)
 	/* Fill the struct */
 	cl_addr_copy(&n->neighbour, neighbour);
 	n->timestamp = xTaskGetTickCount();
+	n->ticket = ticket;
 
 	/* Add it to the list */
 	list_add(blocked_neighbour_list, n);
 
+	/* The timeout of this neighbour may expire before the next check */
+	xTaskNotifyGive(timeout_task);
+
 	char addr_str[CL_ADDR_STRING_LENGTH];
 	cl_addr_string(neighbour, addr_str, sizeof(addr_str));
 	LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Block neighbour %s", addr_str);
@@ -1090,83 +1914,123 @@ static int convergence_layer_dgram_set_unblocked(const cl_addr_t* const neighbou
 }
 
 
-static void convergence_layer_dgram_check_blocked_neighbours()
+/**
+ * \brief Resends the pending bundles to neighbours, whose timeout has expired
+ * \return ticks until the next timeout expires, at most wait
+ */
+static TickType_t convergence_layer_dgram_check_blocked_neighbours(TickType_t wait)
 {
 	struct blocked_neighbour_t * n = NULL;
+	struct blocked_neighbour_t * next = NULL;
 	struct transmit_ticket_t * ticket = NULL;
+	bool resend = false;
 
+	/* Every neighbour has its own timer, so look at all of them */
 	for( n = list_head(blocked_neighbour_list);
 		 n != NULL;
-		 n = list_item_next(n) ) {
+		 n = next ) {
+		next = list_item_next(n);
+
+		const TickType_t elapsed = xTaskGetTickCount() - n->timestamp;
+		const TickType_t timeout = convergence_layer_dgram_get_timeout(&n->neighbour);
+		if( elapsed < timeout ) {
+			if( timeout - elapsed < wait ) {
+				wait = timeout - elapsed;
+			}
+			continue;
+		}
 
-		if( (xTaskGetTickCount() - n->timestamp) >= pdMS_TO_TICKS(CONVERGENCE_LAYER_TIMEOUT) ) {
-			/* We have a neighbour that takes quite long to reply apparently -
-			 * unblock him and resend the pending bundle
-			 */
-			break;
+		/* We have a neighbour that takes quite long to reply apparently -
+		 * unblock him and resend the pending bundle
+		 */
+		cl_addr_t neighbour;
+		cl_addr_copy(&neighbour, &n->neighbour);
+
+		/* Go and find the currently transmitting ticket to that neighbour */
+		ticket = convergence_layer_dgram_find_ticket(&neighbour, CONVERGENCE_LAYER_QUEUE_ACK_PEND);
+
+		/* Unblock the neighbour */
+		convergence_layer_dgram_set_unblocked(&neighbour);
+
+		/* Back off, until he answers again */
+		struct dgram_neighbour_t * const dn = convergence_layer_dgram_get_neighbour(&neighbour);
+		if( dn->backoff < UINT8_MAX ) {
+			dn->backoff++;
 		}
-	}
 
-	/* Nothing to do for us */
-	if( n == NULL ) {
-		return;
-	}
+		char addr_str[CL_ADDR_STRING_LENGTH];
+		cl_addr_string(&neighbour, addr_str, sizeof(addr_str));
+		LOG(LOGD_DTN, LOG_CL, LOGL_WRN, "Neighbour %s stale, removing lock (backoff %u)", addr_str, dn->backoff);
 
-	/* Go and find the currently transmitting ticket to that neighbour */
-	for( ticket = list_head(transmission_ticket_list);
-		 ticket != NULL;
-		 ticket = list_item_next(ticket) ) {
-		if( cl_addr_cmp(&ticket->neighbour, &n->neighbour) && (ticket->flags & CONVERGENCE_LAYER_QUEUE_ACK_PEND) ) {
-			break;
+		/* There seems to be no ticket, nothing to do for us */
+		if( ticket == NULL ) {
+			continue;
 		}
-	}
 
-	/* Unblock the neighbour */
-	convergence_layer_dgram_set_unblocked(&n->neighbour);
+		/* The pending segment is not timed anymore */
+		ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_RTT;
 
-	char addr_str[CL_ADDR_STRING_LENGTH];
-	cl_addr_string(&n->neighbour, addr_str, sizeof(addr_str));
-	LOG(LOGD_DTN, LOG_CL, LOGL_WRN, "Neighbour %s stale, removing lock", addr_str);
+		if( ticket->timeouts < UINT8_MAX ) {
+			ticket->timeouts ++;
+		}
 
-	/* There seems to be no ticket, nothing to do for us */
-	if( ticket == NULL ) {
-		return;
+		if( CONVERGENCE_LAYER_TIMEOUT_RETRIES > 0 && ticket->timeouts >= CONVERGENCE_LAYER_TIMEOUT_RETRIES ) {
+			LOG(LOGD_DTN, LOG_CL, LOGL_WRN, "CL: Giving up on bundle %lu after %d timeouts", ticket->bundle_number, ticket->timeouts);
+
+			/* Bundle fails over and over again, notify routing */
+			ticket->flags |= CONVERGENCE_LAYER_QUEUE_FAIL;
+
+			/* Notify routing module */
+			ROUTING.sent(ticket, ROUTING_STATUS_FAIL);
+
+			/* The next ticket starts without backoff */
+			dn->backoff = 0;
+			continue;
+		}
+
+		/* Otherwise: just reactivate the ticket, it will be transmitted again */
+		ticket->flags |= CONVERGENCE_LAYER_QUEUE_ACTIVE;
+
+		/* Of a multipart bundle only the oldest segment in flight is sent again */
+		if( ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART ) {
+			ticket->flags |= CONVERGENCE_LAYER_QUEUE_RETRANSMIT;
+		}
+
+		resend = true;
 	}
 
-	/* Otherwise: just reactivate the ticket, it will be transmitted again */
-	ticket->flags |= CONVERGENCE_LAYER_QUEUE_ACTIVE;
+	if( resend ) {
+		/* Tell the process to resend the bundles */
+		xSemaphoreGive(transmit_reqest_sem);
+	}
 
-	/* Tell the process to resend the bundles */
-	xSemaphoreGive(transmit_reqest_sem);
+	return wait;
 }
 
 
 static void convergence_layer_dgram_check_blocked_tickets()
 {
-	struct transmit_ticket_t * ticket = NULL;
-	int changed = 1;
-
-	while(changed) {
-		changed = 0;
+	struct dgram_queue_t * q = NULL;
+	struct dgram_queue_t * next = NULL;
 
-		for( ticket = list_head(transmission_ticket_list);
-			 ticket != NULL;
-			 ticket = list_item_next(ticket) ) {
+	for( q = list_head(queue_list);
+		 q != NULL;
+		 q = next ) {
+		/* The queue is freed with its last ticket */
+		next = list_item_next(q);
 
-			/* Only multipart receiver tickets can time out */
-			if( !(ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART_RECV) ) {
-				continue;
-			}
+		/* Only multipart receiver tickets can time out, there is one per neighbour at most */
+		struct transmit_ticket_t * const ticket = q->recv;
+		if( ticket == NULL ) {
+			continue;
+		}
 
-			if( (xTaskGetTickCount() - ticket->timestamp) > pdMS_TO_TICKS(CONVERGENCE_LAYER_MULTIPART_TIMEOUT * 1000) ) {
-				char addr_str[CL_ADDR_STRING_LENGTH];
-				cl_addr_string(&ticket->neighbour, addr_str, sizeof(addr_str));
-				LOG(LOGD_DTN, LOG_CL, LOGL_WRN, "Multipart receiving ticket for peer %s timed out, removing", addr_str);
+		if( (xTaskGetTickCount() - ticket->timestamp) > pdMS_TO_TICKS(CONVERGENCE_LAYER_MULTIPART_TIMEOUT * 1000) ) {
+			char addr_str[CL_ADDR_STRING_LENGTH];
+			cl_addr_string(&ticket->neighbour, addr_str, sizeof(addr_str));
+			LOG(LOGD_DTN, LOG_CL, LOGL_WRN, "Multipart receiving ticket for peer %s timed out, removing", addr_str);
 
-				changed = 1;
-				convergence_layer_dgram_free_transmit_ticket(ticket);
-				break;
-			}
+			convergence_layer_dgram_free_transmit_ticket(ticket);
 		}
 	}
 }
@@ -1174,9 +2038,12 @@ static void convergence_layer_dgram_check_blocked_tickets()
 
 static void convergence_layer_dgram_check_timeouts(void* p)
 {
+	TickType_t wait = pdMS_TO_TICKS(100);
+
 	while (true) {
-		vTaskDelay(pdMS_TO_TICKS(100));
-		convergence_layer_dgram_check_blocked_neighbours();
+		/* Wake up, when the next timeout of a neighbour expires or a neighbour was blocked */
+		ulTaskNotifyTake(pdTRUE, wait > 0 ? wait : 1);
+		wait = convergence_layer_dgram_check_blocked_neighbours(pdMS_TO_TICKS(100));
 		convergence_layer_dgram_check_blocked_tickets();
 	}
 }
@@ -1195,9 +2062,10 @@ int convergence_layer_dgram_neighbour_down(const cl_addr_t* const neighbour)
 		changed = 0;
 
 		/* Go and look for a ticket for this neighbour */
-		for(ticket = list_head(transmission_ticket_list);
-			ticket != NULL;
-			ticket = list_item_next(ticket) ) {
+		struct dgram_queue_t * const q = convergence_layer_dgram_find_queue(neighbour);
+		for( ticket = (q != NULL) ? list_head(q->tickets) : NULL;
+			 ticket != NULL;
+			 ticket = list_item_next(ticket) ) {
 
 			/* Do not delete tickets for which we are currently awaiting an ACK */
 			if( ticket->flags & CONVERGENCE_LAYER_QUEUE_ACK_PEND ) {
@@ -1216,16 +2084,14 @@ int convergence_layer_dgram_neighbour_down(const cl_addr_t* const neighbour)
 				break;
 			}
 
-			if( cl_addr_cmp(neighbour, &ticket->neighbour) ) {
-				/* Notify routing module */
-				ROUTING.sent(ticket, ROUTING_STATUS_FAIL);
+			/* Notify routing module */
+			ROUTING.sent(ticket, ROUTING_STATUS_FAIL);
 
-				/* Mark as changed */
-				changed = 1;
+			/* Mark as changed */
+			changed = 1;
 
-				/* Stop look and start over again */
-				break;
-			}
+			/* Stop look and start over again */
+			break;
 		}
 	}
 
@@ -1239,16 +2105,22 @@ int convergence_layer_dgram_neighbour_down(const cl_addr_t* const neighbour)
 #ifdef DEBUG
 static void convergence_layer_dgram_show_tickets()
 {
+	struct dgram_queue_t * q = NULL;
 	struct transmit_ticket_t * ticket = NULL;
 
 	printf("--- TICKET LIST\n");
-	for(ticket = list_head(transmission_ticket_list);
-		ticket != NULL;
-		ticket = list_item_next(ticket) ) {
+	for( q = list_head(queue_list);
+		 q != NULL;
+		 q = list_item_next(q) ) {
 
 		char addr_str[CL_ADDR_STRING_LENGTH];
-		cl_addr_string(&ticket->neighbour, addr_str, sizeof(addr_str));
-		printf("B %10lu to %s with SeqNo %u and Flags %02X\n", ticket->bundle_number, addr_str, ticket->sequence_number, ticket->flags);
+		cl_addr_string(&q->neighbour, addr_str, sizeof(addr_str));
+
+		for( ticket = list_head(q->tickets);
+			 ticket != NULL;
+			 ticket = list_item_next(ticket) ) {
+			printf("B %10lu to %s with SeqNo %u and Flags %02X\n", ticket->bundle_number, addr_str, ticket->sequence_number, ticket->flags);
+		}
 	}
 
 	printf("---\n");
@@ -1258,21 +2130,31 @@ static void convergence_layer_dgram_show_tickets()
 
 static void convergence_layer_dgram_process(void* p)
 {
+	struct dgram_queue_t * q = NULL;
+	struct dgram_queue_t * next_queue = NULL;
 	struct transmit_ticket_t * ticket = NULL;
-	int n;
+	struct transmit_ticket_t * next = NULL;
+	cl_addr_t next_neighbour;
 
 	/* Initialize ticket storage */
 	memb_init(&transmission_ticket_mem);
-	list_init(transmission_ticket_list);
+	memb_init(&queue_mem);
+	list_init(queue_list);
+	memset(queue_index, 0, sizeof(queue_index));
+	memset(bundle_index, 0, sizeof(bundle_index));
 
 	/* Initialize neighbour storage */
 	memb_init(&blocked_neighbour_mem);
 	list_init(blocked_neighbour_list);
+	memb_init(&neighbour_mem);
+	list_init(neighbour_list);
 
 	LOG(LOGD_DTN, LOG_CL, LOGL_INF, "CL process is running");
 
 	while(1) {
-		while (!xSemaphoreTake(transmit_reqest_sem, portMAX_DELAY) ) { }
+		/* Wake up in time for delayed SACKs */
+		xSemaphoreTake(transmit_reqest_sem, convergence_layer_sack_pending ? pdMS_TO_TICKS(CONVERGENCE_LAYER_SACK_TIMEOUT) : portMAX_DELAY);
+		convergence_layer_sack_pending = false;
 
 		/* slow down the transmission to mind collisions */
 		if (convergence_layer_backoff_pending) {
@@ -1284,53 +2166,94 @@ static void convergence_layer_dgram_process(void* p)
 		}
 
 
-		LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Try to send %d available tickets", list_length(transmission_ticket_list));
+		LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Try to send %d available tickets", convergence_layer_slots);
+
+		/* If we have been woken up, it must have been a poll to transmit outgoing bundles.
+		 * Every neighbour gets at most one segment per round, so all neighbours,
+		 * that are not waiting for an app-layer ACK, are served at once.
+		 * Sending a segment blocks its neighbour for the other tickets.
+		 */
+		for( q = list_head(queue_list);
+			 q != NULL;
+			 q = next_queue ) {
+			/* The queue is freed with its last ticket */
+			next_queue = list_item_next(q);
+			if( next_queue != NULL ) {
+				cl_addr_copy(&next_neighbour, &next_queue->neighbour);
+			}
+
+			/* Neighbour for which we are currently waiting on app-layer ACKs cannot receive anything now */
+			const struct blocked_neighbour_t * const blocked = convergence_layer_dgram_find_blocked(&q->neighbour);
+
+			for( ticket = list_head(q->tickets);
+				 ticket != NULL;
+				 ticket = next ) {
+				/* The ticket may be freed, while it is processed */
+				next = list_item_next(ticket);
+
+				if( (ticket->flags & CONVERGENCE_LAYER_QUEUE_ACK) || (ticket->flags & CONVERGENCE_LAYER_QUEUE_NACK) || (ticket->flags & CONVERGENCE_LAYER_QUEUE_TEMP_NACK) ) {
+					/* ACKs are sent again, when their timer expired */
+					convergence_layer_dgram_resend_ack(ticket);
+					continue;
+				}
+
+				if( ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART_RECV ) {
+					/* Send the delayed SACK, if no further segment has arrived in time */
+					if( ticket->flags & CONVERGENCE_LAYER_QUEUE_SACK_DELAYED ) {
+						if( (xTaskGetTickCount() - ticket->timestamp) >= pdMS_TO_TICKS(CONVERGENCE_LAYER_SACK_TIMEOUT) ) {
+							ticket->flags &= ~CONVERGENCE_LAYER_QUEUE_SACK_DELAYED;
+							ticket->unacked = 0;
+							convergence_layer_dgram_create_send_ack(&ticket->neighbour, ticket->neighbour.clayer->next_seqno(ticket->sequence_number),
+																	CONVERGENCE_LAYER_TYPE_ACK, ticket->received);
+
+							/* The older ACKs after this ticket are gone now */
+							next = list_item_next(ticket);
+						} else {
+							convergence_layer_sack_pending = true;
+						}
+					}
+					continue;
+				}
 
-		/* If we have been woken up, it must have been a poll to transmit outgoing bundles */
-		for(ticket = list_head(transmission_ticket_list);
-			ticket != NULL;
-			ticket = list_item_next(ticket) ) {
-			if( ((ticket->flags & CONVERGENCE_LAYER_QUEUE_ACK) || (ticket->flags & CONVERGENCE_LAYER_QUEUE_NACK)) && !(ticket->flags & CONVERGENCE_LAYER_QUEUE_IN_TRANSIT) ) {
-				n = convergence_layer_dgram_resend_ack(ticket);
-				if( n ) {
-					/* Transmission happened */
+				/* The ACKs and the incoming bundle are at the head of the queue.
+				 * A multipart bundle may send more segments to the neighbour,
+				 * which is blocked for it, as long as its window allows it.
+				 * His other tickets are not looked at.
+				 */
+				if( blocked != NULL ) {
+					ticket = blocked->ticket;
+					if( ticket != NULL && (ticket->flags & CONVERGENCE_LAYER_QUEUE_MULTIPART) &&
+						(ticket->flags & CONVERGENCE_LAYER_QUEUE_ACTIVE) && !(ticket->flags & CONVERGENCE_LAYER_QUEUE_IN_TRANSIT) ) {
+						convergence_layer_dgram_prepare_segmentation(ticket);
+					}
 					break;
 				}
-			}
 
-			/* Tickets that are in transit have to wait */
-			if( ticket->flags & CONVERGENCE_LAYER_QUEUE_IN_TRANSIT ) {
-				continue;
-			}
+				/* Tickets that are in transit have to wait */
+				if( ticket->flags & CONVERGENCE_LAYER_QUEUE_IN_TRANSIT ) {
+					continue;
+				}
 
-			/* Tickets that are in any other state than ACTIVE cannot be transmitted */
-			if( !(ticket->flags & CONVERGENCE_LAYER_QUEUE_ACTIVE) ) {
-				continue;
-			}
+				/* Tickets that are in any other state than ACTIVE cannot be transmitted */
+				if( !(ticket->flags & CONVERGENCE_LAYER_QUEUE_ACTIVE) ) {
+					continue;
+				}
 
-			/* Neighbour for which we are currently waiting on app-layer ACKs cannot receive anything now */
-			if( convergence_layer_dgram_is_blocked(&ticket->neighbour) ) {
-				char addr_str[CL_ADDR_STRING_LENGTH];
-				cl_addr_string(&ticket->neighbour, addr_str, sizeof(addr_str));
-				LOG(LOGD_DTN, LOG_CL, LOGL_DBG, "Neighbour %s is blocked. Not sending bundle %u with ticket %p",
-					addr_str, ticket->bundle_number, ticket);
-				continue;
+				/* Send the bundle just now.
+				 * If the radio is busy or an error occured, the ticket is tried again,
+				 * when the CL calls us back or the timeout has expired.
+				 * Tickets to other neighbours and over other CLs are sent anyway.
+				 * Any ticket may be freed while sending, when its bundle is deleted,
+				 * so the other tickets of this neighbour wait for the next round.
+				 */
+				convergence_layer_dgram_prepare_segmentation(ticket);
+				break;
 			}
 
-			/* Send the bundle just now */
-			const int ret = convergence_layer_dgram_prepare_segmentation(ticket);
-
-			if (ret > 0) {
-				// TODO send other ip packages for other neighbours
-				/* package successfully send, break and wait for ack */
+			/* Start over in the next round, if the next queue was freed meanwhile */
+			if( next_queue != NULL && convergence_layer_dgram_find_queue(&next_neighbour) != next_queue ) {
+				xSemaphoreGive(transmit_reqest_sem);
 				break;
-			} else if (ret == 0) {
-				/* Radio is busy now look for ip packages */
-				/* We will get polled again when the MAC layers calls us back,
-				 * so lean back and relax
-				 */
-			} else {
-				/* an error occured, try again later */
 			}
 		}
 	}
@@ -27,11 +27,30 @@
 #include "lib/mmem.h"
 
 #include "cl_address.h"
+#include "bundle.h"
 
 /**
  * How many outgoing bundles can we queue?
  */
+#ifdef CONVERGENCE_LAYER_CONF_QUEUE
+#define CONVERGENCE_LAYER_QUEUE CONVERGENCE_LAYER_CONF_QUEUE
+#else
 #define CONVERGENCE_LAYER_QUEUE 				10
+#endif
+
+/**
+ * How many buckets have the indexes of the tickets by neighbour and by bundle number?
+ * Has to be a power of two.
+ */
+#ifdef CONVERGENCE_LAYER_CONF_HASH_SIZE
+#define CONVERGENCE_LAYER_HASH_SIZE CONVERGENCE_LAYER_CONF_HASH_SIZE
+#else
+#define CONVERGENCE_LAYER_HASH_SIZE				16
+#endif
+
+#if CONVERGENCE_LAYER_HASH_SIZE & (CONVERGENCE_LAYER_HASH_SIZE - 1)
+#error "CONVERGENCE_LAYER_HASH_SIZE has to be a power of two"
+#endif
 
 /**
  * How many queue slots remain free for internal use?
@@ -41,9 +60,21 @@
 
 /**
  * How often shall we retransmit bundles before we notify routing
+ * This counts missing link-layer ACKs.
  */
 #define CONVERGENCE_LAYER_RETRIES				4
 
+/**
+ * After how many timeouts of app-layer ACKs in a row shall we notify routing?
+ * Every timeout doubles the timeout of the neighbour up to CONVERGENCE_LAYER_MAX_TIMEOUT.
+ * 0 retries a neighbour, until he answers.
+ */
+#ifdef CONVERGENCE_LAYER_CONF_TIMEOUT_RETRIES
+#define CONVERGENCE_LAYER_TIMEOUT_RETRIES CONVERGENCE_LAYER_CONF_TIMEOUT_RETRIES
+#else
+#define CONVERGENCE_LAYER_TIMEOUT_RETRIES		0
+#endif
+
 /**
  * How often shell we retry to transmit, if it has not been transmitted at all?
  */
@@ -51,6 +82,7 @@
 
 /**
  * How long shall we wait for an app-layer ACK or NACK? [in milli seconds]
+ * This is only used, until the round trip time to the neighbour was measured.
  */
 #ifndef CONVERGENCE_LAYER_TIMEOUT
 #define CONVERGENCE_LAYER_TIMEOUT				200
@@ -63,6 +95,8 @@
 
 /**
  * How long shell we wait before retransmitting an app-layer ACK or NACK? [in milli seconds]
+ * Once the round trip time to the neighbour is known, his timeout is divided by
+ * CONVERGENCE_LAYER_RETRANSMIT_TRIES instead.
  */
 #define CONVERGENCE_LAYER_RETRANSMIT_TIMEOUT	100
 
@@ -71,6 +105,75 @@
  */
 #define CONVERGENCE_LAYER_RETRANSMIT_TRIES		(CONVERGENCE_LAYER_TIMEOUT / CONVERGENCE_LAYER_RETRANSMIT_TIMEOUT)
 
+/**
+ * How many segments of a multipart bundle may be in flight at once?
+ * The window is further limited to less than half of the sequence number
+ * space of the CL (1 on dgram:lowpan, 7 on dgram:udp) and to the window,
+ * that the peer has advertised in its ACKs.
+ * Peers without advertisement (like IBR-DTN) get 1, which is stop-and-wait.
+ *
+ * dgram:lowpan has a 2 bit sequence number, which IBR-DTN expects,
+ * so the radio link is always stop-and-wait and gets no pipelining.
+ * Only dgram:udp uses this window.
+ */
+#ifdef CONVERGENCE_LAYER_CONF_WINDOW
+#define CONVERGENCE_LAYER_WINDOW CONVERGENCE_LAYER_CONF_WINDOW
+#else
+#define CONVERGENCE_LAYER_WINDOW				4
+#endif
+
+#if CONVERGENCE_LAYER_WINDOW < 1 || CONVERGENCE_LAYER_WINDOW > 7
+#error "CONVERGENCE_LAYER_WINDOW has to be between 1 and 7"
+#endif
+
+/**
+ * After how many segments of a multipart bundle shall we send a SACK?
+ * Only segments, which are flagged as sent with a window, are acked together,
+ * all others get an ACK of their own.
+ * Delayed ACKs and SACKs need a window above 1, so they only take effect on
+ * dgram:udp. dgram:lowpan acks every segment at once.
+ */
+#ifdef CONVERGENCE_LAYER_CONF_SACK_SEGMENTS
+#define CONVERGENCE_LAYER_SACK_SEGMENTS CONVERGENCE_LAYER_CONF_SACK_SEGMENTS
+#else
+#define CONVERGENCE_LAYER_SACK_SEGMENTS			2
+#endif
+
+/**
+ * How long shall we delay a SACK at most? [in milli seconds]
+ */
+#ifdef CONVERGENCE_LAYER_CONF_SACK_TIMEOUT
+#define CONVERGENCE_LAYER_SACK_TIMEOUT CONVERGENCE_LAYER_CONF_SACK_TIMEOUT
+#else
+#define CONVERGENCE_LAYER_SACK_TIMEOUT			20
+#endif
+
+/**
+ * Bounds of the retransmission timeout, that is estimated from the
+ * round trip time to every neighbour [in milli seconds]
+ * A delayed SACK must not make the timeout expire.
+ */
+#ifdef CONVERGENCE_LAYER_CONF_MIN_TIMEOUT
+#define CONVERGENCE_LAYER_MIN_TIMEOUT CONVERGENCE_LAYER_CONF_MIN_TIMEOUT
+#else
+#define CONVERGENCE_LAYER_MIN_TIMEOUT			(CONVERGENCE_LAYER_SACK_TIMEOUT + 10)
+#endif
+
+#ifdef CONVERGENCE_LAYER_CONF_MAX_TIMEOUT
+#define CONVERGENCE_LAYER_MAX_TIMEOUT CONVERGENCE_LAYER_CONF_MAX_TIMEOUT
+#else
+#define CONVERGENCE_LAYER_MAX_TIMEOUT			5000
+#endif
+
+/**
+ * Of how many neighbours shall we remember the advertised window and the round trip time?
+ */
+#ifdef CONVERGENCE_LAYER_CONF_NEIGHBOURS
+#define CONVERGENCE_LAYER_NEIGHBOURS CONVERGENCE_LAYER_CONF_NEIGHBOURS
+#else
+#define CONVERGENCE_LAYER_NEIGHBOURS			8
+#endif
+
 
 /**
  * Bundle queue flags
@@ -85,6 +188,11 @@
 #define CONVERGENCE_LAYER_QUEUE_TEMP_NACK	0x80
 #define CONVERGENCE_LAYER_QUEUE_MULTIPART	0x100
 #define CONVERGENCE_LAYER_QUEUE_MULTIPART_RECV	0x200
+#define CONVERGENCE_LAYER_QUEUE_RETRANSMIT	0x400
+#define CONVERGENCE_LAYER_QUEUE_RECOVERY	0x800
+#define CONVERGENCE_LAYER_QUEUE_LAST_RECV	0x1000
+#define CONVERGENCE_LAYER_QUEUE_SACK_DELAYED	0x2000
+#define CONVERGENCE_LAYER_QUEUE_RTT			0x4000
 
 /**
  * CL Header Types
@@ -100,6 +208,18 @@
  */
 #define CONVERGENCE_LAYER_FLAGS_FIRST		0x02
 #define CONVERGENCE_LAYER_FLAGS_LAST		0x01
+/* The segment was sent with a window, so the ACK may be delayed */
+#define CONVERGENCE_LAYER_FLAGS_WINDOW		0x04
+
+/**
+ * CL Options in the payload of ACK frames
+ * Every option is encoded as type, length and value
+ */
+#define CONVERGENCE_LAYER_OPTION_WINDOW		0x57
+/* Turns the ACK into a SACK: the segments after the acked one, that were received.
+ * Bit n is the segment n + 1 after the acked one.
+ */
+#define CONVERGENCE_LAYER_OPTION_SACK		0x53
 
 /**
  * CL Callback Status
@@ -122,9 +242,14 @@
 struct transmit_ticket_t {
 	struct transmit_ticket_t * next;
 
+	/* Next ticket in the same bucket of the bundle number index */
+	struct transmit_ticket_t * next_bundle;
+
 	uint16_t flags;
 	uint8_t tries;
 	uint8_t failed_tries;
+	/* Timeouts of app-layer ACKs in a row */
+	uint8_t timeouts;
 	cl_addr_t neighbour;
 	uint32_t bundle_number;
 	uint8_t sequence_number;
@@ -132,8 +257,35 @@ struct transmit_ticket_t {
 
 	int offset_sent;
 	int offset_acked;
+
+	/* Offset of the segment, that is handed to the CL right now */
+	int offset_transit;
+
+	/* The holes before this offset were sent again already */
+	int offset_retransmit;
+
+	/* Segment, whose round trip time is measured, if CONVERGENCE_LAYER_QUEUE_RTT is set */
+	int offset_rtt;
+	TickType_t timestamp_rtt;
+
+	/* Reassembly buffer of an incoming multipart bundle */
 	struct mmem buffer;
 
+	/* Segments of a multipart bundle, that were received out of order by us or the peer.
+	 * Bit n is the segment n + 1 after the oldest segment, that is missing.
+	 */
+	uint8_t received;
+	uint16_t segment_length;
+
+	/* Sequence number of the first segment of an incoming multipart bundle */
+	uint8_t first_sequence_number;
+
+	/* Incoming segments, that were not acked yet */
+	uint8_t unacked;
+
+	/* Serializer of an outgoing bundle */
+	struct bundle_cursor_t cursor;
+
 	struct mmem * bundle;
 };
 
@@ -156,6 +308,14 @@ int convergence_layer_dgram_delete_bundle(uint32_t bundle_number);
 
 int convergence_layer_dgram_neighbour_down(const cl_addr_t* const neighbour);
 
+/**
+ * \brief Changes the number of segments, that may be in flight to a neighbour
+ * \param window 1 (stop-and-wait) to CONVERGENCE_LAYER_WINDOW
+ *
+ * The window is advertised to the peers in our ACKs, too.
+ */
+void convergence_layer_dgram_set_window(const uint8_t window);
+
 #endif /* CONVERGENCE_LAYER */
 
 /** @} */
@@ -20,6 +20,10 @@
  * CL COMPAT VALUES
  */
 #define CONVERGENCE_LAYER_COMPAT			0x00
+/* Data frame of a sender with a window, so the ACK may be delayed.
+ * Not sent as long as the window is limited to 1 by the sequence number.
+ */
+#define CONVERGENCE_LAYER_COMPAT_WINDOW		0x40
 
 
 /**
@@ -71,6 +75,10 @@ static size_t convergence_layer_lowpan_dgram_max_payload_length(void)
 }
 
 
+/**
+ * The 2 bit sequence number limits the window to 1 segment,
+ * see CONVERGENCE_LAYER_WINDOW. It is kept for IBR-DTN.
+ */
 static uint8_t convergence_layer_lowpan_dgram_next_sequence_number(const uint8_t last_seqno)
 {
 	return (last_seqno + 1) % 4;
@@ -121,7 +129,7 @@ static int convergence_layer_lowpan_dgram_send_discovery(const uint8_t* const pa
  * @param dest
  * @param sequence_number
  * @param flags
- * @param payload
+ * @param cursor the segment is read from this cursor
  * @param length
  * @param reference
  * @return <0 an error occured
@@ -129,7 +137,7 @@ static int convergence_layer_lowpan_dgram_send_discovery(const uint8_t* const pa
  *          1 bundle was send
  */
 static int convergence_layer_lowpan_dgram_send_bundle(const cl_addr_t* const dest, const int sequence_number, const uint8_t flags,
-											const uint8_t* const payload, const size_t length, const void* const reference)
+											struct bundle_cursor_t* const cursor, const size_t length, const void* const reference)
 {
 	configASSERT(dest->clayer == &clayer_lowpan_dgram);
 
@@ -169,8 +177,18 @@ static int convergence_layer_lowpan_dgram_send_bundle(const cl_addr_t* const des
 	buffer[0] |= (sequence_number << 2) & CONVERGENCE_LAYER_MASK_SEQNO;
 	buffer[0] |= flags & CONVERGENCE_LAYER_MASK_FLAGS;
 
-	/* copy the payload */
-	memcpy(&buffer[1], payload, length);
+	/* There is no room for another flag, so a windowed sender uses its own COMPAT value.
+	 * It is only used with peers, that have advertised a window.
+	 */
+	if( flags & CONVERGENCE_LAYER_FLAGS_WINDOW ) {
+		buffer[0] |= CONVERGENCE_LAYER_COMPAT_WINDOW;
+	}
+
+	/* read the payload straight into the network buffer */
+	if (bundle_cursor_read(cursor, &buffer[1], length) != length) {
+		LOG(LOGD_DTN, LOG_CL, LOGL_ERR, "Bundle segment (seq %u, len %lu) is behind the end of the bundle", sequence_number, length);
+		return -3;
+	}
 
 	/* And send it out */
 	// TODO remove const cast
@@ -191,13 +209,15 @@ static int convergence_layer_lowpan_dgram_send_bundle(const cl_addr_t* const des
  * @param destination
  * @param sequence_number
  * @param type
+ * @param payload options of the ACK
+ * @param length
  * @param reference
  * @return <0 an error occured
  *          0 bundle was not send, because of locked driver
  *          1 bundle was send
  */
 static int convergence_layer_lowpan_dgram_send_ack(const cl_addr_t* const destination, const int sequence_number, const int type,
-											 const void* const reference)
+											 const uint8_t* const payload, const size_t length, const void* const reference)
 {
 	configASSERT(destination->clayer == &clayer_lowpan_dgram);
 
@@ -233,8 +253,15 @@ static int convergence_layer_lowpan_dgram_send_ack(const cl_addr_t* const destin
 		buffer[0] |= (CONVERGENCE_LAYER_FLAGS_FIRST) & CONVERGENCE_LAYER_MASK_FLAGS; // This flag indicates a temporary nack
 	}
 
+	/* Append the options, if they fit into the frame */
+	size_t length_to_send = sizeof(struct lowpan_dgram_hdr);
+	if( length > 0 && length_to_send + length <= dtn_network_get_buffer_length() ) {
+		memcpy(buffer + length_to_send, payload, length);
+		length_to_send += length;
+	}
+
 	/* Send it out via the MAC */
-	dtn_network_send((linkaddr_t*)&destination->lowpan, sizeof(struct lowpan_dgram_hdr), (void*)reference);
+	dtn_network_send((linkaddr_t*)&destination->lowpan, length_to_send, (void*)reference);
 
 	return 1;
 }
@@ -265,7 +292,9 @@ static int convergence_layer_lowpan_dgram_incoming_frame(const cl_addr_t* const
 	// TODO call alive_eid, if discovery entry does not already exist
 
 	/* Check the COMPAT information */
-	if( (payload[0] & CONVERGENCE_LAYER_MASK_COMPAT) != CONVERGENCE_LAYER_COMPAT ) {
+	const bool window = ( (payload[0] & CONVERGENCE_LAYER_MASK_COMPAT) == CONVERGENCE_LAYER_COMPAT_WINDOW &&
+						  (payload[0] & CONVERGENCE_LAYER_MASK_TYPE) == CONVERGENCE_LAYER_TYPE_DATA );
+	if( (payload[0] & CONVERGENCE_LAYER_MASK_COMPAT) != CONVERGENCE_LAYER_COMPAT && !window ) {
 		char addr_str[CL_ADDR_STRING_LENGTH];
 		cl_addr_string(source, addr_str, sizeof(addr_str));
 		LOG(LOGD_DTN, LOG_CL, LOGL_INF, "Ignoring incoming frame from %s", addr_str);
@@ -278,7 +307,7 @@ static int convergence_layer_lowpan_dgram_incoming_frame(const cl_addr_t* const
 
 	if( (header & CONVERGENCE_LAYER_MASK_TYPE) == CONVERGENCE_LAYER_TYPE_DATA ) {
 		/* is data */
-		const int flags = (header & CONVERGENCE_LAYER_MASK_FLAGS) >> 0;
+		const int flags = ((header & CONVERGENCE_LAYER_MASK_FLAGS) >> 0) | (window ? CONVERGENCE_LAYER_FLAGS_WINDOW : 0);
 		const int sequence_number = (header & CONVERGENCE_LAYER_MASK_SEQNO) >> 2;
 
 		return convergence_layer_dgram_incoming_data(source, data_pointer, data_length, rssi, sequence_number, flags);
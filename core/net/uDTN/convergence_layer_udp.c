@@ -217,6 +217,60 @@ int convergence_layer_udp_send_data(const ip_addr_t* const addr, const uint8_t*
 }
 
 
+/**
+ * @brief convergence_layer_udp_send_bundle sends a header and a bundle segment in one package
+ * @param addr destination address
+ * @param header CL header, which is put in front of the segment
+ * @param header_length length of the CL header
+ * @param cursor the segment is read from the current position of this cursor
+ * @param length length of the segment
+ * @return < 0 on fail
+ */
+int convergence_layer_udp_send_bundle(const ip_addr_t* const addr, const uint8_t* const header, const size_t header_length,
+									  struct bundle_cursor_t* const cursor, const size_t length)
+{
+	configASSERT(addr != NULL && header != NULL && cursor != NULL);
+
+	// TODO use thread safe netifapi_netif_common instead
+	// posibly not needed, becasue it checks only a flag
+	if (!netif_is_up(netif_default)) {
+		LOG(LOGD_DTN, LOG_CL_UDP, LOGL_WRN, "Network interface is down. Could not send udp data.");
+		return -5;
+	}
+
+	struct netbuf* const buf = netbuf_new();
+	if (buf == NULL) {
+		LOG(LOGD_DTN, LOG_CL_UDP, LOGL_ERR, "Not enough free memory for allocating a new netbuf.");
+		return -1;
+	}
+
+	/* The segment is only copied once, straight into the pbuf */
+	uint8_t* const data = netbuf_alloc(buf, header_length + length);
+	if (data == NULL) {
+		LOG(LOGD_DTN, LOG_CL_UDP, LOGL_ERR, "Not enough free memory for allocating a new pbuf.");
+		netbuf_delete(buf);
+		return -2;
+	}
+
+	memcpy(data, header, header_length);
+	if (bundle_cursor_read(cursor, data + header_length, length) != length) {
+		LOG(LOGD_DTN, LOG_CL_UDP, LOGL_ERR, "Bundle segment is behind the end of the bundle.");
+		netbuf_delete(buf);
+		return -3;
+	}
+
+	const err_t err = netconn_sendto(bundle_conn, buf, (ip_addr_t*)addr, CL_UDP_BUNDLE_PORT);
+	if (err != ERR_OK) {
+		LOG(LOGD_DTN, LOG_CL_UDP, LOGL_WRN, "Could not send data. Buffer is not existing. (err %d)", err);
+		netbuf_delete(buf);
+		return -4;
+	}
+
+	netbuf_delete(buf);
+	return 0;
+}
+
+
 /**
  * @brief convergence_layer_udp_init initializes all components for the UDP-CL
  * @return true on success
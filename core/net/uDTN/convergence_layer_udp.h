@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <lwip/ip_addr.h>
 
+#include "bundle.h"
+
 
 #define UDP_DISCOVERY_ANNOUNCEMENT		1
 
@@ -23,6 +25,8 @@ ip_addr_t udp_mcast_addr;
 int convergence_layer_udp_init(void);
 int convergence_layer_udp_send_data(const ip_addr_t* const addr, const uint8_t* const payload, const size_t length,
 									const uint8_t* const payload2, const size_t length2);
+int convergence_layer_udp_send_bundle(const ip_addr_t* const addr, const uint8_t* const header, const size_t header_length,
+									  struct bundle_cursor_t* const cursor, const size_t length);
 
 #ifdef UDP_DISCOVERY_ANNOUNCEMENT
 int convergence_layer_udp_send_discovery(const uint8_t* const payload, const size_t length);
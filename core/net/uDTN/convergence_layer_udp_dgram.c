@@ -27,7 +27,9 @@ typedef enum
 	SEGMENT_FIRST = 0x02,
 	SEGMENT_LAST = 0x01,
 	SEGMENT_MIDDLE = 0x00,
-	NACK_TEMPORARY = 0x04
+	NACK_TEMPORARY = 0x04,
+	/* uDTN only: the sender has a window, so the ACK may be delayed */
+	SEGMENT_WINDOW = 0x08
 } HEADER_FLAGS;
 
 
@@ -47,16 +49,21 @@ static int convergence_layer_udp_dgram_init()
 }
 
 
-static inline int convergence_layer_udp_dgram_send(const ip_addr_t* const ip, const HEADER_TYPES type, const int sequence_number, const HEADER_FLAGS flags,
-											const uint8_t* const payload, const size_t length, const void* const reference)
+static inline void convergence_layer_udp_dgram_build_header(uint8_t* const buffer, const HEADER_TYPES type, const int sequence_number, const HEADER_FLAGS flags)
 {
 	// TODO use structure for package building
-	uint8_t buffer[sizeof(struct udp_dgram_hdr)];
-
 	/* Discovery Prefix */
 	buffer[0] = type;
 	/* flags (4-bit) + seqno (4-bit) */
 	buffer[1] = ((flags << 4) & 0xF0) | (sequence_number & 0x0F);
+}
+
+
+static inline int convergence_layer_udp_dgram_send(const ip_addr_t* const ip, const HEADER_TYPES type, const int sequence_number, const HEADER_FLAGS flags,
+											const uint8_t* const payload, const size_t length, const void* const reference)
+{
+	uint8_t buffer[sizeof(struct udp_dgram_hdr)];
+	convergence_layer_udp_dgram_build_header(buffer, type, sequence_number, flags);
 
 	/* Send it out via the MAC */
 	const int ret = convergence_layer_udp_send_data(ip, buffer, sizeof(buffer), payload, length);
@@ -94,7 +101,8 @@ static int convergence_layer_udp_dgram_send_discovery(const uint8_t* const paylo
 }
 
 
-static int convergence_layer_udp_dgram_send_ack(const cl_addr_t* const dest, const int sequence_number, const int type, const void* const reference)
+static int convergence_layer_udp_dgram_send_ack(const cl_addr_t* const dest, const int sequence_number, const int type,
+											const uint8_t* const payload, const size_t length, const void* const reference)
 {
 	configASSERT(dest->clayer == &clayer_udp_dgram);
 
@@ -119,26 +127,43 @@ static int convergence_layer_udp_dgram_send_ack(const cl_addr_t* const dest, con
 	}
 
 	// TODO use the port, too, because other nodes can use other ports
-	return convergence_layer_udp_dgram_send(&dest->ip, header_type, sequence_number, header_flags, NULL, 0, reference);
+	return convergence_layer_udp_dgram_send(&dest->ip, header_type, sequence_number, header_flags, payload, length, reference);
 }
 
 
 static int convergence_layer_udp_dgram_send_bundle(const cl_addr_t* const dest, const int sequence_number, const uint8_t flags,
-											const uint8_t* const payload, const size_t length, const void* const reference)
+											struct bundle_cursor_t* const cursor, const size_t length, const void* const reference)
 {
 	configASSERT(dest->clayer == &clayer_udp_dgram);
 
 	/* sending an package over ethernet */
 	LED_On(LED_ORANGE);
 
-	const HEADER_FLAGS header_flags = flags;
+	uint8_t buffer[sizeof(struct udp_dgram_hdr)];
+	/* convert dgram:lowpan flags to dgram:udp flags */
+	HEADER_FLAGS header_flags = SEGMENT_MIDDLE;
+	if (flags & CONVERGENCE_LAYER_FLAGS_FIRST) {
+		header_flags |= SEGMENT_FIRST;
+	}
+	if (flags & CONVERGENCE_LAYER_FLAGS_LAST) {
+		header_flags |= SEGMENT_LAST;
+	}
+	if (flags & CONVERGENCE_LAYER_FLAGS_WINDOW) {
+		header_flags |= SEGMENT_WINDOW;
+	}
+	convergence_layer_udp_dgram_build_header(buffer, HEADER_SEGMENT, sequence_number, header_flags);
+
+	/* The segment is read from the cursor straight into the pbuf */
 	// TODO use the port, too, because other nodes can use other ports
-	const int ret =  convergence_layer_udp_dgram_send(&dest->ip, HEADER_SEGMENT, sequence_number, header_flags, payload, length, reference);
+	const int ret = convergence_layer_udp_send_bundle(&dest->ip, buffer, sizeof(buffer), cursor, length);
+
+	const uint8_t status = (ret < 0) ? CONVERGENCE_LAYER_STATUS_NOSEND : CONVERGENCE_LAYER_STATUS_OK;
+	convergence_layer_dgram_status(reference, status);
 
 	/* package over ethernet sent */
 	LED_Off(LED_ORANGE);
 
-	return ret;
+	return 1;
 }
 
 
@@ -165,6 +190,9 @@ static int convergence_layer_udp_dgram_incoming_frame(const cl_addr_t* const sou
 	if (header_flags & SEGMENT_LAST) {
 		flags |= CONVERGENCE_LAYER_FLAGS_LAST;
 	}
+	if (header_flags & SEGMENT_WINDOW) {
+		flags |= CONVERGENCE_LAYER_FLAGS_WINDOW;
+	}
 	if (header_flags & NACK_TEMPORARY) {
 		/* overwrite, because only one type is possible */
 		flags = CONVERGENCE_LAYER_FLAGS_FIRST;
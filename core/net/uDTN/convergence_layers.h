@@ -3,6 +3,7 @@
 
 #include "net/packetbuf.h"
 #include "cl_address.h"
+#include "bundle.h"
 
 
 /**
@@ -27,10 +28,13 @@ struct convergence_layer {
 
 	int (* const send_discovery)(const uint8_t* const payload, const size_t length);
 
-	int (* const send_ack)(const cl_addr_t* const dest, const int seqno, const int type, const void* const reference);
+	/* the payload carries the options of an ACK, see CONVERGENCE_LAYER_OPTION_* */
+	int (* const send_ack)(const cl_addr_t* const dest, const int seqno, const int type,
+						const uint8_t* const payload, const size_t length, const void* const reference);
 
+	/* reads the next length bytes of the encoded bundle from cursor into the outgoing frame */
 	int (* const send_bundle)(const cl_addr_t* const dest, const int seqno, const uint8_t flags,
-						const uint8_t* const payload, const size_t length, const void* const reference);
+						struct bundle_cursor_t* const cursor, const size_t length, const void* const reference);
 
 	int (* const input)(const cl_addr_t* const source, const uint8_t* const payload, const size_t length, const packetbuf_attr_t rssi);
 };
@@ -43,7 +43,7 @@
 #define FLASH_WRITE_PAGE(page, offset, buffer, length)
 #define FLASH_READ_PAGE(page, offset, buffer, length)
 #define FLASH_ERASE_PAGE(page)
-#define FLASH_PAGE_SIZE									8UL
+#define FLASH_PAGE_SIZE									256UL
 #define FLASH_PAGE_OFFSET								0UL
 #define FLASH_PAGES 									512UL
 
@@ -25,6 +25,7 @@
 
 #include "bundle.h"
 #include "storage.h"
+#include "storage_query.h"
 #include "sdnv.h"
 #include "agent.h"
 #include "discovery.h"
@@ -74,14 +75,21 @@ int routing_null_send_bundle(uint32_t bundle_number, linkaddr_t * neighbour)
 	return 1;
 }
 
+/**
+ * Matches all stored bundles, the storage answers it without reading them
+ */
+static const struct storage_query_t routing_null_query_all = {
+	.fields = 0,
+};
+
 void routing_null_new_neighbour(linkaddr_t *dest)
 {
 	struct storage_entry_t * entry = NULL;
 
 	/* Send all known bundles to that neighbour */
-	for( entry = BUNDLE_STORAGE.get_bundles();
+	for( entry = BUNDLE_STORAGE.query_bundles(&routing_null_query_all, NULL);
 			entry != NULL;
-			entry = list_item_next(entry) ) {
+			entry = BUNDLE_STORAGE.query_bundles(&routing_null_query_all, entry) ) {
 		/* Queue bundle for transmission */
 		routing_null_send_bundle(entry->bundle_num, dest);
 	}
@@ -98,9 +106,9 @@ void routing_null_send_to_known_neighbours(void)
 		 nei_l = list_item_next(nei_l) ) {
 
 		/* Send all known bundles to that neighbour */
-		for( entry = BUNDLE_STORAGE.get_bundles();
+		for( entry = BUNDLE_STORAGE.query_bundles(&routing_null_query_all, NULL);
 				entry != NULL;
-				entry = list_item_next(entry) ) {
+				entry = BUNDLE_STORAGE.query_bundles(&routing_null_query_all, entry) ) {
 
 			/* Queue bundle for transmission */
 			routing_null_send_bundle(entry->bundle_num, &nei_l->neighbour);
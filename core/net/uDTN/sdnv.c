@@ -24,99 +24,122 @@
 #define MAX_LENGTH 5
 #define MAX_LENGTH_LONG 10
 
-int sdnv_encode_long(uint64_t val, uint8_t* bp, size_t len)
+/**
+ * \brief writes the sdnv bytes of a value with a known encoding length
+ * \param val value to be encoded
+ * \param bp pointer to sdnv
+ * \param val_len length of sdnv
+ */
+static inline void sdnv_encode_bytes(uint64_t val, uint8_t* bp, size_t val_len)
 {
-	size_t val_len = 0;
-	uint32_t tmp = val;
-
-	do {
-		tmp = tmp >> 7;
-		val_len++;
-	} while (tmp != 0);
+	/* last octet without the high bit */
+	bp[--val_len] = val & 0x7f;
+	while (val_len > 0) {
+		val = val >> 7;
+		bp[--val_len] = 0x80 | (val & 0x7f);
+	}
+}
 
+int sdnv_encode_long(uint64_t val, uint8_t* bp, size_t len)
+{
+	/* fast paths for short values */
+	if (val < 0x80 && len >= 1) {
+		bp[0] = val;
+		return 1;
+	}
+	if (val < 0x4000 && len >= 2) {
+		bp[0] = 0x80 | (val >> 7);
+		bp[1] = val & 0x7f;
+		return 2;
+	}
 
+	const size_t val_len = sdnv_encoding_len_long(val);
 	if (len < val_len) {
 		return -1;
 	}
 
-	bp += val_len;
-	uint8_t high_bit = 0; // for the last octet
-	do {
-		--bp;
-		*bp = (uint8_t)(high_bit | (val & 0x7f));
-		high_bit = (1 << 7); // for all but the last octet
-		val = val >> 7;
-	} while (val != 0);
+	sdnv_encode_bytes(val, bp, val_len);
 
 	return val_len;
 }
 
 int sdnv_encode(uint32_t val, uint8_t* bp, size_t len)
 {
-	size_t val_len = 0;
-	uint32_t tmp = val;
-
-	do {
-		tmp = tmp >> 7;
-		val_len++;
-	} while (tmp != 0);
-
+	/* fast paths for short values */
+	if (val < 0x80 && len >= 1) {
+		bp[0] = val;
+		return 1;
+	}
+	if (val < 0x4000 && len >= 2) {
+		bp[0] = 0x80 | (val >> 7);
+		bp[1] = val & 0x7f;
+		return 2;
+	}
 
+	const size_t val_len = sdnv_encoding_len(val);
 	if (len < val_len) {
 		return -1;
 	}
 
-	bp += val_len;
-	uint8_t high_bit = 0; // for the last octet
-	do {
-		--bp;
-		*bp = (uint8_t)(high_bit | (val & 0x7f));
-		high_bit = (1 << 7); // for all but the last octet
-		val = val >> 7;
-	} while (val != 0);
+	sdnv_encode_bytes(val, bp, val_len);
 
 	return val_len;
 }
 
-size_t sdnv_encoding_len_long(uint64_t val)
+int sdnv_encode_fixed(uint64_t val, uint8_t* bp, size_t width)
 {
-	size_t val_len = 0;
+	if (width < 1 || sdnv_encoding_len_long(val) > width) {
+		return -1;
+	}
 
-	do {
-		val = val >> 7;
-		val_len++;
-	} while (val != 0);
+	/* the unused high octets become 0x80 */
+	sdnv_encode_bytes(val, bp, width);
 
-	return val_len;
+	return width;
+}
+
+size_t sdnv_encoding_len_long(uint64_t val)
+{
+	if (val < 0x80) {
+		return 1;
+	}
+
+	/* 7 value bits per octet */
+	return (64 - __builtin_clzll(val) + 6) / 7;
 }
 
 size_t sdnv_encoding_len(uint32_t val)
 {
-	size_t val_len = 0;
-	//	printf("val %lu ptr %p\n ",val,&val);
-	do {
-		val = val >> 7;
-		val_len++;
-	} while (val != 0);
+	if (val < 0x80) {
+		return 1;
+	}
 
-	return val_len;
+	/* 7 value bits per octet */
+	return (32 - __builtin_clz(val) + 6) / 7;
 }
 
 int sdnv_decode_long(const uint8_t* bp, size_t len, uint64_t* val)
 {
 	const uint8_t* start = bp;
 	size_t val_len = 0;
-	*val = 0;
-
-	LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "sdnv_decode");
 
 	if (!val) {
 		LOG(LOGD_DTN, LOG_SDNV, LOGL_ERR, "SDNV: NULL pointer");
 		return -1;
 	}
 
+	/* fast paths for short values */
+	if (len >= 1 && !(bp[0] & 0x80)) {
+		*val = bp[0];
+		return 1;
+	}
+	if (len >= 2 && !(bp[1] & 0x80)) {
+		*val = ((bp[0] & 0x7f) << 7) | bp[1];
+		return 2;
+	}
+
+	*val = 0;
 	do {
-		LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "SDNV: len: %u", len);
 		if (len == 0){
 			LOG(LOGD_DTN, LOG_SDNV, LOGL_ERR, "SDNV: buffer too short");
 			return sdnv_len(start); // buffer too short
@@ -138,28 +161,32 @@ int sdnv_decode_long(const uint8_t* bp, size_t len, uint64_t* val)
 		return sdnv_len(start);
 	}
 
-	LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "SDNV: val: %lu", *val);
 	return val_len;
 }
 
 int sdnv_decode(const uint8_t* bp, size_t len, uint32_t* val)
 {
-	configASSERT(IS_RAM(bp) && IS_RAM(val));
-
-	LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "sdnv_decode(in %p, len %lu, out %p)", bp, len, val);
 	const uint8_t* start = bp;
 	if (!val) {
 		LOG(LOGD_DTN, LOG_SDNV, LOGL_ERR, "SDNV: NULL pointer");
 		return -1;
 	}
 
+	/* fast paths for short values */
+	if (len >= 1 && !(bp[0] & 0x80)) {
+		*val = bp[0];
+		return 1;
+	}
+	if (len >= 2 && !(bp[1] & 0x80)) {
+		*val = ((bp[0] & 0x7f) << 7) | bp[1];
+		return 2;
+	}
+
 	size_t val_len = 0;
 	*val = 0;
 	do {
-		LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "SDNV: len: %u", len);
 		if (len == 0){
 			LOG(LOGD_DTN, LOG_SDNV, LOGL_ERR, "SDNV: buffer too short");
-			val = 0;
 			return sdnv_len(start); // buffer too short
 		}
 		*val = (*val << 7) | (*bp & 0x7f);
@@ -184,10 +211,43 @@ int sdnv_decode(const uint8_t* bp, size_t len, uint32_t* val)
 		return sdnv_len(start);
 	}
 
-	LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "SDNV: val: %lu", *val);
 	return val_len;
 }
 
+int sdnv_decode_array(const uint8_t* bp, size_t len, uint64_t* vals, size_t count)
+{
+	size_t offs = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		/* fast path for single octet values */
+		if (offs < len && !(bp[offs] & 0x80)) {
+			vals[i] = bp[offs++];
+			continue;
+		}
+
+		const size_t start = offs;
+		uint64_t val = 0;
+		do {
+			if (offs >= len || offs - start >= MAX_LENGTH_LONG) {
+				LOG(LOGD_DTN, LOG_SDNV, LOGL_ERR, "SDNV: field %u is too long or truncated", i);
+				return -1;
+			}
+			val = (val << 7) | (bp[offs] & 0x7f);
+		} while (bp[offs++] & 0x80);
+
+		/* more than 64 value bits */
+		if (offs - start == MAX_LENGTH_LONG && bp[start] > 0x81) {
+			LOG(LOGD_DTN, LOG_SDNV, LOGL_ERR, "SDNV: field %u has more than 64 bits", i);
+			return -1;
+		}
+
+		vals[i] = val;
+	}
+
+	return offs;
+}
+
 size_t sdnv_len(const uint8_t* bp)
 {
 	size_t val_len = 1;
@@ -42,6 +42,15 @@ int sdnv_encode_long(uint64_t val, uint8_t * bp, size_t len);
  */
 int sdnv_encode(uint32_t val, uint8_t * bp, size_t len);
 
+/**
+ * \brief encodes a value in sdnv with a fixed length
+ * \param val value to be encoded
+ * \param bp pointer to sdnv
+ * \param width length of the sdnv, leading octets are padded with 0x80
+ * \return width or -1 if the value does not fit
+ */
+int sdnv_encode_fixed(uint64_t val, uint8_t * bp, size_t width);
+
 /** 
  * \brief calculates the length needed to encode an uint64 value in sdnv
  * \param val value to be encoded
@@ -74,6 +83,16 @@ int sdnv_decode_long(const uint8_t * bp, size_t len, uint64_t * val);
  */
 int sdnv_decode(const uint8_t * bp, size_t len, uint32_t * val);
 
+/**
+ * \brief decodes consecutive sdnvs in one pass
+ * \param bp pointer to the first sdnv
+ * \param len length of the buffer
+ * \param vals array, which receives count values
+ * \param count number of sdnvs to decode
+ * \return number of bytes decoded or -1 if a sdnv is truncated or longer than 64 bit
+ */
+int sdnv_decode_array(const uint8_t * bp, size_t len, uint64_t * vals, size_t count);
+
 /**
  * \brief calculates the length of a sdnv
  * \param bp pointer to sdnv
@@ -66,6 +66,7 @@
 
 /**
  * Should the storage run out if space, what shall we do?
+ * This is the policy after startup, it can be changed with storage_eviction_set_policy()
  */
 // Options
 #define BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDER 1
@@ -91,6 +92,9 @@ struct storage_entry_t {
 	uint32_t bundle_num;
 };
 
+struct storage_query_t;
+struct storage_eviction_node_t;
+
 /** storage module interface  */
 struct storage_driver {
 	char *name;
@@ -113,10 +117,18 @@ struct storage_driver {
 	uint16_t (* get_bundle_num)(void);
 	/** returns pointer to list of bundles */
 	struct storage_entry_t * (* get_bundles)(void);
+	/** returns the next bundle behind previous (or the first one if previous is NULL), which matches the query */
+	struct storage_entry_t * (* query_bundles)(const struct storage_query_t * const query, const struct storage_entry_t * const previous);
+	/** copies priority, reception time and expiration of a bundle into eviction and its destination into dst_node, without reading it */
+	uint8_t (* describe_bundle)(uint32_t bundle_num, struct storage_eviction_node_t * const eviction, uint32_t * const dst_node);
 	/** block until the count of saved bundles has changed */
 	void (* const wait_for_changes)(void);
 	/** initializes the underlying medium to delete everything */
 	int (* format)();
+	/** block until all saved bundles have been written to the medium */
+	void (* flush)(void);
+	/** saves a bundle, which is not read soon, so it is not kept in RAM after being written */
+	uint8_t (* demote_bundle)(struct mmem* const bundlemem, uint32_t* const bundle_number);
 };
 extern const struct storage_driver BUNDLE_STORAGE;
 #endif
@@ -0,0 +1,156 @@
+/**
+ * \addtogroup storage_cache
+ * @{
+ */
+
+/**
+ * \file
+ * \brief LRU cache of bundles, which were read from a persistent storage
+ */
+
+#include <string.h>
+
+#include "bundle.h"
+
+#include "storage_cache.h"
+
+/** Lookups of all caches, which found the bundle */
+static uint32_t storage_cache_hits = 0;
+
+/** Lookups of all caches, which did not find the bundle */
+static uint32_t storage_cache_misses = 0;
+
+/**
+ * \brief Releases the bundle of an entry
+ */
+static void storage_cache_drop(struct storage_cache_t * const cache, struct storage_cache_entry_t * const entry)
+{
+	cache->used -= entry->size;
+	bundle_decrement(entry->bundlemem);
+	entry->bundlemem = NULL;
+}
+
+/**
+ * \brief Finds the entry of a bundle
+ * \return the entry or NULL
+ */
+static struct storage_cache_entry_t * storage_cache_find(struct storage_cache_t * const cache, const uint32_t bundle_num)
+{
+	for (int i = 0; i < cache->size; i++) {
+		if (cache->entries[i].bundlemem != NULL && cache->entries[i].bundle_num == bundle_num) {
+			return &cache->entries[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Finds the least recently used entry
+ * \param unused returns an unused entry or NULL if all are used
+ * \return the entry or NULL if the cache is empty
+ */
+static struct storage_cache_entry_t * storage_cache_lru(struct storage_cache_t * const cache, struct storage_cache_entry_t ** const unused)
+{
+	struct storage_cache_entry_t * lru = NULL;
+
+	*unused = NULL;
+
+	for (int i = 0; i < cache->size; i++) {
+		struct storage_cache_entry_t * const entry = &cache->entries[i];
+
+		if (entry->bundlemem == NULL) {
+			*unused = entry;
+		} else if (lru == NULL || entry->last_use < lru->last_use) {
+			lru = entry;
+		}
+	}
+
+	return lru;
+}
+
+void storage_cache_init(struct storage_cache_t * const cache)
+{
+	memset(cache->entries, 0, cache->size * sizeof(struct storage_cache_entry_t));
+	cache->used = 0;
+	cache->clock = 0;
+}
+
+void storage_cache_clear(struct storage_cache_t * const cache)
+{
+	for (int i = 0; i < cache->size; i++) {
+		if (cache->entries[i].bundlemem != NULL) {
+			storage_cache_drop(cache, &cache->entries[i]);
+		}
+	}
+}
+
+struct mmem * storage_cache_get(struct storage_cache_t * const cache, const uint32_t bundle_num)
+{
+	struct storage_cache_entry_t * const entry = storage_cache_find(cache, bundle_num);
+
+	if (entry == NULL) {
+		storage_cache_misses++;
+		return NULL;
+	}
+
+	storage_cache_hits++;
+	entry->last_use = ++cache->clock;
+	bundle_increment(entry->bundlemem);
+
+	return entry->bundlemem;
+}
+
+int storage_cache_put(struct storage_cache_t * const cache, const uint32_t bundle_num, struct mmem * const bundlemem)
+{
+	struct storage_cache_entry_t * entry = storage_cache_find(cache, bundle_num);
+
+	if (entry != NULL) {
+		storage_cache_drop(cache, entry);
+	}
+
+	/* The blocks are held in their own MMEM chunks and count as well */
+	const uint32_t size = bundle_get_size(bundlemem);
+
+	if (cache->size == 0 || size > cache->budget) {
+		return 0;
+	}
+
+	/* Drop the least recently used bundles, until the new one fits */
+	struct storage_cache_entry_t * unused = NULL;
+	for (;;) {
+		entry = storage_cache_lru(cache, &unused);
+		if (unused != NULL && cache->used + size <= cache->budget) {
+			break;
+		}
+
+		storage_cache_drop(cache, entry);
+	}
+	entry = unused;
+
+	bundle_increment(bundlemem);
+	entry->bundle_num = bundle_num;
+	entry->bundlemem = bundlemem;
+	entry->size = size;
+	entry->last_use = ++cache->clock;
+	cache->used += entry->size;
+
+	return 1;
+}
+
+void storage_cache_remove(struct storage_cache_t * const cache, const uint32_t bundle_num)
+{
+	struct storage_cache_entry_t * const entry = storage_cache_find(cache, bundle_num);
+
+	if (entry != NULL) {
+		storage_cache_drop(cache, entry);
+	}
+}
+
+void storage_cache_get_counters(uint32_t * const hits, uint32_t * const misses)
+{
+	*hits = storage_cache_hits;
+	*misses = storage_cache_misses;
+}
+
+/** @} */
@@ -0,0 +1,116 @@
+/**
+ * \addtogroup bundle_storage
+ * @{
+ */
+
+/**
+ * \defgroup storage_cache Read cache for storage modules
+ *
+ * @{
+ */
+
+/**
+ * \file
+ * \brief LRU cache of bundles, which were read from a persistent storage
+ *
+ * The cache keeps a reference to each cached bundle and hands out further
+ * references, so that all readers share the same MMEM block.
+ * The number of bundles and the MMEM used by them are limited.
+ * If a bundle does not fit, the least recently used bundles are dropped.
+ * A cached bundle is only freed, when its last reader has released it.
+ *
+ * The cache does not lock, the storage module has to serialise the calls.
+ */
+
+#ifndef __STORAGE_CACHE_H__
+#define __STORAGE_CACHE_H__
+
+#include <stdint.h>
+
+#include "sys/cc.h"
+#include "lib/mmem.h"
+
+/**
+ * \brief Declares a cache for up to num bundles, which use up to bytes of MMEM
+ */
+#define STORAGE_CACHE(name, num, bytes) \
+		static struct storage_cache_entry_t CC_CONCAT(name,_cache_entries)[num]; \
+		static struct storage_cache_t name = {num, bytes, 0, 0, CC_CONCAT(name,_cache_entries)}
+
+struct storage_cache_entry_t {
+	uint32_t bundle_num;
+
+	/** cached bundle or NULL if the entry is unused */
+	struct mmem * bundlemem;
+
+	/** MMEM in bytes, which was used by the bundle and its blocks when it was added */
+	uint32_t size;
+
+	/** value of the use counter of the cache at the last access */
+	uint32_t last_use;
+};
+
+struct storage_cache_t {
+	/** number of entries */
+	uint16_t size;
+
+	/** MMEM in bytes, which can be used by the cached bundles */
+	uint32_t budget;
+
+	/** MMEM in bytes, which is used by the cached bundles */
+	uint32_t used;
+
+	/** counts the accesses to order the entries */
+	uint32_t clock;
+
+	struct storage_cache_entry_t * entries;
+};
+
+/**
+ * \brief Empties the cache without releasing the bundles, only used at startup
+ * \param cache the cache
+ */
+void storage_cache_init(struct storage_cache_t * const cache);
+
+/**
+ * \brief Releases all cached bundles
+ * \param cache the cache
+ */
+void storage_cache_clear(struct storage_cache_t * const cache);
+
+/**
+ * \brief Looks up a bundle and counts a hit or a miss
+ * \param cache the cache
+ * \param bundle_num bundle number
+ * \return a new reference to the bundle (caller has to free) or NULL
+ */
+struct mmem * storage_cache_get(struct storage_cache_t * const cache, const uint32_t bundle_num);
+
+/**
+ * \brief Adds a bundle to the cache
+ *
+ * The cache takes its own reference, the one of the caller is kept.
+ * \param cache the cache
+ * \param bundle_num bundle number
+ * \param bundlemem pointer to the MMEM struct containing the bundle
+ * \return 1 if the bundle was added, 0 if it is bigger than the budget
+ */
+int storage_cache_put(struct storage_cache_t * const cache, const uint32_t bundle_num, struct mmem * const bundlemem);
+
+/**
+ * \brief Drops a bundle from the cache, e.g. because it was deleted
+ * \param cache the cache
+ * \param bundle_num bundle number
+ */
+void storage_cache_remove(struct storage_cache_t * const cache, const uint32_t bundle_num);
+
+/**
+ * \brief Gets the number of hits and misses of all caches since startup
+ * \param hits returns the number of lookups, which found the bundle
+ * \param misses returns the number of lookups, which did not find the bundle
+ */
+void storage_cache_get_counters(uint32_t * const hits, uint32_t * const misses);
+
+#endif /* __STORAGE_CACHE_H__ */
+/** @} */
+/** @} */
@@ -0,0 +1,177 @@
+/**
+ * \addtogroup storage_eviction
+ * @{
+ */
+
+/**
+ * \file
+ * \brief Chooses the stored bundle, which is deleted to make room for a new one
+ */
+
+#include "lib/logging.h"
+
+#include "bundle.h"
+#include "agent.h"
+#include "storage_expiry.h"
+
+#include "storage_eviction.h"
+
+/**
+ * Bits of the key, which are used for the order within a priority class.
+ * The priority class is stored in the upper bits.
+ */
+#define STORAGE_EVICTION_ORDER_BITS		30
+#define STORAGE_EVICTION_ORDER_MASK		((1UL << STORAGE_EVICTION_ORDER_BITS) - 1)
+
+static uint8_t storage_eviction_policy = BUNDLE_STORAGE_BEHAVIOUR;
+
+/**
+ * \brief Calculates the key of a node for the current policy
+ *
+ * The lowest priority class comes first,
+ * within a class the next victim of the policy.
+ */
+static uint32_t storage_eviction_key(const struct storage_eviction_node_t * const node, const uint8_t policy)
+{
+	uint32_t order = 0;
+
+	switch (policy) {
+		case BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDEST:
+			order = node->received;
+			break;
+		case BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGEST:
+			order = ~node->received;
+			break;
+		case BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDER:
+			order = node->expiration;
+			break;
+		case BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGER:
+			order = ~node->expiration;
+			break;
+		default:
+			break;
+	}
+
+	return ((uint32_t) node->priority << STORAGE_EVICTION_ORDER_BITS) | (order & STORAGE_EVICTION_ORDER_MASK);
+}
+
+/**
+ * \brief Orders the heap for the current policy, if it was changed since the last use
+ */
+static void storage_eviction_update(struct storage_eviction_t * const eviction)
+{
+	const uint8_t policy = storage_eviction_policy;
+
+	if (eviction->policy == policy) {
+		return;
+	}
+
+	for (int i = 0; i < eviction->heap.count; i++) {
+		struct storage_eviction_node_t * const node = (struct storage_eviction_node_t *) eviction->heap.nodes[i];
+		node->key = storage_eviction_key(node, policy);
+	}
+	storage_heap_rebuild(&eviction->heap);
+
+	eviction->policy = policy;
+}
+
+int storage_eviction_set_policy(const uint8_t policy)
+{
+	switch (policy) {
+		case BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDER:
+		case BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGER:
+		case BUNDLE_STORAGE_BEHAVIOUR_DO_NOT_DELETE:
+		case BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDEST:
+		case BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGEST:
+			break;
+		default:
+			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Unknown eviction policy %u", policy);
+			return -1;
+	}
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Eviction policy %u", policy);
+	storage_eviction_policy = policy;
+
+	return 1;
+}
+
+uint8_t storage_eviction_get_policy(void)
+{
+	return storage_eviction_policy;
+}
+
+void storage_eviction_init(struct storage_eviction_t * const eviction)
+{
+	storage_heap_init(&eviction->heap);
+	eviction->policy = storage_eviction_policy;
+}
+
+void storage_eviction_describe(struct storage_eviction_node_t * const node, struct mmem * const bundlemem, const uint32_t expiration)
+{
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+
+	node->priority = (bundle->flags & BUNDLE_PRIORITY_MASK) >> 7;
+	node->received = storage_expiry_now();
+	node->expiration = expiration;
+}
+
+void storage_eviction_copy(struct storage_eviction_node_t * const node, const struct storage_eviction_node_t * const other)
+{
+	node->priority = other->priority;
+	node->received = other->received;
+	node->expiration = other->expiration;
+}
+
+int storage_eviction_add(struct storage_eviction_t * const eviction, struct storage_eviction_node_t * const node)
+{
+	storage_eviction_update(eviction);
+
+	node->key = storage_eviction_key(node, eviction->policy);
+
+	return storage_heap_add(&eviction->heap, (struct storage_heap_node_t *) node);
+}
+
+void storage_eviction_remove(struct storage_eviction_t * const eviction, struct storage_eviction_node_t * const node)
+{
+	storage_heap_remove(&eviction->heap, (struct storage_heap_node_t *) node);
+}
+
+struct storage_eviction_node_t * storage_eviction_victim(struct storage_eviction_t * const eviction, const struct storage_eviction_node_t * const incoming)
+{
+	storage_eviction_update(eviction);
+
+	if (eviction->policy == BUNDLE_STORAGE_BEHAVIOUR_DO_NOT_DELETE) {
+		return NULL;
+	}
+
+	const struct storage_eviction_node_t * const victim = (struct storage_eviction_node_t *) storage_heap_first(&eviction->heap);
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	/* Always keep bundles with higher priority */
+	if (victim->priority > incoming->priority) {
+		return NULL;
+	}
+
+	switch (eviction->policy) {
+		case BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDER:
+			/* Only delete a bundle, which expires before the new one */
+			if (victim->expiration > incoming->expiration) {
+				return NULL;
+			}
+			break;
+		case BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGER:
+			/* Only delete a bundle, which expires after the new one */
+			if (victim->expiration <= incoming->expiration) {
+				return NULL;
+			}
+			break;
+		default:
+			break;
+	}
+
+	return (struct storage_eviction_node_t *) victim;
+}
+
+/** @} */
@@ -0,0 +1,137 @@
+/**
+ * \addtogroup bundle_storage
+ * @{
+ */
+
+/**
+ * \defgroup storage_eviction Eviction of stored bundles
+ *
+ * @{
+ */
+
+/**
+ * \file
+ * \brief Chooses the stored bundle, which is deleted to make room for a new one
+ *
+ * The bundles, which may be deleted, are kept in a storage heap ordered by
+ * their priority class and an order depending on the eviction policy.
+ * The first bundle of the heap is the victim, so choosing it costs O(1)
+ * and deleting it O(log n).
+ *
+ * The policy is one of the BUNDLE_STORAGE_BEHAVIOUR_* values and can be
+ * changed at runtime. BUNDLE_STORAGE_BEHAVIOUR is used after startup.
+ * Each heap is reordered on its next use after the policy was changed.
+ */
+
+#ifndef __STORAGE_EVICTION_H__
+#define __STORAGE_EVICTION_H__
+
+#include <stdint.h>
+
+#include "lib/mmem.h"
+
+#include "storage.h"
+#include "storage_heap.h"
+
+/**
+ * \brief Declares the eviction heap for up to num bundles
+ */
+#define STORAGE_EVICTION(name, num) \
+		static struct storage_heap_node_t * CC_CONCAT(name,_eviction_nodes)[num]; \
+		static struct storage_eviction_t name = {{num, 0, CC_CONCAT(name,_eviction_nodes)}, 0}
+
+/**
+ * Gets the storage entry, in which the node is embedded as member
+ */
+#define storage_eviction_entry(node, type, member) \
+		storage_heap_entry(node, type, member)
+
+/**
+ * Node of the eviction heap
+ *
+ * The layout has to be compatible with struct storage_heap_node_t in storage_heap.h
+ */
+struct storage_eviction_node_t {
+	/** key of the heap, calculated from the fields below */
+	uint32_t key;
+
+	/** Position in the heap */
+	uint16_t position;
+
+	/** priority class of the bundle (0 = bulk to 2 = expedited) */
+	uint8_t priority;
+
+	/** Uptime in seconds at which the bundle was stored */
+	uint32_t received;
+
+	/** Uptime in seconds at which the bundle expires */
+	uint32_t expiration;
+};
+
+struct storage_eviction_t {
+	struct storage_heap_t heap;
+
+	/** Policy of the current order of the heap */
+	uint8_t policy;
+};
+
+/**
+ * \brief Changes the eviction policy
+ * \param policy one of BUNDLE_STORAGE_BEHAVIOUR_*
+ * \return 1 on success or -1 if the policy is unknown
+ */
+int storage_eviction_set_policy(const uint8_t policy);
+
+/**
+ * \brief Gets the eviction policy
+ * \return one of BUNDLE_STORAGE_BEHAVIOUR_*
+ */
+uint8_t storage_eviction_get_policy(void);
+
+/**
+ * \brief Removes all bundles from the heap
+ * \param eviction the eviction heap
+ */
+void storage_eviction_init(struct storage_eviction_t * const eviction);
+
+/**
+ * \brief Fills a node with the properties of a bundle
+ * \param node the node
+ * \param bundlemem pointer to the MMEM struct containing the bundle
+ * \param expiration uptime in seconds at which the bundle expires
+ */
+void storage_eviction_describe(struct storage_eviction_node_t * const node, struct mmem * const bundlemem, const uint32_t expiration);
+
+/**
+ * \brief Copies the properties of a bundle from the node of another heap
+ * \param node the node
+ * \param other node filled by storage_eviction_describe()
+ */
+void storage_eviction_copy(struct storage_eviction_node_t * const node, const struct storage_eviction_node_t * const other);
+
+/**
+ * \brief Makes a bundle available for eviction
+ * \param eviction the eviction heap
+ * \param node node embedded in the storage entry, filled by storage_eviction_describe()
+ * \return 1 on success or -1 if the heap is full
+ */
+int storage_eviction_add(struct storage_eviction_t * const eviction, struct storage_eviction_node_t * const node);
+
+/**
+ * \brief Protects a bundle from eviction, e.g. because it is deleted or locked
+ * \param eviction the eviction heap
+ * \param node node embedded in the storage entry
+ */
+void storage_eviction_remove(struct storage_eviction_t * const eviction, struct storage_eviction_node_t * const node);
+
+/**
+ * \brief Chooses the bundle, which should be deleted in favour of a new bundle
+ * \param eviction the eviction heap
+ * \param incoming node describing the new bundle
+ * \return the node of the bundle to delete or NULL if the new bundle should not be stored
+ */
+struct storage_eviction_node_t * storage_eviction_victim(struct storage_eviction_t * const eviction, const struct storage_eviction_node_t * const incoming);
+
+#endif /* __STORAGE_EVICTION_H__ */
+/** @} */
+/** @} */
@@ -0,0 +1,69 @@
+/**
+ * \addtogroup storage_expiry
+ * @{
+ */
+
+/**
+ * \file
+ * \brief Queue of the stored bundles ordered by their time of expiration
+ */
+
+#include "bundle.h"
+#include "bundle_ageing.h"
+#include "system_clock.h"
+
+#include "storage_expiry.h"
+
+void storage_expiry_init(struct storage_expiry_t * const queue)
+{
+	storage_heap_init(&queue->heap);
+}
+
+uint32_t storage_expiry_now(void)
+{
+	udtn_timeval_t tv;
+
+	udtn_uptime(&tv);
+
+	return tv.tv_sec;
+}
+
+uint32_t storage_expiry_of_bundle(struct mmem * const bundlemem)
+{
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	const uint32_t now = storage_expiry_now();
+	const uint32_t age = bundle_ageing_get_age(bundlemem) / 1000;
+
+	if (age >= bundle->lifetime) {
+		return now;
+	}
+
+	return now + (bundle->lifetime - age);
+}
+
+int storage_expiry_add(struct storage_expiry_t * const queue, struct storage_expiry_node_t * const node, const uint32_t expiration)
+{
+	node->expiration = expiration;
+
+	return storage_heap_add(&queue->heap, (struct storage_heap_node_t *) node);
+}
+
+void storage_expiry_remove(struct storage_expiry_t * const queue, struct storage_expiry_node_t * const node)
+{
+	storage_heap_remove(&queue->heap, (struct storage_heap_node_t *) node);
+}
+
+struct storage_expiry_node_t * storage_expiry_pop_expired(struct storage_expiry_t * const queue, const uint32_t now)
+{
+	struct storage_expiry_node_t * const node = (struct storage_expiry_node_t *) storage_heap_first(&queue->heap);
+
+	if (node == NULL || node->expiration > now) {
+		return NULL;
+	}
+
+	storage_expiry_remove(queue, node);
+
+	return node;
+}
+
+/** @} */
@@ -0,0 +1,109 @@
+/**
+ * \addtogroup bundle_storage
+ * @{
+ */
+
+/**
+ * \defgroup storage_expiry Bundle expiry queue for storage modules
+ *
+ * @{
+ */
+
+/**
+ * \file
+ * \brief Queue of the stored bundles ordered by their time of expiration
+ *
+ * The queue is a storage heap of nodes, which are embedded into the
+ * entries of the storage module. Finding the expired bundles costs O(log n) per expired bundle,
+ * instead of checking every stored bundle.
+ */
+
+#ifndef __STORAGE_EXPIRY_H__
+#define __STORAGE_EXPIRY_H__
+
+#include <stdint.h>
+
+#include "lib/mmem.h"
+
+#include "storage_heap.h"
+
+/**
+ * \brief Declares a queue for up to num bundles
+ *
+ * \code
+ * STORAGE_EXPIRY(bundle_expiry, BUNDLE_STORAGE_SIZE);
+ * \endcode
+ */
+#define STORAGE_EXPIRY(name, num) \
+		static struct storage_heap_node_t * CC_CONCAT(name,_expiry_nodes)[num]; \
+		static struct storage_expiry_t name = {{num, 0, CC_CONCAT(name,_expiry_nodes)}}
+
+/**
+ * Gets the storage entry, in which the node is embedded as member
+ */
+#define storage_expiry_entry(node, type, member) \
+		storage_heap_entry(node, type, member)
+
+/**
+ * Node of the queue
+ *
+ * The layout has to be compatible with struct storage_heap_node_t in storage_heap.h
+ */
+struct storage_expiry_node_t {
+	/** Uptime in seconds at which the bundle expires, the key of the heap */
+	uint32_t expiration;
+
+	/** Position in the heap */
+	uint16_t position;
+};
+
+struct storage_expiry_t {
+	struct storage_heap_t heap;
+};
+
+/**
+ * \brief Removes all nodes from the queue
+ * \param queue the queue
+ */
+void storage_expiry_init(struct storage_expiry_t * const queue);
+
+/**
+ * \brief Gets the current time of the queue
+ * \return uptime in seconds
+ */
+uint32_t storage_expiry_now(void);
+
+/**
+ * \brief Calculates the time of expiration of a bundle
+ * \param bundlemem pointer to the MMEM struct containing the bundle
+ * \return uptime in seconds at which the lifetime of the bundle is over
+ */
+uint32_t storage_expiry_of_bundle(struct mmem * const bundlemem);
+
+/**
+ * \brief Queues a node
+ * \param queue the queue
+ * \param node node embedded in the storage entry
+ * \param expiration uptime in seconds at which the bundle expires
+ * \return 1 on success or -1 if the queue is full
+ */
+int storage_expiry_add(struct storage_expiry_t * const queue, struct storage_expiry_node_t * const node, const uint32_t expiration);
+
+/**
+ * \brief Removes a node from the queue
+ * \param queue the queue
+ * \param node node embedded in the storage entry, may be not queued
+ */
+void storage_expiry_remove(struct storage_expiry_t * const queue, struct storage_expiry_node_t * const node);
+
+/**
+ * \brief Removes the next expired node from the queue
+ * \param queue the queue
+ * \param now current uptime in seconds
+ * \return the node or NULL if no queued bundle has expired yet
+ */
+struct storage_expiry_node_t * storage_expiry_pop_expired(struct storage_expiry_t * const queue, const uint32_t now);
+
+#endif /* __STORAGE_EXPIRY_H__ */
+/** @} */
+/** @} */
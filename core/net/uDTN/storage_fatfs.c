@@ -14,6 +14,28 @@
  * \author Timo Wischer <wischer@ibr.cs.tu-bs.de>
  * \author Georg von Zengen <vonzeng@ibr.cs.tu-bs.de>
  * \author Wolf-Bastian Poettner <poettner@ibr.cs.tu-bs.de>
+ *
+ * The bundles are appended as records to a fixed number of segment files,
+ * which are preallocated once. Saving a bundle writes into an already
+ * allocated region of a segment, deleting a bundle marks its record as dead.
+ * So the FAT and the directory are not changed for every bundle.
+ * Segments with many dead records are compacted by moving their live
+ * records to the active segment, afterwards the segment is reused.
+ *
+ * The metadata of all stored bundles is checkpointed into a manifest file,
+ * followed by a journal of the changes since the checkpoint. The writer
+ * keeps the manifest open and syncs the journal once per batch of jobs.
+ * At startup
+ * the bundles are restored from the manifest and only the records behind
+ * the known end of each segment have to be read.
+ *
+ * All writes to the SD card are done by a writer task. A saved bundle is
+ * kept in RAM and served from there, until the writer has appended it to
+ * a segment and has sent dtn_bundle_durable_event. So receiving bundles
+ * does not wait for the SD card. flush() waits for all queued writes.
+ *
+ * Recently read and written bundles are kept in a small read cache,
+ * so that sending a bundle to several neighbours reads it only once.
  */
 
 #include <stdlib.h>
@@ -21,6 +43,8 @@
 #include <string.h>
 
 #include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
 #include "semphr.h"
 #include "timers.h"
 #include "ff.h"
@@ -39,12 +63,110 @@
 #include "convergence_layer_dgram.h"
 
 #include "storage.h"
+#include "storage_index.h"
+#include "storage_expiry.h"
+#include "storage_eviction.h"
+#include "storage_cache.h"
+#include "storage_query.h"
 
 /**
  * How long can a filename possibly be?
  */
 #define STORAGE_FILE_NAME_LENGTH 	15
 
+/**
+ * Size of a segment file in bytes, has to be larger than the biggest bundle
+ */
+#ifdef STORAGE_FATFS_CONF_SEGMENT_SIZE
+#define STORAGE_FATFS_SEGMENT_SIZE STORAGE_FATFS_CONF_SEGMENT_SIZE
+#else
+#define STORAGE_FATFS_SEGMENT_SIZE (64 * 1024UL)
+#endif
+
+/**
+ * Number of segment files
+ */
+#ifdef STORAGE_FATFS_CONF_SEGMENTS
+#define STORAGE_FATFS_SEGMENTS STORAGE_FATFS_CONF_SEGMENTS
+#else
+#define STORAGE_FATFS_SEGMENTS 16
+#endif
+
+/**
+ * Segments are compacted in the background, if fewer segments are empty.
+ * One empty segment is always kept for the compaction.
+ */
+#ifdef STORAGE_FATFS_CONF_SEGMENTS_RESERVE
+#define STORAGE_FATFS_SEGMENTS_RESERVE STORAGE_FATFS_CONF_SEGMENTS_RESERVE
+#else
+#define STORAGE_FATFS_SEGMENTS_RESERVE 2
+#endif
+
+/**
+ * A new checkpoint is written, if the journal has more records
+ */
+#ifdef STORAGE_FATFS_CONF_JOURNAL_LENGTH
+#define STORAGE_FATFS_JOURNAL_LENGTH STORAGE_FATFS_CONF_JOURNAL_LENGTH
+#else
+#define STORAGE_FATFS_JOURNAL_LENGTH BUNDLE_STORAGE_SIZE
+#endif
+
+/**
+ * How many jobs can be queued for the writer task?
+ * New bundles are not accepted, while the queue is full.
+ */
+#ifdef STORAGE_FATFS_CONF_QUEUE_LENGTH
+#define STORAGE_FATFS_QUEUE_LENGTH STORAGE_FATFS_CONF_QUEUE_LENGTH
+#else
+#define STORAGE_FATFS_QUEUE_LENGTH 8
+#endif
+
+/**
+ * How many bundles and how much MMEM in bytes can be used by the read cache?
+ */
+#ifdef STORAGE_FATFS_CONF_CACHE_BUNDLES
+#define STORAGE_FATFS_CACHE_BUNDLES STORAGE_FATFS_CONF_CACHE_BUNDLES
+#else
+#define STORAGE_FATFS_CACHE_BUNDLES 4
+#endif
+
+#ifdef STORAGE_FATFS_CONF_CACHE_BYTES
+#define STORAGE_FATFS_CACHE_BYTES STORAGE_FATFS_CONF_CACHE_BYTES
+#else
+#define STORAGE_FATFS_CACHE_BYTES 4096
+#endif
+
+/**
+ * Magic numbers of the headers in a segment file and the manifest.
+ * The magic of the manifest changes with the layout of its entries.
+ */
+#define STORAGE_FATFS_MAGIC_SEGMENT		0x47455375UL
+#define STORAGE_FATFS_MAGIC_LIVE		0x45564C75UL
+#define STORAGE_FATFS_MAGIC_DEAD		0x44414475UL
+#define STORAGE_FATFS_MAGIC_MANIFEST	0x32414D75UL
+
+/**
+ * File names of the manifest and of a checkpoint, which is being written
+ */
+#define STORAGE_FATFS_MANIFEST			"manifest.bin"
+#define STORAGE_FATFS_MANIFEST_NEW		"manifest.new"
+
+/**
+ * Types of the journal records
+ */
+#define STORAGE_FATFS_JOURNAL_ADD		1
+#define STORAGE_FATFS_JOURNAL_DELETE	2
+#define STORAGE_FATFS_JOURNAL_RESET		3
+
+/**
+ * Types of the jobs of the writer task
+ */
+#define STORAGE_FATFS_JOB_SAVE			1
+#define STORAGE_FATFS_JOB_DELETE		2
+#define STORAGE_FATFS_JOB_COMPACT		3
+#define STORAGE_FATFS_JOB_CHECKPOINT	4
+#define STORAGE_FATFS_JOB_FLUSH			5
+
 /**
  * Internal representation of a bundle
  *
@@ -62,21 +184,178 @@ struct file_list_entry_t {
 	uint32_t lifetime;
 	uint32_t bundle_flags;
 
+	/** destination node, to answer queries without reading the bundle */
+	uint32_t dst_node;
+
 	// TODO use size_t
 	uint16_t file_size;
 
 	/** Flags */
 	uint8_t flags;
+
+	/** segment containing the record of the bundle */
+	uint8_t segment;
+
+	/** offset of the record header in the segment */
+	uint32_t offset;
+
+	/** bundle, which is not yet written to a segment, or NULL */
+	struct mmem * pending;
+
+	/** position in the expiry queue */
+	struct storage_expiry_node_t expiry;
+
+	/** position in the eviction heap */
+	struct storage_eviction_node_t eviction;
+};
+
+/**
+ * Header at the beginning of a segment file
+ */
+struct file_segment_header_t {
+	uint32_t magic;
+
+	/** changed every time the segment is reused */
+	uint32_t generation;
+} __attribute__ ((packed));
+
+/**
+ * Header of a record in a segment, followed by the bundle.
+ * Only records with the generation of their segment are valid,
+ * the first invalid header ends the segment.
+ */
+struct file_record_header_t {
+	/** STORAGE_FATFS_MAGIC_LIVE or STORAGE_FATFS_MAGIC_DEAD after deletion */
+	uint32_t magic;
+	uint32_t generation;
+	uint32_t bundle_num;
+
+	/** size of the bundle following the header */
+	uint16_t size;
+} __attribute__ ((packed));
+
+/**
+ * State of a segment in RAM
+ */
+struct file_segment_t {
+	uint32_t generation;
+
+	/** offset of the next record to be appended */
+	uint32_t tail;
+
+	/** size of the records of the stored bundles */
+	uint32_t live_bytes;
+
+	/** number of stored bundles in the segment */
+	uint16_t live_records;
+};
+
+/**
+ * Job of the writer task
+ */
+struct file_job_t {
+	/** STORAGE_FATFS_JOB_* */
+	uint8_t type;
+
+	uint32_t bundle_num;
+
+	union {
+		/** STORAGE_FATFS_JOB_SAVE: bundle to be written, the job holds a reference */
+		struct mmem * bundlemem;
+
+		/** STORAGE_FATFS_JOB_DELETE: record of the deleted bundle */
+		struct {
+			uint8_t segment;
+			uint32_t offset;
+			uint16_t size;
+		} record;
+
+		/** STORAGE_FATFS_JOB_FLUSH: task to be notified */
+		TaskHandle_t task;
+	} data;
 };
 
+/**
+ * Header of the manifest, followed by the state of all segments
+ * as struct file_manifest_segment_t, the entries and the journal records
+ */
+struct file_manifest_header_t {
+	uint32_t magic;
+	uint16_t segments;
+	uint16_t entries;
+} __attribute__ ((packed));
+
+struct file_manifest_segment_t {
+	uint32_t generation;
+	uint32_t tail;
+} __attribute__ ((packed));
+
+/**
+ * Metadata of a stored bundle in the manifest
+ */
+struct file_manifest_entry_t {
+	uint32_t bundle_num;
+	uint32_t rec_time;
+	uint32_t lifetime;
+	uint32_t bundle_flags;
+	uint32_t dst_node;
+	uint16_t file_size;
+	uint8_t segment;
+	uint32_t offset;
+
+	/** seconds since the bundle was stored */
+	uint32_t age;
+
+	/** seconds until the bundle expires */
+	uint32_t remaining;
+} __attribute__ ((packed));
+
+/**
+ * Change of the stored bundles since the last checkpoint
+ */
+struct file_journal_record_t {
+	/** STORAGE_FATFS_JOURNAL_* */
+	uint8_t type;
+
+	union {
+		/** new or moved bundle */
+		struct file_manifest_entry_t entry;
+
+		/** deleted bundle */
+		uint32_t bundle_num;
+
+		/** reused segment */
+		struct {
+			uint8_t segment;
+			uint32_t generation;
+		} __attribute__ ((packed)) reset;
+	} data;
+} __attribute__ ((packed));
+
+/**
+ * File header of a bundle block, followed by the block data.
+ * A bundle record contains the struct bundle_t followed by its blocks.
+ */
+struct file_block_header_t {
+	uint8_t type;
+	uint32_t flags;
+	int block_size;
+} __attribute__ ((packed));
+
 /**
  * Flags for the storage
  */
 #define STORAGE_COFFEE_FLAGS_LOCKED 	0x1
+/** The bundle is not added to the read cache after being written */
+#define STORAGE_FATFS_FLAGS_UNCACHED	0x2
 
 // List and memory blocks for the bundles
 LIST(bundle_list);
 MEMB(bundle_mem, struct file_list_entry_t, BUNDLE_STORAGE_SIZE);
+STORAGE_INDEX(bundle_index, BUNDLE_STORAGE_SIZE);
+STORAGE_EXPIRY(bundle_expiry, BUNDLE_STORAGE_SIZE);
+STORAGE_EVICTION(bundle_eviction, BUNDLE_STORAGE_SIZE);
+STORAGE_CACHE(bundle_cache, STORAGE_FATFS_CACHE_BUNDLES, STORAGE_FATFS_CACHE_BYTES);
 
 // global, internal variables
 /** Counts the number of bundles in storage */
@@ -88,6 +367,31 @@ static uint8_t bundle_list_changed = 0;
 static SemaphoreHandle_t wait_for_changes_sem = NULL;
 static SemaphoreHandle_t bundle_deleted_sem = NULL;
 
+/** Protects the segments and the positions of the records against compaction */
+static SemaphoreHandle_t segment_mutex = NULL;
+
+static struct file_segment_t segments[STORAGE_FATFS_SEGMENTS];
+
+/** Segment to which new records are appended */
+static uint8_t active_segment;
+
+/** Newest generation of all segments */
+static uint32_t segment_generation;
+
+/** Flag to indicate whether changes can be appended to the journal of the manifest */
+static uint8_t manifest_valid = 0;
+
+/** Number of records in the journal */
+static uint16_t journal_records = 0;
+
+/** The manifest is kept open for the journal, it is synced once per batch of writer jobs */
+static FIL journal_fd;
+static uint8_t journal_open = 0;
+static uint8_t journal_unsynced = 0;
+
+/** Jobs for the writer task */
+static QueueHandle_t job_queue = NULL;
+
 static FATFS fatfs;
 
 ///**
@@ -106,11 +410,114 @@ static FATFS fatfs;
  */
 static void storage_fatfs_prune(const TimerHandle_t timer);
 static uint8_t storage_fatfs_delete_bundle(uint32_t bundle_number, uint8_t reason);
+static uint8_t storage_fatfs_delete_bundle_wait(const uint32_t bundle_number, const uint8_t reason, const TickType_t wait);
+static struct mmem * storage_fatfs_read_entry(const struct file_list_entry_t * const entry);
 static struct mmem * storage_fatfs_read_bundle(uint32_t bundle_number);
+static void storage_fatfs_flush(void);
 
 #if (BUNDLE_STORAGE_INIT == 0)
 static void storage_fatfs_reconstruct_bundles();
 #endif
+static void storage_fatfs_writer_process(void* p);
+
+
+/**
+ * \brief Returns the size of the file for a bundle
+ * \param bundlemem Pointer to the MMEM struct containing the bundle
+ * \return file size in bytes
+ */
+static size_t storage_fatfs_file_size(struct mmem * const bundlemem)
+{
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	size_t size = sizeof(struct bundle_t);
+
+	for(int i=0; i<bundle->num_blocks; i++) {
+		size += sizeof(struct file_block_header_t) + bundle_get_block(bundlemem, i)->block_size;
+	}
+
+	return size;
+}
+
+/**
+ * \brief Writes the bundle struct and all blocks into a file
+ * \param fd opened file
+ * \param bundlemem Pointer to the MMEM struct containing the bundle
+ * \return number of bytes written
+ */
+static size_t storage_fatfs_write_blocks(FIL* const fd, struct mmem * const bundlemem)
+{
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	size_t written = 0;
+	UINT bytes_written = 0;
+
+	if(f_write(fd, bundle, sizeof(struct bundle_t), &bytes_written) != FR_OK) {
+		return written;
+	}
+	written += bytes_written;
+
+	for(int i=0; i<bundle->num_blocks; i++) {
+		const struct bundle_block_t * const block = bundle_get_block(bundlemem, i);
+		const struct file_block_header_t header = {
+			.type = block->type,
+			.flags = block->flags,
+			.block_size = block->block_size,
+		};
+
+		if(f_write(fd, &header, sizeof(header), &bytes_written) != FR_OK) {
+			return written;
+		}
+		written += bytes_written;
+
+		if(f_write(fd, block->payload, block->block_size, &bytes_written) != FR_OK) {
+			return written;
+		}
+		written += bytes_written;
+	}
+
+	return written;
+}
+
+/**
+ * \brief Reads the bundle struct and all blocks from a file
+ * \param fd opened file
+ * \param bundlemem Pointer to the MMEM struct of a newly created bundle
+ * \return 1 on success, 0 on error
+ */
+static uint8_t storage_fatfs_read_blocks(FIL* const fd, struct mmem * const bundlemem)
+{
+	struct bundle_t * bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	UINT bytes_read = 0;
+
+	if(f_read(fd, bundle, sizeof(struct bundle_t), &bytes_read) != FR_OK || bytes_read != sizeof(struct bundle_t)) {
+		return 0;
+	}
+
+	/* The blocks are added again one by one */
+	const uint8_t num_blocks = bundle->num_blocks;
+	bundle->num_blocks = 0;
+
+	for(int i=0; i<num_blocks; i++) {
+		struct file_block_header_t header;
+
+		if(f_read(fd, &header, sizeof(header), &bytes_read) != FR_OK || bytes_read != sizeof(header)) {
+			return 0;
+		}
+
+		if(bundle_add_block(bundlemem, header.type, BUNDLE_BLOCK_FLAG_NULL, NULL, header.block_size) < 0) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to allocate %u bytes for block %u", header.block_size, i);
+			return 0;
+		}
+
+		struct bundle_block_t * const block = bundle_get_block(bundlemem, i);
+		block->flags = header.flags;
+
+		if(f_read(fd, block->payload, block->block_size, &bytes_read) != FR_OK || bytes_read != block->block_size) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
 
 
 
@@ -143,390 +550,1268 @@ static void storage_fatfs_file_close(FIL* const fd, const char* const filename)
 }
 
 
-static int storage_fatfs_format()
+/**
+ * \brief Fills a manifest entry with the metadata of a stored bundle
+ * \param entry entry of the bundle
+ * \param record manifest entry
+ */
+static void storage_fatfs_manifest_describe(const struct file_list_entry_t * const entry, struct file_manifest_entry_t * const record)
 {
-	//	RADIO_SAFE_STATE_ON();
-
-	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Formatting flash");
+	const uint32_t now = storage_expiry_now();
+
+	record->bundle_num = entry->bundle_num;
+	record->rec_time = entry->rec_time;
+	record->lifetime = entry->lifetime;
+	record->bundle_flags = entry->bundle_flags;
+	record->dst_node = entry->dst_node;
+	record->file_size = entry->file_size;
+	record->segment = entry->segment;
+	record->offset = entry->offset;
+	record->age = now - entry->eviction.received;
+	record->remaining = entry->eviction.expiration > now ? entry->eviction.expiration - now : 0;
+}
 
-	const FRESULT res = f_mkfs("0:/", 0, 0);
-	if (res != FR_OK) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Formatting failed with error code %u!", res);
-		return -1;
+/**
+ * \brief Closes the journal of the manifest
+ *
+ * The caller has to hold the segment_mutex.
+ */
+static void storage_fatfs_journal_close(void)
+{
+	if( !journal_open ) {
+		return;
 	}
 
-	//	RADIO_SAFE_STATE_OFF();
-
-	return 0;
+	storage_fatfs_file_close(&journal_fd, STORAGE_FATFS_MANIFEST);
+	journal_open = 0;
+	journal_unsynced = 0;
 }
 
-
 /**
- * \brief called by agent at startup
+ * \brief Drops the manifest, after its journal could not be written
+ *
+ * The caller has to hold the segment_mutex.
+ * The manifest would restore outdated bundles otherwise.
  */
-static bool storage_fatfs_init(void)
+static void storage_fatfs_journal_invalidate(void)
 {
-	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "storage_fatfs init");
-
-	/* Only execute the initalisation before the scheduler was started.
-	 * So there exists only one thread and
-	 * no locking is needed for the initialisation
-	 */
-	configASSERT(xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED);
+	manifest_valid = 0;
+	storage_fatfs_journal_close();
+	f_unlink(STORAGE_FATFS_MANIFEST);
+}
 
-	/* cancle, if initialisation was already done */
-	if(wait_for_changes_sem != NULL || bundle_deleted_sem != NULL) {
-		return false;
-	}
-	/* Do not use an recursive mutex,
-	 * because mmem_check() will not work vital then.
-	 */
-	wait_for_changes_sem = xSemaphoreCreateCounting(1, 0);
-	if(wait_for_changes_sem == NULL) {
-		return false;
+/**
+ * \brief Writes the appended journal records through to the SD card
+ *
+ * The caller has to hold the segment_mutex.
+ * The writer task syncs once per batch of jobs and before a flush completes.
+ */
+static void storage_fatfs_journal_sync(void)
+{
+	if( !journal_open || !journal_unsynced ) {
+		return;
 	}
 
-	bundle_deleted_sem = xSemaphoreCreateCounting(1, 0);
-	if(bundle_deleted_sem == NULL) {
-		return false;
+	const FRESULT res = f_sync(&journal_fd);
+	if( res != FR_OK ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to sync file %s (err %u)", STORAGE_FATFS_MANIFEST, res);
+		storage_fatfs_journal_invalidate();
+		return;
 	}
 
-	// Initialize the bundle list
-	list_init(bundle_list);
-
-	// Initialize the bundle memory block
-	memb_init(&bundle_mem);
+	journal_unsynced = 0;
+}
 
-	bundles_in_storage = 0;
-	bundle_list_changed = 0;
+/**
+ * \brief Appends a record to the journal of the manifest
+ *
+ * The caller has to hold the segment_mutex.
+ * The manifest stays open, the record is written through by storage_fatfs_journal_sync().
+ * If the journal cannot be written, the manifest is removed,
+ * because it would restore outdated bundles.
+ * \param record journal record
+ */
+static void storage_fatfs_journal(const struct file_journal_record_t * const record)
+{
+	UINT bytes_written = 0;
 
-	const FRESULT ret = f_mount(&fatfs, "0:/", 1);
-	if (ret != FR_OK) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Mounting sd card failed with error code %u!", ret);
-		return false;
+	if( !manifest_valid ) {
+		/* The next checkpoint writes a new manifest */
+		return;
 	}
 
-#if BUNDLE_STORAGE_INIT
-	if (storage_fatfs_format() < 0) {
-		return false;
-	}
-#else
-	// Try to restore our bundle list from the file system
-	storage_fatfs_reconstruct_bundles();
-#endif
+	if( !journal_open ) {
+		const FRESULT res = f_open(&journal_fd, STORAGE_FATFS_MANIFEST, FA_OPEN_EXISTING | FA_WRITE);
+		if( res != FR_OK ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to open file %s (err %u)", STORAGE_FATFS_MANIFEST, res);
+			storage_fatfs_journal_invalidate();
+			return;
+		}
+		journal_open = 1;
 
-	// Set the timer to regularly prune expired bundles
-	const TimerHandle_t store_timer = xTimerCreate("store timer", pdMS_TO_TICKS(5000), pdTRUE, NULL, storage_fatfs_prune);
-	if (store_timer == NULL) {
-		return false;
+		if( f_lseek(&journal_fd, f_size(&journal_fd)) != FR_OK ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to seek to the end of file %s", STORAGE_FATFS_MANIFEST);
+			storage_fatfs_journal_invalidate();
+			return;
+		}
 	}
 
-	if ( !xTimerStart(store_timer, 0) ) {
-		return false;
+	if( f_write(&journal_fd, record, sizeof(*record), &bytes_written) != FR_OK || bytes_written != sizeof(*record) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to write journal record to file %s", STORAGE_FATFS_MANIFEST);
+		storage_fatfs_journal_invalidate();
+		return;
 	}
 
-	return true;
+	journal_unsynced = 1;
+	journal_records++;
 }
 
-#if (BUNDLE_STORAGE_INIT == 0)
 /**
- * \brief Restore bundles stored in CFS
+ * \brief Journals the new position of a bundle
+ * \param entry entry of the bundle
  */
-static void storage_fatfs_reconstruct_bundles()
+static void storage_fatfs_journal_add(const struct file_list_entry_t * const entry)
 {
-	struct file_list_entry_t * entry = NULL;
-	DIR directory_iterator;
-	struct mmem * bundleptr = NULL;
-	struct bundle_t * bundle = NULL;
-	uint8_t found = 0;
+	struct file_journal_record_t record = {
+		.type = STORAGE_FATFS_JOURNAL_ADD,
+	};
 
-//	RADIO_SAFE_STATE_ON();
+	storage_fatfs_manifest_describe(entry, &record.data.entry);
+	storage_fatfs_journal(&record);
+}
 
-	const FRESULT n = f_opendir(&directory_iterator, "/");
-	if(n != FR_OK) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to list directory / (err %u)", n);
-//		RADIO_SAFE_STATE_OFF();
-		return;
-	}
+/**
+ * \brief Journals the deletion of a bundle
+ * \param bundle_number number of the bundle
+ */
+static void storage_fatfs_journal_delete(const uint32_t bundle_number)
+{
+	const struct file_journal_record_t record = {
+		.type = STORAGE_FATFS_JOURNAL_DELETE,
+		.data.bundle_num = bundle_number,
+	};
 
-	FILINFO directory_entry;
-#if _USE_LFN
-	/* not using static buffer, becasue this is only needed on intialization */
-	char lfn[_MAX_LFN + 1];
-	directory_entry.lfname = lfn;
-	directory_entry.lfsize = sizeof(lfn);
-#endif
+	storage_fatfs_journal(&record);
+}
+
+/**
+ * \brief Journals the reuse of a segment
+ * \param segment number of the segment
+ */
+static void storage_fatfs_journal_reset(const uint8_t segment)
+{
+	const struct file_journal_record_t record = {
+		.type = STORAGE_FATFS_JOURNAL_RESET,
+		.data.reset.segment = segment,
+		.data.reset.generation = segments[segment].generation,
+	};
+
+	storage_fatfs_journal(&record);
+}
+
+/**
+ * \brief Writes the metadata of all stored bundles into a new manifest
+ *
+ * The caller has to hold the segment_mutex.
+ * The old manifest and its journal are replaced,
+ * after the new one was written completely.
+ * \return 1 on success, 0 on error
+ */
+static uint8_t storage_fatfs_checkpoint(void)
+{
+	struct file_manifest_header_t header = {
+		.magic = STORAGE_FATFS_MAGIC_MANIFEST,
+		.segments = STORAGE_FATFS_SEGMENTS,
+		.entries = 0,
+	};
+	struct file_list_entry_t * entry = NULL;
+	UINT bytes_written = 0;
+	uint16_t entries = 0;
+	uint8_t ok = 1;
+	FIL fd;
+
+	/* Pending bundles are journaled by the writer, after they were appended */
+	for(entry = list_head(bundle_list); entry != NULL; entry = list_item_next(entry)) {
+		if( entry->pending == NULL ) {
+			header.entries++;
+		}
+	}
+
+	/* The journal of the old manifest is complete, until the new one replaces it */
+	storage_fatfs_journal_close();
+
+	FRESULT res = f_open(&fd, STORAGE_FATFS_MANIFEST_NEW, FA_CREATE_ALWAYS | FA_WRITE);
+	if( res != FR_OK ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to open file %s (err %u)", STORAGE_FATFS_MANIFEST_NEW, res);
+		return 0;
+	}
+
+	ok = f_write(&fd, &header, sizeof(header), &bytes_written) == FR_OK && bytes_written == sizeof(header);
+
+	for(int i=0; ok && i<STORAGE_FATFS_SEGMENTS; i++) {
+		const struct file_manifest_segment_t segment = {
+			.generation = segments[i].generation,
+			.tail = segments[i].tail,
+		};
+
+		ok = f_write(&fd, &segment, sizeof(segment), &bytes_written) == FR_OK && bytes_written == sizeof(segment);
+	}
+
+	for(entry = list_head(bundle_list); ok && entry != NULL; entry = list_item_next(entry)) {
+		struct file_manifest_entry_t record;
+
+		if( entry->pending != NULL ) {
+			continue;
+		}
+
+		storage_fatfs_manifest_describe(entry, &record);
+		ok = f_write(&fd, &record, sizeof(record), &bytes_written) == FR_OK && bytes_written == sizeof(record);
+		entries++;
+	}
+
+	storage_fatfs_file_close(&fd, STORAGE_FATFS_MANIFEST_NEW);
+
+	if( !ok || entries != header.entries ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to write checkpoint to file %s", STORAGE_FATFS_MANIFEST_NEW);
+		f_unlink(STORAGE_FATFS_MANIFEST_NEW);
+		return 0;
+	}
+
+	/* The new manifest is used at startup, if the old one is missing */
+	f_unlink(STORAGE_FATFS_MANIFEST);
+	res = f_rename(STORAGE_FATFS_MANIFEST_NEW, STORAGE_FATFS_MANIFEST);
+	if( res != FR_OK ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to rename file %s (err %u)", STORAGE_FATFS_MANIFEST_NEW, res);
+		manifest_valid = 0;
+		return 0;
+	}
+
+	manifest_valid = 1;
+	journal_records = 0;
+	bundle_list_changed = 0;
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "checkpoint of %u bundles written", entries);
+
+	return 1;
+}
+
+/**
+ * \brief Determines the file name of a segment
+ * \param filename buffer of STORAGE_FILE_NAME_LENGTH bytes
+ * \param segment number of the segment
+ */
+static void storage_fatfs_segment_name(char* const filename, const uint8_t segment)
+{
+	snprintf(filename, STORAGE_FILE_NAME_LENGTH, "%u.seg", segment);
+}
+
+/**
+ * \brief Opens the file of a segment
+ * \param fd file object
+ * \param segment number of the segment
+ * \param mode FatFs access mode
+ * \return 1 on success, 0 on error
+ */
+static uint8_t storage_fatfs_segment_open(FIL* const fd, const uint8_t segment, const BYTE mode)
+{
+	char segment_filename[STORAGE_FILE_NAME_LENGTH];
+
+	storage_fatfs_segment_name(segment_filename, segment);
+
+	const FRESULT res = f_open(fd, segment_filename, mode);
+	if (res != FR_OK) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to open segment %s (err %u)", segment_filename, res);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void storage_fatfs_segment_close(FIL* const fd, const uint8_t segment)
+{
+	char segment_filename[STORAGE_FILE_NAME_LENGTH];
+
+	storage_fatfs_segment_name(segment_filename, segment);
+	storage_fatfs_file_close(fd, segment_filename);
+}
+
+/**
+ * \brief Empties a segment by starting a new generation
+ *
+ * The segment file is created and allocated in full, if it does not exist.
+ * \param segment number of the segment
+ * \return 1 on success, 0 on error
+ */
+static uint8_t storage_fatfs_segment_reset(const uint8_t segment)
+{
+	struct file_segment_t * const state = &segments[segment];
+	const struct file_segment_header_t header = {
+		.magic = STORAGE_FATFS_MAGIC_SEGMENT,
+		.generation = segment_generation + 1,
+	};
+	UINT bytes_written = 0;
+	FIL fd;
+
+	/* Nothing can be appended, until the reset succeeded */
+	state->tail = STORAGE_FATFS_SEGMENT_SIZE;
+	state->live_bytes = 0;
+	state->live_records = 0;
+
+	if( !storage_fatfs_segment_open(&fd, segment, FA_OPEN_ALWAYS | FA_WRITE) ) {
+		return 0;
+	}
+
+	/* Seeking behind the end of the file allocates the clusters of the whole segment */
+	if( f_size(&fd) < STORAGE_FATFS_SEGMENT_SIZE ) {
+		if( f_lseek(&fd, STORAGE_FATFS_SEGMENT_SIZE) != FR_OK || f_tell(&fd) != STORAGE_FATFS_SEGMENT_SIZE ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to allocate %lu bytes for segment %u", STORAGE_FATFS_SEGMENT_SIZE, segment);
+			storage_fatfs_segment_close(&fd, segment);
+			return 0;
+		}
+	}
+
+	if( f_lseek(&fd, 0) != FR_OK || f_write(&fd, &header, sizeof(header), &bytes_written) != FR_OK || bytes_written != sizeof(header) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to write header of segment %u", segment);
+		storage_fatfs_segment_close(&fd, segment);
+		return 0;
+	}
+
+	storage_fatfs_segment_close(&fd, segment);
+
+	segment_generation = header.generation;
+	state->generation = header.generation;
+	state->tail = sizeof(header);
+
+	storage_fatfs_journal_reset(segment);
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "segment %u reset to generation %lu", segment, state->generation);
+
+	return 1;
+}
+
+/**
+ * \brief Finds a segment without stored bundles, which is not the active one
+ * \param count returns the number of such segments
+ * \return number of the segment or -1
+ */
+static int storage_fatfs_segment_empty(uint8_t* const count)
+{
+	int empty = -1;
+
+	*count = 0;
+
+	for(int i=0; i<STORAGE_FATFS_SEGMENTS; i++) {
+		if( i == active_segment || segments[i].live_records > 0 ) {
+			continue;
+		}
+
+		empty = i;
+		(*count)++;
+	}
+
+	return empty;
+}
+
+/**
+ * \brief Appends the record of a bundle to the active segment
+ *
+ * The caller has to hold the segment_mutex.
+ * The eviction node of the entry has to be filled for the journal.
+ * New bundles have to leave one empty segment, so that compaction
+ * can always move the records of a segment, even if all others are full.
+ * \param entry entry of the bundle, its position is updated
+ * \param bundlemem Pointer to the MMEM struct containing the bundle
+ * \param reserve number of empty segments, which must not be used
+ * \return 1 on success, 0 if no segment has room for the bundle, -1 on error
+ */
+static int storage_fatfs_segment_append(struct file_list_entry_t * const entry, struct mmem * const bundlemem, const uint8_t reserve)
+{
+	uint8_t empty_segments = 0;
+
+	const uint32_t size = sizeof(struct file_record_header_t) + entry->file_size;
+	UINT bytes_written = 0;
+	FIL fd;
+
+	if( size > STORAGE_FATFS_SEGMENT_SIZE - sizeof(struct file_segment_header_t) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "bundle %lu does not fit into a segment (%lu bytes)", entry->bundle_num, size);
+		return -1;
+	}
+
+	if( segments[active_segment].tail + size > STORAGE_FATFS_SEGMENT_SIZE ) {
+		/* The active segment is full, continue with an empty one */
+		const int segment = storage_fatfs_segment_empty(&empty_segments);
+		if( empty_segments <= reserve ) {
+			return 0;
+		}
+
+		if( !storage_fatfs_segment_reset(segment) ) {
+			return -1;
+		}
+
+		active_segment = segment;
+	}
+
+	struct file_segment_t * const state = &segments[active_segment];
+	const struct file_record_header_t header = {
+		.magic = STORAGE_FATFS_MAGIC_LIVE,
+		.generation = state->generation,
+		.bundle_num = entry->bundle_num,
+		.size = entry->file_size,
+	};
+
+	if( !storage_fatfs_segment_open(&fd, active_segment, FA_OPEN_EXISTING | FA_WRITE) ) {
+		return -1;
+	}
+
+	/* The header is written after the bundle, so that it commits the record.
+	 * On failure the tail is not moved and the region will be overwritten.
+	 */
+	if( f_lseek(&fd, state->tail + sizeof(header)) != FR_OK ||
+			storage_fatfs_write_blocks(&fd, bundlemem) != entry->file_size ||
+			f_lseek(&fd, state->tail) != FR_OK ||
+			f_write(&fd, &header, sizeof(header), &bytes_written) != FR_OK ||
+			bytes_written != sizeof(header) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to write %lu bytes to segment %u, aborting", size, active_segment);
+		storage_fatfs_segment_close(&fd, active_segment);
+		return -1;
+	}
+
+	storage_fatfs_segment_close(&fd, active_segment);
+
+	entry->segment = active_segment;
+	entry->offset = state->tail;
+
+	state->tail += size;
+	state->live_bytes += size;
+	state->live_records++;
+
+	storage_fatfs_journal_add(entry);
+
+	return 1;
+}
+
+/**
+ * \brief Marks the record of a deleted bundle as dead
+ *
+ * The caller has to hold the segment_mutex.
+ * \param segment segment containing the record
+ * \param offset offset of the record header
+ * \param size size of the bundle
+ */
+static void storage_fatfs_segment_release(const uint8_t segment, const uint32_t offset, const uint16_t size)
+{
+	const uint32_t magic = STORAGE_FATFS_MAGIC_DEAD;
+	UINT bytes_written = 0;
+	FIL fd;
+
+	segments[segment].live_bytes -= sizeof(struct file_record_header_t) + size;
+	segments[segment].live_records--;
+
+	if( !storage_fatfs_segment_open(&fd, segment, FA_OPEN_EXISTING | FA_WRITE) ) {
+		return;
+	}
+
+	if( f_lseek(&fd, offset) != FR_OK || f_write(&fd, &magic, sizeof(magic), &bytes_written) != FR_OK || bytes_written != sizeof(magic) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "unable to mark record %lu of segment %u as dead", offset, segment);
+	}
+
+	storage_fatfs_segment_close(&fd, segment);
+}
+
+/**
+ * \brief Reads the bundle of an entry from its segment
+ *
+ * The caller has to hold the segment_mutex.
+ * \param entry entry of the bundle
+ * \return pointer to the MMEM struct containing the bundle (caller has to free)
+ */
+static struct mmem * storage_fatfs_segment_load(const struct file_list_entry_t * const entry)
+{
+	FIL fd;
+
+	struct mmem * bundlemem = bundle_create_bundle();
+	if( bundlemem == NULL ) {
+		// Give up the cached bundles, they are read again if needed
+		storage_cache_clear(&bundle_cache);
+		bundlemem = bundle_create_bundle();
+	}
+
+	if( bundlemem == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "cannot allocate memory for bundle %lu", entry->bundle_num);
+		return NULL;
+	}
+
+	if( !storage_fatfs_segment_open(&fd, entry->segment, FA_OPEN_EXISTING | FA_READ) ) {
+		bundle_decrement(bundlemem);
+		return NULL;
+	}
+
+	if( f_lseek(&fd, entry->offset + sizeof(struct file_record_header_t)) != FR_OK ||
+			!storage_fatfs_read_blocks(&fd, bundlemem) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to read %u bytes from segment %u, aborting", entry->file_size, entry->segment);
+		storage_fatfs_segment_close(&fd, entry->segment);
+		bundle_decrement(bundlemem);
+		return NULL;
+	}
+
+	storage_fatfs_segment_close(&fd, entry->segment);
+
+	return bundlemem;
+}
+
+/**
+ * \brief Empties the segment with the most dead records by moving its bundles to the active segment
+ *
+ * Called by the writer task. The segment_mutex is held during the whole
+ * compaction of the segment, so that the moved bundles cannot be deleted in the meantime.
+ * \return 1 if a segment was emptied, 0 otherwise
+ */
+static uint8_t storage_fatfs_compact(void)
+{
+	int victim = -1;
+	uint32_t dead_max = 0;
+
+	xSemaphoreTake(segment_mutex, portMAX_DELAY);
+
+	for(int i=0; i<STORAGE_FATFS_SEGMENTS; i++) {
+		if( i == active_segment || segments[i].live_records == 0 ) {
+			continue;
+		}
+
+		const uint32_t dead = segments[i].tail - sizeof(struct file_segment_header_t) - segments[i].live_bytes;
+		if( dead > dead_max ) {
+			victim = i;
+			dead_max = dead;
+		}
+	}
+
+	if( victim < 0 ) {
+		/* No segment would gain space */
+		xSemaphoreGive(segment_mutex);
+		return 0;
+	}
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "compacting segment %u (%lu dead bytes, %u bundles)", victim, dead_max, segments[victim].live_records);
+
+	for(struct file_list_entry_t * entry = list_head(bundle_list);
+			entry != NULL && segments[victim].live_records > 0;
+			entry = list_item_next(entry)) {
+		if( entry->pending != NULL || entry->segment != victim ) {
+			continue;
+		}
+
+		const uint32_t offset = entry->offset;
+
+		struct mmem * const bundlemem = storage_fatfs_segment_load(entry);
+		if( bundlemem == NULL ) {
+			break;
+		}
+
+		const int ret = storage_fatfs_segment_append(entry, bundlemem, 0);
+		bundle_decrement(bundlemem);
+
+		if( ret <= 0 ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "unable to move bundle %lu, compaction aborted", entry->bundle_num);
+			break;
+		}
+
+		storage_fatfs_segment_release(victim, offset, entry->file_size);
+	}
+
+	const uint8_t emptied = segments[victim].live_records == 0;
+
+	xSemaphoreGive(segment_mutex);
+
+	return emptied;
+}
+
+
+static int storage_fatfs_format()
+{
+	//	RADIO_SAFE_STATE_ON();
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Formatting flash");
+
+	/* Queued jobs would write to the old segments */
+	if( xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED ) {
+		storage_fatfs_flush();
+	}
+
+	xSemaphoreTake(segment_mutex, portMAX_DELAY);
+
+	/* The manifest is lost with the file system */
+	storage_fatfs_journal_close();
+
+	storage_cache_clear(&bundle_cache);
+
+	const FRESULT res = f_mkfs("0:/", 0, 0);
+	if (res != FR_OK) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Formatting failed with error code %u!", res);
+		xSemaphoreGive(segment_mutex);
+		return -1;
+	}
+
+	/* Allocate the segments on the empty file system */
+	segment_generation = 0;
+	active_segment = 0;
+	manifest_valid = 0;
+	for(int i=0; i<STORAGE_FATFS_SEGMENTS; i++) {
+		if( !storage_fatfs_segment_reset(i) ) {
+			xSemaphoreGive(segment_mutex);
+			return -1;
+		}
+	}
+
+	storage_fatfs_checkpoint();
+
+	xSemaphoreGive(segment_mutex);
+
+	//	RADIO_SAFE_STATE_OFF();
+
+	return 0;
+}
+
+
+/**
+ * \brief called by agent at startup
+ */
+static bool storage_fatfs_init(void)
+{
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "storage_fatfs init");
+
+	/* Only execute the initalisation before the scheduler was started.
+	 * So there exists only one thread and
+	 * no locking is needed for the initialisation
+	 */
+	configASSERT(xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED);
+
+	/* cancle, if initialisation was already done */
+	if(wait_for_changes_sem != NULL || bundle_deleted_sem != NULL) {
+		return false;
+	}
+	/* Do not use an recursive mutex,
+	 * because mmem_check() will not work vital then.
+	 */
+	wait_for_changes_sem = xSemaphoreCreateCounting(1, 0);
+	if(wait_for_changes_sem == NULL) {
+		return false;
+	}
+
+	bundle_deleted_sem = xSemaphoreCreateCounting(1, 0);
+	if(bundle_deleted_sem == NULL) {
+		return false;
+	}
+
+	segment_mutex = xSemaphoreCreateMutex();
+	if(segment_mutex == NULL) {
+		return false;
+	}
+
+	job_queue = xQueueCreate(STORAGE_FATFS_QUEUE_LENGTH, sizeof(struct file_job_t));
+	if(job_queue == NULL) {
+		return false;
+	}
+
+	// Initialize the bundle list
+	list_init(bundle_list);
+
+	// Initialize the bundle memory block
+	memb_init(&bundle_mem);
+
+	// Initialize the index of the bundle list
+	storage_index_init(&bundle_index);
+
+	// Initialize the queue of expiring bundles
+	storage_expiry_init(&bundle_expiry);
+
+	// Initialize the heap of deletable bundles
+	storage_eviction_init(&bundle_eviction);
+
+	// Initialize the read cache
+	storage_cache_init(&bundle_cache);
+
+	bundles_in_storage = 0;
+	bundle_list_changed = 0;
+
+	memset(segments, 0, sizeof(segments));
+	active_segment = 0;
+	segment_generation = 0;
+	manifest_valid = 0;
+	journal_records = 0;
+	journal_open = 0;
+	journal_unsynced = 0;
+
+	const FRESULT ret = f_mount(&fatfs, "0:/", 1);
+	if (ret != FR_OK) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Mounting sd card failed with error code %u!", ret);
+		return false;
+	}
+
+#if BUNDLE_STORAGE_INIT
+	if (storage_fatfs_format() < 0) {
+		return false;
+	}
+#else
+	// Try to restore our bundle list from the file system
+	storage_fatfs_reconstruct_bundles();
+#endif
+
+	// Start the writer, it runs after the scheduler was started
+	if ( !xTaskCreate(storage_fatfs_writer_process, "STORAGE writer", configFATFS_STACK_SIZE, NULL, 2, NULL) ) {
+		return false;
+	}
+
+	// Set the timer to regularly prune expired bundles
+	const TimerHandle_t store_timer = xTimerCreate("store timer", pdMS_TO_TICKS(5000), pdTRUE, NULL, storage_fatfs_prune);
+	if (store_timer == NULL) {
+		return false;
+	}
+
+	if ( !xTimerStart(store_timer, 0) ) {
+		return false;
+	}
 
-	while( f_readdir(&directory_iterator, &directory_entry) == FR_OK ) {
-		if (directory_entry.fname[0] == 0) {
-			/* end of directory */
-			break;
-		}
+	return true;
+}
 
-		if (directory_entry.fattrib & AM_DIR) {
-			/* ignore directories */
-			continue;
-		}
+#if (BUNDLE_STORAGE_INIT == 0)
+/**
+ * \brief Adds a restored entry to the list, the index and the queues
+ * \param entry completely filled entry
+ */
+static void storage_fatfs_restore_entry(struct file_list_entry_t * const entry)
+{
+	list_add(bundle_list, entry);
+	storage_index_add(&bundle_index, (struct storage_entry_t *) entry);
+	storage_expiry_add(&bundle_expiry, &entry->expiry, entry->eviction.expiration);
+	storage_eviction_add(&bundle_eviction, &entry->eviction);
+	bundles_in_storage++;
 
-		/* Check if there is a . in the filename */
-		const char* const filename =  directory_entry.lfname[0] ? directory_entry.lfname : directory_entry.fname;
+	segments[entry->segment].live_bytes += sizeof(struct file_record_header_t) + entry->file_size;
+	segments[entry->segment].live_records++;
+}
 
-		if (f_size(&directory_entry) < sizeof(struct bundle_t)) {
-			/* ignore files with a too small size */
-			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "filename %s is too small, skipping (size %lu)", filename, f_size(&directory_entry));
-			continue;
-		}
+/**
+ * \brief Removes a restored entry, whose record is not valid anymore
+ * \param entry the entry
+ */
+static void storage_fatfs_restore_forget(struct file_list_entry_t * const entry)
+{
+	segments[entry->segment].live_bytes -= sizeof(struct file_record_header_t) + entry->file_size;
+	segments[entry->segment].live_records--;
 
-		char* const delimeter = strchr(filename, '.');
-		if( delimeter == NULL ) {
-			/* filename is invalid */
-			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "filename %s is invalid, skipping", filename);
-			continue;
-		}
+	list_remove(bundle_list, entry);
+	storage_index_remove(&bundle_index, entry->bundle_num);
+	storage_expiry_remove(&bundle_expiry, &entry->expiry);
+	storage_eviction_remove(&bundle_eviction, &entry->eviction);
+	bundles_in_storage--;
 
-		/* Check if the extension is b */
-		if( *(delimeter+1) != 'b' ) {
-			/* filename is invalid */
-			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "filename %s is invalid, skipping", filename);
-			continue;
-		}
+	memb_free(&bundle_mem, entry);
+}
+
+/**
+ * \brief Restores an entry from the manifest or from its journal
+ * \param record metadata of the bundle
+ */
+static void storage_fatfs_restore_manifest_entry(const struct file_manifest_entry_t * const record)
+{
+	struct file_list_entry_t * entry = NULL;
+	const uint32_t now = storage_expiry_now();
 
-		/* Get the bundle number from the filename */
-		delimeter[0] = '\0';
-		const uint32_t bundle_number = strtoul(filename, NULL, 10);
+	if( record->segment >= STORAGE_FATFS_SEGMENTS ) {
+		return;
+	}
 
-		/* Check if this bundle is in storage already */
-		found = 0;
-		for(entry = list_head(bundle_list);
-			entry != NULL;
-			entry = list_item_next(entry)) {
+	entry = (struct file_list_entry_t *) storage_index_find(&bundle_index, record->bundle_num);
+	if( entry != NULL ) {
+		/* The bundle was moved by compaction */
+		segments[entry->segment].live_bytes -= sizeof(struct file_record_header_t) + entry->file_size;
+		segments[entry->segment].live_records--;
+
+		entry->segment = record->segment;
+		entry->offset = record->offset;
+
+		segments[entry->segment].live_bytes += sizeof(struct file_record_header_t) + entry->file_size;
+		segments[entry->segment].live_records++;
+		return;
+	}
+
+	entry = memb_alloc(&bundle_mem);
+	if( entry == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to allocate struct, cannot restore bundle %lu", record->bundle_num);
+		return;
+	}
+
+	memset(entry, 0, sizeof(struct file_list_entry_t));
+
+	entry->bundle_num = record->bundle_num;
+	entry->rec_time = record->rec_time;
+	entry->lifetime = record->lifetime;
+	entry->bundle_flags = record->bundle_flags;
+	entry->dst_node = record->dst_node;
+	entry->file_size = record->file_size;
+	entry->segment = record->segment;
+	entry->offset = record->offset;
 
-			if( entry->bundle_num == bundle_number ) {
-				found = 1;
+	entry->eviction.priority = (record->bundle_flags & BUNDLE_PRIORITY_MASK) >> 7;
+	entry->eviction.received = now > record->age ? now - record->age : 0;
+	entry->eviction.expiration = now + record->remaining;
+
+	storage_fatfs_restore_entry(entry);
+}
+
+/**
+ * \brief Applies a journal record to the restored entries
+ * \param record the journal record
+ */
+static void storage_fatfs_restore_journal(const struct file_journal_record_t * const record)
+{
+	struct file_list_entry_t * entry = NULL;
+
+	switch (record->type) {
+		case STORAGE_FATFS_JOURNAL_ADD: {
+			const struct file_manifest_entry_t * const added = &record->data.entry;
+
+			if( added->segment >= STORAGE_FATFS_SEGMENTS ) {
 				break;
 			}
-		}
 
-		if( found == 1 ) {
-			continue;
+			storage_fatfs_restore_manifest_entry(added);
+
+			const uint32_t end = added->offset + sizeof(struct file_record_header_t) + added->file_size;
+			if( segments[added->segment].tail < end ) {
+				segments[added->segment].tail = end;
+			}
+			break;
 		}
 
-		/* Allocate a directory entry for the bundle */
-		entry = memb_alloc(&bundle_mem);
-		if( entry == NULL ) {
-			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to allocate struct, cannot restore bundle (file %s, size %u)",
-				filename, f_size(&directory_entry));
-			continue;
+		case STORAGE_FATFS_JOURNAL_DELETE:
+			entry = (struct file_list_entry_t *) storage_index_find(&bundle_index, record->data.bundle_num);
+			if( entry != NULL ) {
+				storage_fatfs_restore_forget(entry);
+			}
+			break;
+
+		case STORAGE_FATFS_JOURNAL_RESET:
+			if( record->data.reset.segment >= STORAGE_FATFS_SEGMENTS ) {
+				break;
+			}
+
+			segments[record->data.reset.segment].generation = record->data.reset.generation;
+			segments[record->data.reset.segment].tail = sizeof(struct file_segment_header_t);
+			break;
+
+		default:
+			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "unknown journal record %u", record->type);
+			break;
+	}
+}
+
+/**
+ * \brief Restores the stored bundles from the manifest and its journal
+ * \return 1 on success, 0 if the segments have to be scanned completely
+ */
+static uint8_t storage_fatfs_restore_manifest(void)
+{
+	struct file_manifest_header_t header;
+	UINT bytes = 0;
+	FIL fd;
+
+	FRESULT res = f_open(&fd, STORAGE_FATFS_MANIFEST, FA_OPEN_EXISTING | FA_READ);
+	if( res == FR_NO_FILE ) {
+		/* The last checkpoint may have been interrupted before renaming the new manifest */
+		if( f_rename(STORAGE_FATFS_MANIFEST_NEW, STORAGE_FATFS_MANIFEST) == FR_OK ) {
+			res = f_open(&fd, STORAGE_FATFS_MANIFEST, FA_OPEN_EXISTING | FA_READ);
 		}
+	} else {
+		/* A new manifest besides the old one is incomplete */
+		f_unlink(STORAGE_FATFS_MANIFEST_NEW);
+	}
 
-		/* Fill in the entry */
-		entry->bundle_num = bundle_number;
-		entry->file_size = f_size(&directory_entry);
+	if( res != FR_OK ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "no manifest found, scanning segments");
+		return 0;
+	}
 
-		/* Add bundle to the list */
-		list_add(bundle_list, entry);
-		bundles_in_storage ++;
+	if( f_read(&fd, &header, sizeof(header), &bytes) != FR_OK || bytes != sizeof(header) ||
+			header.magic != STORAGE_FATFS_MAGIC_MANIFEST || header.segments != STORAGE_FATFS_SEGMENTS ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "manifest is invalid, scanning segments");
+		storage_fatfs_file_close(&fd, STORAGE_FATFS_MANIFEST);
+		return 0;
+	}
 
-		/* Now read bundle from storage to update the rest of the entry */
-//		RADIO_SAFE_STATE_OFF();
-		bundleptr = storage_fatfs_read_bundle(entry->bundle_num);
-//		RADIO_SAFE_STATE_ON();
+	for(int i=0; i<STORAGE_FATFS_SEGMENTS; i++) {
+		struct file_manifest_segment_t segment;
 
-		if( bundleptr == NULL ) {
-			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to restore bundle %lu", entry->bundle_num);
-			list_remove(bundle_list, entry);
-			memb_free(&bundle_mem, entry);
-			bundles_in_storage--;
-			continue;
+		if( f_read(&fd, &segment, sizeof(segment), &bytes) != FR_OK || bytes != sizeof(segment) ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "manifest is truncated, scanning segments");
+			storage_fatfs_file_close(&fd, STORAGE_FATFS_MANIFEST);
+			return 0;
 		}
 
-		/* Get bundle struct */
-		bundle = (struct bundle_t *) MMEM_PTR(bundleptr);
+		segments[i].generation = segment.generation;
+		segments[i].tail = segment.tail;
+	}
 
-		/* Copy everything we need from the bundle */
-		entry->rec_time = bundle->rec_time;
-		entry->lifetime = bundle->lifetime;
-		entry->file_size = bundleptr->size;
-		entry->bundle_num = bundle->bundle_num;
+	for(int i=0; i<header.entries; i++) {
+		struct file_manifest_entry_t record;
 
-		/* Deallocate memory */
-		bundle_decrement(bundleptr);
-		bundle = NULL;
-		bundleptr = NULL;
-		entry = NULL;
+		if( f_read(&fd, &record, sizeof(record), &bytes) != FR_OK || bytes != sizeof(record) ) {
+			break;
+		}
+
+		storage_fatfs_restore_manifest_entry(&record);
 	}
 
-	/* Close directory handle */
-	f_closedir(&directory_iterator);
+	/* A record, which was not written completely, ends the journal */
+	for(;;) {
+		struct file_journal_record_t record;
 
-	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Restored %u bundles from CFS", bundles_in_storage);
+		if( f_read(&fd, &record, sizeof(record), &bytes) != FR_OK || bytes != sizeof(record) ) {
+			break;
+		}
 
-//	RADIO_SAFE_STATE_OFF();
-}
-#endif
+		storage_fatfs_restore_journal(&record);
+		journal_records++;
+	}
+
+	storage_fatfs_file_close(&fd, STORAGE_FATFS_MANIFEST);
 
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Restored %u bundles from manifest and %u journal records", bundles_in_storage, journal_records);
+
+	return 1;
+}
 
 /**
- * \brief deletes expired bundles from storage
+ * \brief Restores the bundle of a live record
+ * \param fd opened segment file
+ * \param segment number of the segment
+ * \param offset offset of the record header
+ * \param record header of the record
+ * \return 1 if the bundle was restored, 0 otherwise
  */
-static void storage_fatfs_prune(const TimerHandle_t timer)
+static uint8_t storage_fatfs_restore_record(FIL* const fd, const uint8_t segment, const uint32_t offset, const struct file_record_header_t * const record)
 {
 	struct file_list_entry_t * entry = NULL;
+	struct mmem * bundlemem = NULL;
+	struct bundle_t * bundle = NULL;
 
-	// Delete expired bundles from storage
-	for(entry = list_head(bundle_list);
-			entry != NULL;
-			entry = list_item_next(entry)) {
-		const TickType_t elapsed_time = (xTaskGetTickCount() - entry->rec_time) / portTICK_PERIOD_MS / 1000;
+	/* Allocate a directory entry for the bundle */
+	entry = memb_alloc(&bundle_mem);
+	if( entry == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to allocate struct, cannot restore bundle %lu", record->bundle_num);
+		return 0;
+	}
+
+	memset(entry, 0, sizeof(struct file_list_entry_t));
+
+	/* Now read bundle from storage to fill in the rest of the entry */
+	bundlemem = bundle_create_bundle();
+	if( bundlemem == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "cannot allocate memory for bundle %lu", record->bundle_num);
+		memb_free(&bundle_mem, entry);
+		return 0;
+	}
+
+	if( f_lseek(fd, offset + sizeof(struct file_record_header_t)) != FR_OK || !storage_fatfs_read_blocks(fd, bundlemem) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to restore bundle %lu", record->bundle_num);
+		bundle_decrement(bundlemem);
+		memb_free(&bundle_mem, entry);
+		return 0;
+	}
+
+	/* Get bundle struct */
+	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+
+	/* Copy everything we need from the bundle */
+	entry->bundle_num = bundle->bundle_num;
+	entry->rec_time = bundle->rec_time;
+	entry->lifetime = bundle->lifetime;
+	entry->bundle_flags = bundle->flags;
+	entry->dst_node = bundle->dst_node;
+	entry->file_size = record->size;
+	entry->segment = segment;
+	entry->offset = offset;
+
+	/* Add bundle to the list */
+	storage_eviction_describe(&entry->eviction, bundlemem, storage_expiry_of_bundle(bundlemem));
+	storage_fatfs_restore_entry(entry);
+
+	/* Deallocate memory */
+	bundle_decrement(bundlemem);
+
+	return 1;
+}
 
-		if( entry->lifetime < elapsed_time ) {
-			LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "bundle lifetime expired of bundle %lu", entry->bundle_num);
-			storage_fatfs_delete_bundle(entry->bundle_num, REASON_LIFETIME_EXPIRED);
+/**
+ * \brief Removes the restored entries of a segment
+ * \param segment number of the segment
+ */
+static void storage_fatfs_restore_forget_segment(const uint8_t segment)
+{
+	struct file_list_entry_t * entry = list_head(bundle_list);
+
+	while( entry != NULL ) {
+		struct file_list_entry_t * const next = list_item_next(entry);
+
+		if( entry->segment == segment ) {
+			storage_fatfs_restore_forget(entry);
 		}
+
+		entry = next;
 	}
 }
 
 /**
- * \brief Sets the storage to its initial state
+ * \brief Restores the bundles of a segment
+ *
+ * If the segment state was restored from the manifest,
+ * only the records behind its tail are read.
+ * \param segment number of the segment
+ * \param resume 1 if the state was restored from the manifest
+ * \return 1 on success, 0 if the segment has to be reset
  */
-static void storage_fatfs_reinit(void)
+static uint8_t storage_fatfs_restore_segment(const uint8_t segment, const uint8_t resume)
 {
-	// Remove all bundles from storage
-	while(bundles_in_storage > 0) {
-		struct file_list_entry_t * entry = list_head(bundle_list);
+	struct file_segment_t * const state = &segments[segment];
+	struct file_segment_header_t header;
+	UINT bytes = 0;
+	FIL fd;
 
-		if( entry == NULL ) {
-			// We do not have bundles in storage, stop deleting them
+	if( !storage_fatfs_segment_open(&fd, segment, FA_OPEN_ALWAYS | FA_READ | FA_WRITE) ) {
+		return 0;
+	}
+
+	if( f_read(&fd, &header, sizeof(header), &bytes) != FR_OK || bytes != sizeof(header) ||
+			header.magic != STORAGE_FATFS_MAGIC_SEGMENT || f_size(&fd) < STORAGE_FATFS_SEGMENT_SIZE ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "segment %u is not initialised", segment);
+		storage_fatfs_segment_close(&fd, segment);
+		storage_fatfs_restore_forget_segment(segment);
+		return 0;
+	}
+
+	if( !resume || header.generation != state->generation ||
+			state->tail < sizeof(header) || state->tail > STORAGE_FATFS_SEGMENT_SIZE ) {
+		if( resume ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "segment %u does not match the manifest, scanning it", segment);
+			storage_fatfs_restore_forget_segment(segment);
+		}
+
+		state->generation = header.generation;
+		state->tail = sizeof(header);
+		state->live_bytes = 0;
+		state->live_records = 0;
+	}
+
+	if( header.generation > segment_generation ) {
+		segment_generation = header.generation;
+	}
+
+	/* Read the records up to the first one, which was not written in this generation */
+	while( state->tail + sizeof(struct file_record_header_t) <= STORAGE_FATFS_SEGMENT_SIZE ) {
+		struct file_record_header_t record;
+		const uint32_t offset = state->tail;
+
+		if( f_lseek(&fd, offset) != FR_OK || f_read(&fd, &record, sizeof(record), &bytes) != FR_OK || bytes != sizeof(record) ) {
 			break;
 		}
 
-		storage_fatfs_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE);
+		if( (record.magic != STORAGE_FATFS_MAGIC_LIVE && record.magic != STORAGE_FATFS_MAGIC_DEAD) ||
+				record.generation != state->generation ||
+				record.size < sizeof(struct bundle_t) ||
+				offset + sizeof(record) + record.size > STORAGE_FATFS_SEGMENT_SIZE ) {
+			break;
+		}
+
+		state->tail += sizeof(record) + record.size;
+
+		if( record.magic == STORAGE_FATFS_MAGIC_DEAD ) {
+			continue;
+		}
+
+		if( storage_index_find(&bundle_index, record.bundle_num) != NULL ) {
+			/* Left behind by an interrupted compaction */
+			const uint32_t magic = STORAGE_FATFS_MAGIC_DEAD;
+			LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "bundle %lu is stored twice, dropping copy in segment %u", record.bundle_num, segment);
+			if( f_lseek(&fd, offset) == FR_OK ) {
+				f_write(&fd, &magic, sizeof(magic), &bytes);
+			}
+			continue;
+		}
+
+		storage_fatfs_restore_record(&fd, segment, offset, &record);
 	}
 
-	// And reset our counters
-	bundles_in_storage = 0;
+	storage_fatfs_segment_close(&fd, segment);
+
+	return 1;
 }
 
 /**
- * \brief This function delete as many bundles from the storage as necessary to have at least one slot free
- * \param bundlemem Pointer to the MMEM struct containing the bundle
- * \return 1 on success, 0 if no room could be made free
+ * \brief Restore bundles stored in the segments
  */
-static uint8_t storage_fatfs_make_room(struct mmem * bundlemem)
+static void storage_fatfs_reconstruct_bundles()
 {
-	/* Delete expired bundles first */
-	storage_fatfs_prune(NULL);
+	uint8_t invalid[STORAGE_FATFS_SEGMENTS];
 
-	/* If we do not have a pointer, we cannot compare - do nothing */
-	if( bundlemem == NULL ) {
-		return 0;
+//	RADIO_SAFE_STATE_ON();
+
+	const uint8_t resume = storage_fatfs_restore_manifest();
+
+	/* Read the records, which were appended after the last journal record */
+	for(int i=0; i<STORAGE_FATFS_SEGMENTS; i++) {
+		invalid[i] = !storage_fatfs_restore_segment(i, resume);
 	}
 
-#if BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DO_NOT_DELETE
-	/* We do not delete at all. If storage is used up, we sit there and wait */
-	if( bundles_in_storage >= BUNDLE_STORAGE_SIZE ) {
+	/* The new generations have to be newer than all restored ones */
+	for(int i=0; i<STORAGE_FATFS_SEGMENTS; i++) {
+		if( invalid[i] ) {
+			storage_fatfs_segment_reset(i);
+		}
+	}
+
+	/* Continue appending to the newest segment */
+	active_segment = 0;
+	for(int i=1; i<STORAGE_FATFS_SEGMENTS; i++) {
+		if( segments[i].generation > segments[active_segment].generation ) {
+			active_segment = i;
+		}
+	}
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Restored %u bundles from %u segments", bundles_in_storage, STORAGE_FATFS_SEGMENTS);
+
+	/* Start with an empty journal */
+	storage_fatfs_checkpoint();
+
+//	RADIO_SAFE_STATE_OFF();
+}
+#endif
+
+
+/**
+ * \brief Queues a job for the writer task
+ * \param job the job, which is copied into the queue
+ * \param timeout ticks to wait for room in the queue
+ * \return 1 on success, 0 if the queue is full
+ */
+static uint8_t storage_fatfs_submit(const struct file_job_t * const job, const TickType_t timeout)
+{
+	if( xQueueSend(job_queue, job, timeout) != pdTRUE ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "writer queue full, job %u for bundle %lu not queued", job->type, job->bundle_num);
 		return 0;
 	}
-#elif (BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDEST || BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGEST )
-	struct bundle_t * bundle = NULL;
-	struct file_list_entry_t * entry = NULL;
 
-	/* Keep deleting bundles until we have enough slots */
-	while( bundles_in_storage >= BUNDLE_STORAGE_SIZE) {
-		unsigned long comparator = 0;
-		struct file_list_entry_t * deletor = NULL;
+	return 1;
+}
+
+/**
+ * \brief deletes expired bundles from storage
+ *
+ * Called by the store timer, which also lets the writer compact one segment
+ * if only few segments are empty and write a checkpoint
+ * if the journal became too long.
+ */
+static void storage_fatfs_prune(const TimerHandle_t timer)
+{
+	struct storage_expiry_node_t * node = NULL;
+	const uint32_t now = storage_expiry_now();
+	uint8_t empty_segments = 0;
+	struct file_job_t job;
 
-		for( entry = list_head(bundle_list);
-			 entry != NULL;
-			 entry = list_item_next(entry) ) {
+	/* The timer must not wait for the segments or the writer,
+	 * bundles, which are not deleted now, are deleted on the next run
+	 */
+	const TickType_t wait = (timer != NULL) ? 0 : portMAX_DELAY;
 
-			/* Never delete locked bundles */
-			if( entry->flags & STORAGE_COFFEE_FLAGS_LOCKED ) {
-				continue;
-			}
+	// Delete expired bundles from storage, only these are taken from the queue
+	while( (node = storage_expiry_pop_expired(&bundle_expiry, now)) != NULL ) {
+		struct file_list_entry_t * const entry = storage_expiry_entry(node, struct file_list_entry_t, expiry);
 
-			/* Always keep bundles with higher priority */
-			if( (entry->bundle_flags & BUNDLE_PRIORITY_MASK) > (bundle->flags & BUNDLE_PRIORITY_MASK ) ) {
-				continue;
-			}
+		LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "bundle lifetime expired of bundle %lu", entry->bundle_num);
+		if( !storage_fatfs_delete_bundle_wait(entry->bundle_num, REASON_LIFETIME_EXPIRED, wait) ) {
+			// Try again on the next run
+			storage_expiry_add(&bundle_expiry, node, now + 1);
 
-#if BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDEST
-			if( (clock_seconds() - entry->rec_time) > comparator || comparator == 0) {
-				comparator = clock_seconds() - entry->rec_time;
-				deletor = entry;
-			}
-#elif BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGEST
-			if( (clock_seconds() - entry->rec_time) < comparator || comparator == 0) {
-				comparator = clock_seconds() - entry->rec_time;
-				deletor = entry;
+			if( wait == 0 ) {
+				break;
 			}
-#endif
 		}
+	}
+
+	if( timer == NULL ) {
+		return;
+	}
+
+	/* The timer must not wait for the writer, the jobs are retried on the next run */
+	memset(&job, 0, sizeof(job));
+
+	storage_fatfs_segment_empty(&empty_segments);
+	if( empty_segments < STORAGE_FATFS_SEGMENTS_RESERVE ) {
+		job.type = STORAGE_FATFS_JOB_COMPACT;
+		storage_fatfs_submit(&job, 0);
+	}
+
+	if( journal_records >= STORAGE_FATFS_JOURNAL_LENGTH || !manifest_valid ) {
+		job.type = STORAGE_FATFS_JOB_CHECKPOINT;
+		storage_fatfs_submit(&job, 0);
+	}
+}
+
+/**
+ * \brief Sets the storage to its initial state
+ */
+static void storage_fatfs_reinit(void)
+{
+	// Remove all bundles from storage
+	while(bundles_in_storage > 0) {
+		struct file_list_entry_t * entry = list_head(bundle_list);
 
-		/* Either the for loop did nothing or did not break */
 		if( entry == NULL ) {
-			/* We do not have deletable bundles in storage, stop deleting them */
-			return 0;
+			// We do not have bundles in storage, stop deleting them
+			break;
 		}
 
-		/* Delete Bundle */
 		storage_fatfs_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE);
 	}
-#elif (BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDER || BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGER )
-	struct bundle_t * bundle = NULL;
-	struct file_list_entry_t * entry = NULL;
 
-	/* Keep deleting bundles until we have enough slots */
-	while( bundles_in_storage >= BUNDLE_STORAGE_SIZE) {
-		/* Obtain the new pointer each time, since the address may change */
-		bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	// And reset our counters
+	bundles_in_storage = 0;
+}
+
+/**
+ * \brief This function delete as many bundles from the storage as necessary to have at least one slot free
+ * \param bundlemem Pointer to the MMEM struct containing the bundle
+ * \return 1 on success, 0 if no room could be made free
+ */
+static uint8_t storage_fatfs_make_room(struct mmem * bundlemem)
+{
+	/* Delete expired bundles first */
+	storage_fatfs_prune(NULL);
 
-		/* We need this double-loop because otherwise we would be modifying the list
-		 * while iterating through it
-		 */
-		for( entry = list_head(bundle_list);
-			 entry != NULL;
-			 entry = list_item_next(entry) ) {
-			/* Never delete locked bundles */
-			if( entry->flags & STORAGE_COFFEE_FLAGS_LOCKED ) {
-				continue;
-			}
+	/* If we do not have a pointer, we cannot compare - do nothing */
+	if( bundlemem == NULL ) {
+		return 0;
+	}
 
-			/* Always keep bundles with higher priority */
-			if( (entry->bundle_flags & BUNDLE_PRIORITY_MASK) > (bundle->flags & BUNDLE_PRIORITY_MASK ) ) {
-				continue;
-			}
+	struct storage_eviction_node_t incoming;
+	struct storage_eviction_node_t * victim = NULL;
 
-			const uint32_t new_age = bundle->lifetime - ( (xTaskGetTickCount() - bundle->rec_time) / 1000 / portTICK_PERIOD_MS );
-			const uint32_t old_age = entry->lifetime - ( (xTaskGetTickCount() - entry->rec_time) / 1000 / portTICK_PERIOD_MS );
-#if BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDER
-			/* If the new bundle has a longer lifetime than the bundle in our storage,
-			 * delete the bundle from storage to make room
-			 */
-			if (new_age >= old_age) {
-				break;
-			}
-#elif BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGER
-			/* Delete youngest bundle in storage */
-			// TODO possibly wrong comparsion
-			if(new_age >= old_age) {
-				break;
-			}
-#endif
-		}
+	storage_eviction_describe(&incoming, bundlemem, storage_expiry_of_bundle(bundlemem));
 
-		/* Either the for loop did nothing or did not break */
-		if( entry == NULL ) {
+	/* Keep deleting bundles until we have enough slots */
+	while( bundles_in_storage >= BUNDLE_STORAGE_SIZE ) {
+		victim = storage_eviction_victim(&bundle_eviction, &incoming);
+		if( victim == NULL ) {
 			/* We do not have deletable bundles in storage, stop deleting them */
 			return 0;
 		}
 
 		/* Delete Bundle */
-		storage_fatfs_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE);
+		const struct file_list_entry_t * const entry = storage_eviction_entry(victim, struct file_list_entry_t, eviction);
+		if( !storage_fatfs_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE) ) {
+			return 0;
+		}
 	}
-#else
-#error No Bundle Deletion Strategy defined
-#endif
 
 	/* At least one slot is free now */
 	return 1;
@@ -534,16 +1819,18 @@ static uint8_t storage_fatfs_make_room(struct mmem * bundlemem)
 
 /**
  * \brief saves a bundle in storage
+ *
+ * The bundle is stored in RAM and queued for the writer task.
  * \param bundlemem pointer to the MMEM struct containing the bundle
  * \param bundle_number_ptr The pointer to the bundle number will be stored here
+ * \param flags initial STORAGE_FATFS_FLAGS_* of the entry
  * \return 1 on success, 0 otherwise
  */
-static uint8_t storage_fatfs_save_bundle(struct mmem* const bundlemem, uint32_t* const bundle_number_ptr)
+static uint8_t storage_fatfs_save(struct mmem* const bundlemem, uint32_t* const bundle_number_ptr, const uint8_t flags)
 {
 	struct bundle_t * bundle = NULL;
 	struct file_list_entry_t * entry = NULL;
-	char bundle_filename[STORAGE_FILE_NAME_LENGTH];
-	int n;
+	struct file_job_t job;
 
 	if( bundlemem == NULL ) {
 		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "save_bundle with invalid pointer %p", bundlemem);
@@ -560,16 +1847,12 @@ static uint8_t storage_fatfs_save_bundle(struct mmem* const bundlemem, uint32_t*
 	}
 
 	// Look for duplicates in the storage
-	for(entry = list_head(bundle_list);
-		entry != NULL;
-		entry = list_item_next(entry)) {
-
-		if( bundle->bundle_num == entry->bundle_num ) {
-			LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "%lu is the same bundle", entry->bundle_num);
-			*bundle_number_ptr = entry->bundle_num;
-			bundle_decrement(bundlemem);
-			return entry->bundle_num;
-		}
+	entry = (struct file_list_entry_t *) storage_index_find(&bundle_index, bundle->bundle_num);
+	if( entry != NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "%lu is the same bundle", entry->bundle_num);
+		*bundle_number_ptr = entry->bundle_num;
+		bundle_decrement(bundlemem);
+		return entry->bundle_num;
 	}
 
 	while ( !storage_fatfs_make_room(bundlemem) ) {
@@ -606,138 +1889,170 @@ static uint8_t storage_fatfs_save_bundle(struct mmem* const bundlemem, uint32_t*
 	// Copy necessary values from the bundle
 	entry->rec_time = bundle->rec_time;
 	entry->lifetime = bundle->lifetime;
-	entry->file_size = bundlemem->size;
+	entry->file_size = storage_fatfs_file_size(bundlemem);
 	entry->bundle_flags = bundle->flags;
+	entry->dst_node = bundle->dst_node;
+	entry->flags = flags;
 
 	// Assign a unique bundle number
 	entry->bundle_num = bundle->bundle_num;
 
-	// determine the filename
-	n = snprintf(bundle_filename, STORAGE_FILE_NAME_LENGTH, "%lu.b", entry->bundle_num);
-	if( n == STORAGE_FILE_NAME_LENGTH ) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "file name buffer is too short");
-		memb_free(&bundle_mem, entry);
-		bundle_decrement(bundlemem);
-		return 0;
-	}
+	storage_eviction_describe(&entry->eviction, bundlemem, storage_expiry_of_bundle(bundlemem));
 
-//	RADIO_SAFE_STATE_ON();
+	// The entry keeps the reference of the caller, until the writer has appended the bundle to a segment
+	entry->pending = bundlemem;
 
-	// Store the bundle into the file
-//	n = cfs_coffee_reserve(bundle_filename, bundlemem->size);
-//	if( n < 0 ) {
-//		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to reserve %u bytes for bundle", bundlemem->size);
-//		memb_free(&bundle_mem, entry);
-//		bundle_decrement(bundlemem);
-//		RADIO_SAFE_STATE_OFF();
-//		return 0;
-//	}
-
-	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "open file %s", bundle_filename);
-	// Open the output file
-	FIL fd_write;
-	const FRESULT res = f_open(&fd_write, bundle_filename, FA_CREATE_ALWAYS | FA_WRITE);
-	if (res != FR_OK) {
-		// Unable to open file, abort here
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to open file %s, cannot save bundle (err %u)", bundle_filename, res);
-		storage_fatfs_file_close(&fd_write, bundle_filename);
-		memb_free(&bundle_mem, entry);
-		bundle_decrement(bundlemem);
-//		RADIO_SAFE_STATE_OFF();
-		return 0;
-	}
+	memset(&job, 0, sizeof(job));
+	job.type = STORAGE_FATFS_JOB_SAVE;
+	job.bundle_num = entry->bundle_num;
+	job.data.bundlemem = bundlemem;
+	bundle_increment(bundlemem);
 
-	// Write our complete bundle
-	UINT bytes_written = 0;
-	const FRESULT ret = f_write(&fd_write, bundle, bundlemem->size, &bytes_written);
-	if(ret != FR_OK || bytes_written != bundlemem->size) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to write %u bytes to file %s, aborting (err %u, written %u)",
-			bundlemem->size, bundle_filename, res, bytes_written);
-		storage_fatfs_file_close(&fd_write, bundle_filename);
-		f_unlink(bundle_filename);
+	/* The writer cannot look for the entry, before it was added */
+	xSemaphoreTake(segment_mutex, portMAX_DELAY);
 
+	if( !storage_fatfs_submit(&job, 0) ) {
+		xSemaphoreGive(segment_mutex);
+
+		/* Do not accept the bundle and send a temporary NACK */
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "writer is busy, cannot save bundle %lu", entry->bundle_num);
 		memb_free(&bundle_mem, entry);
 		bundle_decrement(bundlemem);
-//		RADIO_SAFE_STATE_OFF();
+		bundle_decrement(bundlemem);
 		return 0;
 	}
 
-	// And close the file
-	storage_fatfs_file_close(&fd_write, bundle_filename);
-	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "file %s closed", bundle_filename);
-
-//	RADIO_SAFE_STATE_OFF();
-
 	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "New Bundle %lu (%lu), Src %lu.%lu, Dest %lu.%lu, Seq %lu",
 		bundle->bundle_num, entry->bundle_num, bundle->src_node, ((uint32_t)bundle->src_srv),
 		bundle->dst_node, ((uint32_t)bundle->dst_srv), bundle->tstamp_seq);
 
-	// Add bundle to the list
+	// Add bundle to the list and the index
 	list_add(bundle_list, entry);
+	storage_index_add(&bundle_index, (struct storage_entry_t *) entry);
+	storage_expiry_add(&bundle_expiry, &entry->expiry, entry->eviction.expiration);
+	storage_eviction_add(&bundle_eviction, &entry->eviction);
 
 	// Mark the bundle list as changed
 	bundle_list_changed = 1;
 	bundles_in_storage++;
 
-	// Now we have to free the incoming bundle slot
-	bundle_decrement(bundlemem);
-
 	// Now copy over the STATIC pointer to the bundle number, so that
 	// the caller can stick it into an event
 	*bundle_number_ptr = entry->bundle_num;
 
+	xSemaphoreGive(segment_mutex);
+
 	/* storage status has changed */
 	xSemaphoreGive(wait_for_changes_sem);
 
 	return 1;
 }
 
+/**
+ * \brief saves a bundle in storage
+ * \param bundlemem pointer to the MMEM struct containing the bundle
+ * \param bundle_number_ptr The pointer to the bundle number will be stored here
+ * \return 1 on success, 0 otherwise
+ */
+static uint8_t storage_fatfs_save_bundle(struct mmem* const bundlemem, uint32_t* const bundle_number_ptr)
+{
+	return storage_fatfs_save(bundlemem, bundle_number_ptr, 0);
+}
+
+/**
+ * \brief saves a bundle, which is not read soon
+ *
+ * The bundle is freed after being written, instead of being added to the read cache.
+ * \param bundlemem pointer to the MMEM struct containing the bundle
+ * \param bundle_number_ptr The pointer to the bundle number will be stored here
+ * \return 1 on success, 0 otherwise
+ */
+static uint8_t storage_fatfs_demote_bundle(struct mmem* const bundlemem, uint32_t* const bundle_number_ptr)
+{
+	return storage_fatfs_save(bundlemem, bundle_number_ptr, STORAGE_FATFS_FLAGS_UNCACHED);
+}
+
 /**
  * \brief deletes a bundle form storage
  * \param bundle_number bundle number to be deleted
  * \param reason reason code
- * \return 1 on success or 0 on error
+ * \param wait how long to wait for the segments and the writer queue
+ * \return 1 on success or 0 on error, also if the wait was exceeded
  */
-static uint8_t storage_fatfs_delete_bundle(uint32_t bundle_number, uint8_t reason)
+static uint8_t storage_fatfs_delete_bundle_wait(const uint32_t bundle_number, const uint8_t reason, const TickType_t wait)
 {
 	struct bundle_t * bundle = NULL;
 	struct file_list_entry_t * entry = NULL;
 	struct mmem * bundlemem = NULL;
-	char bundle_filename[STORAGE_FILE_NAME_LENGTH];
-	int n;
+	struct mmem * pending = NULL;
+	struct file_job_t job;
 
 	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Deleting Bundle %lu with reason %u", bundle_number, reason);
 
-	// Look for the bundle we are talking about
-	for(entry = list_head(bundle_list);
-		entry != NULL;
-		entry = list_item_next(entry)) {
+//	RADIO_SAFE_STATE_ON();
 
-		if( entry->bundle_num == bundle_number ) {
-			break;
-		}
+	if( xSemaphoreTake(segment_mutex, wait) != pdTRUE ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "segments busy, bundle %lu not deleted", bundle_number);
+		return 0;
 	}
 
+	// Look for the bundle we are talking about
+	entry = (struct file_list_entry_t *) storage_index_find(&bundle_index, bundle_number);
+
 	if( entry == NULL ) {
 		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Could not find bundle %lu on del_bundle", bundle_number);
+		xSemaphoreGive(segment_mutex);
 		return 0;
 	}
 
-	// Figure out the source to send status report
-	if( reason != REASON_DELIVERED ) {
-		if( (entry->bundle_flags & BUNDLE_FLAG_CUST_REQ ) || (entry->bundle_flags & BUNDLE_FLAG_REP_DELETE) ){
-			bundlemem = storage_fatfs_read_bundle(bundle_number);
-			if( bundlemem == NULL ) {
-				LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to read back bundle %lu", bundle_number);
-				return 0;
-			}
+	// The record has to be marked as dead by the writer
+	if( entry->pending == NULL && wait != portMAX_DELAY && uxQueueSpacesAvailable(job_queue) == 0 ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "writer queue full, bundle %lu not deleted", bundle_number);
+		xSemaphoreGive(segment_mutex);
+		return 0;
+	}
 
-			bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
-			bundle->del_reason = reason;
+	// Read the bundle to send a status report to its source
+	if( reason != REASON_DELIVERED && ((entry->bundle_flags & BUNDLE_FLAG_CUST_REQ) || (entry->bundle_flags & BUNDLE_FLAG_REP_DELETE)) ) {
+		bundlemem = storage_fatfs_read_entry(entry);
+		if( bundlemem == NULL ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to read back bundle %lu", bundle_number);
+			xSemaphoreGive(segment_mutex);
+			return 0;
+		}
+	}
 
-			if (bundle->src_node != dtn_node_id){
-				STATUSREPORT.send(bundlemem, 16, bundle->del_reason);
-			}
+	// Remove the bundle from the list
+	list_remove(bundle_list, entry);
+	storage_index_remove(&bundle_index, bundle_number);
+	storage_expiry_remove(&bundle_expiry, &entry->expiry);
+	storage_eviction_remove(&bundle_eviction, &entry->eviction);
+	storage_cache_remove(&bundle_cache, bundle_number);
+
+	memset(&job, 0, sizeof(job));
+	job.type = STORAGE_FATFS_JOB_DELETE;
+	job.bundle_num = bundle_number;
+	job.data.record.segment = entry->segment;
+	job.data.record.offset = entry->offset;
+	job.data.record.size = entry->file_size;
+	pending = entry->pending;
+
+	// Mark the bundle list as changed
+	bundle_list_changed = 1;
+	bundles_in_storage--;
+
+	// Free the storage struct
+	memb_free(&bundle_mem, entry);
+
+	xSemaphoreGive(segment_mutex);
+
+	// Figure out the source to send status report
+	if( bundlemem != NULL ) {
+		bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+		bundle->del_reason = reason;
+
+		if (bundle->src_node != dtn_node_id){
+			STATUSREPORT.send(bundlemem, 16, bundle->del_reason);
 		}
 
 		bundle_decrement(bundlemem);
@@ -747,29 +2062,16 @@ static uint8_t storage_fatfs_delete_bundle(uint32_t bundle_number, uint8_t reaso
 	// Notified the agent, that a bundle has been deleted
 	agent_delete_bundle(bundle_number);
 
-	// Remove the bundle from the list
-	list_remove(bundle_list, entry);
-
-	// determine the filename and remove the file
-	n = snprintf(bundle_filename, STORAGE_FILE_NAME_LENGTH, "%lu.b", entry->bundle_num);
-	if( n == STORAGE_FILE_NAME_LENGTH ) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "file name buffer is too short");
-		return 0;
+	if( pending != NULL ) {
+		// The bundle was not written yet, the writer drops its job
+		bundle_decrement(pending);
+	} else if( !storage_fatfs_submit(&job, wait) ) {
+		// Another task has filled the queue meanwhile, the record must not stay live
+		storage_fatfs_submit(&job, portMAX_DELAY);
 	}
 
-//	RADIO_SAFE_STATE_ON();
-
-	f_unlink(bundle_filename);
-
 //	RADIO_SAFE_STATE_OFF();
 
-	// Mark the bundle list as changed
-	bundle_list_changed = 1;
-	bundles_in_storage--;
-
-	// Free the storage struct
-	memb_free(&bundle_mem, entry);
-
 	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Bundle %lu deleted with reason %u", bundle_number, reason);
 
 	/* there is one more slot free, now */
@@ -781,6 +2083,52 @@ static uint8_t storage_fatfs_delete_bundle(uint32_t bundle_number, uint8_t reaso
 	return 1;
 }
 
+/**
+ * \brief deletes a bundle form storage
+ * \param bundle_number bundle number to be deleted
+ * \param reason reason code
+ * \return 1 on success or 0 on error
+ */
+static uint8_t storage_fatfs_delete_bundle(uint32_t bundle_number, uint8_t reason)
+{
+	return storage_fatfs_delete_bundle_wait(bundle_number, reason, portMAX_DELAY);
+}
+
+/**
+ * \brief Reads the bundle of an entry from RAM, the read cache or its segment
+ *
+ * The caller has to hold the segment_mutex.
+ * \param entry entry of the bundle
+ * \return pointer to the MMEM struct containing the bundle (caller has to free)
+ */
+static struct mmem * storage_fatfs_read_entry(const struct file_list_entry_t * const entry)
+{
+	struct mmem * bundlemem = NULL;
+
+	if( entry->pending != NULL ) {
+		// The writer has not appended the bundle yet, use the one in RAM
+		bundlemem = entry->pending;
+		bundle_increment(bundlemem);
+		return bundlemem;
+	}
+
+	bundlemem = storage_cache_get(&bundle_cache, entry->bundle_num);
+	if( bundlemem != NULL ) {
+		return bundlemem;
+	}
+
+//	RADIO_SAFE_STATE_ON();
+
+	bundlemem = storage_fatfs_segment_load(entry);
+	if( bundlemem != NULL ) {
+		storage_cache_put(&bundle_cache, entry->bundle_num, bundlemem);
+	}
+
+//	RADIO_SAFE_STATE_OFF();
+
+	return bundlemem;
+}
+
 /**
  * \brief reads a bundle from storage
  * \param bundle_number bundle number to read
@@ -790,76 +2138,151 @@ static struct mmem * storage_fatfs_read_bundle(uint32_t bundle_number)
 {
 	struct file_list_entry_t * entry = NULL;
 	struct mmem * bundlemem = NULL;
-	char bundle_filename[STORAGE_FILE_NAME_LENGTH];
-	int n;
 
 	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Reading Bundle %lu", bundle_number);
 
-	// Look for the bundle we are talking about
-	for(entry = list_head(bundle_list);
-		entry != NULL;
-		entry = list_item_next(entry)) {
+	/* The record must not be moved or released while reading it */
+	xSemaphoreTake(segment_mutex, portMAX_DELAY);
 
-		if( entry->bundle_num == bundle_number ) {
-			break;
-		}
-	}
+	// Look for the bundle we are talking about
+	entry = (struct file_list_entry_t *) storage_index_find(&bundle_index, bundle_number);
 
 	if( entry == NULL ) {
 		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Could not find bundle %lu on read_bundle", bundle_number);
+		xSemaphoreGive(segment_mutex);
 		return NULL;
 	}
 
-	bundlemem = bundle_create_bundle();
-	if( bundlemem == NULL ) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "cannot allocate memory for bundle %lu", bundle_number);
-		return NULL;
-	}
+	bundlemem = storage_fatfs_read_entry(entry);
+	xSemaphoreGive(segment_mutex);
 
-	n = mmem_realloc(bundlemem, entry->file_size);
-	if( !n ) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to realloc enough memory");
-		bundle_decrement(bundlemem);
-		return NULL;
-	}
+	return bundlemem;
+}
 
-	// determine the filename
-	n = snprintf(bundle_filename, STORAGE_FILE_NAME_LENGTH, "%lu.b", entry->bundle_num);
-	if( n == STORAGE_FILE_NAME_LENGTH ) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "file name buffer is too short");
-		bundle_decrement(bundlemem);
-		return NULL;
-	}
+/**
+ * \brief Appends a queued bundle to a segment
+ * \param bundle_number number of the bundle
+ * \param bundlemem bundle of the job, the reference of the job is kept
+ */
+static void storage_fatfs_writer_save(const uint32_t bundle_number, struct mmem * const bundlemem)
+{
+	struct file_list_entry_t * entry = NULL;
+	event_container_t event;
+	int n = 0;
 
-//	RADIO_SAFE_STATE_ON();
+	// Append the bundle to the active segment, compact segments if all are full
+	do {
+		xSemaphoreTake(segment_mutex, portMAX_DELAY);
 
-	// Open the output file
-	FIL fd_read;
-	const FRESULT open_res = f_open(&fd_read, bundle_filename, FA_OPEN_EXISTING | FA_READ);
-	if(open_res != FR_OK) {
-		// Unable to open file, abort here
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to open file %s, cannot read bundle (err %u)", bundle_filename, open_res);
-		bundle_decrement(bundlemem);
-		storage_fatfs_file_close(&fd_read, bundle_filename);
-		return NULL;
+		// The bundle may have been deleted, while the job was queued
+		entry = (struct file_list_entry_t *) storage_index_find(&bundle_index, bundle_number);
+		if( entry == NULL || entry->pending != bundlemem ) {
+			xSemaphoreGive(segment_mutex);
+			return;
+		}
+
+		n = storage_fatfs_segment_append(entry, bundlemem, 1);
+		if( n > 0 ) {
+			entry->pending = NULL;
+
+			// The bundle is likely to be sent soon, unless it was demoted
+			if( !(entry->flags & STORAGE_FATFS_FLAGS_UNCACHED) ) {
+				storage_cache_put(&bundle_cache, bundle_number, bundlemem);
+			}
+		}
+
+		xSemaphoreGive(segment_mutex);
+	} while( n == 0 && storage_fatfs_compact() );
+
+	if( n <= 0 ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to append bundle %lu to a segment, deleting it", bundle_number);
+		storage_fatfs_delete_bundle(bundle_number, REASON_DEPLETED_STORAGE);
+		return;
 	}
 
-	// Read our complete bundle
-	UINT bytes_read = 0;
-	const FRESULT ret = f_read(&fd_read, MMEM_PTR(bundlemem), bundlemem->size, &bytes_read);
-	if(ret != FR_OK || bytes_read != bundlemem->size) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to read %u bytes from file %s, aborting", bundlemem->size, bundle_filename);
-		bundle_decrement(bundlemem);
-		storage_fatfs_file_close(&fd_read, bundle_filename);
-		return NULL;
+	// The bundle is read from the cache or the segment from now on, release the reference of the entry
+	bundle_decrement(bundlemem);
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Bundle %lu written to segment", bundle_number);
+
+	event.event = dtn_bundle_durable_event;
+	event.bundle_number = bundle_number;
+	agent_send_event(&event);
+}
+
+/**
+ * \brief Task, which does all writes to the SD card
+ */
+static void storage_fatfs_writer_process(void* p)
+{
+	struct file_job_t job;
+
+	for(;;) {
+		if( xQueueReceive(job_queue, &job, portMAX_DELAY) != pdTRUE ) {
+			continue;
+		}
+
+		switch (job.type) {
+			case STORAGE_FATFS_JOB_SAVE:
+				storage_fatfs_writer_save(job.bundle_num, job.data.bundlemem);
+				bundle_decrement(job.data.bundlemem);
+				break;
+
+			case STORAGE_FATFS_JOB_DELETE:
+				xSemaphoreTake(segment_mutex, portMAX_DELAY);
+				storage_fatfs_segment_release(job.data.record.segment, job.data.record.offset, job.data.record.size);
+				storage_fatfs_journal_delete(job.bundle_num);
+				xSemaphoreGive(segment_mutex);
+				break;
+
+			case STORAGE_FATFS_JOB_COMPACT:
+				storage_fatfs_compact();
+				break;
+
+			case STORAGE_FATFS_JOB_CHECKPOINT:
+				xSemaphoreTake(segment_mutex, portMAX_DELAY);
+				storage_fatfs_checkpoint();
+				xSemaphoreGive(segment_mutex);
+				break;
+
+			case STORAGE_FATFS_JOB_FLUSH:
+				// All jobs queued before the flush are done and journaled
+				xSemaphoreTake(segment_mutex, portMAX_DELAY);
+				storage_fatfs_journal_sync();
+				xSemaphoreGive(segment_mutex);
+				xTaskNotifyGive(job.data.task);
+				break;
+
+			default:
+				LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unknown writer job %u", job.type);
+				break;
+		}
+
+		// Sync the journal once for all jobs, which were queued together
+		if( uxQueueMessagesWaiting(job_queue) == 0 ) {
+			xSemaphoreTake(segment_mutex, portMAX_DELAY);
+			storage_fatfs_journal_sync();
+			xSemaphoreGive(segment_mutex);
+		}
 	}
+}
+
+/**
+ * \brief Waits, until the writer task has done all jobs queued before
+ */
+static void storage_fatfs_flush(void)
+{
+	struct file_job_t job;
 
-	// And close the file
-	storage_fatfs_file_close(&fd_read, bundle_filename);
+	memset(&job, 0, sizeof(job));
+	job.type = STORAGE_FATFS_JOB_FLUSH;
+	job.data.task = xTaskGetCurrentTaskHandle();
 
-//	RADIO_SAFE_STATE_OFF();
+	if( !storage_fatfs_submit(&job, portMAX_DELAY) ) {
+		return;
+	}
 
-	return bundlemem;
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 }
 
 /**
@@ -889,6 +2312,57 @@ static struct storage_entry_t * storage_fatfs_get_bundles(void)
 	return (struct storage_entry_t *) list_head(bundle_list);
 }
 
+/**
+ * \brief Get the next bundle, which matches a query
+ * \param query the query
+ * \param previous entry returned by the last call or NULL to start with the first bundle
+ * \returns pointer to the bundle list entry or NULL if no more bundles match
+ */
+static struct storage_entry_t * storage_fatfs_query_bundles(const struct storage_query_t * const query, const struct storage_entry_t * const previous)
+{
+	struct file_list_entry_t * entry = NULL;
+
+	if( previous == NULL ) {
+		entry = list_head(bundle_list);
+	} else {
+		entry = list_item_next((void *) previous);
+	}
+
+	for( ; entry != NULL; entry = list_item_next(entry) ) {
+		if( storage_query_match(query, &entry->eviction, entry->dst_node, entry->flags & STORAGE_COFFEE_FLAGS_LOCKED) ) {
+			return (struct storage_entry_t *) entry;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Get the metadata of a bundle without reading it
+ * \param bundle_num Bundle number
+ * \param eviction returns the priority class, the time of reception and the expiration
+ * \param dst_node returns the destination node
+ * \return 1 on success or 0 if the bundle is not stored
+ */
+static uint8_t storage_fatfs_describe_bundle(uint32_t bundle_num, struct storage_eviction_node_t * const eviction, uint32_t * const dst_node)
+{
+	const struct file_list_entry_t * entry = NULL;
+
+	xSemaphoreTake(segment_mutex, portMAX_DELAY);
+
+	// Look for the bundle we are talking about
+	entry = (struct file_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
+
+	if( entry != NULL ) {
+		storage_eviction_copy(eviction, &entry->eviction);
+		*dst_node = entry->dst_node;
+	}
+
+	xSemaphoreGive(segment_mutex);
+
+	return entry != NULL;
+}
+
 /**
  * \brief Mark a bundle as locked so that it will not be deleted even if we are running out of space
  *
@@ -900,13 +2374,7 @@ static uint8_t storage_fatfs_lock_bundle(uint32_t bundle_num)
 	struct file_list_entry_t * entry = NULL;
 
 	// Look for the bundle we are talking about
-	for(entry = list_head(bundle_list);
-			entry != NULL;
-			entry = list_item_next(entry)) {
-		if( entry->bundle_num == bundle_num ) {
-			break;
-		}
-	}
+	entry = (struct file_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
 
 	if( entry == NULL ) {
 		return 0;
@@ -914,6 +2382,9 @@ static uint8_t storage_fatfs_lock_bundle(uint32_t bundle_num)
 
 	entry->flags |= STORAGE_COFFEE_FLAGS_LOCKED;
 
+	// Never delete locked bundles
+	storage_eviction_remove(&bundle_eviction, &entry->eviction);
+
 	return 1;
 }
 
@@ -925,19 +2396,15 @@ static void storage_fatfs_unlock_bundle(uint32_t bundle_num)
 	struct file_list_entry_t * entry = NULL;
 
 	// Look for the bundle we are talking about
-	for(entry = list_head(bundle_list);
-			entry != NULL;
-			entry = list_item_next(entry)) {
-		if( entry->bundle_num == bundle_num ) {
-			break;
-		}
-	}
+	entry = (struct file_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
 
 	if( entry == NULL ) {
 		return;
 	}
 
 	entry->flags &= ~STORAGE_COFFEE_FLAGS_LOCKED;
+
+	storage_eviction_add(&bundle_eviction, &entry->eviction);
 }
 
 
@@ -961,8 +2428,12 @@ const struct storage_driver storage_fatfs = {
 	storage_fatfs_get_free_space,
 	storage_fatfs_get_bundle_numbers,
 	storage_fatfs_get_bundles,
+	storage_fatfs_query_bundles,
+	storage_fatfs_describe_bundle,
 	storage_fatfs_wait_for_changes,
 	storage_fatfs_format,
+	storage_fatfs_flush,
+	storage_fatfs_demote_bundle,
 };
 /** @} */
 /** @} */
@@ -10,19 +10,32 @@
  */
 
 /**
- * \file 
+ * \file
  * \author Wolf-Bastian Pöttner <poettner@ibr.cs.tu-bs.de>
+ *
+ * A bundle is stored as a chain of records. Each record holds a fragment of
+ * the bundle and the page of the next fragment. New records are appended to
+ * the open page, so small bundles share a page. A bundle, which does not fit,
+ * continues on further pages, which are filled completely.
+ *
+ * Deleting a bundle only marks its records as dead. A page is released,
+ * when all its records are dead, and is erased when it is allocated again.
+ * The free pages are kept in a bitmap in RAM and allocated round robin,
+ * so the erase cycles are spread over all pages of the region.
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 
 #include "FreeRTOS.h"
 #include "timers.h"
+#include "semphr.h"
 
 #include "lib/list.h"
 #include "lib/logging.h"
+#include "lib/random.h"
 #include "dev/watchdog.h"
 
 /* <> is necessary to include the header in the platform (instead of our fake header) */
@@ -38,6 +51,27 @@
 #include "system_clock.h"
 
 #include "storage.h"
+#include "storage_index.h"
+#include "storage_expiry.h"
+#include "storage_eviction.h"
+#include "storage_query.h"
+
+/**
+ * Number of flash pages used for the bundles
+ */
+#ifdef STORAGE_FLASH_CONF_PAGES
+#define FLASH_PAGES_IN_USE STORAGE_FLASH_CONF_PAGES
+#else
+#define FLASH_PAGES_IN_USE FLASH_PAGES
+#endif
+
+#if FLASH_PAGES_IN_USE > FLASH_PAGES
+#error More flash pages in use than available
+#endif
+
+#if FLASH_PAGE_SIZE < 64
+#error Flash pages are too small for the records
+#endif
 
 struct storage_flash_entry_t {
 	/** pointer to the next list element */
@@ -49,30 +83,95 @@ struct storage_flash_entry_t {
 	/** Internal flash for the storage */
 	uint8_t storage_flags;
 
-	/** Flash page where bundle is stored */
+	/** Flash page of the first record of the bundle */
 	uint16_t page;
 
+	/** Offset of the first record in its page */
+	uint16_t offset;
+
 	/** Flags of the primary bundle block */
 	uint32_t bundle_flags;
 
-	/** Timestamp at which the bundle will expire */
-	uint32_t expiration;
+	/** destination node, to answer queries without reading the bundle */
+	uint32_t dst_node;
+
+	/** Timestamp at which the bundle will expire and position in the expiry queue */
+	struct storage_expiry_node_t expiry;
+
+	/** position in the eviction heap */
+	struct storage_eviction_node_t eviction;
 };
 
+/**
+ * Header at the beginning of a used flash page
+ */
 struct storage_flash_page_t {
 	uint32_t tag;
-	uint32_t size;
-	uint8_t bundle[FLASH_PAGE_SIZE - 8];
+} __attribute__ ((packed));
+
+/**
+ * Header of a record, followed by the fragment of the bundle
+ */
+struct storage_flash_record_t {
+	uint32_t bundle_num;
+
+	/** bytes of the fragment */
+	uint16_t length;
+
+	/** page of the next fragment, which starts the page, or STORAGE_FLASH_NO_PAGE */
+	uint16_t next_page;
+
+	/** number of the fragment, 0 for the first one */
+	uint8_t fragment;
+
+	/** STORAGE_FLASH_RECORD_* */
+	uint8_t state;
+
+	uint16_t reserved;
+} __attribute__ ((packed));
+
+/**
+ * Block header of a bundle, followed by the block data.
+ * A stored bundle contains the struct bundle_t followed by its blocks.
+ */
+struct storage_flash_block_t {
+	uint8_t type;
+	uint32_t flags;
+	int block_size;
+} __attribute__ ((packed));
+
+/**
+ * Position while reading or writing the records of a bundle
+ */
+struct storage_flash_cursor_t {
+	uint32_t bundle_num;
+
+	/** page and offset of the next byte */
+	uint16_t page;
+	uint16_t offset;
+
+	/** bytes left in the current fragment */
+	uint16_t left;
+
+	/** page of the next fragment */
+	uint16_t next_page;
+
+	/** number of the current fragment */
+	uint8_t fragment;
+
+	/** bytes of the bundle behind the current fragment (only used for writing) */
+	uint32_t remaining;
 };
 
 struct mmem * last_bundle = NULL;
 uint32_t last_bundle_number = 0;
 
-struct storage_flash_page_t page_buffer;
-
 // List and memory blocks for the bundles
 LIST(bundle_list);
 MEMB(bundle_mem, struct storage_flash_entry_t, BUNDLE_STORAGE_SIZE);
+STORAGE_INDEX(bundle_index, BUNDLE_STORAGE_SIZE);
+STORAGE_EXPIRY(bundle_expiry, BUNDLE_STORAGE_SIZE);
+STORAGE_EVICTION(bundle_eviction, BUNDLE_STORAGE_SIZE);
 
 /**
  * Flags for the storage
@@ -80,29 +179,55 @@ MEMB(bundle_mem, struct storage_flash_entry_t, BUNDLE_STORAGE_SIZE);
 #define STORAGE_FLASH_FLAGS_LOCKED 	0x1
 
 /**
- * "Magic" tag to detect flash pages that contain a bundle
+ * "Magic" tag to detect flash pages that contain records
  */
 #define STORAGE_FLASH_TAG			0xAA55A5AA
 
+/**
+ * States of a record. Erased flash reads as STORAGE_FLASH_RECORD_FREE,
+ * the other states only clear bits, so they can be written without erasing.
+ */
+#define STORAGE_FLASH_RECORD_FREE	0xFF
+#define STORAGE_FLASH_RECORD_LIVE	0x7F
+#define STORAGE_FLASH_RECORD_DEAD	0x00
+
+#define STORAGE_FLASH_NO_PAGE		0xFFFF
+
+/**
+ * Records start at word boundaries
+ */
+#define STORAGE_FLASH_ALIGN(x)		(((x) + 3) & ~3UL)
+
+/**
+ * Bytes of a fragment, which fill a page completely
+ */
+#define STORAGE_FLASH_FRAGMENT_SIZE	(FLASH_PAGE_SIZE - sizeof(struct storage_flash_page_t) - sizeof(struct storage_flash_record_t))
+
+/**
+ * A new record is not started in the open page, if fewer bytes of the bundle would fit
+ */
+#define STORAGE_FLASH_MIN_FRAGMENT	16
+
 /** Is used to periodically traverse all bundles and delete those that are expired */
 static TimerHandle_t storage_flash_timer;
 
+static SemaphoreHandle_t wait_for_changes_sem = NULL;
+
 uint32_t bundles_in_storage = 0;
 
-#if BUNDLE_STORAGE_SIZE > FLASH_PAGES
-#error More storage slots than flash pages, not supported
-#endif
+/** Bit set for every page, which can be allocated */
+static uint8_t free_pages[(FLASH_PAGES_IN_USE + 7) / 8];
+static uint16_t free_page_count = 0;
 
-/**
- * We want to use as many flash pages as possible (for wear leveling)
- * However, using too many pages makes scanning and formatting very slow
- * Therefore we use 4 times as many pages as we have slots in the storage
- */
-#if (4 * BUNDLE_STORAGE_SIZE) > FLASH_PAGES
-#define FLASH_PAGES_IN_USE FLASH_PAGES
-#else
-#define FLASH_PAGES_IN_USE (4 * BUNDLE_STORAGE_SIZE)
-#endif
+/** Number of live records in every page */
+static uint8_t live_records[FLASH_PAGES_IN_USE];
+
+/** Page to which small records are appended or STORAGE_FLASH_NO_PAGE */
+static uint16_t open_page = STORAGE_FLASH_NO_PAGE;
+static uint16_t open_offset = 0;
+
+/** Last allocated page, the next one is searched behind it */
+static uint16_t alloc_cursor = 0;
 
 /**
  * Forward declarations of our internal functions
@@ -111,23 +236,499 @@ struct mmem *storage_flash_read_bundle(uint32_t bundle_number);
 uint8_t storage_flash_delete_bundle(uint32_t bundle_number, uint8_t reason);
 void storage_flash_reinit(void);
 
-int storage_flash_page_in_use(uint32_t page)
+static inline uint8_t storage_flash_page_free(const uint16_t page)
 {
-	uint32_t tag = 0;
+	return free_pages[page / 8] & (1 << (page % 8));
+}
+
+/**
+ * \brief Makes a page available for allocation
+ */
+static void storage_flash_page_release(const uint16_t page)
+{
+	if( storage_flash_page_free(page) ) {
+		return;
+	}
 
-	FLASH_READ_PAGE(page + FLASH_PAGE_OFFSET, 0, (uint8_t *) &tag, 4);
+	free_pages[page / 8] |= 1 << (page % 8);
+	free_page_count++;
 
-	return tag == (STORAGE_FLASH_TAG + page);
+	if( page == open_page ) {
+		open_page = STORAGE_FLASH_NO_PAGE;
+	}
 }
 
-void storage_flash_scan(void)
+/**
+ * \brief Allocates the next free page behind the last one and erases it
+ * \return the page or STORAGE_FLASH_NO_PAGE if all pages are used
+ */
+static uint16_t storage_flash_page_alloc(void)
+{
+	struct storage_flash_page_t header;
+
+	for(uint16_t i=1; i<=FLASH_PAGES_IN_USE; i++) {
+		const uint16_t page = (alloc_cursor + i) % FLASH_PAGES_IN_USE;
+
+		if( !storage_flash_page_free(page) ) {
+			continue;
+		}
+
+		free_pages[page / 8] &= ~(1 << (page % 8));
+		free_page_count--;
+		live_records[page] = 0;
+		alloc_cursor = page;
+
+		FLASH_ERASE_PAGE(page + FLASH_PAGE_OFFSET);
+
+		header.tag = STORAGE_FLASH_TAG + page;
+		FLASH_WRITE_PAGE(page + FLASH_PAGE_OFFSET, 0, (uint8_t *) &header, sizeof(header));
+
+		return page;
+	}
+
+	return STORAGE_FLASH_NO_PAGE;
+}
+
+/**
+ * \brief Changes the page to which small records are appended
+ *
+ * The previous page is released, if all its records have been deleted meanwhile.
+ */
+static void storage_flash_page_open(const uint16_t page, const uint16_t offset)
+{
+	const uint16_t previous = open_page;
+
+	open_page = page;
+	open_offset = offset;
+
+	if( previous != STORAGE_FLASH_NO_PAGE && previous != page && live_records[previous] == 0 ) {
+		storage_flash_page_release(previous);
+	}
+}
+
+/**
+ * \brief Returns the number of bytes a bundle occupies in the records
+ * \param bundlemem Pointer to the MMEM struct containing the bundle
+ */
+static uint32_t storage_flash_bundle_size(struct mmem * const bundlemem)
+{
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	uint32_t size = sizeof(struct bundle_t);
+
+	for(int i=0; i<bundle->num_blocks; i++) {
+		size += sizeof(struct storage_flash_block_t) + bundle_get_block(bundlemem, i)->block_size;
+	}
+
+	return size;
+}
+
+/**
+ * \brief Returns the bytes of the first fragment, which fit into the open page
+ */
+static uint16_t storage_flash_open_space(void)
+{
+	if( open_page == STORAGE_FLASH_NO_PAGE ||
+			open_offset + sizeof(struct storage_flash_record_t) + STORAGE_FLASH_MIN_FRAGMENT > FLASH_PAGE_SIZE ) {
+		return 0;
+	}
+
+	return FLASH_PAGE_SIZE - open_offset - sizeof(struct storage_flash_record_t);
+}
+
+/**
+ * \brief Checks, whether enough pages are free for a bundle
+ * \param size bytes of the bundle
+ */
+static uint8_t storage_flash_fits(const uint32_t size)
+{
+	const uint16_t space = storage_flash_open_space();
+
+	if( size <= space ) {
+		return 1;
+	}
+
+	const uint32_t pages = (size - space + STORAGE_FLASH_FRAGMENT_SIZE - 1) / STORAGE_FLASH_FRAGMENT_SIZE;
+
+	return pages <= free_page_count;
+}
+
+/**
+ * \brief Writes the record header of the next fragment
+ * \param cursor cursor of the bundle, page and offset point to the new record
+ */
+static uint8_t storage_flash_record_begin(struct storage_flash_cursor_t * const cursor)
+{
+	struct storage_flash_record_t record;
+	const uint16_t space = FLASH_PAGE_SIZE - cursor->offset - sizeof(struct storage_flash_record_t);
+
+	record.bundle_num = cursor->bundle_num;
+	record.length = cursor->remaining < space ? cursor->remaining : space;
+	record.next_page = STORAGE_FLASH_NO_PAGE;
+	record.fragment = cursor->fragment;
+	record.state = STORAGE_FLASH_RECORD_LIVE;
+	record.reserved = 0xFFFF;
+
+	if( cursor->remaining > record.length ) {
+		record.next_page = storage_flash_page_alloc();
+		if( record.next_page == STORAGE_FLASH_NO_PAGE ) {
+			return 0;
+		}
+	}
+
+	FLASH_WRITE_PAGE(cursor->page + FLASH_PAGE_OFFSET, cursor->offset, (uint8_t *) &record, sizeof(record));
+	live_records[cursor->page]++;
+
+	cursor->offset += sizeof(record);
+	cursor->left = record.length;
+	cursor->next_page = record.next_page;
+	cursor->remaining -= record.length;
+
+	return 1;
+}
+
+/**
+ * \brief Writes bytes of a bundle, new fragments are started as needed
+ * \return 1 on success, 0 if no page could be allocated
+ */
+static uint8_t storage_flash_write(struct storage_flash_cursor_t * const cursor, const void * const data, uint32_t length)
+{
+	const uint8_t * bytes = data;
+
+	while( length > 0 ) {
+		if( cursor->left == 0 ) {
+			cursor->page = cursor->next_page;
+			cursor->offset = sizeof(struct storage_flash_page_t);
+			cursor->fragment++;
+
+			if( cursor->page == STORAGE_FLASH_NO_PAGE || !storage_flash_record_begin(cursor) ) {
+				return 0;
+			}
+		}
+
+		const uint16_t chunk = length < cursor->left ? length : cursor->left;
+
+		FLASH_WRITE_PAGE(cursor->page + FLASH_PAGE_OFFSET, cursor->offset, (uint8_t *) bytes, chunk);
+
+		cursor->offset += chunk;
+		cursor->left -= chunk;
+		bytes += chunk;
+		length -= chunk;
+	}
+
+	return 1;
+}
+
+/**
+ * \brief Reads the record header of a fragment
+ * \return 1 if the record is a live record of the bundle, 0 otherwise
+ */
+static uint8_t storage_flash_record_open(struct storage_flash_cursor_t * const cursor)
+{
+	struct storage_flash_record_t record;
+
+	FLASH_READ_PAGE(cursor->page + FLASH_PAGE_OFFSET, cursor->offset, (uint8_t *) &record, sizeof(record));
+
+	if( record.state != STORAGE_FLASH_RECORD_LIVE || record.bundle_num != cursor->bundle_num ||
+			record.fragment != cursor->fragment ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Fragment %u of bundle %lu not found on page %u",
+			cursor->fragment, cursor->bundle_num, cursor->page);
+		return 0;
+	}
+
+	cursor->offset += sizeof(record);
+	cursor->left = record.length;
+	cursor->next_page = record.next_page;
+
+	return 1;
+}
+
+/**
+ * \brief Reads bytes of a bundle, following the fragments
+ * \return 1 on success, 0 if the chain of records is broken
+ */
+static uint8_t storage_flash_read(struct storage_flash_cursor_t * const cursor, void * const data, uint32_t length)
+{
+	uint8_t * bytes = data;
+
+	while( length > 0 ) {
+		if( cursor->left == 0 ) {
+			if( cursor->next_page == STORAGE_FLASH_NO_PAGE ) {
+				return 0;
+			}
+
+			cursor->page = cursor->next_page;
+			cursor->offset = sizeof(struct storage_flash_page_t);
+			cursor->fragment++;
+
+			if( !storage_flash_record_open(cursor) ) {
+				return 0;
+			}
+		}
+
+		const uint16_t chunk = length < cursor->left ? length : cursor->left;
+
+		FLASH_READ_PAGE(cursor->page + FLASH_PAGE_OFFSET, cursor->offset, bytes, chunk);
+
+		cursor->offset += chunk;
+		cursor->left -= chunk;
+		bytes += chunk;
+		length -= chunk;
+	}
+
+	return 1;
+}
+
+/**
+ * \brief Marks a record as dead and releases its page, if it has no live records left
+ */
+static void storage_flash_record_kill(const uint16_t page, const uint16_t offset)
+{
+	const uint8_t state = STORAGE_FLASH_RECORD_DEAD;
+
+	FLASH_WRITE_PAGE(page + FLASH_PAGE_OFFSET, offset + offsetof(struct storage_flash_record_t, state), (uint8_t *) &state, 1);
+
+	if( live_records[page] > 0 ) {
+		live_records[page]--;
+	}
+
+	if( live_records[page] == 0 && page != open_page ) {
+		storage_flash_page_release(page);
+	}
+}
+
+/**
+ * \brief Marks all records of a bundle as dead
+ *
+ * The first record is killed last, so that an interrupted deletion
+ * is detected as broken chain at the next start.
+ */
+static void storage_flash_chain_kill(const uint32_t bundle_num, const uint16_t page, const uint16_t offset)
+{
+	struct storage_flash_record_t record;
+
+	FLASH_READ_PAGE(page + FLASH_PAGE_OFFSET, offset, (uint8_t *) &record, sizeof(record));
+
+	uint16_t next = record.next_page;
+	uint8_t fragment = 1;
+
+	while( next != STORAGE_FLASH_NO_PAGE && next < FLASH_PAGES_IN_USE ) {
+		const uint16_t current = next;
+
+		FLASH_READ_PAGE(current + FLASH_PAGE_OFFSET, sizeof(struct storage_flash_page_t), (uint8_t *) &record, sizeof(record));
+		if( record.state != STORAGE_FLASH_RECORD_LIVE || record.bundle_num != bundle_num || record.fragment != fragment ) {
+			/* The page was allocated, but writing its record failed */
+			if( live_records[current] == 0 && current != open_page ) {
+				storage_flash_page_release(current);
+			}
+			break;
+		}
+
+		next = record.next_page;
+		fragment++;
+
+		storage_flash_record_kill(current, sizeof(struct storage_flash_page_t));
+	}
+
+	storage_flash_record_kill(page, offset);
+}
+
+/**
+ * \brief Loads a bundle from its records
+ * \param bundle_num number of the bundle
+ * \param page page of the first record
+ * \param offset offset of the first record
+ * \return pointer to the MMEM struct containing the bundle (caller has to free) or NULL
+ */
+static struct mmem * storage_flash_load(const uint32_t bundle_num, const uint16_t page, const uint16_t offset)
+{
+	struct storage_flash_cursor_t cursor;
+
+	memset(&cursor, 0, sizeof(cursor));
+	cursor.bundle_num = bundle_num;
+	cursor.page = page;
+	cursor.offset = offset;
+
+	if( !storage_flash_record_open(&cursor) ) {
+		return NULL;
+	}
+
+	// Allocate memory for the bundle
+	struct mmem * const bundlemem = bundle_create_bundle();
+	if( bundlemem == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "cannot allocate memory for bundle %lu", bundle_num);
+		return NULL;
+	}
+
+	struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	if( !storage_flash_read(&cursor, bundle, sizeof(struct bundle_t)) ) {
+		bundle_decrement(bundlemem);
+		return NULL;
+	}
+
+	/* The blocks are added again one by one */
+	const uint8_t num_blocks = bundle->num_blocks;
+	bundle->num_blocks = 0;
+
+	for(int i=0; i<num_blocks; i++) {
+		struct storage_flash_block_t header;
+
+		if( !storage_flash_read(&cursor, &header, sizeof(header)) ) {
+			bundle_decrement(bundlemem);
+			return NULL;
+		}
+
+		if( bundle_add_block(bundlemem, header.type, BUNDLE_BLOCK_FLAG_NULL, NULL, header.block_size) < 0 ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to allocate %u bytes for block %u", header.block_size, i);
+			bundle_decrement(bundlemem);
+			return NULL;
+		}
+
+		struct bundle_block_t * const block = bundle_get_block(bundlemem, i);
+		block->flags = header.flags;
+
+		if( !storage_flash_read(&cursor, block->payload, block->block_size) ) {
+			bundle_decrement(bundlemem);
+			return NULL;
+		}
+	}
+
+	return bundlemem;
+}
+
+/**
+ * \brief Writes a bundle as chain of records, starting in the open page
+ * \param bundlemem Pointer to the MMEM struct containing the bundle
+ * \param entry entry of the bundle, its page and offset are set
+ * \return 1 on success, 0 on error
+ */
+static uint8_t storage_flash_store(struct mmem * const bundlemem, struct storage_flash_entry_t * const entry)
+{
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	struct storage_flash_cursor_t cursor;
+
+	memset(&cursor, 0, sizeof(cursor));
+	cursor.bundle_num = entry->bundle_num;
+	cursor.remaining = storage_flash_bundle_size(bundlemem);
+
+	if( storage_flash_open_space() > 0 ) {
+		cursor.page = open_page;
+		cursor.offset = open_offset;
+	} else {
+		cursor.page = storage_flash_page_alloc();
+		cursor.offset = sizeof(struct storage_flash_page_t);
+		if( cursor.page == STORAGE_FLASH_NO_PAGE ) {
+			return 0;
+		}
+	}
+
+	entry->page = cursor.page;
+	entry->offset = cursor.offset;
+
+	if( !storage_flash_record_begin(&cursor) ) {
+		/* Nothing has been written */
+		if( live_records[cursor.page] == 0 && cursor.page != open_page ) {
+			storage_flash_page_release(cursor.page);
+		}
+		return 0;
+	}
+
+	if( !storage_flash_write(&cursor, bundle, sizeof(struct bundle_t)) ) {
+		storage_flash_chain_kill(entry->bundle_num, entry->page, entry->offset);
+		return 0;
+	}
+
+	for(int i=0; i<bundle->num_blocks; i++) {
+		const struct bundle_block_t * const block = bundle_get_block(bundlemem, i);
+		const struct storage_flash_block_t header = {
+			.type = block->type,
+			.flags = block->flags,
+			.block_size = block->block_size,
+		};
+
+		if( !storage_flash_write(&cursor, &header, sizeof(header)) ||
+				!storage_flash_write(&cursor, block->payload, block->block_size) ) {
+			storage_flash_chain_kill(entry->bundle_num, entry->page, entry->offset);
+			return 0;
+		}
+	}
+
+	/* Following small bundles are packed behind the last fragment */
+	storage_flash_page_open(cursor.page, STORAGE_FLASH_ALIGN(cursor.offset));
+
+	return 1;
+}
+
+/**
+ * \brief Adds a bundle to the list, the index and the queues
+ */
+static void storage_flash_add_entry(struct storage_flash_entry_t * const n, struct mmem * const bundlemem)
+{
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+
+	n->bundle_num = bundle->bundle_num;
+	n->bundle_flags = bundle->flags;
+	n->dst_node = bundle->dst_node;
+
+	// Increment the storage counter
+	bundles_in_storage++;
+
+	// Add bundle to list
+	list_add(bundle_list, n);
+	storage_index_add(&bundle_index, (struct storage_entry_t *) n);
+
+	// Figure out when the bundle is going to expire
+	storage_eviction_describe(&n->eviction, bundlemem, storage_expiry_of_bundle(bundlemem));
+	storage_expiry_add(&bundle_expiry, &n->expiry, n->eviction.expiration);
+	storage_eviction_add(&bundle_eviction, &n->eviction);
+}
+
+/**
+ * \brief Restores a bundle from its first record found by the scan
+ */
+static void storage_flash_restore(const uint32_t bundle_num, const uint16_t page, const uint16_t offset)
 {
 	struct storage_flash_entry_t * n = NULL;
 	struct mmem * bundlemem = NULL;
 	struct bundle_t * bundle = NULL;
-	int h;
-	int ret = 0;
-	udtn_timeval_t tv;
+
+	bundlemem = storage_flash_load(bundle_num, page, offset);
+	if( bundlemem == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Bundle %lu on page %u is broken, deleting it", bundle_num, page);
+		storage_flash_chain_kill(bundle_num, page, offset);
+		return;
+	}
+
+	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+
+	// Allocate list entry for bundle
+	n = memb_alloc(&bundle_mem);
+	if( n == NULL || storage_index_find(&bundle_index, bundle_num) != NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to allocate struct, cannot restore bundle %lu", bundle_num);
+		if( n != NULL ) {
+			memb_free(&bundle_mem, n);
+		}
+		storage_flash_chain_kill(bundle_num, page, offset);
+		bundle_decrement(bundlemem);
+		return;
+	}
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Restored Bundle %lu, Src %lu, Dest %lu, Seq %lu from page %u", bundle->bundle_num, bundle->src_node, bundle->dst_node, bundle->tstamp_seq, page);
+
+	memset(n, 0, sizeof(struct storage_flash_entry_t));
+	n->page = page;
+	n->offset = offset;
+	storage_flash_add_entry(n, bundlemem);
+
+	// Deallocate bundle
+	bundle_decrement(bundlemem);
+}
+
+void storage_flash_scan(void)
+{
+	struct storage_flash_entry_t * n = NULL;
+	struct storage_flash_page_t header;
+	struct storage_flash_record_t record;
+	uint16_t h;
 
 	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Scanning flash for bundles");
 
@@ -137,127 +738,145 @@ void storage_flash_scan(void)
 		list_remove(bundle_list, n);
 		memb_free(&bundle_mem, n);
 	}
+	storage_index_init(&bundle_index);
+	storage_expiry_init(&bundle_expiry);
+	storage_eviction_init(&bundle_eviction);
+	bundles_in_storage = 0;
 
-	/* Now scan all flash pages for potential bundles */
+	/* Count the live records of all pages first, so that restoring can kill broken chains */
 	for(h=0; h<FLASH_PAGES_IN_USE; h++) {
-		// Read bundle from flash+
-		memset(&page_buffer, 0, sizeof(page_buffer));
-		FLASH_READ_PAGE(h + FLASH_PAGE_OFFSET, 0, (uint8_t *) &page_buffer, sizeof(page_buffer));
+		FLASH_READ_PAGE(h + FLASH_PAGE_OFFSET, 0, (uint8_t *) &header, sizeof(header));
 
 		if( h % 10 == 0 ) {
 			LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Reading flash page %u of %u", h, FLASH_PAGES_IN_USE);
+			watchdog_periodic();
 		}
 
-		watchdog_periodic();
+		if( header.tag != STORAGE_FLASH_TAG + h ) {
+			continue;
+		}
 
-		// Check if page is in use
-		if( page_buffer.tag == STORAGE_FLASH_TAG + h ) {
+		for(uint16_t offset = sizeof(header);
+				offset + sizeof(record) <= FLASH_PAGE_SIZE;
+				offset = STORAGE_FLASH_ALIGN(offset + sizeof(record) + record.length)) {
+			FLASH_READ_PAGE(h + FLASH_PAGE_OFFSET, offset, (uint8_t *) &record, sizeof(record));
 
-			// Allocate memory for the bundle
-			bundlemem = bundle_create_bundle();
-			if( bundlemem == NULL ) {
-				LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "cannot allocate memory to resture bundle");
-				return;
-			}
-
-			// Allocate the proper amount
-			ret = mmem_realloc(bundlemem, page_buffer.size);
-			if( !ret ) {
-				LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to realloc enough memory");
-				bundle_decrement(bundlemem);
-				return;
+			if( record.state == STORAGE_FLASH_RECORD_FREE ) {
+				break;
 			}
 
-			// Copy data into MMEM
-			memcpy(MMEM_PTR(bundlemem), page_buffer.bundle, page_buffer.size);
-
-			bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
-
-			// Allocate list entry for bundle
-			n = memb_alloc(&bundle_mem);
-
-			if( n == NULL ) {
-				LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to allocate struct, cannot restore bundle");
-				return;
+			if( record.state == STORAGE_FLASH_RECORD_LIVE ) {
+				live_records[h]++;
 			}
+		}
 
-			LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Restored Bundle %lu, Src %lu, Dest %lu, Seq %lu from page %d", bundle->bundle_num, bundle->src_node, bundle->dst_node, bundle->tstamp_seq, h);
+		if( live_records[h] > 0 ) {
+			free_pages[h / 8] &= ~(1 << (h % 8));
+			free_page_count--;
+		}
+	}
 
-			// Fill the struct of the bundle
-			n->page = h;
-			n->bundle_num = bundle->bundle_num;
-			n->bundle_flags = bundle->flags;
+	/* Then restore the bundles from their first records */
+	for(h=0; h<FLASH_PAGES_IN_USE; h++) {
+		if( storage_flash_page_free(h) ) {
+			continue;
+		}
 
-			// Figure out when the bundle is going to expire
-			udtn_uptime(&tv);
-			n->expiration = tv.tv_sec + (bundle->lifetime - bundle_ageing_get_age(bundlemem) / 1000);
+		watchdog_periodic();
 
-			// Increment the storage counter
-			bundles_in_storage++;
+		for(uint16_t offset = sizeof(header);
+				offset + sizeof(record) <= FLASH_PAGE_SIZE;
+				offset = STORAGE_FLASH_ALIGN(offset + sizeof(record) + record.length)) {
+			FLASH_READ_PAGE(h + FLASH_PAGE_OFFSET, offset, (uint8_t *) &record, sizeof(record));
 
-			// Add bundle to list
-			list_add(bundle_list, n);
+			if( record.state == STORAGE_FLASH_RECORD_FREE ) {
+				break;
+			}
 
-			// Deallocate bundle
-			bundle_decrement(bundlemem);		}
+			if( record.state == STORAGE_FLASH_RECORD_LIVE && record.fragment == 0 ) {
+				storage_flash_restore(record.bundle_num, h, offset);
+			}
+		}
 	}
 }
 
 static void storage_flash_prune(const TimerHandle_t timer)
 {
-	struct storage_flash_entry_t * entry = NULL;
-	uint32_t * deletion[BUNDLE_STORAGE_SIZE];
-	int pointer = 0;
-	int h = 0;
-	udtn_timeval_t tv;
-
-	udtn_uptime(&tv);
+	struct storage_expiry_node_t * node = NULL;
+	const uint32_t now = storage_expiry_now();
 
 	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Pruning expired bundles");
 
-	memset(deletion, 0, sizeof(deletion));
-
-	// Delete expired bundles from storage
-	for(entry = list_head(bundle_list);
-			entry != NULL;
-			entry = list_item_next(entry)) {
+	// Delete expired bundles from storage, only these are taken from the queue
+	while( (node = storage_expiry_pop_expired(&bundle_expiry, now)) != NULL ) {
+		struct storage_flash_entry_t * const entry = storage_expiry_entry(node, struct storage_flash_entry_t, expiry);
 
-		if( entry->expiration <= tv.tv_sec ) {
-			LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "bundle lifetime expired of bundle %lu", entry->bundle_num);
-			deletion[pointer++] = &entry->bundle_num;
+		LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "bundle lifetime expired of bundle %lu", entry->bundle_num);
+		if( !storage_flash_delete_bundle(entry->bundle_num, REASON_LIFETIME_EXPIRED) ) {
+			// Try again on the next run
+			storage_expiry_add(&bundle_expiry, node, now + 1);
 		}
 	}
 
-	for(h=0; h<pointer; h++) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Deleting bundle %lu LT", *deletion[h]);
-		storage_flash_delete_bundle(*deletion[h], REASON_LIFETIME_EXPIRED);
-	}
-
 //	ctimer_restart(&storage_flash_timer);
 	xTimerReset(storage_flash_timer, 0);
 }
 
-void storage_flash_format(void)
+/**
+ * \brief Marks all pages as free, they are erased when they are allocated
+ */
+static void storage_flash_pages_init(void)
 {
-	int h;
+	memset(free_pages, 0, sizeof(free_pages));
+	for(uint16_t h=0; h<FLASH_PAGES_IN_USE; h++) {
+		free_pages[h / 8] |= 1 << (h % 8);
+	}
+	free_page_count = FLASH_PAGES_IN_USE;
+
+	memset(live_records, 0, sizeof(live_records));
+	open_page = STORAGE_FLASH_NO_PAGE;
+	open_offset = 0;
+
+	/* The allocation order is not stored, so start at a random page */
+	alloc_cursor = random_rand() % FLASH_PAGES_IN_USE;
+}
 
+int storage_flash_format(void)
+{
 	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Formatting flash");
 
-	/* Delete all flash pages */
-	for(h=0; h<FLASH_PAGES_IN_USE; h++) {
+	/* Pages are only erased before they are used again,
+	 * so the tags of all pages have to be destroyed here
+	 */
+	for(uint16_t h=0; h<FLASH_PAGES_IN_USE; h++) {
+		const uint32_t tag = 0;
+
 		if( h % 10 == 0 ) {
-			LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Erasing page %u of %u", h, FLASH_PAGES_IN_USE);
+			LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Invalidating page %u of %u", h, FLASH_PAGES_IN_USE);
+			watchdog_periodic();
 		}
 
-		FLASH_ERASE_PAGE(h + FLASH_PAGE_OFFSET);
-		watchdog_periodic();
+		FLASH_WRITE_PAGE(h + FLASH_PAGE_OFFSET, 0, (uint8_t *) &tag, sizeof(tag));
 	}
+
+	storage_flash_pages_init();
+
+	return 0;
 }
 
 bool storage_flash_init(void)
 {
 	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "storage_flash init");
 
+	/* cancle, if initialisation was already done */
+	if(wait_for_changes_sem != NULL) {
+		return false;
+	}
+	wait_for_changes_sem = xSemaphoreCreateCounting(1, 0);
+	if(wait_for_changes_sem == NULL) {
+		return false;
+	}
+
 	// Initialize flash
 	FLASH_INIT();
 
@@ -267,8 +886,19 @@ bool storage_flash_init(void)
 	// Initialize the bundle memory block
 	memb_init(&bundle_mem);
 
+	// Initialize the index of the bundle list
+	storage_index_init(&bundle_index);
+
+	// Initialize the queue of expiring bundles
+	storage_expiry_init(&bundle_expiry);
+
+	// Initialize the heap of deletable bundles
+	storage_eviction_init(&bundle_eviction);
+
 	bundles_in_storage = 0;
 
+	storage_flash_pages_init();
+
 #if BUNDLE_STORAGE_INIT
 	storage_flash_format();
 #else
@@ -303,8 +933,18 @@ void storage_flash_reinit(void)
 		list_remove(bundle_list, n);
 		memb_free(&bundle_mem, n);
 	}
+	storage_index_init(&bundle_index);
+	storage_expiry_init(&bundle_expiry);
+	storage_eviction_init(&bundle_eviction);
+	bundles_in_storage = 0;
 }
 
+/**
+ * \brief This function delete as many bundles from the storage as necessary to have
+ *        a free slot and enough free pages for the bundle
+ * \param bundlemem Pointer to the MMEM struct containing the bundle
+ * \return 1 on success, 0 if no room could be made free
+ */
 uint8_t storage_flash_make_room(struct mmem * bundlemem)
 {
 	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Making room for new bundles");
@@ -317,118 +957,26 @@ uint8_t storage_flash_make_room(struct mmem * bundlemem)
 		return 0;
 	}
 
-#if BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DO_NOT_DELETE
-	/* We do not delete at all. If storage is used up, we sit there and wait */
-	if( bundles_in_storage >= BUNDLE_STORAGE_SIZE ) {
-		return 0;
-	}
-#elif (BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDEST || BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGEST )
-	struct bundle_t * bundle = NULL;
-	struct storage_flash_entry_t * entry = NULL;
-
-	/* Keep deleting bundles until we have enough slots */
-	while( bundles_in_storage >= BUNDLE_STORAGE_SIZE) {
-		uint32_t comparator = 0;
-		struct storage_flash_entry_t * deletor = NULL;
-
-		/* Obtain the new pointer each time, since the address may change */
-		bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
-
-		for( entry = list_head(bundle_list);
-			 entry != NULL;
-			 entry = list_item_next(entry) ) {
+	struct storage_eviction_node_t incoming;
+	struct storage_eviction_node_t * victim = NULL;
+	const uint32_t size = storage_flash_bundle_size(bundlemem);
 
-			/* Never delete locked bundles */
-			if( entry->storage_flags & STORAGE_FLASH_FLAGS_LOCKED ) {
-				continue;
-			}
-
-			/* Always keep bundles with higher priority */
-			if( (entry->bundle_flags & BUNDLE_PRIORITY_MASK) > (bundle->flags & BUNDLE_PRIORITY_MASK ) ) {
-				continue;
-			}
-
-#if BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDEST
-			if( entry->expiration < comparator || comparator == 0) {
-				comparator = entry->expiration;
-				deletor = entry;
-			}
-#elif BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGEST
-			if( entry->expiration > comparator || comparator == 0) {
-				comparator = entry->expiration;
-				deletor = entry;
-			}
-#endif
-		}
+	storage_eviction_describe(&incoming, bundlemem, storage_expiry_of_bundle(bundlemem));
 
-		/* Either the for loop did nothing or did not break */
-		if( deletor == NULL ) {
+	/* Keep deleting bundles until we have enough slots and pages */
+	while( bundles_in_storage >= BUNDLE_STORAGE_SIZE || !storage_flash_fits(size) ) {
+		victim = storage_eviction_victim(&bundle_eviction, &incoming);
+		if( victim == NULL ) {
 			/* We do not have deletable bundles in storage, stop deleting them */
 			return 0;
 		}
 
 		/* Delete Bundle */
-		storage_flash_delete_bundle(deletor->bundle_num, REASON_DEPLETED_STORAGE);
-	}
-
-#elif (BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDER || BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGER )
-	struct bundle_t * bundle = NULL;
-	struct storage_flash_entry_t * entry = NULL;
-	uint32_t expiration = 0;
-	udtn_timeval_t tv;
-
-	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
-	udtn_uptime(&tv);
-	expiration = tv.tv_sec + (bundle->lifetime - bundle_ageing_get_age(bundlemem) / 1000);
-
-	/* Keep deleting bundles until we have enough slots */
-	while( bundles_in_storage >= BUNDLE_STORAGE_SIZE) {
-		/* Obtain the new pointer each time, since the address may change */
-		bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
-
-		/* We need this double-loop because otherwise we would be modifying the list
-		 * while iterating through it
-		 */
-		for( entry = list_head(bundle_list);
-			 entry != NULL;
-			 entry = list_item_next(entry) ) {
-			/* Never delete locked bundles */
-			if( entry->storage_flags & STORAGE_FLASH_FLAGS_LOCKED ) {
-				continue;
-			}
-
-			/* Always keep bundles with higher priority */
-			if( (entry->bundle_flags & BUNDLE_PRIORITY_MASK) > (bundle->flags & BUNDLE_PRIORITY_MASK ) ) {
-				continue;
-			}
-
-#if BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDER
-			/* If the new bundle has a longer lifetime than the bundle in our storage,
-			 * delete the bundle from storage to make room
-			 */
-			if( expiration >= entry->expiration ) {
-				break;
-			}
-#elif BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGER
-			/* Delete youngest bundle in storage */
-			if( expiration < entry->expiration ) {
-				break;
-			}
-#endif
-		}
-
-		/* Either the for loop did nothing or did not break */
-		if( entry == NULL ) {
-			/* We do not have deletable bundles in storage, stop deleting them */
+		const struct storage_flash_entry_t * const entry = storage_eviction_entry(victim, struct storage_flash_entry_t, eviction);
+		if( !storage_flash_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE) ) {
 			return 0;
 		}
-
-		/* Delete Bundle */
-		storage_flash_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE);
 	}
-#else
-#error No Bundle Deletion Strategy defined
-#endif
 
 	return 1;
 }
@@ -439,12 +987,10 @@ uint8_t storage_flash_make_room(struct mmem * bundlemem)
  * \param bundle_number_ptr pointer where the bundle number will be stored (on success)
  * \return 0 on error, 1 on success
  */
-uint8_t storage_flash_save_bundle(struct mmem * bundlemem, uint32_t ** bundle_number_ptr)
+uint8_t storage_flash_save_bundle(struct mmem * const bundlemem, uint32_t * const bundle_number_ptr)
 {
 	struct storage_flash_entry_t * n = NULL;
 	struct bundle_t * bundle = NULL;
-	int page;
-	udtn_timeval_t tv;
 
 	if( bundlemem == NULL ) {
 		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "storage_flash_save_bundle with invalid pointer %p", bundlemem);
@@ -460,6 +1006,15 @@ uint8_t storage_flash_save_bundle(struct mmem * bundlemem, uint32_t ** bundle_nu
 		return 0;
 	}
 
+	// Look for duplicates in the storage
+	n = (struct storage_flash_entry_t *) storage_index_find(&bundle_index, bundle->bundle_num);
+	if( n != NULL ) {
+		// If we find the bundle, return it right away (no need to do anything)
+		*bundle_number_ptr = n->bundle_num;
+		bundle_decrement(bundlemem);
+		return 1;
+	}
+
 	/* This function call may actually change the location of our bundle in memory, so be careful! */
 	if( !storage_flash_make_room(bundlemem) ) {
 		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Cannot store bundle, no room");
@@ -473,34 +1028,6 @@ uint8_t storage_flash_save_bundle(struct mmem * bundlemem, uint32_t ** bundle_nu
 	// Update the pointer to our bundle
 	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
 
-	// Normally we would store a bundle in his own slot
-	page = bundle->bundle_num % FLASH_PAGES_IN_USE;
-
-	// Look for duplicates in the storage
-	for(n = list_head(bundle_list);
-			n != NULL;
-			n = list_item_next(n) ) {
-
-		// In case the destined slot is taken, move on
-		if( n->page == page ) {
-			page ++;
-		}
-
-		// If we find the bundle, return it right away (no need to do anything)
-		if( n->bundle_num == bundle->bundle_num ) {
-			*bundle_number_ptr = &n->bundle_num;
-			bundle_decrement(bundlemem);
-			return 1;
-		}
-	}
-
-	// Find the next empty page
-	while( storage_flash_page_in_use(page) ) {
-		// TODO: This loop fails if all pages are used
-		// This should not happen, since there must be space at this point
-		page ++;
-	}
-
 	n = memb_alloc(&bundle_mem);
 
 	if( n == NULL ) {
@@ -509,35 +1036,24 @@ uint8_t storage_flash_save_bundle(struct mmem * bundlemem, uint32_t ** bundle_nu
 		return 0;
 	}
 
-	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "New Bundle %lu, Src %lu, Dest %lu, Seq %lu on Page %d", bundle->bundle_num, bundle->src_node, bundle->dst_node, bundle->tstamp_seq, page);
-
-	// Fill the struct of the bundle
-	n->page = page;
+	memset(n, 0, sizeof(struct storage_flash_entry_t));
 	n->bundle_num = bundle->bundle_num;
-	n->bundle_flags = bundle->flags;
 
-	// Figure out when the bundle is going to expire
-	udtn_uptime(&tv);
-	n->expiration = tv.tv_sec + (bundle->lifetime - bundle_ageing_get_age(bundlemem) / 1000);
-
-	// Create the flash page
-	memset(&page_buffer, 0, sizeof(page_buffer));
-	page_buffer.tag = STORAGE_FLASH_TAG + page;
-	page_buffer.size = bundlemem->size;
-	memcpy(page_buffer.bundle, bundle, bundlemem->size);
-
-	// Write the flash page
-	FLASH_WRITE_PAGE(page + FLASH_PAGE_OFFSET, 0, (uint8_t *) &page_buffer, sizeof(page_buffer));
+	// Write the records of the bundle
+	if( !storage_flash_store(bundlemem, n) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to write bundle %lu to flash", n->bundle_num);
+		memb_free(&bundle_mem, n);
+		bundle_decrement(bundlemem);
+		return 0;
+	}
 
-	// Increment the storage counter
-	bundles_in_storage++;
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "New Bundle %lu, Src %lu, Dest %lu, Seq %lu on Page %u", bundle->bundle_num, bundle->src_node, bundle->dst_node, bundle->tstamp_seq, n->page);
 
-	// Add bundle to list
-	list_add(bundle_list, n);
+	storage_flash_add_entry(n, bundlemem);
 
-	// Now copy over the STATIC pointer to the bundle number, so that
+	// Now copy over the bundle number, so that
 	// the caller can stick it into an event
-	*bundle_number_ptr = &n->bundle_num;
+	*bundle_number_ptr = n->bundle_num;
 
 	/* Always keep a pointer to the last written bundle for faster read access to it */
 	if( last_bundle != NULL ) {
@@ -547,6 +1063,9 @@ uint8_t storage_flash_save_bundle(struct mmem * bundlemem, uint32_t ** bundle_nu
 	last_bundle = bundlemem;
 	last_bundle_number = n->bundle_num;
 
+	/* storage status has changed */
+	xSemaphoreGive(wait_for_changes_sem);
+
 	return 1;
 }
 
@@ -565,26 +1084,13 @@ uint8_t storage_flash_delete_bundle(uint32_t bundle_number, uint8_t reason)
 	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Deleting Bundle %lu with reason %u", bundle_number, reason);
 
 	// Look for the bundle we are talking about
-	for(n = list_head(bundle_list);
-		n != NULL;
-		n = list_item_next(n)) {
-
-		if( n->bundle_num == bundle_number ) {
-			break;
-		}
-	}
+	n = (struct storage_flash_entry_t *) storage_index_find(&bundle_index, bundle_number);
 
 	if( n == NULL ) {
 		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Could not find bundle %lu on storage_flash_delete_bundle", bundle_number);
 		return 0;
 	}
 
-	if( bundle_number == last_bundle_number ) {
-		bundle_decrement(last_bundle);
-		last_bundle = NULL;
-		last_bundle_number = 0;
-	}
-
 	if( n->storage_flags & STORAGE_FLASH_FLAGS_LOCKED ) {
 		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Cannot delete %lu because it is locked", bundle_number);
 	}
@@ -609,20 +1115,32 @@ uint8_t storage_flash_delete_bundle(uint32_t bundle_number, uint8_t reason)
 		}
 	}
 
+	if( last_bundle != NULL && bundle_number == last_bundle_number ) {
+		bundle_decrement(last_bundle);
+		last_bundle = NULL;
+		last_bundle_number = 0;
+	}
+
 	// Notified the agent, that a bundle has been deleted
 	agent_delete_bundle(bundle_number);
 
-	// Erase the flash page
-	FLASH_ERASE_PAGE(n->page + FLASH_PAGE_OFFSET);
+	// Mark the records as dead, empty pages are released
+	storage_flash_chain_kill(bundle_number, n->page, n->offset);
 
 	// Remove the bundle from the list
 	list_remove(bundle_list, n);
+	storage_index_remove(&bundle_index, bundle_number);
+	storage_expiry_remove(&bundle_expiry, &n->expiry);
+	storage_eviction_remove(&bundle_eviction, &n->eviction);
 
 	bundles_in_storage--;
 
 	// Free the storage struct
 	memb_free(&bundle_mem, n);
 
+	/* storage status has changed */
+	xSemaphoreGive(wait_for_changes_sem);
+
 	return 1;
 }
 
@@ -635,7 +1153,6 @@ struct mmem *storage_flash_read_bundle(uint32_t bundle_number)
 {
 	struct storage_flash_entry_t * n = NULL;
 	struct mmem * bundlemem = NULL;
-	int ret = 0;
 
 	if( last_bundle != NULL && bundle_number == last_bundle_number ) {
 		LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Reading bundle %lu from cache", bundle_number);
@@ -646,48 +1163,19 @@ struct mmem *storage_flash_read_bundle(uint32_t bundle_number)
 	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Reading bundle %lu from flash", bundle_number);
 
 	// Look for the bundle we are talking about
-	for(n = list_head(bundle_list);
-		n != NULL;
-		n = list_item_next(n)) {
-
-		if( n->bundle_num == bundle_number ) {
-			break;
-		}
-	}
+	n = (struct storage_flash_entry_t *) storage_index_find(&bundle_index, bundle_number);
 
 	if( n == NULL ) {
 		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Could not find bundle %lu in storage_flash_read_bundle", bundle_number);
 		return NULL;
 	}
 
-	// Read bundle from flash+
-	memset(&page_buffer, 0, sizeof(page_buffer));
-	FLASH_READ_PAGE(n->page + FLASH_PAGE_OFFSET, 0, (uint8_t *) &page_buffer, sizeof(page_buffer));
-
-	// Check if the page really contains a bundle
-	if( page_buffer.tag != (STORAGE_FLASH_TAG + n->page) ) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Bundle %lu should be on page %u but is not", bundle_number, n->page);
-		return NULL;
-	}
-
-	// Allocate memory for the bundle
-	bundlemem = bundle_create_bundle();
+	bundlemem = storage_flash_load(n->bundle_num, n->page, n->offset);
 	if( bundlemem == NULL ) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "cannot allocate memory for bundle %lu", bundle_number);
-		return NULL;
-	}
-
-	// Allocate the proper amount
-	ret = mmem_realloc(bundlemem, page_buffer.size);
-	if( !ret ) {
-		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to realloc enough memory");
-		bundle_decrement(bundlemem);
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Bundle %lu should be on page %u but is not", bundle_number, n->page);
 		return NULL;
 	}
 
-	// Copy data into MMEM
-	memcpy(MMEM_PTR(bundlemem), page_buffer.bundle, page_buffer.size);
-
 	/* Always keep a pointer to the last read bundle for faster re-read access to it */
 	if( last_bundle != NULL ) {
 		bundle_decrement(last_bundle);
@@ -727,6 +1215,67 @@ struct storage_entry_t * storage_flash_get_bundles(void)
 	return (struct storage_entry_t *) list_head(bundle_list);
 }
 
+/**
+ * \brief Get the next bundle, which matches a query
+ * \param query the query
+ * \param previous entry returned by the last call or NULL to start with the first bundle
+ * \returns pointer to the bundle list entry or NULL if no more bundles match
+ */
+struct storage_entry_t * storage_flash_query_bundles(const struct storage_query_t * const query, const struct storage_entry_t * const previous)
+{
+	struct storage_flash_entry_t * entry = NULL;
+
+	if( previous == NULL ) {
+		entry = list_head(bundle_list);
+	} else {
+		entry = list_item_next((void *) previous);
+	}
+
+	for( ; entry != NULL; entry = list_item_next(entry) ) {
+		if( storage_query_match(query, &entry->eviction, entry->dst_node, entry->storage_flags & STORAGE_FLASH_FLAGS_LOCKED) ) {
+			return (struct storage_entry_t *) entry;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Get the metadata of a bundle without reading it
+ * \param bundle_num Bundle number
+ * \param eviction returns the priority class, the time of reception and the expiration
+ * \param dst_node returns the destination node
+ * \return 1 on success or 0 if the bundle is not stored
+ */
+uint8_t storage_flash_describe_bundle(uint32_t bundle_num, struct storage_eviction_node_t * const eviction, uint32_t * const dst_node)
+{
+	const struct storage_flash_entry_t * entry = NULL;
+
+	// Look for the bundle we are talking about
+	entry = (struct storage_flash_entry_t *) storage_index_find(&bundle_index, bundle_num);
+
+	if( entry == NULL ) {
+		return 0;
+	}
+
+	storage_eviction_copy(eviction, &entry->eviction);
+	*dst_node = entry->dst_node;
+
+	return 1;
+}
+
+static void storage_flash_wait_for_changes(void)
+{
+	if ( !xSemaphoreTake(wait_for_changes_sem, portMAX_DELAY) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Wait for changes failed");
+	}
+}
+
+static void storage_flash_flush(void)
+{
+	/* The bundles are written, when save_bundle returns */
+}
+
 /**
  * \brief Mark a bundle as locked so that it will not be deleted even if we are running out of space
  *
@@ -738,13 +1287,7 @@ uint8_t storage_flash_lock_bundle(uint32_t bundle_num)
 	struct storage_flash_entry_t * entry = NULL;
 
 	// Look for the bundle we are talking about
-	for(entry = list_head(bundle_list);
-			entry != NULL;
-			entry = list_item_next(entry)) {
-		if( entry->bundle_num == bundle_num ) {
-			break;
-		}
-	}
+	entry = (struct storage_flash_entry_t *) storage_index_find(&bundle_index, bundle_num);
 
 	if( entry == NULL ) {
 		return 0;
@@ -752,6 +1295,9 @@ uint8_t storage_flash_lock_bundle(uint32_t bundle_num)
 
 	entry->storage_flags |= STORAGE_FLASH_FLAGS_LOCKED;
 
+	// Never delete locked bundles
+	storage_eviction_remove(&bundle_eviction, &entry->eviction);
+
 	return 1;
 }
 
@@ -763,19 +1309,15 @@ void storage_flash_unlock_bundle(uint32_t bundle_num)
 	struct storage_flash_entry_t * entry = NULL;
 
 	// Look for the bundle we are talking about
-	for(entry = list_head(bundle_list);
-			entry != NULL;
-			entry = list_item_next(entry)) {
-		if( entry->bundle_num == bundle_num ) {
-			break;
-		}
-	}
+	entry = (struct storage_flash_entry_t *) storage_index_find(&bundle_index, bundle_num);
 
 	if( entry == NULL ) {
 		return;
 	}
 
 	entry->storage_flags &= ~STORAGE_FLASH_FLAGS_LOCKED;
+
+	storage_eviction_add(&bundle_eviction, &entry->eviction);
 }
 
 
@@ -791,7 +1333,12 @@ const struct storage_driver storage_flash = {
 	storage_flash_get_free_space,
 	storage_flash_get_bundle_numbers,
 	storage_flash_get_bundles,
+	storage_flash_query_bundles,
+	storage_flash_describe_bundle,
+	storage_flash_wait_for_changes,
 	storage_flash_format,
+	storage_flash_flush,
+	storage_flash_save_bundle,
 };
 
 /** @} */
@@ -0,0 +1,135 @@
+/**
+ * \addtogroup storage_heap
+ * @{
+ */
+
+/**
+ * \file
+ * \brief Binary min-heap of nodes embedded into the entries of a storage module
+ */
+
+#include <string.h>
+
+#include "storage_heap.h"
+
+/**
+ * \brief Puts a node to a position of the heap
+ */
+static inline void storage_heap_place(struct storage_heap_t * const heap, struct storage_heap_node_t * const node, const uint16_t position)
+{
+	heap->nodes[position] = node;
+	node->position = position;
+}
+
+/**
+ * \brief Moves a node up, until its parent has a smaller key
+ */
+static void storage_heap_sift_up(struct storage_heap_t * const heap, uint16_t position)
+{
+	struct storage_heap_node_t * const node = heap->nodes[position];
+
+	while (position > 0) {
+		const uint16_t parent = (position - 1) / 2;
+
+		if (heap->nodes[parent]->key <= node->key) {
+			break;
+		}
+
+		storage_heap_place(heap, heap->nodes[parent], position);
+		position = parent;
+	}
+
+	storage_heap_place(heap, node, position);
+}
+
+/**
+ * \brief Moves a node down, until its children have bigger keys
+ */
+static void storage_heap_sift_down(struct storage_heap_t * const heap, uint16_t position)
+{
+	struct storage_heap_node_t * const node = heap->nodes[position];
+
+	for (;;) {
+		uint16_t child = 2 * position + 1;
+
+		if (child >= heap->count) {
+			break;
+		}
+
+		if (child + 1 < heap->count && heap->nodes[child + 1]->key < heap->nodes[child]->key) {
+			child++;
+		}
+
+		if (node->key <= heap->nodes[child]->key) {
+			break;
+		}
+
+		storage_heap_place(heap, heap->nodes[child], position);
+		position = child;
+	}
+
+	storage_heap_place(heap, node, position);
+}
+
+void storage_heap_init(struct storage_heap_t * const heap)
+{
+	memset(heap->nodes, 0, heap->size * sizeof(struct storage_heap_node_t *));
+	heap->count = 0;
+}
+
+int storage_heap_add(struct storage_heap_t * const heap, struct storage_heap_node_t * const node)
+{
+	if (node->position < heap->count && heap->nodes[node->position] == node) {
+		/* already in the heap */
+		return 1;
+	}
+
+	if (heap->count >= heap->size) {
+		node->position = STORAGE_HEAP_NOT_QUEUED;
+		return -1;
+	}
+
+	heap->nodes[heap->count] = node;
+	heap->count++;
+
+	storage_heap_sift_up(heap, heap->count - 1);
+
+	return 1;
+}
+
+void storage_heap_remove(struct storage_heap_t * const heap, struct storage_heap_node_t * const node)
+{
+	const uint16_t position = node->position;
+
+	if (position >= heap->count || heap->nodes[position] != node) {
+		return;
+	}
+
+	node->position = STORAGE_HEAP_NOT_QUEUED;
+	heap->count--;
+
+	if (position == heap->count) {
+		heap->nodes[position] = NULL;
+		return;
+	}
+
+	/* Fill the gap with the last node and restore the heap order */
+	storage_heap_place(heap, heap->nodes[heap->count], position);
+	heap->nodes[heap->count] = NULL;
+
+	if (position > 0 && heap->nodes[(position - 1) / 2]->key > heap->nodes[position]->key) {
+		storage_heap_sift_up(heap, position);
+	} else {
+		storage_heap_sift_down(heap, position);
+	}
+}
+
+void storage_heap_rebuild(struct storage_heap_t * const heap)
+{
+	/* Sift down all inner nodes, starting with the last one */
+	for (int position = heap->count / 2 - 1; position >= 0; position--) {
+		storage_heap_sift_down(heap, position);
+	}
+}
+
+/** @} */
@@ -0,0 +1,106 @@
+/**
+ * \addtogroup bundle_storage
+ * @{
+ */
+
+/**
+ * \defgroup storage_heap Heap of storage entries
+ *
+ * @{
+ */
+
+/**
+ * \file
+ * \brief Binary min-heap of nodes embedded into the entries of a storage module
+ *
+ * Every node knows its position in the heap,
+ * so that it can be removed or updated without searching for it.
+ * The heap is used by the expiry queue and the eviction engine.
+ */
+
+#ifndef __STORAGE_HEAP_H__
+#define __STORAGE_HEAP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sys/cc.h"
+
+/**
+ * Position of a node, which is not in a heap
+ */
+#define STORAGE_HEAP_NOT_QUEUED	0xFFFF
+
+/**
+ * \brief Declares a heap for up to num nodes
+ */
+#define STORAGE_HEAP(name, num) \
+		static struct storage_heap_node_t * CC_CONCAT(name,_heap_nodes)[num]; \
+		static struct storage_heap_t name = {num, 0, CC_CONCAT(name,_heap_nodes)}
+
+/**
+ * Gets the storage entry, in which the node is embedded as member
+ */
+#define storage_heap_entry(node, type, member) \
+		((type *) ((char *) (node) - offsetof(type, member)))
+
+/**
+ * Node of the heap
+ *
+ * Users may extend the node by own structs,
+ * which have to start with the same fields.
+ */
+struct storage_heap_node_t {
+	/** sort key, the node with the smallest key is the first */
+	uint32_t key;
+
+	/** position in the heap or STORAGE_HEAP_NOT_QUEUED */
+	uint16_t position;
+};
+
+struct storage_heap_t {
+	uint16_t size;
+	uint16_t count;
+	struct storage_heap_node_t ** nodes;
+};
+
+/**
+ * \brief Removes all nodes from the heap
+ * \param heap the heap
+ */
+void storage_heap_init(struct storage_heap_t * const heap);
+
+/**
+ * \brief Adds a node to the heap
+ * \param heap the heap
+ * \param node the node, its key has to be set
+ * \return 1 on success or if the node is already in the heap, -1 if the heap is full
+ */
+int storage_heap_add(struct storage_heap_t * const heap, struct storage_heap_node_t * const node);
+
+/**
+ * \brief Removes a node from the heap
+ * \param heap the heap
+ * \param node the node, may be not in the heap
+ */
+void storage_heap_remove(struct storage_heap_t * const heap, struct storage_heap_node_t * const node);
+
+/**
+ * \brief Restores the order of the heap after the keys of the nodes were changed
+ * \param heap the heap
+ */
+void storage_heap_rebuild(struct storage_heap_t * const heap);
+
+/**
+ * \brief Gets the node with the smallest key
+ * \param heap the heap
+ * \return the node or NULL if the heap is empty
+ */
+static inline struct storage_heap_node_t * storage_heap_first(const struct storage_heap_t * const heap)
+{
+	return heap->count > 0 ? heap->nodes[0] : NULL;
+}
+
+#endif /* __STORAGE_HEAP_H__ */
+/** @} */
+/** @} */
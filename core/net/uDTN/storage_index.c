@@ -0,0 +1,128 @@
+/**
+ * \addtogroup storage_index
+ * @{
+ */
+
+/**
+ * \file
+ * \brief Hash index from the bundle number to the storage entry
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "storage_index.h"
+
+/**
+ * \brief Gets the preferred slot of a bundle number
+ *
+ * Bundle numbers may be sequential, so the bits are mixed
+ * before the low bits are used as the slot number.
+ */
+static inline uint16_t storage_index_slot(const struct storage_index_t * const index, uint32_t bundle_num)
+{
+	bundle_num ^= bundle_num >> 16;
+	bundle_num *= 0x45d9f3b;
+	bundle_num ^= bundle_num >> 16;
+
+	return bundle_num & index->mask;
+}
+
+void storage_index_init(struct storage_index_t * const index)
+{
+	memset(index->slots, 0, (index->mask + 1) * sizeof(struct storage_index_slot_t));
+}
+
+int storage_index_add(struct storage_index_t * const index, struct storage_entry_t * const entry)
+{
+	uint16_t slot = storage_index_slot(index, entry->bundle_num);
+
+	for (uint32_t probes = 0; probes <= index->mask; probes++) {
+		struct storage_index_slot_t * const s = &index->slots[slot];
+
+		if (s->entry == NULL) {
+			s->bundle_num = entry->bundle_num;
+			s->entry = entry;
+			return 1;
+		}
+
+		if (s->bundle_num == entry->bundle_num) {
+			return 0;
+		}
+
+		slot = (slot + 1) & index->mask;
+	}
+
+	return -1;
+}
+
+/**
+ * \brief Gets the slot of a bundle number
+ * \return slot number or -1 if the bundle number is not indexed
+ */
+static int storage_index_lookup(const struct storage_index_t * const index, const uint32_t bundle_num)
+{
+	uint16_t slot = storage_index_slot(index, bundle_num);
+
+	for (uint32_t probes = 0; probes <= index->mask; probes++) {
+		const struct storage_index_slot_t * const s = &index->slots[slot];
+
+		if (s->entry == NULL) {
+			return -1;
+		}
+
+		if (s->bundle_num == bundle_num) {
+			return slot;
+		}
+
+		slot = (slot + 1) & index->mask;
+	}
+
+	return -1;
+}
+
+struct storage_entry_t * storage_index_find(const struct storage_index_t * const index, const uint32_t bundle_num)
+{
+	const int slot = storage_index_lookup(index, bundle_num);
+	if (slot < 0) {
+		return NULL;
+	}
+
+	return index->slots[slot].entry;
+}
+
+int storage_index_remove(struct storage_index_t * const index, const uint32_t bundle_num)
+{
+	const int found = storage_index_lookup(index, bundle_num);
+	if (found < 0) {
+		return 0;
+	}
+
+	/* Shift the following entries of the probe sequence back,
+	 * instead of leaving a tombstone in the slot.
+	 * Otherwise lookups get slower with every deletion.
+	 */
+	uint16_t hole = found;
+	uint16_t slot = (hole + 1) & index->mask;
+
+	while (index->slots[slot].entry != NULL) {
+		const uint16_t preferred = storage_index_slot(index, index->slots[slot].bundle_num);
+
+		/* The entry may only be moved to the hole,
+		 * if the hole is between its preferred slot and its current slot
+		 */
+		if (((slot - preferred) & index->mask) >= ((slot - hole) & index->mask)) {
+			index->slots[hole] = index->slots[slot];
+			hole = slot;
+		}
+
+		slot = (slot + 1) & index->mask;
+	}
+
+	index->slots[hole].entry = NULL;
+	index->slots[hole].bundle_num = 0;
+
+	return 1;
+}
+
+/** @} */
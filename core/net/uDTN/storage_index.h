@@ -0,0 +1,105 @@
+/**
+ * \addtogroup bundle_storage
+ * @{
+ */
+
+/**
+ * \defgroup storage_index Bundle number index for storage modules
+ *
+ * @{
+ */
+
+/**
+ * \file
+ * \brief Hash index from the bundle number to the storage entry
+ *
+ * The index is an open addressing hash table with linear probing.
+ * Its memory is allocated statically by the STORAGE_INDEX() macro,
+ * so lookups do not need any heap allocation.
+ * The index only points to the entries, they are still owned by the storage module.
+ */
+
+#ifndef __STORAGE_INDEX_H__
+#define __STORAGE_INDEX_H__
+
+#include <stdint.h>
+
+#include "sys/cc.h"
+
+#include "storage.h"
+
+/**
+ * Smallest power of two, which is bigger than or equal to x (for x > 0)
+ */
+#define STORAGE_INDEX_POW2_1(x)		((x) | ((x) >> 1))
+#define STORAGE_INDEX_POW2_2(x)		(STORAGE_INDEX_POW2_1(x) | (STORAGE_INDEX_POW2_1(x) >> 2))
+#define STORAGE_INDEX_POW2_4(x)		(STORAGE_INDEX_POW2_2(x) | (STORAGE_INDEX_POW2_2(x) >> 4))
+#define STORAGE_INDEX_POW2_8(x)		(STORAGE_INDEX_POW2_4(x) | (STORAGE_INDEX_POW2_4(x) >> 8))
+#define STORAGE_INDEX_POW2(x)		(STORAGE_INDEX_POW2_8((x) - 1) + 1)
+
+/**
+ * Number of slots of an index for num entries.
+ * The index is kept at most half full, so that the probe sequences stay short.
+ */
+#define STORAGE_INDEX_SLOTS(num)	STORAGE_INDEX_POW2(2 * (num))
+
+/**
+ * \brief Declares an index for up to num entries
+ *
+ * \code
+ * STORAGE_INDEX(bundle_index, BUNDLE_STORAGE_SIZE);
+ * \endcode
+ */
+#define STORAGE_INDEX(name, num) \
+		static struct storage_index_slot_t CC_CONCAT(name,_index_slots)[STORAGE_INDEX_SLOTS(num)]; \
+		static struct storage_index_t name = {STORAGE_INDEX_SLOTS(num) - 1, \
+											  CC_CONCAT(name,_index_slots)}
+
+struct storage_index_slot_t {
+	/** copy of the bundle number, so that probing does not touch the entries */
+	uint32_t bundle_num;
+
+	/** indexed entry or NULL if the slot is empty */
+	struct storage_entry_t * entry;
+};
+
+struct storage_index_t {
+	/** number of slots - 1, the number of slots is a power of two */
+	uint16_t mask;
+
+	struct storage_index_slot_t * slots;
+};
+
+/**
+ * \brief Removes all entries from the index
+ * \param index the index
+ */
+void storage_index_init(struct storage_index_t * const index);
+
+/**
+ * \brief Adds an entry to the index
+ * \param index the index
+ * \param entry entry of the storage module, indexed by its bundle_num
+ * \return 1 on success, 0 if the bundle number is already indexed or -1 if the index is full
+ */
+int storage_index_add(struct storage_index_t * const index, struct storage_entry_t * const entry);
+
+/**
+ * \brief Looks up the entry of a bundle
+ * \param index the index
+ * \param bundle_num bundle number
+ * \return the entry or NULL if the bundle number is not indexed
+ */
+struct storage_entry_t * storage_index_find(const struct storage_index_t * const index, const uint32_t bundle_num);
+
+/**
+ * \brief Removes the entry of a bundle from the index
+ * \param index the index
+ * \param bundle_num bundle number
+ * \return 1 on success or 0 if the bundle number is not indexed
+ */
+int storage_index_remove(struct storage_index_t * const index, const uint32_t bundle_num);
+
+#endif /* __STORAGE_INDEX_H__ */
+/** @} */
+/** @} */
@@ -0,0 +1,1114 @@
+/**
+ * \addtogroup bundle_storage
+ * @{
+ */
+
+/**
+ * \defgroup bundle_storage_mmap Storage in a memory mapped file
+ *
+ * @{
+ */
+
+/**
+ * \file
+ * \brief Persistent storage for nodes running on a POSIX host
+ *
+ * The bundles are stored in a file, which is mapped into memory.
+ * The file is divided into granules of STORAGE_MMAP_GRANULE bytes and
+ * each bundle is stored as record in a run of free granules. The record
+ * starts with a header, followed by the struct bundle_t and the blocks,
+ * as the FatFS storage writes them.
+ *
+ * Reading a bundle only copies the struct bundle_t into MMEM, the blocks
+ * borrow their data from the mapping. The granules of a deleted bundle
+ * are therefore only reused, when no one references the bundle anymore.
+ * Until then, such a bundle still takes one of the BUNDLE_STORAGE_SIZE
+ * slots. The last STORAGE_MMAP_VIEWS bundles, which were read, stay referenced
+ * by the storage, so reading them again does not need any allocation.
+ * The file is only formatted, when no one else references a view.
+ *
+ * The free granules are kept in a bitmap, which is rebuilt from the
+ * record headers at startup.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+#include "semphr.h"
+
+#include "lib/mmem.h"
+#include "lib/list.h"
+#include "lib/logging.h"
+
+#include "bundle.h"
+#include "agent.h"
+#include "statusreport.h"
+#include "statistics.h"
+
+#include "storage.h"
+#include "storage_index.h"
+#include "storage_expiry.h"
+#include "storage_eviction.h"
+#include "storage_query.h"
+
+/**
+ * Path of the file containing the bundles
+ */
+#ifdef STORAGE_MMAP_CONF_FILE
+#define STORAGE_MMAP_FILE STORAGE_MMAP_CONF_FILE
+#else
+#define STORAGE_MMAP_FILE "bundles.mmap"
+#endif
+
+/**
+ * Size of the file in bytes
+ */
+#ifdef STORAGE_MMAP_CONF_SIZE
+#define STORAGE_MMAP_SIZE STORAGE_MMAP_CONF_SIZE
+#else
+#define STORAGE_MMAP_SIZE (64UL * 1024 * 1024)
+#endif
+
+/**
+ * Allocation unit of the file in bytes
+ */
+#ifdef STORAGE_MMAP_CONF_GRANULE
+#define STORAGE_MMAP_GRANULE STORAGE_MMAP_CONF_GRANULE
+#else
+#define STORAGE_MMAP_GRANULE 256UL
+#endif
+
+/**
+ * Number of read bundles, which stay referenced by the storage
+ */
+#ifdef STORAGE_MMAP_CONF_VIEWS
+#define STORAGE_MMAP_VIEWS STORAGE_MMAP_CONF_VIEWS
+#else
+#define STORAGE_MMAP_VIEWS 16
+#endif
+
+#define STORAGE_MMAP_GRANULES		(STORAGE_MMAP_SIZE / STORAGE_MMAP_GRANULE)
+#define STORAGE_MMAP_NO_GRANULE		UINT32_MAX
+
+/**
+ * Magic numbers of the file header and the record headers
+ */
+#define STORAGE_MMAP_MAGIC_FILE		0x50414D75UL
+#define STORAGE_MMAP_MAGIC_LIVE		0x45564C75UL
+#define STORAGE_MMAP_MAGIC_DEAD		0x44414475UL
+
+/**
+ * Header in the first granule of the file
+ */
+struct mmap_file_header_t {
+	uint32_t magic;
+	uint32_t size;
+	uint32_t granule;
+} __attribute__ ((packed));
+
+/**
+ * Header at the beginning of the first granule of a record
+ */
+struct mmap_record_header_t {
+	/** STORAGE_MMAP_MAGIC_LIVE or STORAGE_MMAP_MAGIC_DEAD */
+	uint32_t magic;
+	uint32_t bundle_num;
+
+	/** bytes behind the header */
+	uint32_t length;
+
+	/** ~length ^ bundle_num, to detect block data looking like a header */
+	uint32_t check;
+} __attribute__ ((packed));
+
+/**
+ * Block header of a record, followed by the block data
+ */
+struct mmap_block_header_t {
+	uint8_t type;
+	uint32_t flags;
+	int block_size;
+} __attribute__ ((packed));
+
+struct mmap_list_entry_t {
+	/** pointer to the next list element */
+	struct mmap_list_entry_t * next;
+
+	uint32_t bundle_num;
+
+	/** Flags */
+	uint8_t flags;
+
+	/** destination node, to answer queries without reading the bundle */
+	uint32_t dst_node;
+
+	/** flags of the primary bundle block */
+	uint32_t bundle_flags;
+
+	/** first granule and number of granules of the record */
+	uint32_t granule;
+	uint32_t granules;
+
+	/** read bundle, whose blocks point into the mapping, or NULL */
+	struct mmem * view;
+
+	/** position in the expiry queue */
+	struct storage_expiry_node_t expiry;
+
+	/** position in the eviction heap */
+	struct storage_eviction_node_t eviction;
+};
+
+/**
+ * Flags for the storage
+ */
+#define STORAGE_MMAP_FLAGS_LOCKED 	0x1
+
+// List and memory blocks for the bundles
+LIST(bundle_list);
+MEMB(bundle_mem, struct mmap_list_entry_t, BUNDLE_STORAGE_SIZE);
+STORAGE_INDEX(bundle_index, BUNDLE_STORAGE_SIZE);
+STORAGE_EXPIRY(bundle_expiry, BUNDLE_STORAGE_SIZE);
+STORAGE_EVICTION(bundle_eviction, BUNDLE_STORAGE_SIZE);
+
+/** Deleted bundles, whose views are still referenced, so their granules cannot be reused */
+LIST(released_list);
+
+// global, internal variables
+/** Counts the number of bundles in storage */
+static uint16_t bundles_in_storage;
+
+/** Number of bundles with a view */
+static uint16_t views_held;
+
+/** Number of deleted bundles in released_list, they still occupy a slot */
+static uint16_t bundles_released;
+
+/** File descriptor and mapping of the file */
+static int storage_fd = -1;
+static uint8_t * mapping = NULL;
+
+/** Bit set for every used granule */
+static uint8_t used_granules[(STORAGE_MMAP_GRANULES + 7) / 8];
+static uint32_t free_granules;
+
+/** Allocations start behind the last one */
+static uint32_t alloc_cursor;
+
+/** Is used to periodically traverse all bundles and delete those that are expired */
+static TimerHandle_t r_store_timer;
+
+static SemaphoreHandle_t wait_for_changes_sem = NULL;
+
+/**
+ * "Internal" functions
+ */
+static uint8_t storage_mmap_delete_bundle(uint32_t bundle_number, uint8_t reason);
+static struct mmem * storage_mmap_read_bundle(uint32_t bundle_num);
+
+static inline uint8_t storage_mmap_granule_used(const uint32_t granule)
+{
+	return used_granules[granule / 8] & (1 << (granule % 8));
+}
+
+static void storage_mmap_granules_mark(const uint32_t granule, const uint32_t granules, const uint8_t used)
+{
+	for(uint32_t g = granule; g < granule + granules; g++) {
+		if( used ) {
+			used_granules[g / 8] |= 1 << (g % 8);
+		} else {
+			used_granules[g / 8] &= ~(1 << (g % 8));
+		}
+	}
+
+	if( used ) {
+		free_granules -= granules;
+	} else {
+		free_granules += granules;
+	}
+}
+
+/**
+ * \brief Looks for a run of free granules behind the last allocation
+ * \param granules number of granules
+ * \return the first granule of the run or STORAGE_MMAP_NO_GRANULE
+ */
+static uint32_t storage_mmap_granules_alloc(const uint32_t granules)
+{
+	uint32_t start = STORAGE_MMAP_NO_GRANULE;
+	uint32_t run = 0;
+
+	if( granules > free_granules ) {
+		return STORAGE_MMAP_NO_GRANULE;
+	}
+
+	/* The first granule holds the file header, runs do not wrap around */
+	for(uint32_t i = 0; i < STORAGE_MMAP_GRANULES; i++) {
+		const uint32_t g = (alloc_cursor + i) % STORAGE_MMAP_GRANULES;
+
+		if( g == 0 ) {
+			run = 0;
+			continue;
+		}
+
+		/* Skip completely used bytes of the bitmap */
+		if( g % 8 == 0 && used_granules[g / 8] == 0xFF ) {
+			run = 0;
+			i += 7;
+			continue;
+		}
+
+		if( storage_mmap_granule_used(g) ) {
+			run = 0;
+			continue;
+		}
+
+		if( run == 0 ) {
+			start = g;
+		}
+
+		if( ++run == granules ) {
+			storage_mmap_granules_mark(start, granules, 1);
+			alloc_cursor = start + granules;
+			return start;
+		}
+	}
+
+	return STORAGE_MMAP_NO_GRANULE;
+}
+
+static inline struct mmap_record_header_t * storage_mmap_record(const uint32_t granule)
+{
+	return (struct mmap_record_header_t *) (mapping + granule * STORAGE_MMAP_GRANULE);
+}
+
+/**
+ * \brief Returns the number of bytes of the record of a bundle behind its header
+ */
+static uint32_t storage_mmap_record_length(struct mmem * const bundlemem)
+{
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	uint32_t length = sizeof(struct bundle_t);
+
+	for(int i=0; i<bundle->num_blocks; i++) {
+		length += sizeof(struct mmap_block_header_t) + bundle_get_block(bundlemem, i)->block_size;
+	}
+
+	return length;
+}
+
+static inline uint32_t storage_mmap_record_granules(const uint32_t length)
+{
+	return (sizeof(struct mmap_record_header_t) + length + STORAGE_MMAP_GRANULE - 1) / STORAGE_MMAP_GRANULE;
+}
+
+/**
+ * \brief Writes a bundle into its granules
+ *
+ * The magic is written last, so that an interrupted write is not restored.
+ */
+static void storage_mmap_record_write(struct mmem * const bundlemem, const uint32_t granule, const uint32_t length)
+{
+	struct mmap_record_header_t * const header = storage_mmap_record(granule);
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	uint8_t * position = (uint8_t *) (header + 1);
+
+	header->magic = 0;
+	header->bundle_num = bundle->bundle_num;
+	header->length = length;
+	header->check = ~length ^ bundle->bundle_num;
+
+	memcpy(position, bundle, sizeof(struct bundle_t));
+	position += sizeof(struct bundle_t);
+
+	for(int i=0; i<bundle->num_blocks; i++) {
+		const struct bundle_block_t * const block = bundle_get_block(bundlemem, i);
+		const struct mmap_block_header_t block_header = {
+			.type = block->type,
+			.flags = block->flags,
+			.block_size = block->block_size,
+		};
+
+		memcpy(position, &block_header, sizeof(block_header));
+		position += sizeof(block_header);
+
+		memcpy(position, block->payload, block->block_size);
+		position += block->block_size;
+	}
+
+	__atomic_store_n(&header->magic, STORAGE_MMAP_MAGIC_LIVE, __ATOMIC_RELEASE);
+}
+
+/**
+ * \brief Creates a bundle, whose blocks borrow their data from the mapping
+ * \param granule first granule of the record
+ * \return pointer to the MMEM struct containing the bundle or NULL
+ */
+static struct mmem * storage_mmap_record_view(const uint32_t granule)
+{
+	const struct mmap_record_header_t * const header = storage_mmap_record(granule);
+	const uint8_t * position = (const uint8_t *) (header + 1);
+	const uint8_t * const end = position + header->length;
+
+	struct mmem * const bundlemem = bundle_create_bundle();
+	if( bundlemem == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "cannot allocate memory for bundle %lu", header->bundle_num);
+		return NULL;
+	}
+
+	struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	memcpy(bundle, position, sizeof(struct bundle_t));
+	position += sizeof(struct bundle_t);
+
+	/* The blocks are added again one by one */
+	const uint8_t num_blocks = bundle->num_blocks;
+	bundle->num_blocks = 0;
+
+	for(int i=0; i<num_blocks; i++) {
+		struct mmap_block_header_t block_header;
+
+		if( position + sizeof(block_header) > end ) {
+			bundle_decrement(bundlemem);
+			return NULL;
+		}
+
+		memcpy(&block_header, position, sizeof(block_header));
+		position += sizeof(block_header);
+
+		if( block_header.block_size < 0 || position + block_header.block_size > end ||
+				bundle_add_block_borrowed(bundlemem, block_header.type, block_header.flags,
+										  (uint8_t *) position, block_header.block_size) < 0 ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "block %u of bundle %lu is invalid", i, header->bundle_num);
+			bundle_decrement(bundlemem);
+			return NULL;
+		}
+
+		position += block_header.block_size;
+	}
+
+	return bundlemem;
+}
+
+/**
+ * \brief Frees the entry and the granules of a deleted bundle
+ */
+static void storage_mmap_release(struct mmap_list_entry_t * const entry)
+{
+	if( entry->view != NULL ) {
+		bundle_decrement(entry->view);
+		entry->view = NULL;
+		views_held--;
+	}
+
+	storage_mmap_granules_mark(entry->granule, entry->granules, 0);
+	memb_free(&bundle_mem, entry);
+}
+
+/**
+ * \brief Gives up the views, which are only referenced by the storage
+ *
+ * The views of stored bundles are given up, until at most STORAGE_MMAP_VIEWS are left.
+ * Deleted bundles are released, as soon as their views are not referenced anymore.
+ */
+static void storage_mmap_release_views(void)
+{
+	struct mmap_list_entry_t * entry = NULL;
+	struct mmap_list_entry_t * next = NULL;
+
+	for(entry = list_head(released_list); entry != NULL; entry = next) {
+		next = list_item_next(entry);
+
+		if( bundle_get_references(entry->view) <= 1 ) {
+			list_remove(released_list, entry);
+			storage_mmap_release(entry);
+			bundles_released--;
+		}
+	}
+
+	for(entry = list_head(bundle_list);
+			entry != NULL && views_held > STORAGE_MMAP_VIEWS;
+			entry = list_item_next(entry)) {
+		if( entry->view != NULL && bundle_get_references(entry->view) <= 1 ) {
+			bundle_decrement(entry->view);
+			entry->view = NULL;
+			views_held--;
+		}
+	}
+}
+
+/**
+ * \brief Adds a bundle to the list, the index and the queues
+ */
+static void storage_mmap_add_entry(struct mmap_list_entry_t * const entry, struct mmem * const bundlemem)
+{
+	const struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+
+	entry->bundle_num = bundle->bundle_num;
+	entry->dst_node = bundle->dst_node;
+	entry->bundle_flags = bundle->flags;
+
+	bundles_in_storage++;
+
+	list_add(bundle_list, entry);
+	storage_index_add(&bundle_index, (struct storage_entry_t *) entry);
+	storage_eviction_describe(&entry->eviction, bundlemem, storage_expiry_of_bundle(bundlemem));
+	storage_expiry_add(&bundle_expiry, &entry->expiry, entry->eviction.expiration);
+	storage_eviction_add(&bundle_eviction, &entry->eviction);
+
+	statistics_storage_bundles(bundles_in_storage);
+}
+
+/**
+ * \brief Drops all entries in RAM, the file is not changed
+ */
+static void storage_mmap_clear(void)
+{
+	struct mmap_list_entry_t * entry = NULL;
+
+	while( (entry = list_pop(bundle_list)) != NULL ) {
+		storage_mmap_release(entry);
+	}
+
+	while( (entry = list_pop(released_list)) != NULL ) {
+		storage_mmap_release(entry);
+	}
+
+	storage_index_init(&bundle_index);
+	storage_expiry_init(&bundle_expiry);
+	storage_eviction_init(&bundle_eviction);
+
+	memset(used_granules, 0, sizeof(used_granules));
+	free_granules = STORAGE_MMAP_GRANULES;
+	alloc_cursor = 1;
+	bundles_in_storage = 0;
+	bundles_released = 0;
+	views_held = 0;
+
+	/* The file header is never allocated */
+	storage_mmap_granules_mark(0, 1, 1);
+}
+
+/**
+ * \brief Checks, whether a view is referenced by someone else than the storage
+ * \return 1 if a view is referenced, 0 otherwise
+ */
+static uint8_t storage_mmap_views_referenced(void)
+{
+	struct mmap_list_entry_t * entry = NULL;
+
+	/* Release the deleted bundles, which are not read anymore */
+	storage_mmap_release_views();
+
+	if( bundles_released > 0 ) {
+		return 1;
+	}
+
+	for(entry = list_head(bundle_list);
+			entry != NULL;
+			entry = list_item_next(entry)) {
+		if( entry->view != NULL && bundle_get_references(entry->view) > 1 ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Restores the bundles from the record headers
+ */
+static void storage_mmap_scan(void)
+{
+	uint32_t granule = 1;
+
+	while( granule < STORAGE_MMAP_GRANULES ) {
+		const struct mmap_record_header_t * const header = storage_mmap_record(granule);
+
+		/* Dead records may contain newer records, so only live records are skipped as a whole */
+		if( header->magic != STORAGE_MMAP_MAGIC_LIVE || header->check != (~header->length ^ header->bundle_num) ) {
+			granule++;
+			continue;
+		}
+
+		const uint32_t granules = storage_mmap_record_granules(header->length);
+		if( granules > STORAGE_MMAP_GRANULES - granule ) {
+			granule++;
+			continue;
+		}
+
+		struct mmap_list_entry_t * entry = NULL;
+		struct mmem * const bundlemem = storage_mmap_record_view(granule);
+
+		if( bundlemem != NULL && storage_index_find(&bundle_index, header->bundle_num) == NULL ) {
+			entry = memb_alloc(&bundle_mem);
+		}
+
+		if( entry == NULL ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "unable to restore bundle %lu", header->bundle_num);
+			storage_mmap_record(granule)->magic = STORAGE_MMAP_MAGIC_DEAD;
+			if( bundlemem != NULL ) {
+				bundle_decrement(bundlemem);
+			}
+			granule++;
+			continue;
+		}
+
+		memset(entry, 0, sizeof(struct mmap_list_entry_t));
+		entry->granule = granule;
+		entry->granules = granules;
+		storage_mmap_granules_mark(granule, granules, 1);
+		storage_mmap_add_entry(entry, bundlemem);
+
+		/* Restoring only needs the metadata, the view is not kept */
+		bundle_decrement(bundlemem);
+
+		granule += granules;
+	}
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Restored %u bundles, %lu of %lu granules free",
+		bundles_in_storage, free_granules, STORAGE_MMAP_GRANULES);
+}
+
+/**
+ * \brief Truncates the file and writes a new file header
+ * \return 0 on success, -1 on error or if a bundle is still being read
+ */
+static int storage_mmap_format(void)
+{
+	const struct mmap_file_header_t header = {
+		.magic = STORAGE_MMAP_MAGIC_FILE,
+		.size = STORAGE_MMAP_SIZE,
+		.granule = STORAGE_MMAP_GRANULE,
+	};
+
+	/* The blocks of the views point into the mapping, truncating would clear them */
+	if( storage_mmap_views_referenced() ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Cannot format file %s, bundles are being read", STORAGE_MMAP_FILE);
+		return -1;
+	}
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Formatting file %s", STORAGE_MMAP_FILE);
+
+	storage_mmap_clear();
+
+	/* Truncating drops all records without writing every page */
+	if( ftruncate(storage_fd, 0) < 0 || ftruncate(storage_fd, STORAGE_MMAP_SIZE) < 0 ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to truncate file %s", STORAGE_MMAP_FILE);
+		return -1;
+	}
+
+	memcpy(mapping, &header, sizeof(header));
+
+	return 0;
+}
+
+/**
+ * \brief deletes expired bundles from storage
+ */
+static void storage_mmap_prune(const TimerHandle_t timer)
+{
+	struct storage_expiry_node_t * node = NULL;
+	const uint32_t now = storage_expiry_now();
+
+	// Delete expired bundles from storage, only these are taken from the queue
+	while( (node = storage_expiry_pop_expired(&bundle_expiry, now)) != NULL ) {
+		struct mmap_list_entry_t * const entry = storage_expiry_entry(node, struct mmap_list_entry_t, expiry);
+
+		LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "bundle lifetime expired of bundle %lu", entry->bundle_num);
+		if( !storage_mmap_delete_bundle(entry->bundle_num, REASON_LIFETIME_EXPIRED) ) {
+			// Locked bundles are tried again on the next run
+			storage_expiry_add(&bundle_expiry, node, now + 1);
+		}
+	}
+
+	storage_mmap_release_views();
+
+	xTimerReset(r_store_timer, 0);
+}
+
+/**
+ * \brief called by agent at startup
+ */
+static bool storage_mmap_init(void)
+{
+	struct stat st;
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "storage_mmap init");
+
+	/* cancle, if initialisation was already done */
+	if(wait_for_changes_sem != NULL) {
+		return false;
+	}
+	wait_for_changes_sem = xSemaphoreCreateCounting(1, 0);
+	if(wait_for_changes_sem == NULL) {
+		return false;
+	}
+
+	list_init(bundle_list);
+	list_init(released_list);
+	memb_init(&bundle_mem);
+
+	storage_fd = open(STORAGE_MMAP_FILE, O_RDWR | O_CREAT, 0600);
+	if( storage_fd < 0 ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to open file %s", STORAGE_MMAP_FILE);
+		return false;
+	}
+
+	const uint8_t resize = fstat(storage_fd, &st) < 0 || st.st_size != STORAGE_MMAP_SIZE;
+	if( resize && ftruncate(storage_fd, STORAGE_MMAP_SIZE) < 0 ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to resize file %s", STORAGE_MMAP_FILE);
+		return false;
+	}
+
+	mapping = mmap(NULL, STORAGE_MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, storage_fd, 0);
+	if( mapping == MAP_FAILED ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to map file %s", STORAGE_MMAP_FILE);
+		mapping = NULL;
+		return false;
+	}
+
+	storage_mmap_clear();
+
+	const struct mmap_file_header_t * const header = (struct mmap_file_header_t *) mapping;
+
+	if( BUNDLE_STORAGE_INIT || resize || header->magic != STORAGE_MMAP_MAGIC_FILE ||
+			header->size != STORAGE_MMAP_SIZE || header->granule != STORAGE_MMAP_GRANULE ) {
+		if( storage_mmap_format() < 0 ) {
+			return false;
+		}
+	} else {
+		storage_mmap_scan();
+	}
+
+	r_store_timer = xTimerCreate("store mmap timer", pdMS_TO_TICKS(5 * 1000), pdFALSE, NULL, storage_mmap_prune);
+	if (r_store_timer == NULL) {
+		return false;
+	}
+
+	if ( !xTimerStart(r_store_timer, 0) ) {
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * \brief Sets the storage to its initial state
+ */
+static void storage_mmap_reinit(void)
+{
+	struct mmap_list_entry_t * entry = NULL;
+
+	if( storage_mmap_format() == 0 ) {
+		return;
+	}
+
+	/* Bundles are being read, delete all bundles instead, so their granules are kept until they are released */
+	while( (entry = list_head(bundle_list)) != NULL ) {
+		entry->flags &= ~STORAGE_MMAP_FLAGS_LOCKED;
+		storage_mmap_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE);
+	}
+}
+
+/**
+ * \brief Deletes as many bundles as necessary to have a free slot and granules for a bundle
+ * \param bundlemem Pointer to the MMEM struct containing the bundle
+ * \param granules number of granules of the bundle
+ * \return the first granule allocated for the bundle or STORAGE_MMAP_NO_GRANULE
+ */
+static uint32_t storage_mmap_make_room(struct mmem * const bundlemem, const uint32_t granules)
+{
+	struct storage_eviction_node_t incoming;
+	struct storage_eviction_node_t * victim = NULL;
+	uint32_t granule = STORAGE_MMAP_NO_GRANULE;
+
+	/* Now delete expired bundles */
+	storage_mmap_prune(NULL);
+
+	storage_eviction_describe(&incoming, bundlemem, storage_expiry_of_bundle(bundlemem));
+
+	while( 1 ) {
+		if( bundles_in_storage + bundles_released < BUNDLE_STORAGE_SIZE ) {
+			granule = storage_mmap_granules_alloc(granules);
+			if( granule != STORAGE_MMAP_NO_GRANULE ) {
+				return granule;
+			}
+		}
+
+		victim = storage_eviction_victim(&bundle_eviction, &incoming);
+		if( victim == NULL ) {
+			/* We do not have deletable bundles in storage, stop deleting them */
+			return STORAGE_MMAP_NO_GRANULE;
+		}
+
+		const struct mmap_list_entry_t * const entry = storage_eviction_entry(victim, struct mmap_list_entry_t, eviction);
+		if( !storage_mmap_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE) ) {
+			return STORAGE_MMAP_NO_GRANULE;
+		}
+	}
+}
+
+/**
+ * \brief saves a bundle in storage
+ * \param bundlemem pointer to the bundle
+ * \param bundle_number_ptr pointer where the bundle number will be stored (on success)
+ * \return 0 on error, 1 on success
+ */
+static uint8_t storage_mmap_save_bundle(struct mmem* const bundlemem, uint32_t* const bundle_number_ptr)
+{
+	struct bundle_t *bundle = NULL;
+	struct mmap_list_entry_t * entry = NULL;
+
+	if( bundlemem == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "storage_mmap_save_bundle with invalid pointer %p", bundlemem);
+		return 0;
+	}
+
+	// Get the pointer to our bundle
+	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+
+	if( bundle == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "storage_mmap_save_bundle with invalid MMEM structure");
+		bundle_decrement(bundlemem);
+		return 0;
+	}
+
+	// Look for duplicates in the storage
+	entry = (struct mmap_list_entry_t *) storage_index_find(&bundle_index, bundle->bundle_num);
+	if( entry != NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "%lu is the same bundle", entry->bundle_num);
+		*bundle_number_ptr = entry->bundle_num;
+		bundle_decrement(bundlemem);
+		return 1;
+	}
+
+	const uint32_t length = storage_mmap_record_length(bundlemem);
+	const uint32_t granules = storage_mmap_record_granules(length);
+
+	const uint32_t granule = storage_mmap_make_room(bundlemem, granules);
+	if( granule == STORAGE_MMAP_NO_GRANULE ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Cannot store bundle, no room");
+		bundle_decrement(bundlemem);
+		return 0;
+	}
+
+	entry = memb_alloc(&bundle_mem);
+	if( entry == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to allocate struct, cannot store bundle");
+		storage_mmap_granules_mark(granule, granules, 0);
+		bundle_decrement(bundlemem);
+		return 0;
+	}
+
+	memset(entry, 0, sizeof(struct mmap_list_entry_t));
+	entry->granule = granule;
+	entry->granules = granules;
+
+	storage_mmap_record_write(bundlemem, granule, length);
+
+	// Pointer may have changed by bundle_get_block()
+	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "New Bundle %lu, Src %lu, Dest %lu, Seq %lu at granule %lu",
+		bundle->bundle_num, bundle->src_node, bundle->dst_node, bundle->tstamp_seq, granule);
+
+	storage_mmap_add_entry(entry, bundlemem);
+
+#if BUNDLE_STORAGE_STATUS
+	printf("S %u\n", bundles_in_storage);
+#endif
+
+	// The bundle is stored in the file, free its memory
+	bundle_decrement(bundlemem);
+
+	*bundle_number_ptr = entry->bundle_num;
+
+	/* storage status has changed */
+	xSemaphoreGive(wait_for_changes_sem);
+
+	return 1;
+}
+
+/**
+ * \brief deletes a bundle from storage
+ * \param bundle_number bundle number to be deleted
+ * \param reason reason code
+ * \return 1 on success or 0 on error
+ */
+static uint8_t storage_mmap_delete_bundle(uint32_t bundle_number, uint8_t reason)
+{
+	struct mmap_list_entry_t * entry = NULL;
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Deleting Bundle %lu with reason %u", bundle_number, reason);
+
+	// Look for the bundle we are talking about
+	entry = (struct mmap_list_entry_t *) storage_index_find(&bundle_index, bundle_number);
+
+	if( entry == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Could not find bundle %lu on storage_mmap_delete_bundle", bundle_number);
+		return 0;
+	}
+
+	if( entry->flags & STORAGE_MMAP_FLAGS_LOCKED ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Cannot delete locked bundle %lu", bundle_number);
+		return 0;
+	}
+
+	if( reason != REASON_DELIVERED ) {
+		if( (entry->bundle_flags & BUNDLE_FLAG_CUST_REQ) || (entry->bundle_flags & BUNDLE_FLAG_REP_DELETE) ) {
+			struct mmem * const bundlemem = storage_mmap_read_bundle(bundle_number);
+
+			if( bundlemem != NULL ) {
+				struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+
+				bundle->del_reason = reason;
+				if( bundle->src_node != dtn_node_id ) {
+					STATUSREPORT.send(bundlemem, NODE_DELETED_BUNDLE, reason);
+				}
+
+				bundle_decrement(bundlemem);
+			}
+		}
+	}
+
+	// Notified the agent, that a bundle has been deleted
+	agent_delete_bundle(bundle_number);
+
+	storage_mmap_record(entry->granule)->magic = STORAGE_MMAP_MAGIC_DEAD;
+
+	// Remove the bundle from the list
+	list_remove(bundle_list, entry);
+	storage_index_remove(&bundle_index, bundle_number);
+	storage_expiry_remove(&bundle_expiry, &entry->expiry);
+	storage_eviction_remove(&bundle_eviction, &entry->eviction);
+
+	bundles_in_storage--;
+	statistics_storage_bundles(bundles_in_storage);
+
+	/* The granules are still in use, while someone reads the bundle */
+	if( entry->view != NULL && bundle_get_references(entry->view) > 1 ) {
+		list_add(released_list, entry);
+		bundles_released++;
+	} else {
+		storage_mmap_release(entry);
+	}
+
+#if BUNDLE_STORAGE_STATUS
+	printf("D %u\n", bundles_in_storage);
+#endif
+
+	/* storage status has changed */
+	xSemaphoreGive(wait_for_changes_sem);
+
+	return 1;
+}
+
+/**
+ * \brief reads a bundle from storage
+ *
+ * Only the struct bundle_t is copied into MMEM, the blocks point into the mapping.
+ *
+ * \param bundle_num bundle number to read
+ * \return pointer to the MMEM struct, NULL on error
+ */
+static struct mmem * storage_mmap_read_bundle(uint32_t bundle_num)
+{
+	struct mmap_list_entry_t * entry = NULL;
+
+	// Look for the bundle we are talking about
+	entry = (struct mmap_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
+
+	if( entry == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Could not find bundle %lu in storage_mmap_read_bundle", bundle_num);
+		return NULL;
+	}
+
+	if( entry->view == NULL ) {
+		entry->view = storage_mmap_record_view(entry->granule);
+		if( entry->view == NULL ) {
+			return NULL;
+		}
+
+		views_held++;
+	}
+
+	// Someone requested the bundle, he will have to decrease the reference counter again
+	bundle_increment(entry->view);
+
+	/* The view of this bundle is referenced by the caller now, so it is kept */
+	if( views_held > STORAGE_MMAP_VIEWS ) {
+		storage_mmap_release_views();
+	}
+
+	return entry->view;
+}
+
+/**
+ * \brief checks if there is space for a bundle
+ * \param bundlemem pointer to a bundle struct (not used here)
+ * \return number of free slots
+ */
+static uint16_t storage_mmap_get_free_space(struct mmem * bundlemem)
+{
+	return BUNDLE_STORAGE_SIZE - bundles_in_storage - bundles_released;
+}
+
+/**
+ * \brief Get the number of slots available in storage
+ * \returns the number of free slots
+ */
+static uint16_t storage_mmap_get_bundle_numbers(void)
+{
+	return bundles_in_storage;
+}
+
+/**
+ * \brief Get the bundle list
+ * \returns pointer to first bundle list entry
+ */
+static struct storage_entry_t * storage_mmap_get_bundles(void)
+{
+	return (struct storage_entry_t *) list_head(bundle_list);
+}
+
+/**
+ * \brief Get the next bundle, which matches a query
+ * \param query the query
+ * \param previous entry returned by the last call or NULL to start with the first bundle
+ * \returns pointer to the bundle list entry or NULL if no more bundles match
+ */
+static struct storage_entry_t * storage_mmap_query_bundles(const struct storage_query_t * const query, const struct storage_entry_t * const previous)
+{
+	struct mmap_list_entry_t * entry = NULL;
+
+	if( previous == NULL ) {
+		entry = list_head(bundle_list);
+	} else {
+		entry = list_item_next((void *) previous);
+	}
+
+	for( ; entry != NULL; entry = list_item_next(entry) ) {
+		if( storage_query_match(query, &entry->eviction, entry->dst_node, entry->flags & STORAGE_MMAP_FLAGS_LOCKED) ) {
+			return (struct storage_entry_t *) entry;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Get the metadata of a bundle without reading it
+ * \param bundle_num Bundle number
+ * \param eviction returns the priority class, the time of reception and the expiration
+ * \param dst_node returns the destination node
+ * \return 1 on success or 0 if the bundle is not stored
+ */
+static uint8_t storage_mmap_describe_bundle(uint32_t bundle_num, struct storage_eviction_node_t * const eviction, uint32_t * const dst_node)
+{
+	const struct mmap_list_entry_t * entry = NULL;
+
+	// Look for the bundle we are talking about
+	entry = (struct mmap_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
+
+	if( entry == NULL ) {
+		return 0;
+	}
+
+	storage_eviction_copy(eviction, &entry->eviction);
+	*dst_node = entry->dst_node;
+
+	return 1;
+}
+
+static void storage_mmap_wait_for_changes(void)
+{
+	if ( !xSemaphoreTake(wait_for_changes_sem, portMAX_DELAY) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Wait for changes failed");
+	}
+}
+
+/**
+ * \brief Writes the modified pages of the mapping to the file
+ */
+static void storage_mmap_flush(void)
+{
+	if( mapping != NULL && msync(mapping, STORAGE_MMAP_SIZE, MS_SYNC) < 0 ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to sync file %s", STORAGE_MMAP_FILE);
+	}
+}
+
+/**
+ * \brief Mark a bundle as locked so that it will not be deleted even if we are running out of space
+ *
+ * \param bundle_num Bundle number
+ * \return 1 on success or 0 on error
+ */
+static uint8_t storage_mmap_lock_bundle(uint32_t bundle_num)
+{
+	struct mmap_list_entry_t * entry = NULL;
+
+	// Look for the bundle we are talking about
+	entry = (struct mmap_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
+
+	if( entry == NULL ) {
+		return 0;
+	}
+
+	entry->flags |= STORAGE_MMAP_FLAGS_LOCKED;
+
+	// Never delete locked bundles
+	storage_eviction_remove(&bundle_eviction, &entry->eviction);
+
+	return 1;
+}
+
+/**
+ * \brief Mark a bundle as unlocked after being locked previously
+ */
+static void storage_mmap_unlock_bundle(uint32_t bundle_num)
+{
+	struct mmap_list_entry_t * entry = NULL;
+
+	// Look for the bundle we are talking about
+	entry = (struct mmap_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
+
+	if( entry == NULL ) {
+		return;
+	}
+
+	entry->flags &= ~STORAGE_MMAP_FLAGS_LOCKED;
+
+	storage_eviction_add(&bundle_eviction, &entry->eviction);
+}
+
+
+const struct storage_driver storage_mmap = {
+	"STORAGE_MMAP",
+	storage_mmap_init,
+	storage_mmap_reinit,
+	storage_mmap_save_bundle,
+	storage_mmap_delete_bundle,
+	storage_mmap_read_bundle,
+	storage_mmap_lock_bundle,
+	storage_mmap_unlock_bundle,
+	storage_mmap_get_free_space,
+	storage_mmap_get_bundle_numbers,
+	storage_mmap_get_bundles,
+	storage_mmap_query_bundles,
+	storage_mmap_describe_bundle,
+	storage_mmap_wait_for_changes,
+	storage_mmap_format,
+	storage_mmap_flush,
+	storage_mmap_save_bundle,
+};
+
+/** @} */
+/** @} */
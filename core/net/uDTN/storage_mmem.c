@@ -39,6 +39,10 @@
 #include "convergence_layers.h"
 
 #include "storage.h"
+#include "storage_index.h"
+#include "storage_expiry.h"
+#include "storage_eviction.h"
+#include "storage_query.h"
 
 /**
  * Internal representation of a bundle
@@ -59,8 +63,17 @@ struct bundle_list_entry_t {
 	/** Flags */
 	uint8_t flags;
 
+	/** destination node of the bundle, to answer queries without reading the bundle */
+	uint32_t dst_node;
+
 	/** pointer to the actual bundle stored in MMEM */
 	struct mmem *bundle;
+
+	/** position in the expiry queue */
+	struct storage_expiry_node_t expiry;
+
+	/** position in the eviction heap */
+	struct storage_eviction_node_t eviction;
 };
 
 /**
@@ -71,6 +84,9 @@ struct bundle_list_entry_t {
 // List and memory blocks for the bundles
 LIST(bundle_list);
 MEMB(bundle_mem, struct bundle_list_entry_t, BUNDLE_STORAGE_SIZE);
+STORAGE_INDEX(bundle_index, BUNDLE_STORAGE_SIZE);
+STORAGE_EXPIRY(bundle_expiry, BUNDLE_STORAGE_SIZE);
+STORAGE_EVICTION(bundle_eviction, BUNDLE_STORAGE_SIZE);
 
 // global, internal variables
 /** Counts the number of bundles in storage */
@@ -103,6 +119,11 @@ static int storage_mmem_format(void)
 	return 0;
 }
 
+static void storage_mmem_flush(void)
+{
+	/* The bundles are stored, when save_bundle returns */
+}
+
 /**
  * \brief called by agent at startup
  */
@@ -134,6 +155,15 @@ bool storage_mmem_init(void)
 	// Initialize the bundle memory block
 	memb_init(&bundle_mem);
 
+	// Initialize the index of the bundle list
+	storage_index_init(&bundle_index);
+
+	// Initialize the queue of expiring bundles
+	storage_expiry_init(&bundle_expiry);
+
+	// Initialize the heap of deletable bundles
+	storage_eviction_init(&bundle_eviction);
+
 	// Initialize MMEM for the binary bundle storage
 	mmem_init();
 
@@ -160,18 +190,17 @@ bool storage_mmem_init(void)
  */
 void storage_mmem_prune(const TimerHandle_t timer)
 {
-	struct bundle_list_entry_t * entry = NULL;
-	struct bundle_t *bundle = NULL;
+	struct storage_expiry_node_t * node = NULL;
+	const uint32_t now = storage_expiry_now();
 
-	// Delete expired bundles from storage
-	for(entry = list_head(bundle_list);
-			entry != NULL;
-			entry = list_item_next(entry)) {
-		bundle = (struct bundle_t *) MMEM_PTR(entry->bundle);
+	// Delete expired bundles from storage, only these are taken from the queue
+	while( (node = storage_expiry_pop_expired(&bundle_expiry, now)) != NULL ) {
+		struct bundle_list_entry_t * const entry = storage_expiry_entry(node, struct bundle_list_entry_t, expiry);
 
-		if( bundle_ageing_is_expired(entry->bundle) ) {
-			LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "bundle lifetime expired of bundle %lu", entry->bundle_num);
-			storage_mmem_delete_bundle(bundle->bundle_num, REASON_LIFETIME_EXPIRED);
+		LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "bundle lifetime expired of bundle %lu", entry->bundle_num);
+		if( !storage_mmem_delete_bundle(entry->bundle_num, REASON_LIFETIME_EXPIRED) ) {
+			// Locked bundles are tried again on the next run
+			storage_expiry_add(&bundle_expiry, node, now + 1);
 		}
 	}
 
@@ -212,120 +241,27 @@ uint8_t storage_mmem_make_room(struct mmem * bundlemem)
 		return 0;
 	}
 
-#if BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DO_NOT_DELETE
-	/* We do not delete at all. If storage is used up, we sit there and wait */
-	if( bundles_in_storage >= BUNDLE_STORAGE_SIZE ) {
-		return 0;
-	}
-#elif (BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDEST || BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGEST )
-	struct bundle_t * bundle_new = NULL;
-	struct bundle_t * bundle_old = NULL;
-	struct bundle_list_entry_t * entry = NULL;
-
-	/* Keep deleting bundles until we have enough slots */
-	while( bundles_in_storage >= BUNDLE_STORAGE_SIZE || avail_memory < (2 * CONVERGENCE_LAYER_MAX_SIZE) ) {
-		unsigned long comparator = 0;
-		struct bundle_list_entry_t * deletor = NULL;
-
-		/* Obtain the new pointer each time, since the address may change */
-		bundle_new = (struct bundle_t *) MMEM_PTR(bundlemem);
-
-		for( entry = list_head(bundle_list);
-			 entry != NULL;
-			 entry = list_item_next(entry) ) {
+	struct storage_eviction_node_t incoming;
+	struct storage_eviction_node_t * victim = NULL;
 
-			bundle_old = (struct bundle_t *) MMEM_PTR(entry->bundle);
+	storage_eviction_describe(&incoming, bundlemem, storage_expiry_of_bundle(bundlemem));
 
-			/* Never delete locked bundles */
-			if( entry->flags & STORAGE_MMEM_FLAGS_LOCKED ) {
-				continue;
-			}
-
-			/* Always keep bundles with higher priority */
-			if( (bundle_old->flags & BUNDLE_PRIORITY_MASK) > (bundle_new->flags & BUNDLE_PRIORITY_MASK ) ) {
-				continue;
-			}
-
-#if BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDEST
-			if( (clock_seconds() - bundle_old->rec_time) > comparator || comparator == 0) {
-				comparator = clock_seconds() - bundle_old->rec_time;
-				deletor = entry;
-			}
-#elif BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGEST
-			if( (clock_seconds() - bundle_old->rec_time) < comparator || comparator == 0) {
-				comparator = clock_seconds() - bundle_old->rec_time;
-				deletor = entry;
-			}
-#endif
-		}
-
-		/* Either the for loop did nothing or did not break */
-		if( deletor == NULL ) {
-			/* We do not have deletable bundles in storage, stop deleting them */
-			return 0;
-		}
-
-		/* Delete Bundle */
-		storage_mmem_delete_bundle(deletor->bundle_num, REASON_DEPLETED_STORAGE);
-	}
-#elif (BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDER || BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGER )
-	struct bundle_t * bundle_new = NULL;
-	struct bundle_t * bundle_old = NULL;
-	struct bundle_list_entry_t * entry = NULL;
-
-	/* Keep deleting bundles until we have enough slots */
-	while( bundles_in_storage >= BUNDLE_STORAGE_SIZE) {
-		/* Obtain the new pointer each time, since the address may change */
-		bundle_new = (struct bundle_t *) MMEM_PTR(bundlemem);
-
-		/* We need this double-loop because otherwise we would be modifying the list
-		 * while iterating through it
-		 */
-		for( entry = list_head(bundle_list);
-			 entry != NULL;
-			 entry = list_item_next(entry) ) {
-			bundle_old = (struct bundle_t *) MMEM_PTR(entry->bundle);
-
-			/* Never delete locked bundles */
-			if( entry->flags & STORAGE_MMEM_FLAGS_LOCKED ) {
-				continue;
-			}
-
-			/* Always keep bundles with higher priority */
-			if( (bundle_old->flags & BUNDLE_PRIORITY_MASK) > (bundle_new->flags & BUNDLE_PRIORITY_MASK ) ) {
-				continue;
-			}
-
-			const uint32_t new_age = bundle_new->lifetime - ( (xTaskGetTickCount() - bundle_new->rec_time) / 1000 / portTICK_PERIOD_MS );
-			const uint32_t old_age = bundle_old->lifetime - ( (xTaskGetTickCount() - bundle_old->rec_time) / 1000 / portTICK_PERIOD_MS );
-#if BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_OLDER
-			/* If the new bundle has a longer lifetime than the bundle in our storage,
-			 * delete the bundle from storage to make room
+	/* Keep deleting bundles until we have enough slots and memory */
+	while( bundles_in_storage >= BUNDLE_STORAGE_SIZE || mmem_avail_memory() < (2 * CONVERGENCE_LAYER_MAX_SIZE) ) {
+		victim = storage_eviction_victim(&bundle_eviction, &incoming);
+		if( victim == NULL ) {
+			/* We do not have deletable bundles in storage, stop deleting them.
+			 * Without a free slot the bundle cannot be stored.
 			 */
-			if(new_age >= old_age) {
-				break;
-			}
-#elif BUNDLE_STORAGE_BEHAVIOUR == BUNDLE_STORAGE_BEHAVIOUR_DELETE_YOUNGER
-			/* Delete youngest bundle in storage */
-			// TODO possibly wrong comparsion
-			if(new_age >= old_age) {
-				break;
-			}
-#endif
+			return bundles_in_storage < BUNDLE_STORAGE_SIZE;
 		}
 
-		/* Either the for loop did nothing or did not break */
-		if( entry == NULL ) {
-			/* We do not have deletable bundles in storage, stop deleting them */
+		/* Delete Bundle */
+		const struct bundle_list_entry_t * const entry = storage_eviction_entry(victim, struct bundle_list_entry_t, eviction);
+		if( !storage_mmem_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE) ) {
 			return 0;
 		}
-
-		/* Delete Bundle */
-		storage_mmem_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE);
 	}
-#else
-#error No Bundle Deletion Strategy defined
-#endif
 
 	return 1;
 }
@@ -338,8 +274,7 @@ uint8_t storage_mmem_make_room(struct mmem * bundlemem)
  */
 static uint8_t storage_mmem_save_bundle(struct mmem* const bundlemem, uint32_t* const bundle_number_ptr)
 {
-	struct bundle_t *entrybdl = NULL,
-					*bundle = NULL;
+	struct bundle_t *bundle = NULL;
 	struct bundle_list_entry_t * entry = NULL;
 
 	if( bundlemem == NULL ) {
@@ -357,17 +292,12 @@ static uint8_t storage_mmem_save_bundle(struct mmem* const bundlemem, uint32_t*
 	}
 
 	// Look for duplicates in the storage
-	for(entry = list_head(bundle_list);
-		entry != NULL;
-		entry = list_item_next(entry)) {
-		entrybdl = (struct bundle_t *) MMEM_PTR(entry->bundle);
-
-		if( bundle->bundle_num == entrybdl->bundle_num ) {
-			LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "%lu is the same bundle", entry->bundle_num);
-			*bundle_number_ptr = entry->bundle_num;
-			bundle_decrement(bundlemem);
-			return 1;
-		}
+	entry = (struct bundle_list_entry_t *) storage_index_find(&bundle_index, bundle->bundle_num);
+	if( entry != NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "%lu is the same bundle", entry->bundle_num);
+		*bundle_number_ptr = entry->bundle_num;
+		bundle_decrement(bundlemem);
+		return 1;
 	}
 
 	if( !storage_mmem_make_room(bundlemem) ) {
@@ -410,6 +340,7 @@ static uint8_t storage_mmem_save_bundle(struct mmem* const bundlemem, uint32_t*
 
 	// Set all required fields
 	entry->bundle_num = bundle->bundle_num;
+	entry->dst_node = bundle->dst_node;
 
 	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "New Bundle %lu, Src %lu, Dest %lu, Seq %lu",
 		entry->bundle_num, bundle->src_node, bundle->dst_node, bundle->tstamp_seq);
@@ -423,6 +354,10 @@ static uint8_t storage_mmem_save_bundle(struct mmem* const bundlemem, uint32_t*
 
 	// Add bundle to the list
 	list_add(bundle_list, entry);
+	storage_index_add(&bundle_index, (struct storage_entry_t *) entry);
+	storage_eviction_describe(&entry->eviction, bundlemem, storage_expiry_of_bundle(bundlemem));
+	storage_expiry_add(&bundle_expiry, &entry->expiry, entry->eviction.expiration);
+	storage_eviction_add(&bundle_eviction, &entry->eviction);
 
 	// Now we have to (virtually) free the incoming bundle slot
 	// This should do nothing, as we have incremented the reference counter before
@@ -452,15 +387,7 @@ uint8_t storage_mmem_delete_bundle(uint32_t bundle_number, uint8_t reason)
 	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Deleting Bundle %lu with reason %u", bundle_number, reason);
 
 	// Look for the bundle we are talking about
-	for(entry = list_head(bundle_list);
-		entry != NULL;
-		entry = list_item_next(entry)) {
-		bundle = (struct bundle_t *) MMEM_PTR(entry->bundle);
-
-		if( bundle->bundle_num == bundle_number ) {
-			break;
-		}
-	}
+	entry = (struct bundle_list_entry_t *) storage_index_find(&bundle_index, bundle_number);
 
 	if( entry == NULL ) {
 		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Could not find bundle %lu on storage_mmem_delete_bundle", bundle_number);
@@ -492,6 +419,9 @@ uint8_t storage_mmem_delete_bundle(uint32_t bundle_number, uint8_t reason)
 
 	// Remove the bundle from the list
 	list_remove(bundle_list, entry);
+	storage_index_remove(&bundle_index, bundle_number);
+	storage_expiry_remove(&bundle_expiry, &entry->expiry);
+	storage_eviction_remove(&bundle_eviction, &entry->eviction);
 
 	bundles_in_storage--;
 
@@ -518,18 +448,9 @@ uint8_t storage_mmem_delete_bundle(uint32_t bundle_number, uint8_t reason)
 struct mmem *storage_mmem_read_bundle(uint32_t bundle_num)
 {
 	struct bundle_list_entry_t * entry = NULL;
-	struct bundle_t * bundle = NULL;
 
 	// Look for the bundle we are talking about
-	for(entry = list_head(bundle_list);
-			entry != NULL;
-			entry = list_item_next(entry)) {
-		bundle = (struct bundle_t *) MMEM_PTR(entry->bundle);
-
-		if( bundle->bundle_num == bundle_num ) {
-			break;
-		}
-	}
+	entry = (struct bundle_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
 
 	if( entry == NULL ) {
 		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Could not find bundle %lu in storage_mmem_read_bundle", bundle_num);
@@ -574,6 +495,55 @@ struct storage_entry_t * storage_mmem_get_bundles(void)
 	return (struct storage_entry_t *) list_head(bundle_list);
 }
 
+/**
+ * \brief Get the next bundle, which matches a query
+ * \param query the query
+ * \param previous entry returned by the last call or NULL to start with the first bundle
+ * \returns pointer to the bundle list entry or NULL if no more bundles match
+ */
+struct storage_entry_t * storage_mmem_query_bundles(const struct storage_query_t * const query, const struct storage_entry_t * const previous)
+{
+	struct bundle_list_entry_t * entry = NULL;
+
+	if( previous == NULL ) {
+		entry = list_head(bundle_list);
+	} else {
+		entry = list_item_next((void *) previous);
+	}
+
+	for( ; entry != NULL; entry = list_item_next(entry) ) {
+		if( storage_query_match(query, &entry->eviction, entry->dst_node, entry->flags & STORAGE_MMEM_FLAGS_LOCKED) ) {
+			return (struct storage_entry_t *) entry;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Get the metadata of a bundle without reading it
+ * \param bundle_num Bundle number
+ * \param eviction returns the priority class, the time of reception and the expiration
+ * \param dst_node returns the destination node
+ * \return 1 on success or 0 if the bundle is not stored
+ */
+uint8_t storage_mmem_describe_bundle(uint32_t bundle_num, struct storage_eviction_node_t * const eviction, uint32_t * const dst_node)
+{
+	const struct bundle_list_entry_t * entry = NULL;
+
+	// Look for the bundle we are talking about
+	entry = (struct bundle_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
+
+	if( entry == NULL ) {
+		return 0;
+	}
+
+	storage_eviction_copy(eviction, &entry->eviction);
+	*dst_node = entry->dst_node;
+
+	return 1;
+}
+
 static void storage_mmem_wait_for_changes(void)
 {
 	if ( !xSemaphoreTake(wait_for_changes_sem, portMAX_DELAY) ) {
@@ -592,13 +562,7 @@ uint8_t storage_mmem_lock_bundle(uint32_t bundle_num)
 	struct bundle_list_entry_t * entry = NULL;
 
 	// Look for the bundle we are talking about
-	for(entry = list_head(bundle_list);
-			entry != NULL;
-			entry = list_item_next(entry)) {
-		if( entry->bundle_num == bundle_num ) {
-			break;
-		}
-	}
+	entry = (struct bundle_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
 
 	if( entry == NULL ) {
 		return 0;
@@ -606,6 +570,9 @@ uint8_t storage_mmem_lock_bundle(uint32_t bundle_num)
 
 	entry->flags |= STORAGE_MMEM_FLAGS_LOCKED;
 
+	// Never delete locked bundles
+	storage_eviction_remove(&bundle_eviction, &entry->eviction);
+
 	return 1;
 }
 
@@ -617,19 +584,15 @@ void storage_mmem_unlock_bundle(uint32_t bundle_num)
 	struct bundle_list_entry_t * entry = NULL;
 
 	// Look for the bundle we are talking about
-	for(entry = list_head(bundle_list);
-			entry != NULL;
-			entry = list_item_next(entry)) {
-		if( entry->bundle_num == bundle_num ) {
-			break;
-		}
-	}
+	entry = (struct bundle_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
 
 	if( entry == NULL ) {
 		return;
 	}
 
 	entry->flags &= ~STORAGE_MMEM_FLAGS_LOCKED;
+
+	storage_eviction_add(&bundle_eviction, &entry->eviction);
 }
 
 
@@ -645,8 +608,12 @@ const struct storage_driver storage_mmem = {
 	storage_mmem_get_free_space,
 	storage_mmem_get_bundle_numbers,
 	storage_mmem_get_bundles,
+	storage_mmem_query_bundles,
+	storage_mmem_describe_bundle,
 	storage_mmem_wait_for_changes,
 	storage_mmem_format,
+	storage_mmem_flush,
+	storage_mmem_save_bundle,
 };
 
 /** @} */
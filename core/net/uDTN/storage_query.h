@@ -0,0 +1,101 @@
+/**
+ * \addtogroup bundle_storage
+ * @{
+ */
+
+/**
+ * \defgroup storage_query Queries for stored bundles
+ *
+ * @{
+ */
+
+/**
+ * \file
+ * \brief Selects stored bundles by their metadata
+ *
+ * A query is answered from the metadata, which the storage modules keep
+ * in their entries, so no bundle has to be read. The criteria, which are
+ * selected by the fields of the query, have to match all.
+ *
+ * \code
+ * const struct storage_query_t query = {
+ *     .fields = STORAGE_QUERY_DESTINATION | STORAGE_QUERY_UNLOCKED,
+ *     .dst_node = node,
+ * };
+ *
+ * for( entry = BUNDLE_STORAGE.query_bundles(&query, NULL);
+ *         entry != NULL;
+ *         entry = BUNDLE_STORAGE.query_bundles(&query, entry) ) {
+ *     ...
+ * }
+ * \endcode
+ */
+
+#ifndef __STORAGE_QUERY_H__
+#define __STORAGE_QUERY_H__
+
+#include <stdint.h>
+
+#include "storage.h"
+#include "storage_eviction.h"
+
+/**
+ * Criteria of a query
+ */
+/** Bundles for the node dst_node */
+#define STORAGE_QUERY_DESTINATION		0x01
+/** Bundles of the priority class priority */
+#define STORAGE_QUERY_PRIORITY			0x02
+/** Bundles, which expire before expires_before */
+#define STORAGE_QUERY_EXPIRES_BEFORE	0x04
+/** Bundles, which are not locked */
+#define STORAGE_QUERY_UNLOCKED			0x08
+
+struct storage_query_t {
+	/** STORAGE_QUERY_* */
+	uint8_t fields;
+
+	/** destination node */
+	uint32_t dst_node;
+
+	/** priority class (0 = bulk to 2 = expedited) */
+	uint8_t priority;
+
+	/** Uptime in seconds as returned by storage_expiry_now() */
+	uint32_t expires_before;
+};
+
+/**
+ * \brief Checks, whether the metadata of a stored bundle matches a query
+ * \param query the query
+ * \param eviction eviction node of the bundle, which has its priority and expiration
+ * \param dst_node destination node of the bundle
+ * \param locked non-zero, if the bundle is locked
+ * \return 1 if the bundle matches, 0 otherwise
+ */
+static inline int storage_query_match(const struct storage_query_t * const query,
+									  const struct storage_eviction_node_t * const eviction,
+									  const uint32_t dst_node, const uint8_t locked)
+{
+	if( (query->fields & STORAGE_QUERY_DESTINATION) && dst_node != query->dst_node ) {
+		return 0;
+	}
+
+	if( (query->fields & STORAGE_QUERY_PRIORITY) && eviction->priority != query->priority ) {
+		return 0;
+	}
+
+	if( (query->fields & STORAGE_QUERY_EXPIRES_BEFORE) && eviction->expiration >= query->expires_before ) {
+		return 0;
+	}
+
+	if( (query->fields & STORAGE_QUERY_UNLOCKED) && locked ) {
+		return 0;
+	}
+
+	return 1;
+}
+
+#endif /* __STORAGE_QUERY_H__ */
+/** @} */
+/** @} */
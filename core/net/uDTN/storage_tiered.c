@@ -0,0 +1,989 @@
+/**
+ * \addtogroup bundle_storage
+ * @{
+ */
+
+/**
+ * \defgroup bundle_storage_tiered Tiered Storage with MMEM and a persistent tier
+ *
+ * @{
+ */
+
+/**
+ * \file
+ * \brief Keeps the bundles in MMEM and spills them to a persistent storage
+ *
+ * New bundles are kept in MMEM, the hot tier. When the hot bundles occupy
+ * more than STORAGE_TIERED_HOT_BYTES of MMEM, the bundles with the lowest
+ * priority class, which were not used for the longest time, are demoted to
+ * the cold tier (storage_fatfs by default) until STORAGE_TIERED_HOT_LOW_BYTES
+ * are reached. Reading a cold bundle promotes it back into MMEM, if there is
+ * room, while its copy in the cold tier is kept. So demoting it again
+ * only drops the MMEM reference.
+ *
+ * The cold tier does not add demoted bundles to its read cache, so their
+ * MMEM is freed as soon as they are written. If a new bundle needs that
+ * MMEM, saving it waits for the cold tier to write the demoted bundles.
+ *
+ * Most bundles are forwarded and deleted before the watermark is reached,
+ * so they never touch the cold tier.
+ *
+ * All bundles of both tiers are listed, indexed, expired and evicted here.
+ * The cold tier never holds more than BUNDLE_STORAGE_SIZE bundles,
+ * so it does not evict bundles to make room. It still deletes bundles on
+ * its own, when they expire or cannot be written. Then it holds fewer
+ * bundles than expected and the entries of the missing bundles are dropped
+ * on the next prune run or access.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+#include "semphr.h"
+
+#include "lib/mmem.h"
+#include "lib/memb.h"
+#include "lib/list.h"
+#include "lib/logging.h"
+
+#include "bundle.h"
+#include "agent.h"
+#include "statusreport.h"
+#include "statistics.h"
+#include "convergence_layers.h"
+
+#include "storage.h"
+#include "storage_heap.h"
+#include "storage_index.h"
+#include "storage_expiry.h"
+#include "storage_eviction.h"
+#include "storage_query.h"
+
+/**
+ * Storage driver of the cold tier
+ */
+#ifdef STORAGE_TIERED_CONF_COLD
+#define STORAGE_TIERED_COLD STORAGE_TIERED_CONF_COLD
+#else
+#define STORAGE_TIERED_COLD storage_fatfs
+#endif
+
+/**
+ * Bytes of MMEM, which can be used by hot bundles, before they are demoted
+ */
+#ifdef STORAGE_TIERED_CONF_HOT_BYTES
+#define STORAGE_TIERED_HOT_BYTES STORAGE_TIERED_CONF_HOT_BYTES
+#else
+#define STORAGE_TIERED_HOT_BYTES (16 * 1024UL)
+#endif
+
+/**
+ * Bytes of MMEM used by hot bundles, after the demotion has finished
+ */
+#ifdef STORAGE_TIERED_CONF_HOT_LOW_BYTES
+#define STORAGE_TIERED_HOT_LOW_BYTES STORAGE_TIERED_CONF_HOT_LOW_BYTES
+#else
+#define STORAGE_TIERED_HOT_LOW_BYTES (STORAGE_TIERED_HOT_BYTES * 3 / 4)
+#endif
+
+/**
+ * Bits of the demotion key, which are used for the time of the last use.
+ * The priority class is stored in the upper bits.
+ */
+#define STORAGE_TIERED_USED_BITS		30
+#define STORAGE_TIERED_USED_MASK		((1UL << STORAGE_TIERED_USED_BITS) - 1)
+
+/**
+ * Flags for the storage
+ */
+#define STORAGE_TIERED_FLAGS_LOCKED 	0x1
+/** The bundle is kept in MMEM */
+#define STORAGE_TIERED_FLAGS_HOT		0x2
+/** The bundle is saved in the cold tier */
+#define STORAGE_TIERED_FLAGS_COLD		0x4
+
+/**
+ * Internal representation of a bundle
+ *
+ * The layout is quite fixed - the next pointer and the bundle_num have to go first because this struct
+ * has to be compatible with the struct storage_entry_t in storage.h!
+ */
+struct tiered_list_entry_t {
+	/** pointer to the next list element */
+	struct tiered_list_entry_t * next;
+
+	uint32_t bundle_num;
+
+	/** Flags */
+	uint8_t flags;
+
+	/** bytes of MMEM occupied by the bundle */
+	uint16_t size;
+
+	/** destination node, to answer queries without reading the bundle */
+	uint32_t dst_node;
+
+	/** bundle in MMEM, if STORAGE_TIERED_FLAGS_HOT is set */
+	struct mmem * bundle;
+
+	/** position in the expiry queue */
+	struct storage_expiry_node_t expiry;
+
+	/** position in the eviction heap */
+	struct storage_eviction_node_t eviction;
+
+	/** position in the heap of hot bundles, which can be demoted */
+	struct storage_heap_node_t demotion;
+};
+
+extern const struct storage_driver STORAGE_TIERED_COLD;
+
+// List and memory blocks for the bundles
+LIST(bundle_list);
+MEMB(bundle_mem, struct tiered_list_entry_t, BUNDLE_STORAGE_SIZE);
+STORAGE_INDEX(bundle_index, BUNDLE_STORAGE_SIZE);
+STORAGE_EXPIRY(bundle_expiry, BUNDLE_STORAGE_SIZE);
+STORAGE_EVICTION(bundle_eviction, BUNDLE_STORAGE_SIZE);
+STORAGE_HEAP(bundle_demotion, BUNDLE_STORAGE_SIZE);
+
+// global, internal variables
+/** Counts the number of bundles in storage */
+static uint16_t bundles_in_storage;
+
+/** Bytes of MMEM occupied by hot bundles */
+static size_t hot_bytes;
+
+/** Number of bundles, which are saved in the cold tier */
+static uint16_t cold_bundles;
+
+static SemaphoreHandle_t wait_for_changes_sem = NULL;
+
+/**
+ * "Internal" functions
+ */
+static void storage_tiered_prune(const TimerHandle_t timer);
+static uint8_t storage_tiered_delete_bundle(uint32_t bundle_number, uint8_t reason);
+
+/**
+ * \brief internal function to send statistics to statistics module
+ */
+static void storage_tiered_update_statistics(void)
+{
+	statistics_storage_bundles(bundles_in_storage);
+	statistics_storage_memory(mmem_avail_memory());
+}
+
+/**
+ * \brief Marks a hot bundle as used, so that it is demoted later
+ * \param entry entry of a hot bundle
+ */
+static void storage_tiered_touch(struct tiered_list_entry_t * const entry)
+{
+	storage_heap_remove(&bundle_demotion, &entry->demotion);
+
+	/* Locked bundles are being sent, they are demoted after being unlocked */
+	if( entry->flags & STORAGE_TIERED_FLAGS_LOCKED ) {
+		return;
+	}
+
+	entry->demotion.key = ((uint32_t) entry->eviction.priority << STORAGE_TIERED_USED_BITS) |
+			(storage_expiry_now() & STORAGE_TIERED_USED_MASK);
+	storage_heap_add(&bundle_demotion, &entry->demotion);
+}
+
+/**
+ * \brief Keeps a bundle in MMEM
+ * \param entry entry of the bundle
+ * \param bundlemem the bundle, the entry takes a reference
+ */
+static void storage_tiered_make_hot(struct tiered_list_entry_t * const entry, struct mmem * const bundlemem)
+{
+	bundle_increment(bundlemem);
+	entry->bundle = bundlemem;
+	entry->size = bundle_get_size(bundlemem);
+	entry->flags |= STORAGE_TIERED_FLAGS_HOT;
+
+	hot_bytes += entry->size;
+
+	storage_tiered_touch(entry);
+}
+
+/**
+ * \brief Releases the MMEM of a hot bundle
+ * \param entry entry of a hot bundle
+ */
+static void storage_tiered_release(struct tiered_list_entry_t * const entry)
+{
+	storage_heap_remove(&bundle_demotion, &entry->demotion);
+
+	bundle_decrement(entry->bundle);
+	entry->bundle = NULL;
+	entry->flags &= ~STORAGE_TIERED_FLAGS_HOT;
+
+	hot_bytes -= entry->size;
+}
+
+/**
+ * \brief Moves a hot bundle to the cold tier
+ *
+ * The cold tier keeps the bundle in MMEM, until it has written it.
+ * \param entry entry of a hot bundle
+ * \param written is set to 1, if the bundle has to be written by the cold tier
+ * \return 1 on success, 0 if the cold tier did not accept the bundle
+ */
+static uint8_t storage_tiered_demote(struct tiered_list_entry_t * const entry, uint8_t * const written)
+{
+	uint32_t bundle_number = 0;
+
+	/* A promoted bundle has still its copy in the cold tier */
+	if( !(entry->flags & STORAGE_TIERED_FLAGS_COLD) ) {
+		/* The cold tier consumes one reference and does not cache the bundle */
+		bundle_increment(entry->bundle);
+		if( !STORAGE_TIERED_COLD.demote_bundle(entry->bundle, &bundle_number) ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Could not demote bundle %lu", entry->bundle_num);
+			return 0;
+		}
+
+		entry->flags |= STORAGE_TIERED_FLAGS_COLD;
+		cold_bundles++;
+		*written = 1;
+	}
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Demoted bundle %lu", entry->bundle_num);
+
+	storage_tiered_release(entry);
+
+	return 1;
+}
+
+/**
+ * \brief Demotes the coldest bundles, until the hot bundles are below the watermark
+ * \param incoming bytes of a bundle, which will become hot
+ * \return 1 if demoted bundles are still in MMEM until the cold tier has written them, 0 otherwise
+ */
+static uint8_t storage_tiered_spill(const size_t incoming)
+{
+	uint8_t written = 0;
+
+	if( hot_bytes + incoming <= STORAGE_TIERED_HOT_BYTES ) {
+		return 0;
+	}
+
+	while( hot_bytes + incoming > STORAGE_TIERED_HOT_LOW_BYTES ) {
+		struct storage_heap_node_t * const node = storage_heap_first(&bundle_demotion);
+		if( node == NULL ) {
+			/* Only locked bundles are hot */
+			break;
+		}
+
+		struct tiered_list_entry_t * const entry = storage_heap_entry(node, struct tiered_list_entry_t, demotion);
+		if( !storage_tiered_demote(entry, &written) ) {
+			/* The cold tier is busy, try again with the next bundle */
+			break;
+		}
+	}
+
+	return written;
+}
+
+/**
+ * \brief Removes the entry of a bundle, whose MMEM has already been released
+ * \param entry entry of the bundle
+ */
+static void storage_tiered_remove(struct tiered_list_entry_t * const entry)
+{
+	if( entry->flags & STORAGE_TIERED_FLAGS_COLD ) {
+		cold_bundles--;
+	}
+
+	// Remove the bundle from the list
+	list_remove(bundle_list, entry);
+	storage_index_remove(&bundle_index, entry->bundle_num);
+	storage_expiry_remove(&bundle_expiry, &entry->expiry);
+	storage_eviction_remove(&bundle_eviction, &entry->eviction);
+
+	bundles_in_storage--;
+
+	// Notify the statistics module
+	storage_tiered_update_statistics();
+
+	// Free the storage struct
+	memb_free(&bundle_mem, entry);
+#if BUNDLE_STORAGE_STATUS
+	printf("D %u\n", bundles_in_storage);
+#endif
+
+	/* storage status has changed */
+	xSemaphoreGive(wait_for_changes_sem);
+}
+
+/**
+ * \brief Checks, whether the cold tier still has a bundle
+ * \param entry entry of a cold bundle
+ * \return 1 if the cold tier has the bundle, 0 if it has deleted the bundle on its own
+ */
+static uint8_t storage_tiered_cold_exists(const struct tiered_list_entry_t * const entry)
+{
+	struct storage_eviction_node_t eviction;
+	uint32_t dst_node = 0;
+
+	return STORAGE_TIERED_COLD.describe_bundle(entry->bundle_num, &eviction, &dst_node);
+}
+
+/**
+ * \brief Drops the entry of a bundle, which the cold tier has deleted on its own
+ *
+ * The cold tier has already sent the status report and notified the agent.
+ * \param entry entry of a cold bundle
+ */
+static void storage_tiered_forget(struct tiered_list_entry_t * const entry)
+{
+	LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Bundle %lu was deleted by the cold tier", entry->bundle_num);
+
+	if( entry->flags & STORAGE_TIERED_FLAGS_HOT ) {
+		storage_tiered_release(entry);
+	}
+
+	storage_tiered_remove(entry);
+}
+
+/**
+ * \brief Drops the entries of all bundles, which the cold tier has deleted on its own
+ */
+static void storage_tiered_reconcile(void)
+{
+	struct tiered_list_entry_t * entry = NULL;
+	struct tiered_list_entry_t * next = NULL;
+
+	/* Only walk the list, if bundles are missing */
+	if( STORAGE_TIERED_COLD.get_bundle_num() >= cold_bundles ) {
+		return;
+	}
+
+	for(entry = list_head(bundle_list);
+			entry != NULL;
+			entry = next) {
+		next = list_item_next(entry);
+
+		if( (entry->flags & STORAGE_TIERED_FLAGS_COLD) && !storage_tiered_cold_exists(entry) ) {
+			storage_tiered_forget(entry);
+		}
+	}
+}
+
+/**
+ * \brief Adds the bundles, which were restored by the cold tier
+ */
+static void storage_tiered_restore(void)
+{
+	struct storage_entry_t * cold = NULL;
+
+	for(cold = STORAGE_TIERED_COLD.get_bundles();
+			cold != NULL;
+			cold = cold->next) {
+		struct tiered_list_entry_t * const entry = memb_alloc(&bundle_mem);
+		if( entry == NULL ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to allocate struct, cannot restore bundle %lu", cold->bundle_num);
+			break;
+		}
+
+		memset(entry, 0, sizeof(struct tiered_list_entry_t));
+		entry->bundle_num = cold->bundle_num;
+		entry->flags = STORAGE_TIERED_FLAGS_COLD;
+
+		/* The cold tier knows the expiration, the priority and the destination without reading the bundle */
+		if( !STORAGE_TIERED_COLD.describe_bundle(cold->bundle_num, &entry->eviction, &entry->dst_node) ) {
+			entry->eviction.received = storage_expiry_now();
+			entry->eviction.expiration = UINT32_MAX;
+		}
+
+		list_add(bundle_list, entry);
+		storage_index_add(&bundle_index, (struct storage_entry_t *) entry);
+		storage_expiry_add(&bundle_expiry, &entry->expiry, entry->eviction.expiration);
+		storage_eviction_add(&bundle_eviction, &entry->eviction);
+
+		bundles_in_storage++;
+		cold_bundles++;
+	}
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Restored %u bundles from the cold tier", bundles_in_storage);
+}
+
+static int storage_tiered_format(void)
+{
+	/* The hot bundles cannot be deleted from MMEM, so only format the cold tier */
+	return STORAGE_TIERED_COLD.format();
+}
+
+/**
+ * \brief Writes all hot bundles to the cold tier and waits until they are written
+ *
+ * The bundles are kept in MMEM, so they can still be sent without reading them.
+ */
+static void storage_tiered_flush(void)
+{
+	struct tiered_list_entry_t * entry = NULL;
+	uint32_t bundle_number = 0;
+
+	for(entry = list_head(bundle_list);
+			entry != NULL;
+			entry = list_item_next(entry)) {
+		if( (entry->flags & (STORAGE_TIERED_FLAGS_HOT | STORAGE_TIERED_FLAGS_COLD)) != STORAGE_TIERED_FLAGS_HOT ) {
+			continue;
+		}
+
+		bundle_increment(entry->bundle);
+		if( !STORAGE_TIERED_COLD.save_bundle(entry->bundle, &bundle_number) ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Could not flush bundle %lu", entry->bundle_num);
+			continue;
+		}
+
+		entry->flags |= STORAGE_TIERED_FLAGS_COLD;
+		cold_bundles++;
+		if( entry->flags & STORAGE_TIERED_FLAGS_LOCKED ) {
+			STORAGE_TIERED_COLD.lock_bundle(entry->bundle_num);
+		}
+	}
+
+	STORAGE_TIERED_COLD.flush();
+}
+
+/**
+ * \brief called by agent at startup
+ */
+static bool storage_tiered_init(void)
+{
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "storage_tiered init");
+
+	/* Only execute the initalisation before the scheduler was started.
+	 * So there exists only one thread and
+	 * no locking is needed for the initialisation
+	 */
+	configASSERT(xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED);
+
+	/* cancle, if initialisation was already done */
+	if(wait_for_changes_sem != NULL) {
+		return false;
+	}
+	wait_for_changes_sem = xSemaphoreCreateCounting(1, 0);
+	if(wait_for_changes_sem == NULL) {
+		return false;
+	}
+
+	// Initialize the bundle list
+	list_init(bundle_list);
+
+	// Initialize the bundle memory block
+	memb_init(&bundle_mem);
+
+	// Initialize the index of the bundle list
+	storage_index_init(&bundle_index);
+
+	// Initialize the queue of expiring bundles
+	storage_expiry_init(&bundle_expiry);
+
+	// Initialize the heap of deletable bundles
+	storage_eviction_init(&bundle_eviction);
+
+	// Initialize the heap of demotable bundles
+	storage_heap_init(&bundle_demotion);
+
+	bundles_in_storage = 0;
+	hot_bytes = 0;
+	cold_bundles = 0;
+
+	if( !STORAGE_TIERED_COLD.init() ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Initialising the cold tier %s failed", STORAGE_TIERED_COLD.name);
+		return false;
+	}
+
+	storage_tiered_restore();
+	storage_tiered_update_statistics();
+
+	// Set the timer to regularly prune expired bundles
+	const TimerHandle_t store_timer = xTimerCreate("tiered timer", pdMS_TO_TICKS(5000), pdTRUE, NULL, storage_tiered_prune);
+	if (store_timer == NULL) {
+		return false;
+	}
+
+	if ( !xTimerStart(store_timer, 0) ) {
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * \brief deletes expired bundles from storage
+ */
+static void storage_tiered_prune(const TimerHandle_t timer)
+{
+	struct storage_expiry_node_t * node = NULL;
+	const uint32_t now = storage_expiry_now();
+
+	// Drop the bundles, which the cold tier has deleted meanwhile
+	storage_tiered_reconcile();
+
+	// Delete expired bundles from storage, only these are taken from the queue
+	while( (node = storage_expiry_pop_expired(&bundle_expiry, now)) != NULL ) {
+		struct tiered_list_entry_t * const entry = storage_expiry_entry(node, struct tiered_list_entry_t, expiry);
+
+		LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "bundle lifetime expired of bundle %lu", entry->bundle_num);
+		if( !storage_tiered_delete_bundle(entry->bundle_num, REASON_LIFETIME_EXPIRED) ) {
+			// Locked bundles are tried again on the next run
+			storage_expiry_add(&bundle_expiry, node, now + 1);
+		}
+	}
+}
+
+/**
+ * \brief Sets the storage to its initial state
+ */
+static void storage_tiered_reinit(void)
+{
+	// Remove all bundles from storage
+	while(bundles_in_storage > 0) {
+		struct tiered_list_entry_t * entry = list_head(bundle_list);
+
+		if( entry == NULL ) {
+			// We do not have bundles in storage, stop deleting them
+			break;
+		}
+
+		if( !storage_tiered_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE) ) {
+			break;
+		}
+	}
+}
+
+/**
+ * \brief This function delete as many bundles from the storage as necessary to have at least one slot free
+ * \param bundlemem Pointer to the MMEM struct containing the bundle
+ * \return 1 on success, 0 if no room could be made free
+ */
+static uint8_t storage_tiered_make_room(struct mmem * bundlemem)
+{
+	/* Delete expired bundles first */
+	storage_tiered_prune(NULL);
+
+	/* If we do not have a pointer, we cannot compare - do nothing */
+	if( bundlemem == NULL ) {
+		return 0;
+	}
+
+	struct storage_eviction_node_t incoming;
+	struct storage_eviction_node_t * victim = NULL;
+
+	storage_eviction_describe(&incoming, bundlemem, storage_expiry_of_bundle(bundlemem));
+
+	/* Keep deleting bundles until we have enough slots */
+	while( bundles_in_storage >= BUNDLE_STORAGE_SIZE ) {
+		victim = storage_eviction_victim(&bundle_eviction, &incoming);
+		if( victim == NULL ) {
+			/* We do not have deletable bundles in storage, stop deleting them */
+			return 0;
+		}
+
+		/* Delete Bundle */
+		const struct tiered_list_entry_t * const entry = storage_eviction_entry(victim, struct tiered_list_entry_t, eviction);
+		if( !storage_tiered_delete_bundle(entry->bundle_num, REASON_DEPLETED_STORAGE) ) {
+			return 0;
+		}
+	}
+
+	/* At least one slot is free now */
+	return 1;
+}
+
+/**
+ * \brief saves a bundle in storage
+ *
+ * The bundle is kept in MMEM, colder bundles are demoted to make room for it.
+ * \param bundlemem pointer to the MMEM struct containing the bundle
+ * \param bundle_number_ptr The pointer to the bundle number will be stored here
+ * \return 1 on success, 0 otherwise
+ */
+static uint8_t storage_tiered_save_bundle(struct mmem* const bundlemem, uint32_t* const bundle_number_ptr)
+{
+	struct bundle_t * bundle = NULL;
+	struct tiered_list_entry_t * entry = NULL;
+
+	if( bundlemem == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "save_bundle with invalid pointer %p", bundlemem);
+		return 0;
+	}
+
+	// Get the pointer to our bundle
+	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+
+	if( bundle == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "save_bundle with invalid MMEM structure");
+		bundle_decrement(bundlemem);
+		return 0;
+	}
+
+	// Look for duplicates in the storage
+	entry = (struct tiered_list_entry_t *) storage_index_find(&bundle_index, bundle->bundle_num);
+	if( entry != NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "%lu is the same bundle", entry->bundle_num);
+		*bundle_number_ptr = entry->bundle_num;
+		bundle_decrement(bundlemem);
+		return 1;
+	}
+
+	if( !storage_tiered_make_room(bundlemem) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Cannot store bundle, no room");
+
+		/* Throw away bundle to not take up RAM */
+		bundle_decrement(bundlemem);
+
+		return 0;
+	}
+
+	/* The demoted bundles are freed, when the cold tier has written them.
+	 * Wait for the writes, if their memory is needed for the new bundle.
+	 */
+	if( storage_tiered_spill(bundle_get_size(bundlemem)) && mmem_avail_memory() < CONVERGENCE_LAYER_MAX_SIZE ) {
+		STORAGE_TIERED_COLD.flush();
+	}
+
+	/* Always keep at least the maximum size of a bundle free to allow the CL to
+	 * serialize bundles.
+	 */
+	if( mmem_avail_memory() < CONVERGENCE_LAYER_MAX_SIZE ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Cannot store bundle, memory below threshold");
+
+		bundle_decrement(bundlemem);
+
+		return 0;
+	}
+
+	// Now we have to update the pointer to our bundle, because MMEM may have been modified (freed) and thus the pointer may have changed
+	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+
+	entry = memb_alloc(&bundle_mem);
+	if( entry == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "unable to allocate struct, cannot store bundle");
+		bundle_decrement(bundlemem);
+		return 0;
+	}
+
+	// Clear the memory area
+	memset(entry, 0, sizeof(struct tiered_list_entry_t));
+
+	// Set all required fields
+	entry->bundle_num = bundle->bundle_num;
+	entry->dst_node = bundle->dst_node;
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "New Bundle %lu, Src %lu, Dest %lu, Seq %lu",
+		entry->bundle_num, bundle->src_node, bundle->dst_node, bundle->tstamp_seq);
+
+	// Add bundle to the list
+	list_add(bundle_list, entry);
+	storage_index_add(&bundle_index, (struct storage_entry_t *) entry);
+	storage_eviction_describe(&entry->eviction, bundlemem, storage_expiry_of_bundle(bundlemem));
+	storage_expiry_add(&bundle_expiry, &entry->expiry, entry->eviction.expiration);
+	storage_eviction_add(&bundle_eviction, &entry->eviction);
+
+	// we copy the reference to the bundle, therefore we have to increase the reference counter
+	storage_tiered_make_hot(entry, bundlemem);
+	bundles_in_storage++;
+
+#if BUNDLE_STORAGE_STATUS
+	printf("S %u\n", bundles_in_storage);
+#endif
+
+	// Notify the statistics module
+	storage_tiered_update_statistics();
+
+	// Now we have to (virtually) free the incoming bundle slot
+	// This should do nothing, as we have incremented the reference counter before
+	bundle_decrement(bundlemem);
+
+	// Now copy over the STATIC pointer to the bundle number, so that
+	// the caller can stick it into an event
+	*bundle_number_ptr = entry->bundle_num;
+
+	/* storage status has changed */
+	xSemaphoreGive(wait_for_changes_sem);
+
+	return 1;
+}
+
+/**
+ * \brief deletes a bundle from storage
+ * \param bundle_number bundle number to be deleted
+ * \param reason reason code
+ * \return 1 on success or 0 on error
+ */
+static uint8_t storage_tiered_delete_bundle(uint32_t bundle_number, uint8_t reason)
+{
+	struct tiered_list_entry_t * entry = NULL;
+
+	LOG(LOGD_DTN, LOG_STORE, LOGL_INF, "Deleting Bundle %lu with reason %u", bundle_number, reason);
+
+	// Look for the bundle we are talking about
+	entry = (struct tiered_list_entry_t *) storage_index_find(&bundle_index, bundle_number);
+
+	if( entry == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Could not find bundle %lu on storage_tiered_delete_bundle", bundle_number);
+		return 0;
+	}
+
+	if( entry->flags & STORAGE_TIERED_FLAGS_LOCKED ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Cannot delete locked bundle %lu", bundle_number);
+		return 0;
+	}
+
+	if( entry->flags & STORAGE_TIERED_FLAGS_COLD ) {
+		/* The cold tier sends the status report and notifies the agent */
+		if( !STORAGE_TIERED_COLD.del_bundle(bundle_number, reason) && storage_tiered_cold_exists(entry) ) {
+			LOG(LOGD_DTN, LOG_STORE, LOGL_ERR, "Cold tier could not delete bundle %lu", bundle_number);
+			return 0;
+		}
+
+		/* Otherwise the cold tier has deleted the bundle before */
+		if( entry->flags & STORAGE_TIERED_FLAGS_HOT ) {
+			storage_tiered_release(entry);
+		}
+	} else {
+		// Figure out the source to send status report
+		struct bundle_t * const bundle = (struct bundle_t *) MMEM_PTR(entry->bundle);
+		bundle->del_reason = reason;
+
+		if( reason != REASON_DELIVERED ) {
+			if( (bundle->flags & BUNDLE_FLAG_CUST_REQ ) || (bundle->flags & BUNDLE_FLAG_REP_DELETE) ){
+				if (bundle->src_node != dtn_node_id){
+					STATUSREPORT.send(entry->bundle, 16, bundle->del_reason);
+				}
+			}
+		}
+
+		// Notified the agent, that a bundle has been deleted
+		agent_delete_bundle(bundle_number);
+
+		storage_tiered_release(entry);
+	}
+
+	storage_tiered_remove(entry);
+
+	return 1;
+}
+
+/**
+ * \brief reads a bundle from storage
+ *
+ * A cold bundle is promoted into MMEM, if the hot bundles stay below the watermark.
+ * \param bundle_number bundle number to read
+ * \return pointer to the MMEM struct, NULL on error
+ */
+static struct mmem * storage_tiered_read_bundle(uint32_t bundle_number)
+{
+	struct tiered_list_entry_t * entry = NULL;
+	struct mmem * bundlemem = NULL;
+
+	// Look for the bundle we are talking about
+	entry = (struct tiered_list_entry_t *) storage_index_find(&bundle_index, bundle_number);
+
+	if( entry == NULL ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Could not find bundle %lu in storage_tiered_read_bundle", bundle_number);
+		return NULL;
+	}
+
+	if( entry->flags & STORAGE_TIERED_FLAGS_HOT ) {
+		storage_tiered_touch(entry);
+
+		// Someone requested the bundle, he will have to decrease the reference counter again
+		bundle_increment(entry->bundle);
+		return entry->bundle;
+	}
+
+	bundlemem = STORAGE_TIERED_COLD.read_bundle(bundle_number);
+	if( bundlemem == NULL ) {
+		if( !storage_tiered_cold_exists(entry) ) {
+			storage_tiered_forget(entry);
+		}
+		return NULL;
+	}
+
+	if( hot_bytes + bundle_get_size(bundlemem) <= STORAGE_TIERED_HOT_BYTES ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_DBG, "Promoted bundle %lu", bundle_number);
+		storage_tiered_make_hot(entry, bundlemem);
+	}
+
+	return bundlemem;
+}
+
+/**
+ * \brief checks if there is space for a bundle
+ * \param bundlemem pointer to a bundle struct (not used here)
+ * \return number of free slots
+ */
+static uint16_t storage_tiered_get_free_space(struct mmem * bundlemem)
+{
+	return BUNDLE_STORAGE_SIZE - bundles_in_storage;
+}
+
+/**
+ * \brief Get the number of slots available in storage
+ * \returns the number of free slots
+ */
+static uint16_t storage_tiered_get_bundle_numbers(void)
+{
+	return bundles_in_storage;
+}
+
+/**
+ * \brief Get the bundle list
+ * \returns pointer to first bundle list entry
+ */
+static struct storage_entry_t * storage_tiered_get_bundles(void)
+{
+	return (struct storage_entry_t *) list_head(bundle_list);
+}
+
+/**
+ * \brief Get the next bundle, which matches a query
+ *
+ * The query is answered from the entries of this layer, so cold bundles are not read.
+ *
+ * \param query the query
+ * \param previous entry returned by the last call or NULL to start with the first bundle
+ * \returns pointer to the bundle list entry or NULL if no more bundles match
+ */
+static struct storage_entry_t * storage_tiered_query_bundles(const struct storage_query_t * const query, const struct storage_entry_t * const previous)
+{
+	struct tiered_list_entry_t * entry = NULL;
+
+	if( previous == NULL ) {
+		entry = list_head(bundle_list);
+	} else {
+		entry = list_item_next((void *) previous);
+	}
+
+	for( ; entry != NULL; entry = list_item_next(entry) ) {
+		if( storage_query_match(query, &entry->eviction, entry->dst_node, entry->flags & STORAGE_TIERED_FLAGS_LOCKED) ) {
+			return (struct storage_entry_t *) entry;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Get the metadata of a bundle without reading it
+ * \param bundle_num Bundle number
+ * \param eviction returns the priority class, the time of reception and the expiration
+ * \param dst_node returns the destination node
+ * \return 1 on success or 0 if the bundle is not stored
+ */
+static uint8_t storage_tiered_describe_bundle(uint32_t bundle_num, struct storage_eviction_node_t * const eviction, uint32_t * const dst_node)
+{
+	const struct tiered_list_entry_t * entry = NULL;
+
+	// Look for the bundle we are talking about
+	entry = (struct tiered_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
+
+	if( entry == NULL ) {
+		return 0;
+	}
+
+	storage_eviction_copy(eviction, &entry->eviction);
+	*dst_node = entry->dst_node;
+
+	return 1;
+}
+
+static void storage_tiered_wait_for_changes(void)
+{
+	if ( !xSemaphoreTake(wait_for_changes_sem, portMAX_DELAY) ) {
+		LOG(LOGD_DTN, LOG_STORE, LOGL_WRN, "Wait for changes failed");
+	}
+}
+
+/**
+ * \brief Mark a bundle as locked so that it will not be deleted even if we are running out of space
+ *
+ * Locked bundles are not demoted either.
+ * \param bundle_num Bundle number
+ * \return 1 on success or 0 on error
+ */
+static uint8_t storage_tiered_lock_bundle(uint32_t bundle_num)
+{
+	struct tiered_list_entry_t * entry = NULL;
+
+	// Look for the bundle we are talking about
+	entry = (struct tiered_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
+
+	if( entry == NULL ) {
+		return 0;
+	}
+
+	entry->flags |= STORAGE_TIERED_FLAGS_LOCKED;
+
+	// Never delete locked bundles
+	storage_eviction_remove(&bundle_eviction, &entry->eviction);
+	storage_heap_remove(&bundle_demotion, &entry->demotion);
+
+	// The cold tier must not delete it on its own either
+	if( entry->flags & STORAGE_TIERED_FLAGS_COLD ) {
+		STORAGE_TIERED_COLD.lock_bundle(bundle_num);
+	}
+
+	return 1;
+}
+
+/**
+ * \brief Mark a bundle as unlocked after being locked previously
+ */
+static void storage_tiered_unlock_bundle(uint32_t bundle_num)
+{
+	struct tiered_list_entry_t * entry = NULL;
+
+	// Look for the bundle we are talking about
+	entry = (struct tiered_list_entry_t *) storage_index_find(&bundle_index, bundle_num);
+
+	if( entry == NULL ) {
+		return;
+	}
+
+	entry->flags &= ~STORAGE_TIERED_FLAGS_LOCKED;
+
+	storage_eviction_add(&bundle_eviction, &entry->eviction);
+
+	if( entry->flags & STORAGE_TIERED_FLAGS_HOT ) {
+		storage_tiered_touch(entry);
+	}
+
+	if( entry->flags & STORAGE_TIERED_FLAGS_COLD ) {
+		STORAGE_TIERED_COLD.unlock_bundle(bundle_num);
+	}
+}
+
+
+const struct storage_driver storage_tiered = {
+	"STORAGE_TIERED",
+	storage_tiered_init,
+	storage_tiered_reinit,
+	storage_tiered_save_bundle,
+	storage_tiered_delete_bundle,
+	storage_tiered_read_bundle,
+	storage_tiered_lock_bundle,
+	storage_tiered_unlock_bundle,
+	storage_tiered_get_free_space,
+	storage_tiered_get_bundle_numbers,
+	storage_tiered_get_bundles,
+	storage_tiered_query_bundles,
+	storage_tiered_describe_bundle,
+	storage_tiered_wait_for_changes,
+	storage_tiered_format,
+	storage_tiered_flush,
+	storage_tiered_save_bundle,
+};
+
+/** @} */
+/** @} */
@@ -227,6 +227,9 @@ static void test_process(void* p)
 		}
 	}
 
+	/* Wait until all bundles are written to the SD card */
+	BUNDLE_STORAGE.flush();
+
 	printf("Reinitialize storage\n");
 	/* Reinitialize the storage and see, if the bundles persist */
 	BUNDLE_STORAGE.init();
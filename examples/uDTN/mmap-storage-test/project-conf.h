@@ -0,0 +1,11 @@
+#ifndef __PROJECT_CONF_H__
+#define __PROJECT_CONF_H__
+
+// Keep the file small, so that the test fills it up
+#define STORAGE_MMAP_CONF_FILE "mmap-storage-test.mmap"
+#define STORAGE_MMAP_CONF_SIZE 65536UL
+
+// Keep fewer views than bundles are read
+#define STORAGE_MMAP_CONF_VIEWS 2
+
+#endif /* __PROJECT_CONF_H__ */
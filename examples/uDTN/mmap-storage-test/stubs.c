@@ -0,0 +1,66 @@
+/**
+ * \file
+ *         Stubs of FreeRTOS and of the uDTN modules, which are not linked into the host test
+ *
+ * The test runs in a single thread, so taking a semaphore always succeeds
+ * and the timers never fire.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "timers.h"
+
+#include "lib/mmem.h"
+#include "system_clock.h"
+#include "statusreport.h"
+
+uint32_t dtn_node_id = 1;
+
+/** Number of bundles, which the storage has reported as deleted */
+uint32_t deleted_bundles = 0;
+
+/** Uptime in seconds, the test can advance it */
+uint32_t uptime_seconds = 1000;
+
+static int dummy;
+
+void agent_delete_bundle(uint32_t bundle_number)
+{
+	deleted_bundles++;
+}
+
+uint8_t bundle_ageing_encode_age_extension_block(struct mmem *bundlemem, uint8_t *buffer, int max_len) { return 0; }
+uint8_t bundle_ageing_encoded_length(struct mmem *bundlemem) { return 0; }
+uint32_t bundle_ageing_get_age(struct mmem * bundlemem) { return 0; }
+uint8_t bundle_ageing_parse_age_extension_block(struct mmem *bundlemem, uint8_t type, uint32_t flags, uint8_t *buffer, int length) { return 0; }
+
+QueueHandle_t dtn_process_get_event_queue() { return (QueueHandle_t) &dummy; }
+void print_stack_trace_part(const size_t count) {}
+void statistics_storage_bundles(uint8_t bundles) {}
+void statistics_storage_memory(uint16_t free) {}
+
+static uint8_t statusreport_stub_send(struct mmem *bundlemem, uint8_t status, uint8_t reason) { return 1; }
+const struct status_report_driver statusreport_basic = { "stub", statusreport_stub_send };
+
+void udtn_uptime(udtn_timeval_t *tv)
+{
+	tv->tv_sec = uptime_seconds;
+	tv->tv_usec = 0;
+}
+
+QueueHandle_t xQueueCreateCountingSemaphore(const UBaseType_t max, const UBaseType_t initial) { return (QueueHandle_t) &dummy; }
+QueueHandle_t xQueueCreateMutex(const uint8_t type) { return (QueueHandle_t) &dummy; }
+BaseType_t xQueueGenericReceive(QueueHandle_t queue, void * const buffer, TickType_t wait, const BaseType_t peek) { return pdTRUE; }
+BaseType_t xQueueGenericSend(QueueHandle_t queue, const void * const item, TickType_t wait, const BaseType_t position) { return pdTRUE; }
+void* xQueueGetMutexHolder(QueueHandle_t semaphore) { return NULL; }
+BaseType_t xQueueTakeMutexRecursive(QueueHandle_t mutex, TickType_t wait) { return pdTRUE; }
+BaseType_t xQueueGiveMutexRecursive(QueueHandle_t mutex) { return pdTRUE; }
+BaseType_t xTaskGetSchedulerState(void) { return taskSCHEDULER_NOT_STARTED; }
+TickType_t xTaskGetTickCount(void) { return 0; }
+TimerHandle_t xTimerCreate(const char * const name, const TickType_t period, const UBaseType_t reload, void * const id, TimerCallbackFunction_t callback) { return (TimerHandle_t) &dummy; }
+BaseType_t xTimerGenericCommand(TimerHandle_t timer, const BaseType_t command, const TickType_t value, BaseType_t * const woken, const TickType_t wait) { return pdPASS; }
@@ -0,0 +1,245 @@
+/**
+ * \file
+ *         Host test of the storage in a memory mapped file
+ *
+ * Run it with "fresh" first, it creates a new file and leaves three bundles
+ * in it. Run it with "rescan" afterwards, it restores these bundles from the file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lib/mmem.h"
+
+#include "bundle.h"
+#include "storage.h"
+#include "storage_eviction.h"
+
+extern const struct storage_driver storage_mmap;
+extern uint32_t deleted_bundles;
+
+static int errors = 0;
+
+#define CHECK(c) do { \
+		if( !(c) ) { \
+			printf("FAIL %s:%d %s\n", __FILE__, __LINE__, #c); \
+			errors++; \
+		} \
+	} while(0)
+
+/** Bundles of the last run, which are left in the file for the rescan */
+#define FIRST_KEPT		(200 + BUNDLE_STORAGE_SIZE - 3)
+#define LAST_KEPT		(200 + BUNDLE_STORAGE_SIZE - 1)
+
+static int payload_length(const uint32_t num)
+{
+	return 100 + (num * 97) % 900;
+}
+
+static uint8_t payload_byte(const uint32_t num, const int i)
+{
+	return (uint8_t) (num * 31 + i);
+}
+
+static void save(const uint32_t num)
+{
+	struct mmem * bundlemem = NULL;
+	struct bundle_t * bundle = NULL;
+	uint8_t data[1000];
+	uint32_t bundle_number = 0;
+	int i;
+
+	bundlemem = bundle_create_bundle();
+	CHECK(bundlemem != NULL);
+	if( bundlemem == NULL ) {
+		return;
+	}
+
+	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	bundle->bundle_num = num;
+	bundle->dst_node = 7;
+	bundle->lifetime = 3600 + num;
+
+	for(i=0; i<payload_length(num); i++) {
+		data[i] = payload_byte(num, i);
+	}
+	CHECK(bundle_add_block(bundlemem, BUNDLE_BLOCK_TYPE_PAYLOAD, 0, data, payload_length(num)) == payload_length(num));
+
+	CHECK(storage_mmap.save_bundle(bundlemem, &bundle_number));
+	CHECK(bundle_number == num);
+}
+
+static int verify(struct mmem * const bundlemem, const uint32_t num)
+{
+	const struct bundle_t * bundle = NULL;
+	const struct bundle_block_t * block = NULL;
+	int i;
+
+	if( bundlemem == NULL ) {
+		return 0;
+	}
+
+	bundle = (struct bundle_t *) MMEM_PTR(bundlemem);
+	if( bundle->bundle_num != num || bundle->num_blocks != 1 ) {
+		return 0;
+	}
+
+	block = bundle_get_payload_block(bundlemem);
+	if( block == NULL || block->block_size != payload_length(num) ) {
+		return 0;
+	}
+
+	for(i=0; i<block->block_size; i++) {
+		if( block->payload[i] != payload_byte(num, i) ) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int verify_read(const uint32_t num)
+{
+	struct mmem * const bundlemem = storage_mmap.read_bundle(num);
+	const int ok = verify(bundlemem, num);
+
+	if( bundlemem != NULL ) {
+		bundle_decrement(bundlemem);
+	}
+
+	return ok;
+}
+
+static void test_fresh(void)
+{
+	struct storage_eviction_node_t eviction;
+	struct mmem * held = NULL;
+	uint32_t dst_node = 0;
+	uint32_t n;
+	int r;
+
+	CHECK(storage_mmap.get_bundle_num() == 0);
+	for(n=1; n<=8; n++) {
+		save(n);
+	}
+	CHECK(storage_mmap.get_bundle_num() == 8);
+
+	// A duplicate is not stored again
+	save(3);
+	CHECK(storage_mmap.get_bundle_num() == 8);
+
+	// Read every bundle twice, more bundles than views are kept
+	for(r=0; r<2; r++) {
+		for(n=1; n<=8; n++) {
+			CHECK(verify_read(n));
+		}
+	}
+	CHECK(storage_mmap.read_bundle(99) == NULL);
+
+	// Delete a bundle, which is still being read
+	held = storage_mmap.read_bundle(2);
+	CHECK(verify(held, 2));
+	CHECK(storage_mmap.del_bundle(2, REASON_DELIVERED));
+	CHECK(storage_mmap.read_bundle(2) == NULL);
+	CHECK(storage_mmap.get_bundle_num() == 7);
+
+	// The deleted bundle still takes a slot and cannot be formatted away
+	CHECK(storage_mmap.free_space(NULL) == BUNDLE_STORAGE_SIZE - 8);
+	CHECK(storage_mmap.format() < 0);
+	CHECK(verify(held, 2));
+
+	// New bundles must not overwrite the held one
+	for(n=20; n<=21; n++) {
+		save(n);
+	}
+	CHECK(verify(held, 2));
+
+	// Fill all slots, the held bundle cannot be evicted
+	for(n=40; n<40+BUNDLE_STORAGE_SIZE; n++) {
+		save(n);
+	}
+	CHECK(storage_mmap.get_bundle_num() == BUNDLE_STORAGE_SIZE - 1);
+	CHECK(verify(held, 2));
+	bundle_decrement(held);
+
+	// Metadata without reading
+	CHECK(storage_mmap.describe_bundle(45, &eviction, &dst_node) && dst_node == 7 && eviction.expiration > eviction.received);
+	CHECK(!storage_mmap.describe_bundle(2, &eviction, &dst_node));
+
+	// The slot of the released bundle can be used again, bundles expiring earlier are evicted
+	for(n=200; n<200+BUNDLE_STORAGE_SIZE; n++) {
+		save(n);
+	}
+	CHECK(storage_mmap.get_bundle_num() == BUNDLE_STORAGE_SIZE);
+	for(n=200; n<200+BUNDLE_STORAGE_SIZE; n++) {
+		CHECK(verify_read(n));
+	}
+
+	// Delete all but three, these have to be found by the rescan
+	for(n=200; n<FIRST_KEPT; n++) {
+		CHECK(storage_mmap.del_bundle(n, REASON_DELIVERED));
+	}
+	CHECK(storage_mmap.get_bundle_num() == 3);
+	storage_mmap.flush();
+}
+
+static void test_rescan(const size_t mem_start)
+{
+	struct mmem * held = NULL;
+	uint32_t n;
+
+	CHECK(storage_mmap.get_bundle_num() == 3);
+	for(n=FIRST_KEPT; n<=LAST_KEPT; n++) {
+		CHECK(verify_read(n));
+	}
+	CHECK(storage_mmap.read_bundle(200) == NULL);
+
+	// The granules of the restored bundles are not reused
+	for(n=300; n<304; n++) {
+		save(n);
+	}
+	for(n=FIRST_KEPT; n<=LAST_KEPT; n++) {
+		CHECK(verify_read(n));
+	}
+	for(n=300; n<304; n++) {
+		CHECK(verify_read(n));
+	}
+	CHECK(storage_mmap.get_bundle_num() == 7);
+
+	// Reinit deletes the bundles instead of formatting, while one is being read
+	held = storage_mmap.read_bundle(301);
+	storage_mmap.reinit();
+	CHECK(storage_mmap.get_bundle_num() == 0);
+	CHECK(verify(held, 301));
+	bundle_decrement(held);
+
+	storage_mmap.reinit();
+	CHECK(storage_mmap.get_bundle_num() == 0);
+	CHECK(storage_mmap.free_space(NULL) == BUNDLE_STORAGE_SIZE);
+	CHECK(mmem_avail_memory() == mem_start);
+}
+
+int main(int argc, char ** argv)
+{
+	const int fresh = argc > 1 && strcmp(argv[1], "fresh") == 0;
+
+	if( fresh ) {
+		unlink(STORAGE_MMAP_CONF_FILE);
+	}
+
+	mmem_init();
+	bundle_init();
+	CHECK(storage_mmap.init());
+
+	if( fresh ) {
+		test_fresh();
+	} else {
+		test_rescan(mmem_avail_memory());
+	}
+
+	printf("%s: %d errors, %lu bundles deleted\n", fresh ? "fresh" : "rescan", errors, (unsigned long) deleted_bundles);
+
+	return errors != 0;
+}
@@ -0,0 +1,5 @@
+#ifndef __PROJECT_CONF_H__
+#define __PROJECT_CONF_H__
+
+
+#endif /* __PROJECT_CONF_H__ */
@@ -0,0 +1,173 @@
+/**
+ * \file
+ *         Replays a synthetic MMEM alloc/free trace and measures the time
+ *         spent in the allocator.
+ *
+ *         The trace is hand-written. It models the allocations of a node
+ *         forwarding bundles with the dgram convergence layer and
+ *         storage_mmem, but it is not a capture from a real node. Build
+ *         once with MMEM_CONF_SLAB=0 and once with MMEM_CONF_SLAB=1 to
+ *         compare the compacting heap with the slab allocator.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "lib/mmem.h"
+
+#include "dtn_process.h"
+
+#define DEBUG 1
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+/* Number of times the trace is replayed */
+#define BENCHMARK_ROUNDS 1000
+
+/* Number of concurrently used slots in the trace */
+#define TRACE_SLOTS 8
+
+/* Number of interleaved copies of the trace,
+ * so blocks are not always freed in allocation order
+ */
+#define TRACE_COPIES 3
+
+#define OP_ALLOC	1
+#define OP_REALLOC	2
+#define OP_FREE		3
+
+struct trace_op_t {
+	uint8_t op;
+	uint8_t slot;
+	uint16_t size;
+};
+
+/* Synthetic trace of one bundle being received, stored and forwarded */
+static const struct trace_op_t trace[] = {
+	/* reassembly buffer of the incoming bundle */
+	{OP_ALLOC,   0, 116},
+	{OP_REALLOC, 0, 232},
+	{OP_REALLOC, 0, 348},
+	/* bundle_recover_bundle() */
+	{OP_ALLOC,   1, 84},
+	{OP_REALLOC, 1, 96},
+	{OP_REALLOC, 1, 396},
+	{OP_FREE,    0, 0},
+	/* ACK ticket buffer */
+	{OP_ALLOC,   2, 8},
+	/* routing entry */
+	{OP_ALLOC,   3, 39},
+	{OP_FREE,    2, 0},
+	/* storage read for the report */
+	{OP_ALLOC,   4, 84},
+	{OP_REALLOC, 4, 396},
+	{OP_FREE,    4, 0},
+	/* convergence_layer_dgram_encode_bundle() */
+	{OP_ALLOC,   5, 396},
+	{OP_REALLOC, 5, 341},
+	/* segment buffers */
+	{OP_ALLOC,   6, 116},
+	{OP_FREE,    6, 0},
+	{OP_ALLOC,   6, 116},
+	{OP_FREE,    6, 0},
+	{OP_ALLOC,   6, 109},
+	{OP_FREE,    6, 0},
+	{OP_FREE,    5, 0},
+	/* status report bundle */
+	{OP_ALLOC,   7, 84},
+	{OP_REALLOC, 7, 112},
+	{OP_FREE,    7, 0},
+	/* bundle deleted after being forwarded */
+	{OP_FREE,    3, 0},
+	{OP_FREE,    1, 0},
+};
+
+#define TRACE_LENGTH (sizeof(trace) / sizeof(trace[0]))
+
+static struct mmem slots[TRACE_COPIES][TRACE_SLOTS];
+
+/**
+ * \brief Replay the trace once
+ * \return number of failed allocations
+ */
+static int replay(void)
+{
+	int failed = 0;
+
+	/* Start the copies with an offset, so that their operations overlap */
+	for (int i = 0; i < TRACE_LENGTH + (TRACE_COPIES - 1) * (TRACE_LENGTH / TRACE_COPIES); i++) {
+		for (int c = 0; c < TRACE_COPIES; c++) {
+			const int j = i - c * (TRACE_LENGTH / TRACE_COPIES);
+			if (j < 0 || j >= TRACE_LENGTH) {
+				continue;
+			}
+
+			struct mmem * const m = &slots[c][trace[j].slot];
+			switch (trace[j].op) {
+			case OP_ALLOC:
+				if (mmem_alloc(m, trace[j].size) <= 0) {
+					failed++;
+					m->ptr = NULL;
+				}
+				break;
+
+			case OP_REALLOC:
+				if (m->ptr != NULL && !mmem_realloc(m, trace[j].size)) {
+					failed++;
+				}
+				break;
+
+			case OP_FREE:
+				if (m->ptr != NULL) {
+					mmem_free(m);
+					m->ptr = NULL;
+				}
+				break;
+			}
+		}
+	}
+
+	return failed;
+}
+
+static void benchmark_process(void* p)
+{
+	int failed = 0;
+
+	/* Let the stack settle, so we do not compete for the allocator */
+	vTaskDelay(pdMS_TO_TICKS(1000));
+
+	const size_t avail_before = mmem_avail_memory();
+
+	PRINTF("Replaying %u operations %u times\n", TRACE_LENGTH * TRACE_COPIES, BENCHMARK_ROUNDS);
+
+	const TickType_t start = xTaskGetTickCount();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		failed += replay();
+	}
+	const TickType_t duration = xTaskGetTickCount() - start;
+
+	printf("MMEM benchmark: %lu ms, %d failed, %u bytes leaked\n",
+		   (unsigned long) (duration * portTICK_PERIOD_MS), failed, avail_before - mmem_avail_memory());
+
+	vTaskDelete(NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool init()
+{
+	if ( !dtn_process_create_other_stack(benchmark_process, "MMEM benchmark", configMINIMAL_STACK_SIZE * 2) ) {
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,177 @@
+/**
+ * \file
+ *         Tests the DMA driven SD card transfers of the FatFS disk driver.
+ *
+ *         Files are written and read with multi-sector requests from
+ *         word aligned buffers, which are transferred directly, and from
+ *         unaligned buffers, which go through the bounce buffer of the
+ *         disk driver. A second task counts, while the card is busy, to
+ *         show that the other tasks keep running.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "ff.h"
+
+#include "dtn_process.h"
+
+#define DEBUG 1
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+/* Number of times each file is written and read */
+#define TEST_ROUNDS 20
+
+/* Covers several multi-block requests and more than one bounce buffer chunk */
+#define FILE_SIZE (16 * 512)
+
+static const char filename[] = "sddma.bin";
+
+/* One additional word, so that the data can start at an unaligned address */
+static uint32_t write_buffer[FILE_SIZE / 4 + 1];
+static uint32_t read_buffer[FILE_SIZE / 4 + 1];
+
+static volatile uint32_t idle_counter = 0;
+
+static void counter_process(void* p)
+{
+	while (true) {
+		idle_counter++;
+		vTaskDelay(1);
+	}
+}
+
+static bool write_file(const uint8_t* data)
+{
+	FIL fd;
+	UINT bytes_written = 0;
+
+	if (f_open(&fd, filename, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+		printf("Unable to open file %s for writing\n", filename);
+		return false;
+	}
+
+	const FRESULT res = f_write(&fd, data, FILE_SIZE, &bytes_written);
+	f_close(&fd);
+
+	if (res != FR_OK || bytes_written != FILE_SIZE) {
+		printf("Unable to write %u bytes to file %s (err %u, written %u)\n",
+			   FILE_SIZE, filename, res, bytes_written);
+		return false;
+	}
+
+	return true;
+}
+
+static bool read_file(uint8_t* data)
+{
+	FIL fd;
+	UINT bytes_read = 0;
+
+	if (f_open(&fd, filename, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+		printf("Unable to open file %s for reading\n", filename);
+		return false;
+	}
+
+	const FRESULT res = f_read(&fd, data, FILE_SIZE, &bytes_read);
+	f_close(&fd);
+
+	if (res != FR_OK || bytes_read != FILE_SIZE) {
+		printf("Unable to read %u bytes from file %s (err %u, read %u)\n",
+			   FILE_SIZE, filename, res, bytes_read);
+		return false;
+	}
+
+	return true;
+}
+
+static bool test_transfer(const size_t write_offset, const size_t read_offset)
+{
+	uint8_t* const data = (uint8_t*)write_buffer + write_offset;
+	uint8_t* const read_data = (uint8_t*)read_buffer + read_offset;
+
+	for (int round = 0; round < TEST_ROUNDS; round++) {
+		for (int i = 0; i < FILE_SIZE; i++) {
+			data[i] = (i + round) & 0xFF;
+		}
+		memset(read_data, 0, FILE_SIZE);
+
+		if (!write_file(data) || !read_file(read_data)) {
+			return false;
+		}
+
+		if (memcmp(data, read_data, FILE_SIZE) != 0) {
+			printf("File content differs (write offset %u, read offset %u, round %u)\n",
+				   write_offset, read_offset, round);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void test_process(void* p)
+{
+	/* offsets of the write and the read buffer from a word boundary */
+	static const size_t offsets[][2] = {
+		{0, 0},
+		{1, 0},
+		{0, 1},
+		{2, 3},
+	};
+	bool passed = true;
+
+	/* Let the stack settle */
+	vTaskDelay(pdMS_TO_TICKS(1000));
+
+	for (int i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+		const uint32_t counter_start = idle_counter;
+		const TickType_t start = xTaskGetTickCount();
+
+		if (!test_transfer(offsets[i][0], offsets[i][1])) {
+			passed = false;
+			continue;
+		}
+
+		const TickType_t duration = xTaskGetTickCount() - start;
+		const uint32_t counted = idle_counter - counter_start;
+
+		PRINTF("SD DMA test: write offset %u, read offset %u: %lu ms for %u KB, counter task ran %lu times\n",
+			   offsets[i][0], offsets[i][1], (unsigned long) (duration * portTICK_PERIOD_MS),
+			   2 * TEST_ROUNDS * FILE_SIZE / 1024, (unsigned long) counted);
+
+		if (counted == 0) {
+			printf("SD DMA test: counter task starved while accessing the SD card\n");
+			passed = false;
+		}
+	}
+
+	f_unlink(filename);
+
+	printf("SD DMA test %s\n", passed ? "passed" : "failed");
+
+	vTaskDelete(NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool init()
+{
+	if ( !dtn_process_create_other_stack(counter_process, "SD DMA counter", configMINIMAL_STACK_SIZE) ) {
+		return false;
+	}
+
+	if ( !dtn_process_create_other_stack(test_process, "SD DMA test", configFATFS_STACK_SIZE) ) {
+		return false;
+	}
+
+	return true;
+}
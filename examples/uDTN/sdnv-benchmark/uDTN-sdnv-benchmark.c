@@ -0,0 +1,336 @@
+/**
+ * \file
+ *         Compares the SDNV codec with the previous loop based
+ *         implementation.
+ *
+ *         The values follow the distribution of the primary block
+ *         fields of bundles sent by our nodes: small node and service
+ *         numbers, a DTN timestamp, a sequence number and a lifetime.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "lib/logging.h"
+
+#include "agent.h"
+#include "sdnv.h"
+#include "dtn_process.h"
+
+#define DEBUG 1
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+/* Number of times all fields are encoded and decoded */
+#define BENCHMARK_ROUNDS 2000
+
+/* Number of primary blocks in the test set */
+#define BLOCKS 16
+
+/* Fields of the primary block following the block length */
+#define FIELDS 12
+
+/* Largest encoded primary block */
+#define BLOCK_LENGTH (FIELDS * 10)
+
+/*---------------------------------------------------------------------------*/
+/* Previous implementation, kept as reference */
+
+static size_t reference_len(const uint8_t* bp)
+{
+	size_t val_len = 1;
+	for ( ; *bp++ & 0x80; ++val_len )
+		;
+	return val_len;
+}
+
+static int reference_encode_long(uint64_t val, uint8_t* bp, size_t len)
+{
+	size_t val_len = 0;
+	uint64_t tmp = val;
+
+	do {
+		tmp = tmp >> 7;
+		val_len++;
+	} while (tmp != 0);
+
+
+	if (len < val_len) {
+		return -1;
+	}
+
+	bp += val_len;
+	uint8_t high_bit = 0; // for the last octet
+	do {
+		--bp;
+		*bp = (uint8_t)(high_bit | (val & 0x7f));
+		high_bit = (1 << 7); // for all but the last octet
+		val = val >> 7;
+	} while (val != 0);
+
+	return val_len;
+}
+
+static int reference_decode(const uint8_t* bp, size_t len, uint32_t* val)
+{
+	configASSERT(IS_RAM(bp) && IS_RAM(val));
+
+	LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "sdnv_decode(in %p, len %lu, out %p)", bp, len, val);
+	const uint8_t* start = bp;
+	if (!val) {
+		LOG(LOGD_DTN, LOG_SDNV, LOGL_ERR, "SDNV: NULL pointer");
+		return -1;
+	}
+
+	size_t val_len = 0;
+	*val = 0;
+	do {
+		LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "SDNV: len: %u", len);
+		if (len == 0){
+			LOG(LOGD_DTN, LOG_SDNV, LOGL_ERR, "SDNV: buffer too short");
+			return reference_len(start); // buffer too short
+		}
+		*val = (*val << 7) | (*bp & 0x7f);
+		++val_len;
+
+		if ((*bp & (1 << 7)) == 0){
+			break; // all done;
+		}
+
+		++bp;
+		--len;
+	} while (1);
+
+	if ((val_len > 5) || ((val_len == 5) && (*start > 0x8F))){
+		LOG(LOGD_DTN, LOG_SDNV, LOGL_ERR, "SDNV: val_len >= 5");
+		*val = 0;
+		return reference_len(start);
+	}
+
+	LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "SDNV: val: %lu", *val);
+	return val_len;
+}
+
+static int reference_decode_long(const uint8_t* bp, size_t len, uint64_t* val)
+{
+	const uint8_t* start = bp;
+	size_t val_len = 0;
+	*val = 0;
+
+	LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "sdnv_decode");
+
+	do {
+		LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "SDNV: len: %u", len);
+		if (len == 0){
+			LOG(LOGD_DTN, LOG_SDNV, LOGL_ERR, "SDNV: buffer too short");
+			return reference_len(start); // buffer too short
+		}
+		*val = (*val << 7) | (*bp & 0x7f);
+		++val_len;
+
+		if ((*bp & (1 << 7)) == 0){
+			break; // all done;
+		}
+
+		++bp;
+		--len;
+	} while (1);
+
+	if ((val_len > 10) || ((val_len == 10) && (*start > 0x81))){
+		LOG(LOGD_DTN, LOG_SDNV, LOGL_ERR, "SDNV: val_len >= 10");
+		*val = 0;
+		return reference_len(start);
+	}
+
+	LOG(LOGD_DTN, LOG_SDNV, LOGL_DBG, "SDNV: val: %lu", *val);
+	return val_len;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Service numbers and the timestamp are 64 bit fields */
+static const bool field_is_long[FIELDS] = {
+	false, true, false, true, false, false, false, false, true, false, false, false
+};
+
+static uint64_t values[BLOCKS][FIELDS];
+static uint8_t encoded[BLOCKS][BLOCK_LENGTH];
+static size_t encoded_length[BLOCKS];
+
+/**
+ * \brief Fill the test set with a realistic distribution of field values
+ */
+static void generate_values(void)
+{
+	for (int b = 0; b < BLOCKS; b++) {
+		/* destination, source, report-to and custodian */
+		values[b][0] = 1 + rand() % 200;
+		values[b][1] = (b % 4 == 0) ? 2049 + rand() % 100 : 5 + rand() % 20;
+		values[b][2] = 1 + rand() % 200;
+		values[b][3] = 5 + rand() % 20;
+		values[b][4] = (b % 2) ? values[b][2] : 0;
+		values[b][5] = 0;
+		values[b][6] = 0;
+		values[b][7] = 0;
+		/* seconds since 2000-01-01, sequence number and lifetime */
+		values[b][8] = 530000000 + rand() % 1000000;
+		values[b][9] = rand() % 20000;
+		values[b][10] = (b % 3 == 0) ? 86400 : 3600;
+		/* dictionary length */
+		values[b][11] = 0;
+	}
+}
+
+static uint32_t benchmark_encode(int (*encode)(uint64_t, uint8_t*, size_t))
+{
+	uint32_t check = 0;
+
+	for (int b = 0; b < BLOCKS; b++) {
+		size_t offs = 0;
+		for (int f = 0; f < FIELDS; f++) {
+			offs += encode(values[b][f], &encoded[b][offs], BLOCK_LENGTH - offs);
+		}
+		encoded_length[b] = offs;
+		check += offs;
+	}
+
+	return check;
+}
+
+static int encode_long(uint64_t val, uint8_t* bp, size_t len)
+{
+	return sdnv_encode_long(val, bp, len);
+}
+
+static uint64_t benchmark_decode_reference(void)
+{
+	uint64_t check = 0;
+
+	for (int b = 0; b < BLOCKS; b++) {
+		size_t offs = 0;
+		for (int f = 0; f < FIELDS; f++) {
+			if (field_is_long[f]) {
+				uint64_t v;
+				offs += reference_decode_long(&encoded[b][offs], encoded_length[b] - offs, &v);
+				check += v;
+			} else {
+				uint32_t v;
+				offs += reference_decode(&encoded[b][offs], encoded_length[b] - offs, &v);
+				check += v;
+			}
+		}
+	}
+
+	return check;
+}
+
+static uint64_t benchmark_decode(void)
+{
+	uint64_t check = 0;
+
+	for (int b = 0; b < BLOCKS; b++) {
+		size_t offs = 0;
+		for (int f = 0; f < FIELDS; f++) {
+			if (field_is_long[f]) {
+				uint64_t v;
+				offs += sdnv_decode_long(&encoded[b][offs], encoded_length[b] - offs, &v);
+				check += v;
+			} else {
+				uint32_t v;
+				offs += sdnv_decode(&encoded[b][offs], encoded_length[b] - offs, &v);
+				check += v;
+			}
+		}
+	}
+
+	return check;
+}
+
+static uint64_t benchmark_decode_array(void)
+{
+	uint64_t check = 0;
+	uint64_t fields[FIELDS];
+
+	for (int b = 0; b < BLOCKS; b++) {
+		sdnv_decode_array(encoded[b], encoded_length[b], fields, FIELDS);
+		for (int f = 0; f < FIELDS; f++) {
+			check += fields[f];
+		}
+	}
+
+	return check;
+}
+
+static void benchmark_process(void* p)
+{
+	TickType_t start;
+	uint64_t check[3];
+	uint32_t check_encode[2];
+
+	/* Let the stack settle */
+	vTaskDelay(pdMS_TO_TICKS(1000));
+
+	generate_values();
+
+	PRINTF("Encoding and decoding %u primary blocks %u times\n", BLOCKS, BENCHMARK_ROUNDS);
+
+	start = xTaskGetTickCount();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		check_encode[0] = benchmark_encode(reference_encode_long);
+	}
+	const TickType_t encode_reference = xTaskGetTickCount() - start;
+
+	start = xTaskGetTickCount();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		check_encode[1] = benchmark_encode(encode_long);
+	}
+	const TickType_t encode = xTaskGetTickCount() - start;
+
+	start = xTaskGetTickCount();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		check[0] = benchmark_decode_reference();
+	}
+	const TickType_t decode_reference = xTaskGetTickCount() - start;
+
+	start = xTaskGetTickCount();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		check[1] = benchmark_decode();
+	}
+	const TickType_t decode = xTaskGetTickCount() - start;
+
+	start = xTaskGetTickCount();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		check[2] = benchmark_decode_array();
+	}
+	const TickType_t decode_array = xTaskGetTickCount() - start;
+
+	printf("SDNV benchmark: encode %lu ms (reference %lu ms), decode %lu ms, decode array %lu ms (reference %lu ms)\n",
+		   (unsigned long) (encode * portTICK_PERIOD_MS), (unsigned long) (encode_reference * portTICK_PERIOD_MS),
+		   (unsigned long) (decode * portTICK_PERIOD_MS), (unsigned long) (decode_array * portTICK_PERIOD_MS),
+		   (unsigned long) (decode_reference * portTICK_PERIOD_MS));
+
+	if (check_encode[0] != check_encode[1] || check[0] != check[1] || check[0] != check[2]) {
+		printf("SDNV benchmark: results differ\n");
+	}
+
+	vTaskDelete(NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool init()
+{
+	if ( !dtn_process_create_other_stack(benchmark_process, "SDNV benchmark", configMINIMAL_STACK_SIZE * 2) ) {
+		return false;
+	}
+
+	return true;
+}
@@ -53,6 +53,8 @@
 #include "net/uDTN/agent.h"
 #include "net/uDTN/bundle.h"
 #include "net/uDTN/storage.h"
+#include "net/uDTN/storage_query.h"
+#include "net/uDTN/storage_expiry.h"
 
 #define DEBUG 0
 #if DEBUG
@@ -232,6 +234,9 @@ PROCESS_THREAD(test_process, ev, data)
 	static int mode;
 	static struct etimer timer;
 	static struct storage_entry_t * list_entry = NULL;
+	static struct storage_query_t query;
+	static struct storage_eviction_node_t eviction;
+	static uint32_t dst_node;
 	static int ok = 0;
 	static uint32_t time_start, time_stop;
 
@@ -443,6 +448,40 @@ PROCESS_THREAD(test_process, ev, data)
 					errors ++;
 				}
 			}
+
+			// All bundles are for the same node, which my_create_bundle has set
+			memset(&query, 0, sizeof(query));
+			query.fields = STORAGE_QUERY_DESTINATION | STORAGE_QUERY_UNLOCKED;
+			query.dst_node = DEST_NODE;
+
+			n = 0;
+			for( list_entry = BUNDLE_STORAGE.query_bundles(&query, NULL);
+				 list_entry != NULL;
+				 list_entry = BUNDLE_STORAGE.query_bundles(&query, list_entry) ) {
+				n++;
+			}
+
+			if( n != TEST_BUNDLES ) {
+				PRINTF("Query for destination %u returned %u bundles\n", DEST_NODE, n);
+				errors ++;
+			}
+
+			query.dst_node = DEST_NODE + 1;
+			if( BUNDLE_STORAGE.query_bundles(&query, NULL) != NULL ) {
+				PRINTF("Query for destination %u returned bundles\n", DEST_NODE + 1);
+				errors ++;
+			}
+
+			// The metadata is available without reading the bundles
+			for(i=0; i<TEST_BUNDLES; i++) {
+				if( !BUNDLE_STORAGE.describe_bundle(bundle_numbers[i], &eviction, &dst_node) ) {
+					PRINTF("Bundle %lu cannot be described\n", bundle_numbers[i]);
+					errors ++;
+				} else if( dst_node != DEST_NODE || eviction.expiration <= storage_expiry_now() ) {
+					PRINTF("Bundle %lu is described with destination %lu, expiration %lu\n", bundle_numbers[i], dst_node, eviction.expiration);
+					errors ++;
+				}
+			}
 		}
 
 		if( mode == 0 || mode == 2 ) {
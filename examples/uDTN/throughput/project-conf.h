@@ -9,4 +9,7 @@
 // 3 = BUNDLE_STORAGE_BEHAVIOUR_DO_NOT_DELETE
 #define BUNDLE_CONF_STORAGE_BEHAVIOUR 3
 
+// Allow the window benchmark to go up to 7 segments in flight
+#define CONVERGENCE_LAYER_CONF_WINDOW 7
+
 #endif /* __PROJECT_CONF_H__ */
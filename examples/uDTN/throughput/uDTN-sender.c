@@ -0,0 +1,192 @@
+/**
+ * \file
+ *         Measures the goodput of multipart bundles against the window size
+ *         of the datagram convergence layer.
+ *
+ *         For every window size the same number of bundles is sent to the
+ *         sink. The time is taken from handing the first bundle to the agent
+ *         until the last bundle was delivered and removed from storage.
+ *
+ *         The sender is built, if CONF_SEND_TO_NODE is set to the node id of
+ *         the sink, otherwise uDTN-sink.c is built.
+ */
+
+#ifdef CONF_SEND_TO_NODE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "net/uDTN/bundle.h"
+#include "net/uDTN/agent.h"
+#include "net/uDTN/api.h"
+#include "net/uDTN/storage.h"
+#include "net/uDTN/discovery.h"
+#include "net/uDTN/convergence_layer_dgram.h"
+#include "dtn_process.h"
+
+/* Several segments per bundle, even over ethernet */
+#ifdef CONF_BUNDLE_SIZE
+#define BUNDLE_SIZE CONF_BUNDLE_SIZE
+#else
+#define BUNDLE_SIZE 4096
+#endif
+
+/* Bundles per window size */
+#ifdef CONF_BUNDLES
+#define BUNDLES CONF_BUNDLES
+#else
+#define BUNDLES 20
+#endif
+
+/* How long to wait for the delivery of all bundles of one window size [in seconds] */
+#define DELIVERY_TIMEOUT 120
+
+static const uint8_t windows[] = {1, 2, 4, 7};
+
+static uint8_t userdata[BUNDLE_SIZE];
+
+/*---------------------------------------------------------------------------*/
+static bool send_bundle(void)
+{
+	/* Only proceed, when we have enough storage left */
+	while( BUNDLE_STORAGE.free_space(NULL) <= 2 ) {
+		BUNDLE_STORAGE.wait_for_changes();
+	}
+
+	/* Allocate memory for the outgoing bundle */
+	struct mmem* bundle_outgoing = bundle_create_bundle();
+	if( bundle_outgoing == NULL ) {
+		printf("create_bundle failed\n");
+		return false;
+	}
+
+	/* Source, destination, custody and report-to nodes and services*/
+	uint32_t tmp=CONF_SEND_TO_NODE;
+	bundle_set_attr(bundle_outgoing, DEST_NODE, &tmp);
+	tmp=25;
+	bundle_set_attr(bundle_outgoing, DEST_SERV, &tmp);
+
+	/* Bundle flags */
+	tmp=BUNDLE_FLAG_SINGLETON;
+	bundle_set_attr(bundle_outgoing, FLAGS, &tmp);
+
+	/* Bundle lifetime */
+	tmp=2000;
+	bundle_set_attr(bundle_outgoing, LIFE_TIME, &tmp);
+
+	if (bundle_add_block(bundle_outgoing, BUNDLE_BLOCK_TYPE_PAYLOAD, BUNDLE_BLOCK_FLAG_NULL, userdata, BUNDLE_SIZE) < 0) {
+		printf("not enough room for block\n");
+		bundle_decrement(bundle_outgoing);
+		return false;
+	}
+
+	/* Hand the bundle over to the agent */
+	const event_container_t send_event = {
+		.event = dtn_send_bundle_event,
+		.bundlemem = bundle_outgoing
+	};
+	agent_send_event(&send_event);
+
+	while (true) {
+		event_container_t ev;
+		if (!dtn_process_wait_any_event(portMAX_DELAY, &ev)) {
+			return false;
+		}
+
+		if (ev.event == dtn_bundle_store_failed) {
+			printf("Send failed\n");
+			return false;
+		}
+
+		if (ev.event == dtn_bundle_stored) {
+			return true;
+		}
+
+		/* if there was an unknown event, wait for the next one */
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void udtn_sender_process(void* p)
+{
+	/* Wait for the agent to be initialized */
+	vTaskDelay( pdMS_TO_TICKS(1000) );
+
+	/* Register our endpoint to receive bundles */
+	static struct registration_api reg;
+	reg.status = APP_ACTIVE;
+	reg.event_queue = dtn_process_get_event_queue();
+	reg.app_id = 25;
+	const event_container_t event = {
+		.event = dtn_application_registration_event,
+		.registration = &reg
+	};
+	agent_send_event(&event);
+
+	printf("Waiting for neighbour ipn:%lu to appear...\n", (uint32_t)CONF_SEND_TO_NODE);
+	while( !DISCOVERY.is_neighbour(CONF_SEND_TO_NODE) ) {
+		vTaskDelay( pdMS_TO_TICKS(1000) );
+	}
+
+	/* Give the receiver a second to start up */
+	vTaskDelay( pdMS_TO_TICKS(6000) );
+
+	for(int i=0; i<BUNDLE_SIZE; i++) {
+		userdata[i] = (i & 0xFF);
+	}
+
+	printf("Init done, sending %u bundles of %u bytes per window size\n", BUNDLES, BUNDLE_SIZE);
+
+	for(int w=0; w<sizeof(windows) / sizeof(windows[0]); w++) {
+		convergence_layer_dgram_set_window(windows[w]);
+
+		const TickType_t start = xTaskGetTickCount();
+
+		int bundles_sent = 0;
+		while( bundles_sent < BUNDLES ) {
+			if( send_bundle() ) {
+				bundles_sent++;
+			} else {
+				taskYIELD();
+			}
+		}
+
+		/* The bundles are deleted from storage, when they are delivered to the sink */
+		while( BUNDLE_STORAGE.get_bundle_num() > 0 &&
+			   (xTaskGetTickCount() - start) < pdMS_TO_TICKS(DELIVERY_TIMEOUT * 1000) ) {
+			vTaskDelay( pdMS_TO_TICKS(10) );
+		}
+
+		const TickType_t duration = xTaskGetTickCount() - start;
+		const uint16_t remaining = BUNDLE_STORAGE.get_bundle_num();
+		if( remaining > 0 ) {
+			printf("window %u: %u bundles not delivered after %u s\n", windows[w], remaining, DELIVERY_TIMEOUT);
+			continue;
+		}
+
+		/* use uint64_t, beacuse of throughput calulation */
+		const uint64_t goodput = ((uint64_t)BUNDLE_SIZE) * BUNDLES * 1000 / (duration * portTICK_PERIOD_MS);
+		printf("window %u: %lu ms, goodput %lu bytes/s\n", windows[w],
+			   (uint32_t)(duration * portTICK_PERIOD_MS), (uint32_t)goodput);
+	}
+
+	printf("Window benchmark done\n");
+
+	vTaskDelete(NULL);
+}
+/*---------------------------------------------------------------------------*/
+
+bool init()
+{
+	if ( !dtn_process_create_other_stack(udtn_sender_process, "DTN Sender", 0x200) ) {
+		return false;
+	}
+
+	return true;
+}
+
+#endif /* CONF_SEND_TO_NODE */
@@ -38,6 +38,9 @@
  *	   Adam Dunkels <adam@sics.se>
  */
 
+/* The sender is built instead, see uDTN-sender.c */
+#ifndef CONF_SEND_TO_NODE
+
 #include <stdio.h>
 
 #include "FreeRTOS.h"
@@ -269,3 +272,5 @@ bool init()
 
   return true;
 }
+
+#endif /* CONF_SEND_TO_NODE */